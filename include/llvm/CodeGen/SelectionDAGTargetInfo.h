@@ -83,6 +83,18 @@ public:
     return SDValue();
   }
 
+  /// Emit target-specific code that performs a 2D block copy, usually by
+  /// programming a single DMA descriptor. Targets that return true from
+  /// TargetTransformInfo::hasBlockCopyDMA must implement this; everywhere
+  /// else llvm.memcpy.2d is expanded before instruction selection.
+  virtual SDValue EmitTargetCodeForMemcpy2D(
+      SelectionDAG &DAG, const SDLoc &dl, SDValue Chain, SDValue Dst,
+      SDValue Src, SDValue RowBytes, SDValue Rows, SDValue DstStride,
+      SDValue SrcStride, unsigned Align, bool isVolatile,
+      MachinePointerInfo DstPtrInfo, MachinePointerInfo SrcPtrInfo) const {
+    return SDValue();
+  }
+
   /// Emit target-specific code that performs a memcmp, in cases where that is
   /// faster than a libcall. The first returned SDValue is the result of the
   /// memcmp and the second is the chain. Both SDValues can be null if a normal
@@ -45,6 +45,11 @@ Error thinBackend(Config &C, unsigned Task, AddStreamFn AddStream, Module &M,
                   const FunctionImporter::ImportMapTy &ImportList,
                   const GVSummaryMapTy &DefinedGlobals,
                   MapVector<StringRef, BitcodeModule> &ModuleMap);
+
+/// Place the code of \p M in section .user_text if it is an input that
+/// -lto-main-memory-input names, like a support library built as bitcode, and
+/// mark it "smm-main-memory" so that SPM code management leaves it there.
+void keepInMainMemory(Module &M);
 }
 }
 
@@ -35,11 +35,12 @@
 
 #include <atomic>
 #include <condition_variable>
+#include <deque>
 #include <functional>
 #include <memory>
 #include <mutex>
-#include <queue>
 #include <utility>
+#include <vector>
 
 namespace llvm {
 
@@ -47,7 +48,11 @@ namespace llvm {
 /// threads.
 ///
 /// The pool keeps a vector of threads alive, waiting on a condition variable
-/// for some work to become available.
+/// for some work to become available. Each thread has its own queue of tasks:
+/// tasks submitted from a pool thread go to the queue of that thread, which
+/// runs the most recent ones first, and idle threads steal the oldest tasks of
+/// the other queues. Tasks submitted from outside the pool go to a shared
+/// queue.
 class ThreadPool {
 public:
 #ifndef _MSC_VER
@@ -101,22 +106,47 @@ public:
 #endif
   }
 
-  /// Blocking wait for all the threads to complete and the queue to be empty.
-  /// It is an error to try to add new tasks while blocking on this call.
+  /// Blocking wait for all the threads to complete and the queues to be
+  /// empty. It is an error to try to add new tasks while blocking on this
+  /// call, and to call it from a task of the pool; use a TaskGroup to wait on
+  /// subtasks instead.
   void wait();
 
 private:
+  friend class TaskGroup;
+
+  /// A queue of tasks. Its owner pushes and pops tasks at the back, other
+  /// threads steal them from the front.
+  struct WorkQueue {
+    std::mutex Lock;
+    std::deque<PackagedTaskTy> Tasks;
+  };
+
   /// Asynchronous submission of a task to the pool. The returned future can be
   /// used to wait for the task to finish and is *non-blocking* on destruction.
   std::shared_future<VoidTy> asyncImpl(TaskTy F);
 
+  /// Push a task to the queue of the calling thread.
+  void pushTask(PackagedTaskTy Task);
+
+  /// Pop a task from the queue of the calling thread, or steal one from
+  /// another queue. Returns false if all the queues are empty.
+  bool popTask(PackagedTaskTy &Task);
+
+  /// Run one queued task on the calling thread. Returns false if there was no
+  /// task to run.
+  bool runPendingTask();
+
   /// Threads in flight
   std::vector<llvm::thread> Threads;
 
-  /// Tasks waiting for execution in the pool.
-  std::queue<PackagedTaskTy> Tasks;
+  /// The queue of each thread, followed by the shared queue.
+  std::vector<std::unique_ptr<WorkQueue>> Queues;
+
+  /// Number of tasks queued and not yet started.
+  std::atomic<unsigned> PendingTasks;
 
-  /// Locking and signaling for accessing the Tasks queue.
+  /// Locking and signaling for threads waiting for tasks to be queued.
   std::mutex QueueLock;
   std::condition_variable QueueCondition;
 
@@ -132,6 +162,42 @@ private:
   bool EnableFlag;
 #endif
 };
+
+/// A group of tasks run by a ThreadPool, which can be waited on independently
+/// of the other tasks of the pool.
+///
+/// Tasks may add subtasks to a group and wait on it: while the group isn't
+/// done, the waiting thread runs queued tasks of the pool instead of blocking,
+/// so nested parallelism can't exhaust the threads of the pool.
+class TaskGroup {
+public:
+  explicit TaskGroup(ThreadPool &Pool) : Pool(Pool), PendingTasks(0) {}
+
+  /// Blocking destructor: waits for the tasks of the group to complete.
+  ~TaskGroup() { wait(); }
+
+  /// Asynchronous submission of a task to the group.
+  template <typename Function, typename... Args>
+  void async(Function &&F, Args &&... ArgList) {
+    std::function<void()> Task =
+        std::bind(std::forward<Function>(F), std::forward<Args>(ArgList)...);
+    ++PendingTasks;
+    Pool.async([this, Task] {
+      Task();
+      --PendingTasks;
+    });
+  }
+
+  /// Wait for the tasks of the group to complete, running queued tasks of the
+  /// pool in the meantime.
+  void wait();
+
+private:
+  ThreadPool &Pool;
+
+  /// Number of tasks of the group that haven't completed.
+  std::atomic<unsigned> PendingTasks;
+};
 }
 
 #endif // LLVM_SUPPORT_THREAD_POOL_H
@@ -1491,6 +1491,74 @@ public:
     return false;
   }
 
+  /// Represents how an instruction should be mapped by the outliner.
+  /// \p Legal instructions are those which are safe to outline.
+  /// \p Illegal instructions are those which cannot be outlined.
+  /// \p Invisible instructions are instructions which can be outlined, but
+  /// shouldn't actually impact the outlining result.
+  enum MachineOutlinerInstrType { Legal, Illegal, Invisible };
+
+  /// Returns how or if \p MI should be outlined.
+  virtual MachineOutlinerInstrType getOutliningType(MachineInstr &MI) const {
+    llvm_unreachable(
+        "Target didn't implement TargetInstrInfo::getOutliningType!");
+  }
+
+  /// Return true if the function can safely be outlined from.
+  /// By default, this means that the function has no red zone.
+  virtual bool isFunctionSafeToOutlineFrom(MachineFunction &MF) const {
+    return false;
+  }
+
+  /// Returns the size in bytes that \p MI is expected to take in the emitted
+  /// code. The outliner uses it to estimate the bytes saved, so targets whose
+  /// getInstSizeInBytes is not exact after register allocation may override
+  /// it with an estimate.
+  virtual unsigned getOutliningInstrSize(const MachineInstr &MI) const {
+    return getInstSizeInBytes(MI);
+  }
+
+  /// Returns the number of bytes added at every call site of an outlined
+  /// function. If \p IsTailCall is true, the outlined sequence ends in a
+  /// return and the call replaces it.
+  virtual unsigned getOutliningCallOverhead(bool IsTailCall) const {
+    llvm_unreachable(
+        "Target didn't implement TargetInstrInfo::getOutliningCallOverhead!");
+  }
+
+  /// Returns the number of bytes added to an outlined function on top of the
+  /// outlined instructions.
+  virtual unsigned getOutliningFrameOverhead(bool IsTailCall) const {
+    llvm_unreachable(
+        "Target didn't implement TargetInstrInfo::getOutliningFrameOverhead!");
+  }
+
+  /// Insert a custom prologue for outlined functions.
+  virtual void insertOutlinerPrologue(MachineBasicBlock &MBB,
+                                      MachineFunction &MF,
+                                      bool IsTailCall) const {
+    llvm_unreachable(
+        "Target didn't implement TargetInstrInfo::insertOutlinerPrologue!");
+  }
+
+  /// Insert a custom epilogue for outlined functions.
+  virtual void insertOutlinerEpilogue(MachineBasicBlock &MBB,
+                                      MachineFunction &MF,
+                                      bool IsTailCall) const {
+    llvm_unreachable(
+        "Target didn't implement TargetInstrInfo::insertOutlinerEpilogue!");
+  }
+
+  /// Insert a call to the outlined function \p MF before \p It in \p MBB.
+  /// Returns an iterator to the last instruction inserted.
+  virtual MachineBasicBlock::iterator
+  insertOutlinedCall(Module &M, MachineBasicBlock &MBB,
+                     MachineBasicBlock::iterator &It, MachineFunction &MF,
+                     bool IsTailCall) const {
+    llvm_unreachable(
+        "Target didn't implement TargetInstrInfo::insertOutlinedCall!");
+  }
+
 private:
   unsigned CallFrameSetupOpcode, CallFrameDestroyOpcode;
   unsigned CatchRetOpcode;
@@ -52,6 +52,23 @@ private:
   GlobalVariable *NamesVar;
   size_t NamesSize;
 
+  // The counter loads and stores of the lowered increments in the current
+  // function.
+  std::vector<std::pair<LoadInst *, StoreInst *>> PromotionCandidates;
+
+  // The number of counters promoted so far in the module.
+  int64_t TotalCountersPromoted = 0;
+
+  /// Lower instrumentation intrinsics in the function. Returns true if there
+  /// was any lowering.
+  bool lowerIntrinsics(Function *F);
+
+  /// Register-promote the counter loads and stores in loops.
+  void promoteCounterLoadStores(Function *F);
+
+  /// Returns true if counter promotion is enabled.
+  bool isCounterPromotionEnabled() const;
+
   bool isMachO() const;
 
   /// Get the section name for the counter variables.
@@ -87,11 +87,15 @@ ModulePass *createPGOIndirectCallPromotionLegacyPass(bool InLTO = false);
 
 /// Options for the frontend instrumentation based profiling pass.
 struct InstrProfOptions {
-  InstrProfOptions() : NoRedZone(false) {}
+  InstrProfOptions() : NoRedZone(false), DoCounterPromotion(false) {}
 
   // Add the 'noredzone' attribute to added runtime library calls.
   bool NoRedZone;
 
+  // Keep the counters updated in loops in registers, and add them to memory
+  // at the loop exits.
+  bool DoCounterPromotion;
+
   // Name of the profile file to use as output
   std::string InstrProfileOutput;
 };
@@ -152,6 +152,20 @@ Pass *createLoopSinkPass();
 //
 Pass *createLoopInterchangePass();
 
+//===----------------------------------------------------------------------===//
+//
+// LoopFusion - This pass fuses adjacent loops with the same trip count when
+// that reduces the memory transfers of the data they share.
+//
+Pass *createLoopFusionPass();
+
+//===----------------------------------------------------------------------===//
+//
+// LoopTiling - This pass tiles perfectly nested loops so that the data of a
+// tile fits the cache or a scratchpad memory.
+//
+Pass *createLoopTilingPass();
+
 //===----------------------------------------------------------------------===//
 //
 // LoopStrengthReduce - This pass is strength reduces GEP instructions that use
@@ -181,6 +195,13 @@ Pass *createLoopUnrollPass(int Threshold = -1, int Count = -1,
 // Create an unrolling pass for full unrolling that uses exact trip count only.
 Pass *createSimpleLoopUnrollPass();
 
+//===----------------------------------------------------------------------===//
+//
+// LoopUnrollAndJam - This pass unrolls outer loops and fuses the copies of
+// their inner loops.
+//
+Pass *createLoopUnrollAndJamPass();
+
 //===----------------------------------------------------------------------===//
 //
 // LoopReroll - This pass is a simple loop rerolling pass.
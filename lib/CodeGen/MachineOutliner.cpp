@@ -0,0 +1,939 @@
+//===---- MachineOutliner.cpp - Outline instructions -----------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// Replaces repeated sequences of instructions with function calls.
+///
+/// This works by placing every instruction from every basic block in a
+/// suffix tree, and repeatedly querying that tree for repeated sequences of
+/// instructions. If a sequence of instructions appears often, then it ought
+/// to be beneficial to pull out into a function.
+///
+/// Instructions are mapped to unsigned integers first: instructions that are
+/// identical (MachineInstrExpressionTrait) and safe to outline share a number,
+/// every other instruction and the end of every basic block get a number of
+/// their own. The suffix tree over that string finds every sequence that
+/// occurs more than once in linear time.
+///
+/// The target decides what can be outlined and what it costs through the
+/// outlining hooks of TargetInstrInfo. Sequences are outlined if the bytes
+/// saved at all their occurrences outweigh the calls and the outlined
+/// function, largest savings first.
+///
+/// Outlining only happens among functions of the same section and subtarget,
+/// and the outlined function is placed in that section. Code that is loaded
+/// into a scratchpad as a section (an overlay) cannot call into another one
+/// without going through the runtime that loads it.
+///
+/// The outliner runs after all other machine passes, so it only sees code
+/// that is emitted as it is, and it is enabled with -enable-machine-outliner.
+///
+//===----------------------------------------------------------------------===//
+
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/Twine.h"
+#include "llvm/Analysis/OptimizationDiagnosticInfo.h"
+#include "llvm/CodeGen/MachineFrameInfo.h"
+#include "llvm/CodeGen/MachineFunction.h"
+#include "llvm/CodeGen/MachineInstrBuilder.h"
+#include "llvm/CodeGen/MachineModuleInfo.h"
+#include "llvm/CodeGen/Passes.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/Support/Allocator.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetInstrInfo.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Target/TargetRegisterInfo.h"
+#include "llvm/Target/TargetSubtargetInfo.h"
+#include <algorithm>
+#include <vector>
+
+#define DEBUG_TYPE "machine-outliner"
+
+using namespace llvm;
+using namespace ore;
+
+STATISTIC(NumOutlined, "Number of candidates outlined");
+STATISTIC(FunctionsCreated, "Number of functions created");
+STATISTIC(NumBytesSaved, "Estimated number of bytes saved by outlining");
+
+namespace {
+
+/// Represents an undefined index in the suffix tree.
+const unsigned EmptyIdx = -1;
+
+/// A node in a suffix tree which represents a substring or suffix.
+///
+/// Each node has either no children or at least two children, with the root
+/// being a exception in the empty tree.
+///
+/// Children are represented as a map between unsigned integers and nodes. If
+/// a node N has a child M on unsigned integer k, then the mapping represented
+/// by N is a proper prefix of the mapping represented by M. Note that this,
+/// although similar to a trie is somewhat different: each node stores a full
+/// substring of the full mapping rather than a single character state.
+///
+/// Each internal node contains a pointer to the internal node representing
+/// the same string, but with the first character chopped off. This is stored
+/// in \p Link. Each leaf node stores the start index of its respective
+/// suffix in \p SuffixIdx.
+struct SuffixTreeNode {
+  /// The children of this node.
+  ///
+  /// A child existing on an unsigned integer implies that from the mapping
+  /// represented by the current node, there is a way to reach another
+  /// mapping by tacking that character on the end of the current string.
+  DenseMap<unsigned, SuffixTreeNode *> Children;
+
+  /// The start index of this node's substring in the main string.
+  unsigned StartIdx = EmptyIdx;
+
+  /// The end index of this node's substring in the main string.
+  ///
+  /// Every leaf node must have its \p EndIdx incremented at the end of every
+  /// step in the construction algorithm. To avoid having to update O(N)
+  /// nodes individually at the end of every step, the end index is stored
+  /// as a pointer.
+  unsigned *EndIdx = nullptr;
+
+  /// For leaves, the start index of the suffix represented by this node.
+  ///
+  /// For all other nodes, this is ignored.
+  unsigned SuffixIdx = EmptyIdx;
+
+  /// For internal nodes, a pointer to the internal node representing the
+  /// same sequence with the first character chopped off.
+  ///
+  /// This has two major purposes in the suffix tree. The first is as a
+  /// shortcut in Ukkonen's construction algorithm. One of the things that
+  /// Ukkonen's algorithm does to achieve linear-time construction is
+  /// keep track of which node the next insert should be at. This makes each
+  /// insert O(1), and there are a total of O(N) inserts. The suffix link
+  /// helps with inserting children of internal nodes.
+  SuffixTreeNode *Link = nullptr;
+
+  /// The parent of this node. Every node except for the root has a parent.
+  SuffixTreeNode *Parent = nullptr;
+
+  /// The length of the string formed by concatenating the edge labels from
+  /// the root to this node.
+  unsigned ConcatLen = 0;
+
+  /// Returns true if this node is a leaf.
+  bool isLeaf() const { return SuffixIdx != EmptyIdx; }
+
+  /// Returns true if this node is the root of its owning \p SuffixTree.
+  bool isRoot() const { return StartIdx == EmptyIdx; }
+
+  /// Return the number of elements in the substring associated with this
+  /// node.
+  size_t size() const {
+    // Is it the root? If so, it's the empty string so return 0.
+    if (isRoot())
+      return 0;
+
+    assert(*EndIdx != EmptyIdx && "EndIdx is undefined!");
+
+    // Size = the number of elements in the string.
+    // For example, [0 1 2 3] has length 4, not 3. 3-0 = 3, so we have 3-0+1.
+    return *EndIdx - StartIdx + 1;
+  }
+
+  SuffixTreeNode(unsigned StartIdx, unsigned *EndIdx, SuffixTreeNode *Link,
+                 SuffixTreeNode *Parent)
+      : StartIdx(StartIdx), EndIdx(EndIdx), Link(Link), Parent(Parent) {}
+};
+
+/// A data structure for fast substring queries.
+///
+/// Suffix trees represent the suffixes of their input strings in their
+/// leaves. A suffix tree is a type of compressed trie structure where each
+/// node represents an entire substring rather than a single character. Each
+/// leaf of the tree is a suffix.
+///
+/// A suffix tree can be seen as a type of state machine where each state is a
+/// substring of the full string. The tree is structured so that, for a string
+/// of length N, there are exactly N leaves in the tree. This structure allows
+/// us to quickly find repeated substrings of the input string.
+///
+/// In this implementation, a "string" is a vector of unsigned integers.
+/// These integers may result from hashing some data type. A suffix tree can
+/// contain 1 or many strings, which can then be queried as one large string.
+///
+/// The suffix tree is implemented using Ukkonen's algorithm for linear-time
+/// suffix tree construction. Ukkonen's algorithm is explained in more detail
+/// in the paper by Esko Ukkonen "On-line construction of suffix trees. The
+/// paper is available at
+///
+/// https://www.cs.helsinki.fi/u/ukkonen/SuffixT1withFigs.pdf
+class SuffixTree {
+public:
+  /// Every node in the tree, in the order it was created.
+  std::vector<SuffixTreeNode *> Nodes;
+
+  /// Each element is an integer representing an instruction in the module.
+  ArrayRef<unsigned> Str;
+
+private:
+  /// Maintains each node in the tree.
+  SpecificBumpPtrAllocator<SuffixTreeNode> NodeAllocator;
+
+  /// The root of the suffix tree.
+  ///
+  /// The root represents the empty string. It is maintained by the
+  /// \p NodeAllocator like every other node in the tree.
+  SuffixTreeNode *Root = nullptr;
+
+  /// Maintains the end indices of the internal nodes in the tree.
+  ///
+  /// Each internal node is guaranteed to never have its end index change
+  /// during the construction algorithm; however, leaves must be updated at
+  /// every step. Therefore, we need to store leaf end indices by reference
+  /// to avoid updating O(N) leaves at every step of construction. Thus,
+  /// every internal node must be allocated its own end index.
+  BumpPtrAllocator InternalEndIdxAllocator;
+
+  /// The end index of each leaf in the tree.
+  unsigned LeafEndIdx = -1;
+
+  /// Helper struct which keeps track of the next insertion point in
+  /// Ukkonen's algorithm.
+  struct ActiveState {
+    /// The next node to insert at.
+    SuffixTreeNode *Node;
+
+    /// The index of the first character in the substring currently being
+    /// added.
+    unsigned Idx = EmptyIdx;
+
+    /// The length of the substring we have to add at the current step.
+    unsigned Len = 0;
+  };
+
+  /// The point the next insertion will take place at in the
+  /// construction algorithm.
+  ActiveState Active;
+
+  /// Allocate a leaf node and add it to the tree.
+  ///
+  /// \param Parent The parent of this node.
+  /// \param StartIdx The start index of this node's associated string.
+  /// \param Edge The label on the edge leaving \p Parent to this node.
+  ///
+  /// \returns A pointer to the allocated leaf node.
+  SuffixTreeNode *insertLeaf(SuffixTreeNode &Parent, unsigned StartIdx,
+                             unsigned Edge) {
+    assert(StartIdx <= LeafEndIdx && "String can't start after it ends!");
+
+    SuffixTreeNode *N = new (NodeAllocator.Allocate())
+        SuffixTreeNode(StartIdx, &LeafEndIdx, nullptr, &Parent);
+    Parent.Children[Edge] = N;
+    Nodes.push_back(N);
+
+    return N;
+  }
+
+  /// Allocate an internal node and add it to the tree.
+  ///
+  /// \param Parent The parent of this node. Only null when allocating the
+  /// root.
+  /// \param StartIdx The start index of this node's associated string.
+  /// \param EndIdx The end index of this node's associated string.
+  /// \param Edge The label on the edge leaving \p Parent to this node.
+  ///
+  /// \returns A pointer to the allocated internal node.
+  SuffixTreeNode *insertInternalNode(SuffixTreeNode *Parent, unsigned StartIdx,
+                                     unsigned EndIdx, unsigned Edge) {
+    assert(StartIdx <= EndIdx && "String can't start after it ends!");
+    assert(!(!Parent && StartIdx != EmptyIdx) &&
+           "Non-root internal nodes must have parents!");
+
+    unsigned *E = new (InternalEndIdxAllocator) unsigned(EndIdx);
+    SuffixTreeNode *N = new (NodeAllocator.Allocate())
+        SuffixTreeNode(StartIdx, E, Root, Parent);
+    if (Parent)
+      Parent->Children[Edge] = N;
+    Nodes.push_back(N);
+
+    return N;
+  }
+
+  /// Set the suffix index and the concatenated length of every node.
+  ///
+  /// Parents are created before their children, but splitting an edge puts a
+  /// new node above an older one, so the tree is walked from the root. The
+  /// walk uses a worklist since repetitive code makes for deep trees.
+  void setSuffixIndices() {
+    SmallVector<SuffixTreeNode *, 32> Worklist;
+    Worklist.push_back(Root);
+    while (!Worklist.empty()) {
+      SuffixTreeNode *N = Worklist.pop_back_val();
+      if (N->Parent)
+        N->ConcatLen = N->Parent->ConcatLen + N->size();
+      if (N->Children.empty()) {
+        // Leaves have no children and represent the suffix that starts
+        // ConcatLen characters before the end of the string.
+        N->SuffixIdx = Str.size() - N->ConcatLen;
+        continue;
+      }
+      for (auto &ChildPair : N->Children)
+        Worklist.push_back(ChildPair.second);
+    }
+  }
+
+  /// Construct the suffix tree for the prefix of the input ending at
+  /// \p EndIdx.
+  ///
+  /// Used to construct the full suffix tree iteratively. At the end of each
+  /// step, the constructed suffix tree is either a valid suffix tree, or a
+  /// suffix tree with implicit suffixes. At the end of the final step, the
+  /// suffix tree is a valid tree.
+  ///
+  /// \param EndIdx The end index of the current prefix in the main string.
+  /// \param SuffixesToAdd The number of suffixes that must be added
+  /// to complete the suffix tree at the current phase.
+  ///
+  /// \returns The number of suffixes that have not been added at the end of
+  /// this step.
+  unsigned extend(unsigned EndIdx, unsigned SuffixesToAdd) {
+    SuffixTreeNode *NeedsLink = nullptr;
+
+    while (SuffixesToAdd > 0) {
+
+      // Are we waiting to add anything other than just the last character?
+      if (Active.Len == 0) {
+        // If not, then say the active index is the end index.
+        Active.Idx = EndIdx;
+      }
+
+      assert(Active.Idx <= EndIdx && "Start index can't be after end index!");
+
+      // The first character in the current substring we're looking at.
+      unsigned FirstChar = Str[Active.Idx];
+
+      // Have we inserted anything starting with FirstChar at the current
+      // node?
+      if (Active.Node->Children.count(FirstChar) == 0) {
+        // If not, then we can just insert a leaf and move too the next step.
+        insertLeaf(*Active.Node, EndIdx, FirstChar);
+
+        // The active node is an internal node, and we visited it, so it must
+        // need a link if it doesn't have one.
+        if (NeedsLink) {
+          NeedsLink->Link = Active.Node;
+          NeedsLink = nullptr;
+        }
+      } else {
+        // There's a match with FirstChar, so look for the point in the tree
+        // to insert a new node.
+        SuffixTreeNode *NextNode = Active.Node->Children[FirstChar];
+
+        unsigned SubstringLen = NextNode->size();
+
+        // Is the current suffix we're trying to insert longer than the size
+        // of the child we want to move to?
+        if (Active.Len >= SubstringLen) {
+          // If yes, then consume the characters we've seen and move to the
+          // next node.
+          Active.Idx += SubstringLen;
+          Active.Len -= SubstringLen;
+          Active.Node = NextNode;
+          continue;
+        }
+
+        // Otherwise, the suffix we're trying to insert must be contained in
+        // the next node we want to move to.
+        unsigned LastChar = Str[EndIdx];
+
+        // Is the string we're trying to insert a substring of the next node?
+        if (Str[NextNode->StartIdx + Active.Len] == LastChar) {
+          // If yes, then we're done for this step. Remember our insertion
+          // point and move to the next end index. At this point, we have an
+          // implicit suffix tree.
+          if (NeedsLink && !Active.Node->isRoot()) {
+            NeedsLink->Link = Active.Node;
+            NeedsLink = nullptr;
+          }
+
+          Active.Len++;
+          break;
+        }
+
+        // The string we're trying to insert isn't a substring of the next
+        // node, but matches up to a point. Split the node.
+        //
+        // For example, say we ended our search at a node n and we're trying
+        // to insert ABD. Then we'll create a new node s for AB, reduce n to
+        // just representing C, and insert a new leaf node l to represent d.
+        // This allows us to ensure that if n was a leaf, it remains a leaf.
+        //
+        //   | ABC  ---split--->  | AB
+        //   n                    s
+        //                     C / \ D
+        //                      n   l
+
+        // The node s from the diagram
+        SuffixTreeNode *SplitNode =
+            insertInternalNode(Active.Node, NextNode->StartIdx,
+                               NextNode->StartIdx + Active.Len - 1, FirstChar);
+
+        // Insert the new node representing the new substring into the tree as
+        // a child of the split node. This is the node l from the diagram.
+        insertLeaf(*SplitNode, EndIdx, LastChar);
+
+        // Make the old node a child of the split node and update its start
+        // index. This is the node n from the diagram.
+        NextNode->StartIdx += Active.Len;
+        NextNode->Parent = SplitNode;
+        SplitNode->Children[Str[NextNode->StartIdx]] = NextNode;
+
+        // SplitNode is an internal node, update the suffix link.
+        if (NeedsLink)
+          NeedsLink->Link = SplitNode;
+
+        NeedsLink = SplitNode;
+      }
+
+      // We've added something new to the tree, so there's one less suffix to
+      // add.
+      SuffixesToAdd--;
+
+      if (Active.Node->isRoot()) {
+        if (Active.Len > 0) {
+          Active.Len--;
+          Active.Idx = EndIdx - SuffixesToAdd + 1;
+        }
+      } else {
+        // Start the next phase at the next smallest suffix.
+        Active.Node = Active.Node->Link;
+      }
+    }
+
+    return SuffixesToAdd;
+  }
+
+public:
+  /// Construct a suffix tree from a sequence of unsigned integers.
+  ///
+  /// The last integer of \p Str must occur nowhere else in it, so that every
+  /// suffix ends in a leaf.
+  ///
+  /// \param Str The string to construct the suffix tree for.
+  SuffixTree(ArrayRef<unsigned> Str) : Str(Str) {
+    Root = insertInternalNode(nullptr, EmptyIdx, EmptyIdx, 0);
+    Root->Link = Root;
+
+    // Keep track of the number of suffixes we have to add of the current
+    // prefix.
+    unsigned SuffixesToAdd = 0;
+    Active.Node = Root;
+
+    // Construct the suffix tree iteratively on each prefix of the string.
+    // PfxEndIdx is the end index of the current prefix.
+    // End is one past the last element in the string.
+    for (unsigned PfxEndIdx = 0, End = Str.size(); PfxEndIdx < End;
+         PfxEndIdx++) {
+      SuffixesToAdd++;
+      LeafEndIdx = PfxEndIdx; // Extend each of the leaves.
+      SuffixesToAdd = extend(PfxEndIdx, SuffixesToAdd);
+    }
+
+    // Set the suffix indices of each leaf.
+    assert(Root && "Root node can't be nullptr!");
+    setSuffixIndices();
+  }
+};
+
+/// Maps \p MachineInstrs to unsigned integers and stores the mappings.
+struct InstructionMapper {
+
+  /// The next available integer to assign to a \p MachineInstr that
+  /// cannot be outlined.
+  ///
+  /// Set to -3 for compatability with \p DenseMapInfo<unsigned>.
+  unsigned IllegalInstrNumber = -3;
+
+  /// The next available integer to assign to a \p MachineInstr that can
+  /// be outlined.
+  unsigned LegalInstrNumber = 0;
+
+  /// Correspondence from \p MachineInstrs to unsigned integers.
+  DenseMap<MachineInstr *, unsigned, MachineInstrExpressionTrait>
+      InstructionIntegerMap;
+
+  /// The vector of unsigned integers that the module is mapped to.
+  std::vector<unsigned> UnsignedVec;
+
+  /// \brief Stores the location of the instruction associated with the
+  /// integer at index i in \p UnsignedVec for each index i.
+  std::vector<MachineBasicBlock::iterator> InstrList;
+
+  /// \brief Maps \p *It to a legal integer.
+  ///
+  /// Updates \p InstrList, \p UnsignedVec, \p InstructionIntegerMap and
+  /// \p LegalInstrNumber.
+  void mapToLegalUnsigned(MachineBasicBlock::iterator &It) {
+    // Get the integer for this instruction or give it the current
+    // LegalInstrNumber.
+    InstrList.push_back(It);
+    MachineInstr &MI = *It;
+    bool WasInserted;
+    DenseMap<MachineInstr *, unsigned, MachineInstrExpressionTrait>::iterator
+        ResultIt;
+    std::tie(ResultIt, WasInserted) =
+        InstructionIntegerMap.insert(std::make_pair(&MI, LegalInstrNumber));
+    unsigned MINumber = ResultIt->second;
+
+    // There was an insertion.
+    if (WasInserted)
+      LegalInstrNumber++;
+
+    UnsignedVec.push_back(MINumber);
+
+    // Make sure we don't overflow or use any integers reserved by the
+    // DenseMap.
+    if (LegalInstrNumber >= IllegalInstrNumber)
+      report_fatal_error("Instruction mapping overflow!");
+
+    assert(LegalInstrNumber != DenseMapInfo<unsigned>::getEmptyKey() &&
+           "Tried to assign DenseMap tombstone or empty key to instruction.");
+    assert(LegalInstrNumber != DenseMapInfo<unsigned>::getTombstoneKey() &&
+           "Tried to assign DenseMap tombstone or empty key to instruction.");
+  }
+
+  /// Maps \p *It to an illegal integer.
+  ///
+  /// Updates \p InstrList, \p UnsignedVec, and \p IllegalInstrNumber.
+  void mapToIllegalUnsigned(MachineBasicBlock::iterator &It) {
+    InstrList.push_back(It);
+    UnsignedVec.push_back(IllegalInstrNumber);
+    IllegalInstrNumber--;
+
+    assert(LegalInstrNumber < IllegalInstrNumber &&
+           "Instruction mapping overflow!");
+
+    assert(IllegalInstrNumber != DenseMapInfo<unsigned>::getEmptyKey() &&
+           "IllegalInstrNumber cannot be DenseMap tombstone or empty key!");
+
+    assert(IllegalInstrNumber != DenseMapInfo<unsigned>::getTombstoneKey() &&
+           "IllegalInstrNumber cannot be DenseMap tombstone or empty key!");
+  }
+
+  /// \brief Transforms a \p MachineBasicBlock into a \p vector of \p unsigneds
+  /// and appends it to \p UnsignedVec and \p InstrList.
+  ///
+  /// Two instructions are assigned the same integer if they are identical.
+  /// If an instruction is deemed unsafe to outline, then it will be assigned
+  /// an unique integer. The resulting mapping is placed into a suffix tree
+  /// and queried for candidates.
+  void convertToUnsignedVec(MachineBasicBlock &MBB,
+                            const TargetInstrInfo &TII) {
+    MachineBasicBlock::iterator It = MBB.begin();
+    for (MachineBasicBlock::iterator Et = MBB.end(); It != Et; It++) {
+      // Keep track of where this instruction is in the module.
+      switch (TII.getOutliningType(*It)) {
+      case TargetInstrInfo::MachineOutlinerInstrType::Illegal:
+        mapToIllegalUnsigned(It);
+        break;
+
+      case TargetInstrInfo::MachineOutlinerInstrType::Legal:
+        mapToLegalUnsigned(It);
+        break;
+
+      case TargetInstrInfo::MachineOutlinerInstrType::Invisible:
+        break;
+      }
+    }
+
+    // After we're done every insertion, uniquely terminate this part of the
+    // "string". This makes sure we won't match across basic block or function
+    // boundaries since the "end" is encoded uniquely and thus appears in no
+    // repeated substring.
+    mapToIllegalUnsigned(It);
+  }
+};
+
+/// A sequence that occurs more than once and may be outlined.
+struct OutlinedFunction {
+  /// The start indices of the occurrences in the mapped string.
+  std::vector<unsigned> Occurrences;
+
+  /// The number of mapped instructions in the sequence.
+  unsigned Length = 0;
+
+  /// The estimated number of bytes of the sequence.
+  unsigned SequenceSize = 0;
+
+  /// True if the sequence ends in a return, so it is branched to.
+  bool IsTailCall = false;
+
+  /// The estimated number of bytes saved by outlining all occurrences.
+  int Benefit = 0;
+
+  /// The outlined function, once it is created.
+  MachineFunction *MF = nullptr;
+};
+
+/// An interprocedural pass which finds repeated sequences of
+/// instructions and replaces them with calls to functions.
+///
+/// Each instruction is mapped to an unsigned integer and placed in a string.
+/// The resulting mapping is then placed in a \p SuffixTree. The \p SuffixTree
+/// is then repeatedly queried for repeated sequences of instructions. Each
+/// non-overlapping repeated sequence is then placed in its own
+/// \p MachineFunction and each instance is then replaced with a call to that
+/// function.
+struct MachineOutliner : public ModulePass {
+
+  static char ID;
+
+  /// The number of outlined functions created so far, used to name them.
+  unsigned OutlinedFunctionNum = 0;
+
+  StringRef getPassName() const override { return "Machine Outliner"; }
+
+  void getAnalysisUsage(AnalysisUsage &AU) const override {
+    AU.addRequired<MachineModuleInfo>();
+    AU.addPreserved<MachineModuleInfo>();
+    AU.setPreservesAll();
+    ModulePass::getAnalysisUsage(AU);
+  }
+
+  MachineOutliner() : ModulePass(ID) {
+    initializeMachineOutlinerPass(*PassRegistry::getPassRegistry());
+  }
+
+  /// Compute the number of bytes saved by outlining \p Occurrences
+  /// occurrences of a sequence of \p SequenceSize bytes.
+  int getBenefit(const TargetInstrInfo &TII, unsigned SequenceSize,
+                 unsigned Occurrences, bool IsTailCall) const {
+    int NotOutlined = Occurrences * SequenceSize;
+    int Outlined = Occurrences * TII.getOutliningCallOverhead(IsTailCall) +
+                   SequenceSize + TII.getOutliningFrameOverhead(IsTailCall);
+    return NotOutlined - Outlined;
+  }
+
+  /// Find the sequences worth outlining in the string of \p Mapper.
+  ///
+  /// Every internal node of the suffix tree stands for a sequence that
+  /// occurs once for every leaf below it. Like in the original formulation
+  /// of this outliner, only the leaves directly below a node are taken as
+  /// its occurrences; occurrences in deeper leaves share a longer sequence,
+  /// which is found at the deeper node.
+  void findCandidates(SuffixTree &ST, InstructionMapper &Mapper,
+                      const TargetInstrInfo &TII,
+                      std::vector<OutlinedFunction> &FunctionList);
+
+  /// Pick the sequences to outline from \p FunctionList.
+  ///
+  /// Sequences are taken in order of their benefit. Occurrences that overlap
+  /// an occurrence picked before are dropped, and the sequence is skipped if
+  /// the rest is not worth outlining any more.
+  void pruneOverlaps(std::vector<OutlinedFunction> &FunctionList,
+                     const TargetInstrInfo &TII, size_t StringLen);
+
+  /// Creates a function for \p OF and inserts it into the module.
+  MachineFunction *createOutlinedFunction(Module &M, OutlinedFunction &OF,
+                                          InstructionMapper &Mapper,
+                                          StringRef Section);
+
+  /// Replace the occurrences in \p FunctionList with calls to their outlined
+  /// functions.
+  bool outline(Module &M, std::vector<OutlinedFunction> &FunctionList,
+               InstructionMapper &Mapper, StringRef Section);
+
+  /// Outline the repeated sequences of \p MFs.
+  bool outlineGroup(Module &M, ArrayRef<MachineFunction *> MFs,
+                    StringRef Section);
+
+  /// Runs the outliner on every group of functions in the module.
+  bool runOnModule(Module &M) override;
+};
+
+} // Anonymous namespace.
+
+char MachineOutliner::ID = 0;
+
+namespace llvm {
+ModulePass *createMachineOutlinerPass() { return new MachineOutliner(); }
+}
+
+INITIALIZE_PASS(MachineOutliner, DEBUG_TYPE, "Machine Function Outliner",
+                false, false)
+
+void MachineOutliner::findCandidates(
+    SuffixTree &ST, InstructionMapper &Mapper, const TargetInstrInfo &TII,
+    std::vector<OutlinedFunction> &FunctionList) {
+  for (SuffixTreeNode *N : ST.Nodes) {
+    if (N->isRoot() || N->isLeaf())
+      continue;
+
+    OutlinedFunction OF;
+    OF.Length = N->ConcatLen;
+    for (auto &ChildPair : N->Children)
+      if (ChildPair.second->isLeaf())
+        OF.Occurrences.push_back(ChildPair.second->SuffixIdx);
+    if (OF.Occurrences.size() < 2)
+      continue;
+
+    // Occurrences of a periodic sequence may overlap each other, keep the
+    // first of every overlapping run.
+    std::sort(OF.Occurrences.begin(), OF.Occurrences.end());
+    unsigned NextFree = 0;
+    OF.Occurrences.erase(
+        std::remove_if(OF.Occurrences.begin(), OF.Occurrences.end(),
+                       [&](unsigned StartIdx) {
+                         if (StartIdx < NextFree)
+                           return true;
+                         NextFree = StartIdx + OF.Length;
+                         return false;
+                       }),
+        OF.Occurrences.end());
+    if (OF.Occurrences.size() < 2)
+      continue;
+
+    // Every occurrence consists of identical instructions.
+    unsigned StartIdx = OF.Occurrences.front();
+    for (unsigned i = 0; i < OF.Length; i++)
+      OF.SequenceSize +=
+          TII.getOutliningInstrSize(*Mapper.InstrList[StartIdx + i]);
+    MachineInstr &LastMI = *Mapper.InstrList[StartIdx + OF.Length - 1];
+    OF.IsTailCall = LastMI.isTerminator() || LastMI.isReturn();
+
+    OF.Benefit = getBenefit(TII, OF.SequenceSize, OF.Occurrences.size(),
+                            OF.IsTailCall);
+    if (OF.Benefit < 1)
+      continue;
+
+    FunctionList.push_back(std::move(OF));
+  }
+}
+
+void MachineOutliner::pruneOverlaps(std::vector<OutlinedFunction> &FunctionList,
+                                    const TargetInstrInfo &TII,
+                                    size_t StringLen) {
+  std::stable_sort(FunctionList.begin(), FunctionList.end(),
+                   [](const OutlinedFunction &LHS, const OutlinedFunction &RHS) {
+                     if (LHS.Benefit != RHS.Benefit)
+                       return LHS.Benefit > RHS.Benefit;
+                     return LHS.Length > RHS.Length;
+                   });
+
+  BitVector Outlined(StringLen);
+  std::vector<OutlinedFunction> Chosen;
+  for (OutlinedFunction &OF : FunctionList) {
+    OF.Occurrences.erase(
+        std::remove_if(OF.Occurrences.begin(), OF.Occurrences.end(),
+                       [&](unsigned StartIdx) {
+                         for (unsigned i = 0; i < OF.Length; i++)
+                           if (Outlined.test(StartIdx + i))
+                             return true;
+                         return false;
+                       }),
+        OF.Occurrences.end());
+    if (OF.Occurrences.size() < 2)
+      continue;
+
+    OF.Benefit = getBenefit(TII, OF.SequenceSize, OF.Occurrences.size(),
+                            OF.IsTailCall);
+    if (OF.Benefit < 1)
+      continue;
+
+    for (unsigned StartIdx : OF.Occurrences)
+      Outlined.set(StartIdx, StartIdx + OF.Length);
+    Chosen.push_back(std::move(OF));
+  }
+  FunctionList = std::move(Chosen);
+}
+
+MachineFunction *
+MachineOutliner::createOutlinedFunction(Module &M, OutlinedFunction &OF,
+                                        InstructionMapper &Mapper,
+                                        StringRef Section) {
+  MachineInstr &FirstMI = *Mapper.InstrList[OF.Occurrences.front()];
+  const Function *Caller = FirstMI.getParent()->getParent()->getFunction();
+
+  // Create the function name. This should be unique.
+  std::string Name;
+  do {
+    Name = "OUTLINED_FUNCTION_" + std::to_string(OutlinedFunctionNum++);
+  } while (M.getNamedValue(Name));
+
+  // Create the function using an IR-level function.
+  LLVMContext &C = M.getContext();
+  Function *F = Function::Create(FunctionType::get(Type::getVoidTy(C), false),
+                                 GlobalValue::PrivateLinkage, Name, &M);
+  F->setUnnamedAddr(GlobalValue::UnnamedAddr::Global);
+  F->addFnAttr(Attribute::NoUnwind);
+  F->addFnAttr(Attribute::NoInline);
+  // The outlined code was compiled for the subtarget of its callers.
+  for (StringRef Kind : {"target-cpu", "target-features"})
+    if (Caller->hasFnAttribute(Kind))
+      F->addFnAttr(Caller->getFnAttribute(Kind));
+  if (!Section.empty())
+    F->setSection(Section);
+
+  BasicBlock *EntryBB = BasicBlock::Create(C, "entry", F);
+  IRBuilder<> Builder(EntryBB);
+  Builder.CreateRetVoid();
+
+  MachineModuleInfo &MMI = getAnalysis<MachineModuleInfo>();
+  MachineFunction &MF = MMI.getMachineFunction(*F);
+  MachineBasicBlock &MBB = *MF.CreateMachineBasicBlock();
+  const TargetSubtargetInfo &STI = MF.getSubtarget();
+  const TargetInstrInfo &TII = *STI.getInstrInfo();
+
+  // The instructions are copied after register allocation, and liveness is
+  // not computed for them.
+  MF.getProperties()
+      .set(MachineFunctionProperties::Property::NoPHIs)
+      .set(MachineFunctionProperties::Property::NoVRegs)
+      .reset(MachineFunctionProperties::Property::IsSSA)
+      .reset(MachineFunctionProperties::Property::TracksLiveness);
+
+  // Insert the new function into the module.
+  MF.insert(MF.begin(), &MBB);
+
+  TII.insertOutlinerPrologue(MBB, MF, OF.IsTailCall);
+
+  // Copy over the instructions of the first occurrence. Invisible
+  // instructions in between are not part of the sequence.
+  unsigned StartIdx = OF.Occurrences.front();
+  for (unsigned i = 0; i < OF.Length; i++) {
+    MachineInstr *NewMI =
+        MF.CloneMachineInstr(&*Mapper.InstrList[StartIdx + i]);
+    NewMI->dropMemRefs();
+
+    // Don't keep debug information for outlined instructions.
+    NewMI->setDebugLoc(DebugLoc());
+    MBB.insert(MBB.end(), NewMI);
+  }
+
+  TII.insertOutlinerEpilogue(MBB, MF, OF.IsTailCall);
+
+  // Report the savings on the function the sequence was first found in.
+  OptimizationRemarkEmitter ORE(const_cast<Function *>(Caller));
+  ORE.emit(OptimizationRemark(DEBUG_TYPE, "OutlinedFunction",
+                              FirstMI.getDebugLoc(),
+                              const_cast<BasicBlock *>(&Caller->front()))
+           << "Saved " << NV("OutliningBenefit", OF.Benefit) << " bytes by "
+           << "outlining " << NV("Length", OF.Length) << " instructions "
+           << "from " << NV("NumOccurrences", unsigned(OF.Occurrences.size()))
+           << " locations into " << NV("OutlinedFunction", F));
+
+  return &MF;
+}
+
+bool MachineOutliner::outline(Module &M,
+                              std::vector<OutlinedFunction> &FunctionList,
+                              InstructionMapper &Mapper, StringRef Section) {
+  // Create every function before any occurrence is replaced, since the
+  // instructions are copied from the first occurrence.
+  for (OutlinedFunction &OF : FunctionList) {
+    OF.MF = createOutlinedFunction(M, OF, Mapper, Section);
+    FunctionsCreated++;
+  }
+
+  bool OutlinedSomething = false;
+  for (OutlinedFunction &OF : FunctionList) {
+    for (unsigned StartIdx : OF.Occurrences) {
+      MachineBasicBlock::iterator StartIt = Mapper.InstrList[StartIdx];
+      MachineBasicBlock::iterator EndIt =
+          Mapper.InstrList[StartIdx + OF.Length - 1];
+      MachineBasicBlock *MBB = StartIt->getParent();
+      const TargetInstrInfo &TII =
+          *MBB->getParent()->getSubtarget().getInstrInfo();
+
+      DEBUG(dbgs() << "Outlining " << OF.Length << " instructions of "
+                   << MBB->getParent()->getName() << " into "
+                   << OF.MF->getName() << "\n");
+
+      // Insert a call to the new function and erase the old sequence.
+      MachineBasicBlock::iterator It = StartIt;
+      TII.insertOutlinedCall(M, *MBB, It, *OF.MF, OF.IsTailCall);
+      MBB->erase(StartIt, std::next(EndIt));
+
+      NumOutlined++;
+      OutlinedSomething = true;
+    }
+    NumBytesSaved += OF.Benefit;
+  }
+
+  DEBUG(dbgs() << "OutlinedSomething = " << OutlinedSomething << "\n";);
+
+  return OutlinedSomething;
+}
+
+bool MachineOutliner::outlineGroup(Module &M, ArrayRef<MachineFunction *> MFs,
+                                   StringRef Section) {
+  // The functions of a group share their subtarget.
+  const TargetInstrInfo &TII = *MFs.front()->getSubtarget().getInstrInfo();
+
+  InstructionMapper Mapper;
+  for (MachineFunction *MF : MFs)
+    for (MachineBasicBlock &MBB : *MF)
+      Mapper.convertToUnsignedVec(MBB, TII);
+
+  // Construct a suffix tree, use it to find candidates, and then outline them.
+  SuffixTree ST(Mapper.UnsignedVec);
+  std::vector<OutlinedFunction> FunctionList;
+  findCandidates(ST, Mapper, TII, FunctionList);
+  pruneOverlaps(FunctionList, TII, Mapper.UnsignedVec.size());
+  if (FunctionList.empty())
+    return false;
+  return outline(M, FunctionList, Mapper, Section);
+}
+
+bool MachineOutliner::runOnModule(Module &M) {
+  // Is there anything in the module at all?
+  if (M.empty())
+    return false;
+
+  MachineModuleInfo &MMI = getAnalysis<MachineModuleInfo>();
+
+  // Group the functions by section and subtarget. Every outlined function
+  // adds functions to the module, so collect them first.
+  StringMap<std::vector<MachineFunction *>> Groups;
+  std::vector<std::string> GroupOrder;
+  for (Function &F : M) {
+    // Functions without code are not compiled.
+    if (F.isDeclaration() || F.hasAvailableExternallyLinkage())
+      continue;
+
+    MachineFunction &MF = MMI.getMachineFunction(F);
+    if (MF.empty())
+      continue;
+
+    // Does the target think this function is safe to outline from?
+    const TargetInstrInfo &TII = *MF.getSubtarget().getInstrInfo();
+    if (!TII.isFunctionSafeToOutlineFrom(MF))
+      continue;
+
+    std::string Key = F.getSection();
+    Key += '\0';
+    Key += F.getFnAttribute("target-cpu").getValueAsString();
+    Key += '\0';
+    Key += F.getFnAttribute("target-features").getValueAsString();
+    std::vector<MachineFunction *> &Group = Groups[Key];
+    if (Group.empty())
+      GroupOrder.push_back(Key);
+    Group.push_back(&MF);
+  }
+
+  bool Changed = false;
+  for (const std::string &Key : GroupOrder) {
+    std::vector<MachineFunction *> &Group = Groups[Key];
+    Changed |= outlineGroup(M, Group, Group.front()->getFunction()->getSection());
+  }
+  return Changed;
+}
@@ -7,18 +7,22 @@
 //
 //===----------------------------------------------------------------------===//
 //
-// This pass implements IR lowering for the llvm.load.relative intrinsic.
+// This pass implements IR lowering for the llvm.load.relative intrinsic, and
+// for llvm.memcpy.2d on targets without a block copy DMA engine.
 //
 //===----------------------------------------------------------------------===//
 
 #include "llvm/CodeGen/PreISelIntrinsicLowering.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
 #include "llvm/CodeGen/Passes.h"
+#include "llvm/IR/Constants.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/Intrinsics.h"
 #include "llvm/IR/Module.h"
 #include "llvm/Pass.h"
+#include "llvm/Support/MathExtras.h"
 
 using namespace llvm;
 
@@ -55,11 +59,149 @@ bool lowerLoadRelative(Function &F) {
   return Changed;
 }
 
-bool lowerIntrinsics(Module &M) {
+// Expand a 2D block copy that the target cannot do with a single DMA
+// descriptor, like
+// call void @llvm.memcpy.2d.p0i8.p0i8.i64(i8* %Dst, i8* %Src, i64 4,
+//                                         i64 %Rows, i64 %DS, i64 %SS, ...)
+// When every row is one element the target can gather and scatter, VF rows
+// are copied at a time, masking off the rows past the end:
+//
+// memcpy2d.loop:
+// % Row = phi i64 [ 0, %entry ], [ % Row.next, %memcpy2d.loop ]
+// % Rows.v = add <16 x i64> % Row.splat, <i64 0, i64 1, ..., i64 15>
+// % Mask = icmp ult <16 x i64> % Rows.v, % Rows.splat
+// % SrcPtrs = getelementptr i8, i8* % Src, <16 x i64> % SrcOffs
+// % Elts = call <16 x i32> @llvm.masked.gather.v16i32(... % Mask ...)
+// call void @llvm.masked.scatter.v16i32(<16 x i32> % Elts, ... % Mask)
+// % Row.next = add i64 % Row, 16
+// % More = icmp ult i64 % Row.next, % Rows
+// br i1 % More, label %memcpy2d.loop, label %memcpy2d.exit
+//
+// Otherwise the loop copies one row per iteration with llvm.memcpy.
+void expandMemCpy2D(CallInst *CI, const TargetTransformInfo *TTI) {
+  Value *Dst = CI->getArgOperand(0);
+  Value *Src = CI->getArgOperand(1);
+  Value *RowBytes = CI->getArgOperand(2);
+  Value *Rows = CI->getArgOperand(3);
+  Value *DstStride = CI->getArgOperand(4);
+  Value *SrcStride = CI->getArgOperand(5);
+  unsigned AlignVal = cast<ConstantInt>(CI->getArgOperand(6))->getZExtValue();
+  bool IsVolatile = cast<ConstantInt>(CI->getArgOperand(7))->isOne();
+  Type *IdxTy = RowBytes->getType();
+  LLVMContext &Ctx = CI->getContext();
+
+  // Rows after the first are only as aligned as the strides keep them.
+  unsigned RowAlign = std::max(AlignVal, 1U);
+  for (Value *Stride : {DstStride, SrcStride}) {
+    if (auto *C = dyn_cast<ConstantInt>(Stride))
+      RowAlign = MinAlign(RowAlign, C->getZExtValue());
+    else
+      RowAlign = 1;
+  }
+
+  // See if a row is a single element that can be gathered and scattered.
+  VectorType *VecTy = nullptr;
+  if (auto *RowBytesC = dyn_cast<ConstantInt>(RowBytes)) {
+    uint64_t EltBytes = RowBytesC->getZExtValue();
+    unsigned RegBits = TTI->getRegisterBitWidth(true);
+    if (!IsVolatile && (EltBytes == 1 || EltBytes == 2 || EltBytes == 4 ||
+                        EltBytes == 8) &&
+        RegBits / (EltBytes * 8) >= 2) {
+      VectorType *Candidate = VectorType::get(
+          IntegerType::get(Ctx, EltBytes * 8), RegBits / (EltBytes * 8));
+      if (TTI->isLegalMaskedGather(Candidate) &&
+          TTI->isLegalMaskedScatter(Candidate))
+        VecTy = Candidate;
+    }
+  }
+  unsigned VF = VecTy ? VecTy->getNumElements() : 1;
+
+  BasicBlock *Entry = CI->getParent();
+  BasicBlock *Exit = Entry->splitBasicBlock(CI, "memcpy2d.exit");
+  BasicBlock *Loop = BasicBlock::Create(Ctx, "memcpy2d.loop",
+                                        Entry->getParent(), Exit);
+
+  IRBuilder<> Builder(Entry->getTerminator());
+  Builder.SetCurrentDebugLocation(CI->getDebugLoc());
+  Dst = Builder.CreateBitCast(
+      Dst, Builder.getInt8PtrTy(Dst->getType()->getPointerAddressSpace()));
+  Src = Builder.CreateBitCast(
+      Src, Builder.getInt8PtrTy(Src->getType()->getPointerAddressSpace()));
+  Value *Zero = ConstantInt::get(IdxTy, 0);
+  Value *Any = Builder.CreateICmpNE(Rows, Zero);
+  Instruction *OldBr = Entry->getTerminator();
+  BranchInst::Create(Loop, Exit, Any, OldBr);
+  OldBr->eraseFromParent();
+
+  Builder.SetInsertPoint(Loop);
+  PHINode *Row = Builder.CreatePHI(IdxTy, 2, "row");
+  Row->addIncoming(Zero, Entry);
+
+  if (VecTy) {
+    Type *PtrTy = PointerType::get(VecTy->getElementType(),
+                                   Dst->getType()->getPointerAddressSpace());
+    Type *SrcPtrTy = PointerType::get(VecTy->getElementType(),
+                                      Src->getType()->getPointerAddressSpace());
+    SmallVector<Constant *, 16> Steps;
+    for (unsigned Idx = 0; Idx < VF; ++Idx)
+      Steps.push_back(ConstantInt::get(IdxTy, Idx));
+    Value *RowVec = Builder.CreateAdd(Builder.CreateVectorSplat(VF, Row),
+                                      ConstantVector::get(Steps), "row.vec");
+    Value *Mask = Builder.CreateICmpULT(RowVec,
+                                        Builder.CreateVectorSplat(VF, Rows));
+    Value *SrcPtrs = Builder.CreateGEP(
+        Builder.getInt8Ty(), Src,
+        Builder.CreateMul(RowVec, Builder.CreateVectorSplat(VF, SrcStride)));
+    SrcPtrs = Builder.CreateBitCast(SrcPtrs, VectorType::get(SrcPtrTy, VF));
+    Value *DstPtrs = Builder.CreateGEP(
+        Builder.getInt8Ty(), Dst,
+        Builder.CreateMul(RowVec, Builder.CreateVectorSplat(VF, DstStride)));
+    DstPtrs = Builder.CreateBitCast(DstPtrs, VectorType::get(PtrTy, VF));
+    Value *Elts = Builder.CreateMaskedGather(SrcPtrs, RowAlign, Mask);
+    Builder.CreateMaskedScatter(Elts, DstPtrs, RowAlign, Mask);
+  } else {
+    Value *DstRow = Builder.CreateGEP(Builder.getInt8Ty(), Dst,
+                                      Builder.CreateMul(Row, DstStride));
+    Value *SrcRow = Builder.CreateGEP(Builder.getInt8Ty(), Src,
+                                      Builder.CreateMul(Row, SrcStride));
+    Builder.CreateMemCpy(DstRow, SrcRow, RowBytes, RowAlign, IsVolatile);
+  }
+
+  Value *NextRow = Builder.CreateAdd(Row, ConstantInt::get(IdxTy, VF),
+                                     "row.next");
+  Row->addIncoming(NextRow, Loop);
+  Builder.CreateCondBr(Builder.CreateICmpULT(NextRow, Rows), Loop, Exit);
+  CI->eraseFromParent();
+}
+
+typedef function_ref<const TargetTransformInfo &(Function &)> GetTTIFn;
+
+// This runs at every optimization level, unlike CodeGenPrepare, so that
+// instruction selection never sees a 2D copy the target cannot select.
+bool lowerMemCpy2D(Function &F, GetTTIFn GetTTI) {
+  bool Changed = false;
+  for (auto I = F.use_begin(), E = F.use_end(); I != E;) {
+    auto CI = dyn_cast<CallInst>(I->getUser());
+    ++I;
+    if (!CI || CI->getCalledValue() != &F)
+      continue;
+
+    // Only a target with a block copy DMA engine selects the intrinsic.
+    if (GetTTI(*CI->getFunction()).hasBlockCopyDMA())
+      continue;
+    expandMemCpy2D(CI, &GetTTI(*CI->getFunction()));
+    Changed = true;
+  }
+  return Changed;
+}
+
+bool lowerIntrinsics(Module &M, GetTTIFn GetTTI) {
   bool Changed = false;
   for (Function &F : M) {
     if (F.getName().startswith("llvm.load.relative."))
       Changed |= lowerLoadRelative(F);
+    else if (F.getIntrinsicID() == Intrinsic::memcpy_2d)
+      Changed |= lowerMemCpy2D(F, GetTTI);
   }
   return Changed;
 }
@@ -69,15 +211,28 @@ public:
   static char ID;
   PreISelIntrinsicLoweringLegacyPass() : ModulePass(ID) {}
 
-  bool runOnModule(Module &M) { return lowerIntrinsics(M); }
+  void getAnalysisUsage(AnalysisUsage &AU) const override {
+    AU.addRequired<TargetTransformInfoWrapperPass>();
+  }
+
+  bool runOnModule(Module &M) override {
+    auto GetTTI = [this](Function &F) -> const TargetTransformInfo & {
+      return getAnalysis<TargetTransformInfoWrapperPass>().getTTI(F);
+    };
+    return lowerIntrinsics(M, GetTTI);
+  }
 };
 
 char PreISelIntrinsicLoweringLegacyPass::ID;
 }
 
-INITIALIZE_PASS(PreISelIntrinsicLoweringLegacyPass,
-                "pre-isel-intrinsic-lowering", "Pre-ISel Intrinsic Lowering",
-                false, false)
+INITIALIZE_PASS_BEGIN(PreISelIntrinsicLoweringLegacyPass,
+                      "pre-isel-intrinsic-lowering",
+                      "Pre-ISel Intrinsic Lowering", false, false)
+INITIALIZE_PASS_DEPENDENCY(TargetTransformInfoWrapperPass)
+INITIALIZE_PASS_END(PreISelIntrinsicLoweringLegacyPass,
+                    "pre-isel-intrinsic-lowering",
+                    "Pre-ISel Intrinsic Lowering", false, false)
 
 namespace llvm {
 ModulePass *createPreISelIntrinsicLoweringPass() {
@@ -86,7 +241,11 @@ ModulePass *createPreISelIntrinsicLoweringPass() {
 
 PreservedAnalyses PreISelIntrinsicLoweringPass::run(Module &M,
                                                     ModuleAnalysisManager &AM) {
-  if (!lowerIntrinsics(M))
+  auto &FAM = AM.getResult<FunctionAnalysisManagerModuleProxy>(M).getManager();
+  auto GetTTI = [&FAM](Function &F) -> const TargetTransformInfo & {
+    return FAM.getResult<TargetIRAnalysis>(F);
+  };
+  if (!lowerIntrinsics(M, GetTTI))
     return PreservedAnalyses::all();
   else
     return PreservedAnalyses::none();
@@ -4897,6 +4897,26 @@ SelectionDAGBuilder::visitIntrinsicCall(const CallInst &I, unsigned Intrinsic) {
     updateDAGForMaybeTailCall(MM);
     return nullptr;
   }
+  case Intrinsic::memcpy_2d: {
+    // PreISelIntrinsicLowering expands the intrinsic unless the target has a
+    // block copy DMA engine, which then has to take it.
+    unsigned Align = cast<ConstantInt>(I.getArgOperand(6))->getZExtValue();
+    if (!Align)
+      Align = 1;
+    bool isVol = cast<ConstantInt>(I.getArgOperand(7))->getZExtValue();
+    const SelectionDAGTargetInfo &TSI = DAG.getSelectionDAGInfo();
+    SDValue MC = TSI.EmitTargetCodeForMemcpy2D(
+        DAG, sdl, getRoot(), getValue(I.getArgOperand(0)),
+        getValue(I.getArgOperand(1)), getValue(I.getArgOperand(2)),
+        getValue(I.getArgOperand(3)), getValue(I.getArgOperand(4)),
+        getValue(I.getArgOperand(5)), Align, isVol,
+        MachinePointerInfo(I.getArgOperand(0)),
+        MachinePointerInfo(I.getArgOperand(1)));
+    if (!MC.getNode())
+      report_fatal_error("llvm.memcpy.2d is not supported by this target");
+    DAG.setRoot(MC);
+    return nullptr;
+  }
   case Intrinsic::memcpy_element_atomic: {
     SDValue Dst = getValue(I.getArgOperand(0));
     SDValue Src = getValue(I.getArgOperand(1));
@@ -3952,6 +3952,19 @@ void Verifier::visitIntrinsicCallSite(Intrinsic::ID ID, CallSite CS) {
            CS);
     break;
   }
+  case Intrinsic::memcpy_2d: {
+    ConstantInt *AlignCI = dyn_cast<ConstantInt>(CS.getArgOperand(6));
+    Assert(AlignCI,
+           "alignment argument of memory intrinsics must be a constant int",
+           CS);
+    const APInt &AlignVal = AlignCI->getValue();
+    Assert(AlignCI->isZero() || AlignVal.isPowerOf2(),
+           "alignment argument of memory intrinsics must be a power of 2", CS);
+    Assert(isa<ConstantInt>(CS.getArgOperand(7)),
+           "isvolatile argument of memory intrinsics must be a constant int",
+           CS);
+    break;
+  }
   case Intrinsic::memcpy_element_atomic: {
     ConstantInt *ElementSizeCI = dyn_cast<ConstantInt>(CS.getArgOperand(3));
     Assert(ElementSizeCI, "element size of the element-wise atomic memory "
@@ -434,6 +434,7 @@ Error LTO::addRegularLTO(BitcodeModule BM, const SymbolResolution *&ResI,
   if (Error Err = M.materializeMetadata())
     return Err;
   UpgradeDebugInfo(M);
+  keepInMainMemory(M);
 
   ModuleSymbolTable SymTab;
   SymTab.addModule(&M);
@@ -28,6 +28,7 @@
 #include "llvm/LTO/legacy/UpdateCompilerUsed.h"
 #include "llvm/MC/SubtargetFeature.h"
 #include "llvm/Passes/PassBuilder.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Error.h"
 #include "llvm/Support/FileSystem.h"
 #include "llvm/Support/TargetRegistry.h"
@@ -42,6 +43,12 @@
 using namespace llvm;
 using namespace lto;
 
+static cl::list<std::string> MainMemoryInputs(
+    "lto-main-memory-input",
+    cl::desc("Keep the code of inputs whose name contains this string in main "
+             "memory instead of having SPM code management overlay it"),
+    cl::value_desc("name"));
+
 LLVM_ATTRIBUTE_NORETURN static void reportOpenError(StringRef Path, Twine Msg) {
   errs() << "failed to open " << Path << ": " << Msg << '\n';
   errs().flush();
@@ -289,6 +296,21 @@ static void handleAsmUndefinedRefs(Module &Mod, TargetMachine &TM) {
   updateCompilerUsed(Mod, TM, AsmUndefinedRefs);
 }
 
+void lto::keepInMainMemory(Module &M) {
+  StringRef Name = M.getModuleIdentifier();
+  if (llvm::none_of(MainMemoryInputs, [&](const std::string &Input) {
+        return Name.find(Input) != StringRef::npos;
+      }))
+    return;
+  for (Function &F : M) {
+    if (F.isDeclaration())
+      continue;
+    if (!F.hasSection())
+      F.setSection(".user_text");
+    F.addFnAttr("smm-main-memory");
+  }
+}
+
 Error lto::backend(Config &C, AddStreamFn AddStream,
                    unsigned ParallelCodeGenParallelismLevel,
                    std::unique_ptr<Module> Mod) {
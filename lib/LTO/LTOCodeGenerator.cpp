@@ -35,6 +35,7 @@
 #include "llvm/IR/Module.h"
 #include "llvm/IR/Verifier.h"
 #include "llvm/InitializePasses.h"
+#include "llvm/LTO/LTOBackend.h"
 #include "llvm/LTO/legacy/LTOModule.h"
 #include "llvm/LTO/legacy/UpdateCompilerUsed.h"
 #include "llvm/Linker/Linker.h"
@@ -152,6 +153,7 @@ bool LTOCodeGenerator::addModule(LTOModule *Mod) {
   assert(&Mod->getModule().getContext() == &Context &&
          "Expected module in same context");
 
+  lto::keepInMainMemory(Mod->getModule());
   bool ret = TheLinker->linkInModule(Mod->takeModule());
   setAsmUndefinedRefs(Mod);
 
@@ -167,6 +169,7 @@ void LTOCodeGenerator::setModule(std::unique_ptr<LTOModule> Mod) {
 
   AsmUndefinedRefs.clear();
 
+  lto::keepInMainMemory(Mod->getModule());
   MergedModule = Mod->takeModule();
   TheLinker = make_unique<Linker>(*MergedModule);
   setAsmUndefinedRefs(&*Mod);
@@ -14,88 +14,143 @@
 #include "llvm/Support/ThreadPool.h"
 
 #include "llvm/Config/llvm-config.h"
+#include "llvm/Support/Compiler.h"
 #include "llvm/Support/raw_ostream.h"
 
 using namespace llvm;
 
 #if LLVM_ENABLE_THREADS
 
+// The pool the calling thread belongs to, if any, and the index of its queue.
+static LLVM_THREAD_LOCAL ThreadPool *CurrentPool = nullptr;
+static LLVM_THREAD_LOCAL unsigned CurrentQueue = 0;
+
 // Default to std::thread::hardware_concurrency
 ThreadPool::ThreadPool() : ThreadPool(std::thread::hardware_concurrency()) {}
 
 ThreadPool::ThreadPool(unsigned ThreadCount)
-    : ActiveThreads(0), EnableFlag(true) {
+    : PendingTasks(0), ActiveThreads(0), EnableFlag(true) {
+  // One queue per thread, and the shared queue for tasks submitted from
+  // outside the pool.
+  for (unsigned QueueID = 0; QueueID <= ThreadCount; ++QueueID)
+    Queues.emplace_back(new WorkQueue);
+
   // Create ThreadCount threads that will loop forever, wait on QueueCondition
   // for tasks to be queued or the Pool to be destroyed.
   Threads.reserve(ThreadCount);
   for (unsigned ThreadID = 0; ThreadID < ThreadCount; ++ThreadID) {
-    Threads.emplace_back([&] {
+    Threads.emplace_back([this, ThreadID] {
+      CurrentPool = this;
+      CurrentQueue = ThreadID;
       while (true) {
-        PackagedTaskTy Task;
-        {
-          std::unique_lock<std::mutex> LockGuard(QueueLock);
-          // Wait for tasks to be pushed in the queue
-          QueueCondition.wait(LockGuard,
-                              [&] { return !EnableFlag || !Tasks.empty(); });
-          // Exit condition
-          if (!EnableFlag && Tasks.empty())
-            return;
-          // Yeah, we have a task, grab it and release the lock on the queue
-
-          // We first need to signal that we are active before popping the queue
-          // in order for wait() to properly detect that even if the queue is
-          // empty, there is still a task in flight.
-          {
-            ++ActiveThreads;
-            std::unique_lock<std::mutex> LockGuard(CompletionLock);
-          }
-          Task = std::move(Tasks.front());
-          Tasks.pop();
-        }
-        // Run the task we just grabbed
+        if (runPendingTask())
+          continue;
+        std::unique_lock<std::mutex> LockGuard(QueueLock);
+        // Wait for tasks to be pushed in a queue
+        QueueCondition.wait(LockGuard,
+                            [&] { return !EnableFlag || PendingTasks; });
+        // Exit condition
+        if (!EnableFlag && !PendingTasks)
+          return;
+      }
+    });
+  }
+}
+
+void ThreadPool::pushTask(PackagedTaskTy Task) {
+  // Count the task before queuing it, so that it can't be popped while it is
+  // not counted yet.
+  ++PendingTasks;
+  WorkQueue &Queue =
+      CurrentPool == this ? *Queues[CurrentQueue] : *Queues.back();
+  {
+    std::unique_lock<std::mutex> LockGuard(Queue.Lock);
+    Queue.Tasks.push_back(std::move(Task));
+  }
+  {
+    // Synchronize with threads checking PendingTasks before going to sleep.
+    std::unique_lock<std::mutex> LockGuard(QueueLock);
+
+    // Don't allow enqueueing after disabling the pool
+    assert(EnableFlag && "Queuing a thread during ThreadPool destruction");
+  }
+  QueueCondition.notify_one();
+  {
+    // Synchronize with TaskGroup::wait(), which sleeps until a task is queued
+    // for it to help with.
+    std::unique_lock<std::mutex> LockGuard(CompletionLock);
+  }
+  CompletionCondition.notify_all();
+}
+
+bool ThreadPool::popTask(PackagedTaskTy &Task) {
+  if (!PendingTasks)
+    return false;
+  bool IsPoolThread = CurrentPool == this;
+  unsigned NumQueues = Queues.size();
+  unsigned First = IsPoolThread ? CurrentQueue : NumQueues - 1;
+  for (unsigned I = 0; I != NumQueues; ++I) {
+    WorkQueue &Queue = *Queues[(First + I) % NumQueues];
+    std::unique_lock<std::mutex> LockGuard(Queue.Lock);
+    if (Queue.Tasks.empty())
+      continue;
+    // Run the most recent task of our own queue, as its data is likely still
+    // in cache, but steal the oldest task of other queues, which is likely to
+    // spawn more work.
+    if (IsPoolThread && I == 0) {
+      Task = std::move(Queue.Tasks.back());
+      Queue.Tasks.pop_back();
+    } else {
+      Task = std::move(Queue.Tasks.front());
+      Queue.Tasks.pop_front();
+    }
+    // We first need to signal that we are active before decrementing
+    // PendingTasks in order for wait() to properly detect that even if no task
+    // is pending, there is still a task in flight.
+    ++ActiveThreads;
+    --PendingTasks;
+    return true;
+  }
+  return false;
+}
+
+bool ThreadPool::runPendingTask() {
+  PackagedTaskTy Task;
+  if (!popTask(Task))
+    return false;
 #ifndef _MSC_VER
-        Task();
+  Task();
 #else
-        Task(/* unused */ false);
+  Task(/* unused */ false);
 #endif
 
-        {
-          // Adjust `ActiveThreads`, in case someone waits on ThreadPool::wait()
-          std::unique_lock<std::mutex> LockGuard(CompletionLock);
-          --ActiveThreads;
-        }
-
-        // Notify task completion, in case someone waits on ThreadPool::wait()
-        CompletionCondition.notify_all();
-      }
-    });
+  {
+    // Adjust `ActiveThreads`, in case someone waits on ThreadPool::wait()
+    std::unique_lock<std::mutex> LockGuard(CompletionLock);
+    --ActiveThreads;
   }
+
+  // Notify task completion, in case someone waits on ThreadPool::wait() or
+  // TaskGroup::wait()
+  CompletionCondition.notify_all();
+  return true;
 }
 
 void ThreadPool::wait() {
-  // Wait for all threads to complete and the queue to be empty
+  assert(CurrentPool != this && "ThreadPool::wait() called from a task");
+  // Wait for all threads to complete and the queues to be empty. popTask()
+  // counts a task as active before it stops counting it as pending, so
+  // PendingTasks has to be read first for a task being popped to be seen.
   std::unique_lock<std::mutex> LockGuard(CompletionLock);
-  // The order of the checks for ActiveThreads and Tasks.empty() matters because
-  // any active threads might be modifying the Tasks queue, and this would be a
-  // race.
   CompletionCondition.wait(LockGuard,
-                           [&] { return !ActiveThreads && Tasks.empty(); });
+                           [&] { return !PendingTasks && !ActiveThreads; });
 }
 
 std::shared_future<ThreadPool::VoidTy> ThreadPool::asyncImpl(TaskTy Task) {
   /// Wrap the Task in a packaged_task to return a future object.
   PackagedTaskTy PackagedTask(std::move(Task));
   auto Future = PackagedTask.get_future();
-  {
-    // Lock the queue and push the new task
-    std::unique_lock<std::mutex> LockGuard(QueueLock);
-
-    // Don't allow enqueueing after disabling the pool
-    assert(EnableFlag && "Queuing a thread during ThreadPool destruction");
-
-    Tasks.push(std::move(PackagedTask));
-  }
-  QueueCondition.notify_one();
+  pushTask(std::move(PackagedTask));
   return Future.share();
 }
 
@@ -110,30 +165,53 @@ ThreadPool::~ThreadPool() {
     Worker.join();
 }
 
+void TaskGroup::wait() {
+  while (PendingTasks) {
+    // Help the pool instead of blocking, as our tasks may still be queued
+    // behind others.
+    if (Pool.runPendingTask())
+      continue;
+    // Our remaining tasks are running on other threads, wait for a task to
+    // complete or for more work to be queued.
+    std::unique_lock<std::mutex> LockGuard(Pool.CompletionLock);
+    Pool.CompletionCondition.wait(
+        LockGuard, [&] { return !PendingTasks || Pool.PendingTasks; });
+  }
+}
+
 #else // LLVM_ENABLE_THREADS Disabled
 
 ThreadPool::ThreadPool() : ThreadPool(0) {}
 
 // No threads are launched, issue a warning if ThreadCount is not 0
 ThreadPool::ThreadPool(unsigned ThreadCount)
-    : ActiveThreads(0) {
+    : PendingTasks(0), ActiveThreads(0) {
   if (ThreadCount) {
     errs() << "Warning: request a ThreadPool with " << ThreadCount
            << " threads, but LLVM_ENABLE_THREADS has been turned off\n";
   }
+  Queues.emplace_back(new WorkQueue);
 }
 
-void ThreadPool::wait() {
-  // Sequential implementation running the tasks
-  while (!Tasks.empty()) {
-    auto Task = std::move(Tasks.front());
-    Tasks.pop();
+bool ThreadPool::runPendingTask() {
+  std::deque<PackagedTaskTy> &Tasks = Queues.front()->Tasks;
+  if (Tasks.empty())
+    return false;
+  auto Task = std::move(Tasks.front());
+  Tasks.pop_front();
+  --PendingTasks;
 #ifndef _MSC_VER
-        Task();
+  Task();
 #else
-        Task(/* unused */ false);
+  Task(/* unused */ false);
 #endif
-  }
+  return true;
+}
+
+void ThreadPool::wait() {
+  // Sequential implementation running the tasks
+  while (runPendingTask())
+    ;
 }
 
 std::shared_future<ThreadPool::VoidTy> ThreadPool::asyncImpl(TaskTy Task) {
@@ -147,7 +225,8 @@ std::shared_future<ThreadPool::VoidTy> ThreadPool::asyncImpl(TaskTy Task) {
   auto Future = std::async(std::launch::deferred, std::move(Task), false).share();
   PackagedTaskTy PackagedTask([Future](bool) -> bool { Future.get(); return false; });
 #endif
-  Tasks.push(std::move(PackagedTask));
+  ++PendingTasks;
+  Queues.front()->Tasks.push_back(std::move(PackagedTask));
   return Future;
 }
 
@@ -155,4 +234,14 @@ ThreadPool::~ThreadPool() {
   wait();
 }
 
+void TaskGroup::wait() {
+  // Sequential implementation running the tasks of the pool until the ones of
+  // the group are done.
+  while (PendingTasks) {
+    bool Ran = Pool.runPendingTask();
+    (void)Ran;
+    assert(Ran && "task of the group is not queued");
+  }
+}
+
 #endif
@@ -12,6 +12,7 @@
 //===----------------------------------------------------------------------===//
 
 #include "AArch64InstrInfo.h"
+#include "AArch64MachineFunctionInfo.h"
 #include "AArch64Subtarget.h"
 #include "MCTargetDesc/AArch64AddressingModes.h"
 #include "Utils/AArch64BaseInfo.h"
@@ -4286,3 +4287,114 @@ AArch64InstrInfo::getSerializableBitmaskMachineOperandTargetFlags() const {
       {MO_TLS, "aarch64-tls"}};
   return makeArrayRef(TargetFlags);
 }
+
+AArch64InstrInfo::MachineOutlinerInstrType
+AArch64InstrInfo::getOutliningType(MachineInstr &MI) const {
+  MachineFunction *MF = MI.getParent()->getParent();
+  AArch64FunctionInfo *FuncInfo = MF->getInfo<AArch64FunctionInfo>();
+
+  // Don't outline LOHs.
+  if (FuncInfo->getLOHRelated().count(&MI))
+    return MachineOutlinerInstrType::Illegal;
+
+  // Don't allow debug values to impact outlining type.
+  if (MI.isDebugValue() || MI.isIndirectDebugValue())
+    return MachineOutlinerInstrType::Invisible;
+
+  // Is this a terminator for a basic block?
+  if (MI.isTerminator()) {
+    // Is this the end of a function?
+    if (MI.getParent()->succ_empty())
+      return MachineOutlinerInstrType::Legal;
+
+    // It's not, so don't outline it.
+    return MachineOutlinerInstrType::Illegal;
+  }
+
+  // Don't outline positions.
+  if (MI.isPosition())
+    return MachineOutlinerInstrType::Illegal;
+
+  // Make sure none of the operands are un-outlinable.
+  for (const MachineOperand &MOP : MI.operands())
+    if (MOP.isCPI() || MOP.isJTI() || MOP.isCFIIndex() || MOP.isFI() ||
+        MOP.isTargetIndex())
+      return MachineOutlinerInstrType::Illegal;
+
+  // Don't outline anything that uses the link register.
+  if (MI.modifiesRegister(AArch64::LR, &RI) ||
+      MI.readsRegister(AArch64::LR, &RI))
+    return MachineOutlinerInstrType::Illegal;
+
+  // The call saves the link register on the stack, so anything that uses the
+  // stack pointer would see it moved.
+  if (MI.modifiesRegister(AArch64::SP, &RI) ||
+      MI.readsRegister(AArch64::SP, &RI))
+    return MachineOutlinerInstrType::Illegal;
+
+  return MachineOutlinerInstrType::Legal;
+}
+
+bool AArch64InstrInfo::isFunctionSafeToOutlineFrom(MachineFunction &MF) const {
+  // Saving the link register would overwrite the red zone.
+  return !Subtarget.getFrameLowering()->canUseRedZone(MF);
+}
+
+unsigned AArch64InstrInfo::getOutliningCallOverhead(bool IsTailCall) const {
+  // A branch, or a call with a save and restore of the link register.
+  return IsTailCall ? 4 : 12;
+}
+
+unsigned AArch64InstrInfo::getOutliningFrameOverhead(bool IsTailCall) const {
+  // The outlined sequence already ends in a return if it is tail called.
+  return IsTailCall ? 0 : 4;
+}
+
+void AArch64InstrInfo::insertOutlinerPrologue(MachineBasicBlock &MBB,
+                                              MachineFunction &MF,
+                                              bool IsTailCall) const {}
+
+void AArch64InstrInfo::insertOutlinerEpilogue(MachineBasicBlock &MBB,
+                                              MachineFunction &MF,
+                                              bool IsTailCall) const {
+  // If this is a tail call outlined function, then there's already a return.
+  if (IsTailCall)
+    return;
+
+  // It's not a tail call, so we have to insert the return ourselves.
+  MachineInstr *ret = BuildMI(MF, DebugLoc(), get(AArch64::RET))
+                          .addReg(AArch64::LR, RegState::Undef);
+  MBB.insert(MBB.end(), ret);
+}
+
+MachineBasicBlock::iterator AArch64InstrInfo::insertOutlinedCall(
+    Module &M, MachineBasicBlock &MBB, MachineBasicBlock::iterator &It,
+    MachineFunction &MF, bool IsTailCall) const {
+  // Are we tail calling?
+  if (IsTailCall) {
+    // If yes, then we can just branch to the label.
+    It = BuildMI(MBB, It, DebugLoc(), get(AArch64::B))
+             .addGlobalAddress(MF.getFunction());
+    return It;
+  }
+
+  // We aren't tail calling, so we have to save LR ourselves.
+  BuildMI(MBB, It, DebugLoc(), get(AArch64::STRXpre))
+      .addReg(AArch64::SP, RegState::Define)
+      .addReg(AArch64::LR)
+      .addReg(AArch64::SP)
+      .addImm(-16);
+
+  // Insert the call.
+  BuildMI(MBB, It, DebugLoc(), get(AArch64::BL))
+      .addGlobalAddress(MF.getFunction());
+
+  // Restore the link register.
+  It = BuildMI(MBB, It, DebugLoc(), get(AArch64::LDRXpost))
+           .addReg(AArch64::SP, RegState::Define)
+           .addReg(AArch64::LR, RegState::Define)
+           .addReg(AArch64::SP)
+           .addImm(16);
+
+  return It;
+}
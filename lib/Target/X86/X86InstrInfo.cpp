@@ -9479,6 +9479,182 @@ bool X86InstrInfo::isTailCall(const MachineInstr &Inst) const {
   }
 }
 
+X86InstrInfo::MachineOutlinerInstrType
+X86InstrInfo::getOutliningType(MachineInstr &MI) const {
+  // Don't allow debug values to impact outlining type.
+  if (MI.isDebugValue() || MI.isIndirectDebugValue())
+    return MachineOutlinerInstrType::Invisible;
+
+  // Is this a tail call? If yes, we can outline as a tail call.
+  if (isTailCall(MI))
+    return MachineOutlinerInstrType::Legal;
+
+  // Is this the terminator of a basic block?
+  if (MI.isTerminator() || MI.isReturn()) {
+    // Does its parent have any successors in its MachineFunction?
+    if (MI.getParent()->succ_empty())
+      return MachineOutlinerInstrType::Legal;
+
+    // It does, so we can't tail call it.
+    return MachineOutlinerInstrType::Illegal;
+  }
+
+  // Don't outline anything that modifies or reads from the stack pointer. The
+  // call pushes the return address, so offsets from it would be off by one
+  // slot. Some instructions are built without explicit uses or defs, so the
+  // MCInstrDesc is checked too.
+  if (MI.modifiesRegister(X86::RSP, &RI) || MI.readsRegister(X86::RSP, &RI) ||
+      MI.getDesc().hasImplicitUseOfPhysReg(X86::RSP) ||
+      MI.getDesc().hasImplicitDefOfPhysReg(X86::RSP))
+    return MachineOutlinerInstrType::Illegal;
+
+  // Outlined calls change the instruction pointer, so don't read from it.
+  if (MI.readsRegister(X86::RIP, &RI) ||
+      MI.getDesc().hasImplicitUseOfPhysReg(X86::RIP) ||
+      MI.getDesc().hasImplicitDefOfPhysReg(X86::RIP))
+    return MachineOutlinerInstrType::Illegal;
+
+  // Positions can't safely be outlined.
+  if (MI.isPosition())
+    return MachineOutlinerInstrType::Illegal;
+
+  // Make sure none of the operands of this instruction do anything tricky.
+  for (const MachineOperand &MOP : MI.operands())
+    if (MOP.isCPI() || MOP.isJTI() || MOP.isCFIIndex() || MOP.isFI() ||
+        MOP.isTargetIndex())
+      return MachineOutlinerInstrType::Illegal;
+
+  return MachineOutlinerInstrType::Legal;
+}
+
+bool X86InstrInfo::isFunctionSafeToOutlineFrom(MachineFunction &MF) const {
+  // Only 64-bit calls are inserted.
+  if (!Subtarget.is64Bit())
+    return false;
+
+  // The return address pushed by a call would overwrite the red zone.
+  const X86MachineFunctionInfo *X86FI = MF.getInfo<X86MachineFunctionInfo>();
+  return MF.getFunction()->hasFnAttribute(Attribute::NoRedZone) ||
+         !X86FI->getUsesRedZone();
+}
+
+unsigned X86InstrInfo::getOutliningInstrSize(const MachineInstr &MI) const {
+  if (MI.isDebugValue() || MI.isKill() || MI.isImplicitDef() ||
+      MI.isCFIInstruction() || MI.isLabel())
+    return 0;
+
+  const MCInstrDesc &Desc = MI.getDesc();
+  uint64_t TSFlags = Desc.TSFlags;
+  unsigned Form = TSFlags & X86II::FormMask;
+  // Pseudos are expanded to something, count an average instruction.
+  if (Form == X86II::Pseudo)
+    return 4;
+
+  // Opcode, opcode map and prefixes.
+  unsigned Size = 1;
+  unsigned OpMap = TSFlags & X86II::OpMapMask;
+  switch (TSFlags & X86II::EncodingMask) {
+  case X86II::VEX:
+    Size += (OpMap == X86II::TB) ? 2 : 3;
+    break;
+  case X86II::XOP:
+    Size += 3;
+    break;
+  case X86II::EVEX:
+    Size += 4;
+    break;
+  default:
+    if (OpMap == X86II::TB)
+      Size += 1;
+    else if (OpMap == X86II::T8 || OpMap == X86II::TA)
+      Size += 2;
+    if (TSFlags & X86II::REX_W)
+      Size += 1;
+    if ((TSFlags & X86II::OpSizeMask) == X86II::OpSize16)
+      Size += 1;
+    if (TSFlags & X86II::OpPrefixMask)
+      Size += 1;
+    break;
+  }
+
+  // ModRM byte.
+  switch (Form) {
+  case X86II::RawFrm:
+  case X86II::AddRegFrm:
+  case X86II::RawFrmImm8:
+  case X86II::RawFrmImm16:
+  case X86II::RawFrmMemOffs:
+  case X86II::RawFrmSrc:
+  case X86II::RawFrmDst:
+  case X86II::RawFrmDstSrc:
+    break;
+  default:
+    Size += 1;
+    break;
+  }
+
+  // SIB byte and displacement.
+  int MemOp = X86II::getMemoryOperandNo(TSFlags);
+  if (MemOp >= 0) {
+    MemOp += X86II::getOperandBias(Desc);
+    const MachineOperand &Base = MI.getOperand(MemOp + X86::AddrBaseReg);
+    const MachineOperand &Index = MI.getOperand(MemOp + X86::AddrIndexReg);
+    const MachineOperand &Disp = MI.getOperand(MemOp + X86::AddrDisp);
+    unsigned BaseReg = Base.isReg() ? Base.getReg() : 0;
+    if (Index.getReg() || BaseReg == X86::RSP || BaseReg == X86::ESP ||
+        BaseReg == X86::R12)
+      Size += 1;
+    if (!BaseReg || !Disp.isImm() || !isInt<8>(Disp.getImm()))
+      Size += 4;
+    else if (Disp.getImm() || BaseReg == X86::RBP || BaseReg == X86::R13)
+      Size += 1;
+  }
+
+  if (X86II::hasImm(TSFlags))
+    Size += X86II::getSizeOfImm(TSFlags);
+  return Size;
+}
+
+unsigned X86InstrInfo::getOutliningCallOverhead(bool IsTailCall) const {
+  // A call or a jump with a 32-bit displacement.
+  return 5;
+}
+
+unsigned X86InstrInfo::getOutliningFrameOverhead(bool IsTailCall) const {
+  // The outlined sequence already ends in a return if it is tail called.
+  return IsTailCall ? 0 : 1;
+}
+
+void X86InstrInfo::insertOutlinerPrologue(MachineBasicBlock &MBB,
+                                          MachineFunction &MF,
+                                          bool IsTailCall) const {}
+
+void X86InstrInfo::insertOutlinerEpilogue(MachineBasicBlock &MBB,
+                                          MachineFunction &MF,
+                                          bool IsTailCall) const {
+  // If we're a tail call, we already have a return, so don't do anything.
+  if (IsTailCall)
+    return;
+
+  // We're a normal call, so our sequence doesn't have a return instruction.
+  // Add it in.
+  MachineInstr *retq = BuildMI(MF, DebugLoc(), get(X86::RETQ));
+  MBB.insert(MBB.end(), retq);
+}
+
+MachineBasicBlock::iterator
+X86InstrInfo::insertOutlinedCall(Module &M, MachineBasicBlock &MBB,
+                                 MachineBasicBlock::iterator &It,
+                                 MachineFunction &MF,
+                                 bool IsTailCall) const {
+  // Is it a tail call? If yes, just insert a JMP, and a call otherwise.
+  unsigned Opc = IsTailCall ? X86::TAILJMPd64 : X86::CALL64pcrel32;
+  It = BuildMI(MBB, It, DebugLoc(), get(Opc))
+           .addGlobalAddress(MF.getFunction());
+
+  return It;
+}
+
 namespace {
   /// Create Global Base Reg pass. This initializes the PIC
   /// global base register for x86-32.
@@ -541,6 +541,30 @@ public:
 
   bool isTailCall(const MachineInstr &Inst) const override;
 
+  MachineOutlinerInstrType getOutliningType(MachineInstr &MI) const override;
+
+  bool isFunctionSafeToOutlineFrom(MachineFunction &MF) const override;
+
+  /// Estimates the encoded size of \p MI from its opcode map, prefixes,
+  /// addressing mode and immediate. X86 does not implement getInstSizeInBytes,
+  /// so the outliner counts bytes with this instead.
+  unsigned getOutliningInstrSize(const MachineInstr &MI) const override;
+
+  unsigned getOutliningCallOverhead(bool IsTailCall) const override;
+
+  unsigned getOutliningFrameOverhead(bool IsTailCall) const override;
+
+  void insertOutlinerPrologue(MachineBasicBlock &MBB, MachineFunction &MF,
+                              bool IsTailCall) const override;
+
+  void insertOutlinerEpilogue(MachineBasicBlock &MBB, MachineFunction &MF,
+                              bool IsTailCall) const override;
+
+  MachineBasicBlock::iterator
+  insertOutlinedCall(Module &M, MachineBasicBlock &MBB,
+                     MachineBasicBlock::iterator &It, MachineFunction &MF,
+                     bool IsTailCall) const override;
+
 protected:
   /// Commutes the operands in the given instruction by changing the operands
   /// order and/or changing the instruction's opcode and/or the immediate value
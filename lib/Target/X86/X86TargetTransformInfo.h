@@ -49,6 +49,12 @@ public:
 
   /// @}
 
+  /// \name Cache TTI Implementation
+  /// @{
+  llvm::Optional<unsigned> getCacheSize(
+    TargetTransformInfo::CacheLevel Level);
+  /// @}
+
   /// \name Vector TTI Implementations
   /// @{
 
@@ -15,13 +15,16 @@
 #define DEBUG_TYPE "smmcm"
 
 #include "llvm/Pass.h"
+#include "llvm/ADT/Triple.h"
 #include "llvm/Analysis/AliasAnalysis.h"
 #include "llvm/Analysis/CallGraph.h"
 #include "llvm/Analysis/LoopInfo.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/InlineAsm.h"
 #include "llvm/IR/Instruction.h"
+#include "llvm/IR/IntrinsicInst.h"
 #include "llvm/IR/InstIterator.h"
 #include "llvm/IR/InstVisitor.h"
 #include "llvm/IR/IRBuilder.h"
@@ -31,6 +34,9 @@
 #include "llvm/Transforms/Utils/Cloning.h"
 #include "llvm/Transforms/Utils/ValueMapper.h"
 #include "llvm/Support/Debug.h"
+#include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MathExtras.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Support/YAMLTraits.h"
 
@@ -47,10 +53,29 @@
 #include <unordered_map>
 
 #include "FuncType.h"
+#include "../SMMCommon/SMMInfo.h"
 
 
 using namespace llvm;
 
+enum CachePolicy { LRU, FIFO, CostAware };
+
+static cl::opt<bool> CodeCache("code-cache",
+	cl::desc("Manage the SPM code space as a dynamic cache instead of static overlay regions"));
+
+static cl::opt<unsigned long long> CodeCacheSize("code-cache-size", cl::init(0),
+	cl::desc("Size of the SPM code cache in bytes"));
+
+static cl::opt<CachePolicy> CodeCachePolicy("code-cache-policy", cl::init(LRU),
+	cl::desc("Replacement policy of the SPM code cache"),
+	cl::values(
+	    clEnumValN(LRU, "lru", "Evict the least recently used function"),
+	    clEnumValN(FIFO, "fifo", "Evict the function loaded first"),
+	    clEnumValN(CostAware, "cost", "Evict the function that is cheapest to reload, as hinted by the compiler")));
+
+static cl::opt<std::string> LinkerScript("smm-linker-script",
+	cl::desc("Write the overlays of the code regions to a linker script"), cl::value_desc("filename"));
+
 namespace {
     struct CodeManagement : public ModulePass { // Insert code management functions
 	static char ID; // Pass identification, replacement for typeid
@@ -59,6 +84,7 @@ namespace {
 	virtual void getAnalysisUsage(AnalysisUsage &AU) const {
 	    AU.addRequired<CallGraphWrapperPass>();
 	    AU.addRequired<LoopInfoWrapperPass>();
+	    AU.addRequired<SMMInfo>();
 	}
 
 	// Build the wrapper function: retTy c_call_complete(char *callerName, char *calleeName, calleeTy calleeAddr, ...)
@@ -200,7 +226,14 @@ namespace {
 	    }
 
 	    // Find out the SPM address for callee
-	    CallInst* callee_vma_int8 = CallInst::Create(func_c_get, callee_name, "callee_vma_int8", c_call_entry);
+	    CallInst* callee_vma_int8;
+	    if (CodeCache) {
+		// Functions move in the cache, so the runtime records where the caller is to be brought back there
+		Constant *func_c_get_call = mod->getOrInsertFunction("c_get_call", ptrTy_int8, ptrTy_int8, ptrTy_int8, nullptr);
+		Value *c_get_call_args[] = {caller_name, callee_name};
+		callee_vma_int8 = CallInst::Create(func_c_get_call, c_get_call_args, "callee_vma_int8", c_call_entry);
+	    } else
+		callee_vma_int8 = CallInst::Create(func_c_get, callee_name, "callee_vma_int8", c_call_entry);
 	    //CallInst* callee_vma_int8 = builder.CreateCall(func_c_get, callee_name, "callee_vma_int8");
 	    // Cast the type of the SPM address to the function type of the callee
 	    CastInst* callee_vma = cast <CastInst> (builder.CreateBitCast(callee_vma_int8, calleeTyPtr, "callee_vma")); 
@@ -223,7 +256,12 @@ namespace {
 		callee_ret = builder.CreateCall(callee_vma, callee_arg_vals);
 
 	    // Ensure the caller is present after the callee returns
-	    CallInst::Create(func_c_get, caller_name, "caller_vma", c_call_entry);
+	    if (CodeCache) {
+		// at the address the callee returns to
+		Constant *func_c_return = mod->getOrInsertFunction("c_return", Type::getVoidTy(context), ptrTy_int8, nullptr);
+		CallInst::Create(func_c_return, caller_name, "", c_call_entry);
+	    } else
+		CallInst::Create(func_c_get, caller_name, "caller_vma", c_call_entry);
 	    //builder.CreateCall(func_c_get, caller_name, "caller_vma");
 
 	    // Read return value and return it if its type is not void
@@ -239,6 +277,192 @@ namespace {
 	}
 
 
+	// Check if a constant is the address of a global, possibly offset or cast, which fits in an immediate
+	static bool isSymbolicAddress(Constant *c) {
+	    if (isa<GlobalValue>(c))
+		return true;
+	    ConstantExpr *expr = dyn_cast<ConstantExpr>(c);
+	    if (!expr)
+		return false;
+	    switch (expr->getOpcode()) {
+		case Instruction::BitCast:
+		case Instruction::PtrToInt:
+		case Instruction::AddrSpaceCast:
+		case Instruction::GetElementPtr:
+		    return isSymbolicAddress(expr->getOperand(0));
+		default:
+		    return false;
+	    }
+	}
+
+	// Check if a constant refers to any global
+	static bool refersToGlobal(Constant *c) {
+	    if (isa<GlobalValue>(c) || isa<BlockAddress>(c))
+		return true;
+	    for (Use &op : c->operands()) {
+		if (refersToGlobal(cast<Constant>(op.get())))
+		    return true;
+	    }
+	    return false;
+	}
+
+	// Rebuild a constant that refers to globals out of instructions, with the address of every global in it
+	// materialized as a 64-bit immediate. Returns null for constants that cannot be reached that way.
+	static Value *materializeAbsolute(Constant *c, IRBuilder<> &builder) {
+	    if (!refersToGlobal(c))
+		return c;
+	    if (isSymbolicAddress(c) && (c->getType()->isPointerTy() || c->getType()->isIntegerTy())) {
+		FunctionType *asmTy = FunctionType::get(c->getType(), c->getType(), false);
+		InlineAsm *func_movabs = InlineAsm::get(asmTy, "movabsq $1, $0", "=r,i,~{dirflag},~{fpsr},~{flags}", false);
+		return builder.CreateCall(func_movabs, c, "abs_addr");
+	    }
+	    // Structs, arrays and vectors are filled in element by element
+	    if (isa<ConstantAggregate>(c)) {
+		Value *agg = UndefValue::get(c->getType());
+		for (unsigned i = 0, num = c->getNumOperands(); i < num; i++) {
+		    Value *elem = materializeAbsolute(cast<Constant>(c->getOperand(i)), builder);
+		    if (!elem)
+			return nullptr;
+		    if (c->getType()->isVectorTy())
+			agg = builder.CreateInsertElement(agg, elem, builder.getInt32(i));
+		    else
+			agg = builder.CreateInsertValue(agg, elem, i);
+		}
+		return agg;
+	    }
+	    // Other expressions, like arithmetic on addresses, are computed at run time
+	    if (ConstantExpr *expr = dyn_cast<ConstantExpr>(c)) {
+		Instruction *inst = expr->getAsInstruction();
+		for (unsigned i = 0, num = inst->getNumOperands(); i < num; i++) {
+		    Value *op = materializeAbsolute(cast<Constant>(inst->getOperand(i)), builder);
+		    if (!op) {
+			delete inst;
+			return nullptr;
+		    }
+		    inst->setOperand(i, op);
+		}
+		return builder.Insert(inst);
+	    }
+	    // Block addresses point into the function itself, wherever it was linked
+	    return nullptr;
+	}
+
+	// Cached code runs wherever it is loaded, so it can only reach code and data outside itself through
+	// absolute addresses. Calls to memory intrinsics become calls to the C library, which the code generator
+	// would otherwise emit as PC-relative calls, and the address of every global the function refers to is
+	// materialized as a 64-bit immediate, which also turns direct calls into indirect ones. This is x86-64
+	// code, which the pass checks for before it caches anything.
+	void makePositionIndependent(Function &func) {
+	    Module *mod = func.getParent();
+	    LLVMContext &context = mod->getContext();
+	    IRBuilder<> builder(context);
+	    PointerType *ptrTy_int8 = builder.getInt8PtrTy();
+	    IntegerType *ty_int32 = builder.getInt32Ty();
+	    IntegerType *ty_int64 = builder.getInt64Ty();
+
+	    std::vector<MemIntrinsic *> memIntrinsics;
+	    for (Instruction &inst : instructions(func)) {
+		if (MemIntrinsic *mem_inst = dyn_cast<MemIntrinsic>(&inst))
+		    memIntrinsics.push_back(mem_inst);
+	    }
+	    for (MemIntrinsic *mem_inst : memIntrinsics) {
+		builder.SetInsertPoint(mem_inst);
+		Value *dst = builder.CreateBitCast(mem_inst->getRawDest(), ptrTy_int8);
+		Value *len = builder.CreateZExtOrTrunc(mem_inst->getLength(), ty_int64);
+		if (MemSetInst *set_inst = dyn_cast<MemSetInst>(mem_inst)) {
+		    Constant *func_memset = mod->getOrInsertFunction("memset", ptrTy_int8, ptrTy_int8, ty_int32, ty_int64, nullptr);
+		    builder.CreateCall(func_memset, {dst, builder.CreateZExt(set_inst->getValue(), ty_int32), len});
+		} else {
+		    MemTransferInst *transfer_inst = cast<MemTransferInst>(mem_inst);
+		    Constant *func_libc = mod->getOrInsertFunction(isa<MemCpyInst>(transfer_inst) ? "memcpy" : "memmove", ptrTy_int8, ptrTy_int8, ptrTy_int8, ty_int64, nullptr);
+		    Value *src = builder.CreateBitCast(transfer_inst->getRawSource(), ptrTy_int8);
+		    builder.CreateCall(func_libc, {dst, src, len});
+		}
+		mem_inst->eraseFromParent();
+	    }
+
+	    std::vector<Instruction *> insts;
+	    for (Instruction &inst : instructions(func))
+		insts.push_back(&inst);
+	    for (Instruction *inst : insts) {
+		// Other intrinsics are expanded in place, and the clauses of landing pads are data
+		if (isa<IntrinsicInst>(inst) || isa<LandingPadInst>(inst))
+		    continue;
+		for (unsigned i = 0, num = inst->getNumOperands(); i < num; i++) {
+		    Constant *c = dyn_cast<Constant>(inst->getOperand(i));
+		    if (!c || !refersToGlobal(c))
+			continue;
+		    // Values flowing into a phi are materialized where they flow from
+		    if (PHINode *phi = dyn_cast<PHINode>(inst))
+			builder.SetInsertPoint(phi->getIncomingBlock(i)->getTerminator());
+		    else
+			builder.SetInsertPoint(inst);
+		    Value *abs = materializeAbsolute(c, builder);
+		    if (!abs)
+			report_fatal_error("cannot cache " + func.getName() + ", which takes the address of a basic block");
+		    inst->setOperand(i, abs);
+		}
+	    }
+	}
+
+	// Get the size of the code cache, which has to hold the largest function
+	unsigned long getCodeCacheSize(Module &mod, SMMInfo &info) {
+	    unsigned long maxFuncSize = 0;
+	    for (auto const &entry : info.getFuncSizes(mod)) {
+		if (!isLibraryFunction(entry.first) && !isCodeManagementFunction(entry.first))
+		    maxFuncSize = std::max(maxFuncSize, entry.second);
+	    }
+	    if (!CodeCacheSize)
+		report_fatal_error("the size of the code cache is missing, pass -code-cache-size");
+	    if (CodeCacheSize < maxFuncSize)
+		report_fatal_error("the code cache is smaller than the largest function (" + Twine(maxFuncSize) + " bytes)");
+	    return CodeCacheSize;
+	}
+
+	// Get the replacement hint of each function, the DMA cost of reloading it times the number of calls to it
+	std::unordered_map <Function *, uint64_t> getCacheHints(Module &mod, SMMInfo &info) {
+	    std::unordered_map <std::string, uint64_t> numCalls;
+	    for (const SMMTraceEntry &entry : info.getExecTrace()) {
+		if (entry.Kind == SMMTraceEntry::Call)
+		    numCalls[entry.Name] += entry.Count;
+	    }
+	    std::unordered_map <Function *, uint64_t> hints;
+	    for (auto const &entry : info.getFuncSizes(mod)) {
+		// Without an execution trace every function counts as called once
+		uint64_t calls = numCalls.empty() ? 1 : numCalls[entry.first->getName().str()];
+		hints[entry.first] = calls * info.getDMAModel().getTransferCost(entry.second);
+	    }
+	    return hints;
+	}
+
+	// Write an OVERLAY statement for each region, with a section for each function mapped to it. The script
+	// is INCLUDEd in the SECTIONS of the target linker script where the SPM code space starts, after defining
+	// _smm_load_address, the main memory address the first load image goes to.
+	void writeLinkerScript(const std::vector <std::vector <std::string> > &regions, uint64_t granule) {
+	    std::error_code EC;
+	    raw_fd_ostream out(LinkerScript, EC, sys::fs::F_Text);
+	    if (EC)
+		report_fatal_error("cannot open " + LinkerScript + ": " + EC.message());
+	    out << "/* Code regions of the SPM, generated by smmcm */\n";
+	    std::string prev;
+	    for (const std::vector <std::string> &sections : regions) {
+		if (sections.empty())
+		    continue;
+		// Regions follow each other in the SPM, and so do their load images in main memory
+		out << "OVERLAY ALIGN(" << granule << ") : NOCROSSREFS AT (ALIGN(";
+		if (prev.empty())
+		    out << "_smm_load_address";
+		else
+		    out << "LOADADDR(" << prev << ") + SIZEOF(" << prev << ")";
+		out << ", " << granule << "))\n{\n";
+		// Sections are padded, so every load image starts and ends at a DMA boundary
+		for (const std::string &section : sections)
+		    out << "  " << section << " { *(" << section << ") . = ALIGN(" << granule << "); }\n";
+		out << "}\n";
+		prev = sections.back();
+	    }
+	}
+
 	virtual bool runOnModule (Module &mod) {
 	    int num_regions;
 
@@ -299,42 +523,55 @@ namespace {
 
 	    // Code management related
 	    GlobalVariable* gvar_ptr_region_table = mod.getGlobalVariable("_region_table");
-	    assert(gvar_ptr_region_table);
+	    assert(gvar_ptr_region_table || CodeCache);
 	    ConstantInt * const_num_regions = NULL;
 	    ConstantInt * const_num_mappings = NULL;
-	    std::ifstream ifs;
-	    //std::ofstream ofs;
 	    std::unordered_set<Function *> referredFuncs;
 
-	    /* Read in mappings that relate functions to regions: begin */
-	    ifs.open("_mapping", std::fstream::in);
-	    assert(ifs.good());
-
-	    // Read function stack sizes
-	    ifs >> num_regions;
-	    while (ifs.good()) {
-		int region_id;
-		std::string func_name;
-		ifs >> func_name >> region_id;
-		if (func_name.empty())
-		    continue;
-		// Ignore white spaces after the last line
-		if (func_name != "") {
+	    /* Get the mappings that relate functions to regions: begin */
+	    SMMInfo &info = getAnalysis<SMMInfo>();
+	    if (CodeCache) {
+		// Cached code reaches everything outside itself through x86-64 absolute addresses
+		if (Triple(mod.getTargetTriple()).getArch() != Triple::x86_64)
+		    report_fatal_error("-code-cache only supports x86-64 targets, not " + Twine(mod.getTargetTriple()));
+		// Every user function is cached, no mapping needed
+		for (Function &func : mod) {
+		    if (isLibraryFunction(&func) || isCodeManagementFunction(&func))
+			continue;
+		    referredFuncs.insert(&func);
+		    // Jump tables would hold absolute addresses into the function, which change when it moves
+		    func.addFnAttr("no-jump-tables", "true");
+		}
+		num_regions = 0;
+	    } else {
+		if (!info.hasMapping())
+		    report_fatal_error("no overlay mapping available, run smmcmh-overlay or pass -smm-info-input");
+
+		num_regions = info.getNumRegions();
+		for (const SMMRegionEntry &entry : info.getMapping()) {
 		    Function *func;
-		    //DEBUG(errs() << "\t" << func_name << " " << region_id << "\n");
-		    //if (func_name == "main")
-			//func_name = "smm_main";
-		    func = mod.getFunction(func_name);
-		    func2reg[func] = builder.getInt32(region_id);
+		    //DEBUG(errs() << "\t" << entry.Name << " " << entry.Region << "\n");
+		    func = mod.getFunction(entry.Name);
+		    assert(func);
+		    func2reg[func] = builder.getInt32(entry.Region);
 		    referredFuncs.insert(func);
-
-            errs() << func_name << " id: " << func->getIntrinsicID() << "\n";
 		}
 	    }
 
-	    ifs.close();
-
-	    /* Read in mappings that relate functions to regions: end */
+	    /* Get the mappings that relate functions to regions: end */
+
+	    // Load images are transferred in units of the DMA granularity
+	    uint64_t granule = std::max<uint64_t>(info.getDMAModel().Alignment, 1);
+	    if (!isPowerOf2_64(granule))
+		report_fatal_error("code can only be aligned to DMA granularities that are powers of two");
+	    if (!LinkerScript.empty()) {
+		if (CodeCache)
+		    report_fatal_error("-smm-linker-script needs overlay regions, but -code-cache has none");
+		std::vector <std::vector <std::string> > regions(num_regions);
+		for (const SMMRegionEntry &entry : info.getMapping())
+		    regions[entry.Region].push_back("." + entry.Name);
+		writeLinkerScript(regions, granule);
+	    }
 
 	    /* Replace calls to user functions with calls to management functions: begin */
 
@@ -381,6 +618,8 @@ namespace {
 				0, // Initializer
 				"__load_stop_" + func_name);
 			func_load_addr[fi] = std::make_pair(gvar_load_start, gvar_load_stop);
+			if (granule > 1)
+			    fi->setAlignment(std::max<unsigned>(fi->getAlignment(), granule));
 		    } //else
 			//func_name = "smm_main";
 		//}
@@ -592,6 +831,8 @@ namespace {
 	    }
 	    // Create a seperate section for the smm_main function and record the memory address range of the memory space it is loaded to
 	    func_smm_main->setSection(".main");
+	    if (granule > 1)
+		func_smm_main->setAlignment(std::max<unsigned>(func_smm_main->getAlignment(), granule));
 	    GlobalVariable* gvar_load_start_main = new GlobalVariable(mod, 
 		    IntegerType::get(context, 8),
 		    true, //isConstant
@@ -615,10 +856,23 @@ namespace {
 	    //BasicBlock* main_entry = BasicBlock::Create(getGlobalContext(), "EntryBlock", func_main);
 	    BasicBlock* main_entry = BasicBlock::Create(context, "EntryBlock", func_main);
 	    builder.SetInsertPoint(main_entry);
-	    // Initalize regions
-	    builder.CreateCall(func_c_init_reg, const_num_regions, "");
+	    LoadInst* region_table = NULL;
+	    std::unordered_map <Function *, uint64_t> cacheHints;
+	    if (CodeCache) {
+		// Initialize the cache
+		Constant *func_c_init_cache = mod.getOrInsertFunction("c_init_cache", Type::getVoidTy(context), ty_int64, ty_int32, nullptr);
+		std::vector<Value*> init_args;
+		init_args.push_back(builder.getInt64(getCodeCacheSize(mod, info)));
+		init_args.push_back(builder.getInt32(CodeCachePolicy));
+		builder.CreateCall(func_c_init_cache, init_args);
+		func_c_init_map = cast<Function>(mod.getOrInsertFunction("c_init_cache_map", FunctionType::get(Type::getVoidTy(context), ty_int32, true)));
+		cacheHints = getCacheHints(mod, info);
+	    } else {
+		// Initalize regions
+		builder.CreateCall(func_c_init_reg, const_num_regions, "");
+		region_table = builder.CreateLoad(gvar_ptr_region_table);
+	    }
 	    // Initialize mappings
-	    LoadInst* region_table = builder.CreateLoad(gvar_ptr_region_table);
 	    call_args.clear();
 	    call_args.push_back(const_num_mappings);
 	    for (auto ii = func_load_addr.begin(), ie = func_load_addr.end(); ii != ie; ii++) {
@@ -631,8 +885,15 @@ namespace {
 		    call_args.push_back(func_smm_main);
 		else
 		    call_args.push_back(func);
-		call_args.push_back(builder.CreateSub(builder.CreatePtrToInt(ii->second.second, builder.getInt64Ty()), builder.CreatePtrToInt(ii->second.first, builder.getInt64Ty())));
-		call_args.push_back(builder.CreateGEP(region_table, func2reg[func]));
+		Value *load_size = builder.CreateSub(builder.CreatePtrToInt(ii->second.second, builder.getInt64Ty()), builder.CreatePtrToInt(ii->second.first, builder.getInt64Ty()));
+		// Transfer whole DMA units, which the padding of the sections provides
+		if (granule > 1)
+		    load_size = builder.CreateAnd(builder.CreateAdd(load_size, builder.getInt64(granule - 1)), builder.getInt64(~(granule - 1)));
+		call_args.push_back(load_size);
+		if (CodeCache)
+		    call_args.push_back(builder.getInt64(cacheHints[func]));
+		else
+		    call_args.push_back(builder.CreateGEP(region_table, func2reg[func]));
 	    }
 	    builder.CreateCall(func_c_init_map, call_args);
 
@@ -649,6 +910,12 @@ namespace {
 	    call_args.push_back(const_int32_16);
 	    call_args.push_back(const_int1_0);
 	    builder.CreateCall(func_llvm_memcpy, call_args);
+
+	    // Cached functions only reach what is outside them through absolute addresses
+	    if (CodeCache) {
+		for (auto const &entry : func_load_addr)
+		    makePositionIndependent(entry.first == func_main ? *func_smm_main : *entry.first);
+	    }
 	    // Call the smm_main function
 	    builder.CreateCall(func_smm_main, main_args);
 	    // Return 
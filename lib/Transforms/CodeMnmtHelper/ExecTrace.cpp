@@ -48,6 +48,7 @@
 #include <unordered_map>
 
 #include "FuncType.h"
+#include "../SMMCommon/SMMInfo.h"
 
 
 using namespace llvm;
@@ -60,26 +61,30 @@ namespace {
 	virtual void getAnalysisUsage(AnalysisUsage &AU) const {
 	    AU.addRequired<CallGraphWrapperPass>();
 	    AU.addRequired<LoopInfoWrapperPass>();
+	    AU.addRequired<SMMInfo>();
 	}
 
-	void dfs_visit(CallGraphNode::CallRecord *v, std::vector<CallGraphNode::CallRecord *>& exec_trace) {
+	void dfs_visit(CallGraphNode::CallRecord *v, std::vector<CallGraphNode::CallRecord *>& exec_trace, std::unordered_set<CallGraphNode *> &active_cgns) {
 	    exec_trace.push_back(v);
 	    CallGraphNode *caller_cgn = v->second;
+	    active_cgns.insert(caller_cgn);
 	    for (CallGraphNode::iterator ii = caller_cgn->begin(), ie = caller_cgn->end(); ii != ie; ii++) {
 		CallGraphNode::CallRecord *w = &*ii;
 		CallGraphNode *called_cgn = w->second;
 		Function *called_func = called_cgn->getFunction();
-		// Skip library functions (consider them later?)
-		if ( called_cgn->getFunction() && called_cgn != caller_cgn && !isLibraryFunction(called_func)) {
-		    dfs_visit(w, exec_trace);
+		// Skip library functions (consider them later?) and recursive calls back into the current call chain
+		if ( called_cgn->getFunction() && active_cgns.find(called_cgn) == active_cgns.end() && !isLibraryFunction(called_func)) {
+		    dfs_visit(w, exec_trace, active_cgns);
 		    exec_trace.push_back(v);
 		}
 	    }
+	    active_cgns.erase(caller_cgn);
 	}
 
 	std::vector<CallGraphNode::CallRecord *> getExecTrace(CallGraphNode::CallRecord *root) {
 	    std::vector<CallGraphNode::CallRecord *> exec_trace;
-	    dfs_visit(root, exec_trace);
+	    std::unordered_set<CallGraphNode *> active_cgns;
+	    dfs_visit(root, exec_trace, active_cgns);
 
 	    return exec_trace;
 	}
@@ -87,12 +92,9 @@ namespace {
 
 
 	virtual bool runOnModule (Module &mod) {
-	    unsigned long code_size;
-	    std::ifstream ifs;
-	    std::ofstream ofs;
-	    std::string func_name;
-	    std::unordered_map <std::string, unsigned long> func_code_size;
 	    std::unordered_map <BasicBlock *, std::deque<CallGraphNode::CallRecord *> > loop2call;
+	    std::unordered_map <BasicBlock *, unsigned> loop_ids;
+	    std::vector<SMMTraceEntry> trace;
 	    std::vector<Value*> call_args;
 	    std::vector<CallGraphNode::CallRecord *> exec_trace;
 
@@ -104,17 +106,6 @@ namespace {
 
 	    /* Get the execution trace: begin */
 
-	    ifs.open ("_func_size", std::ifstream::in | std::ifstream::binary);
-	    while (ifs.good()) {
-		func_name.clear();
-		code_size = 0;
-		ifs >> func_name >> code_size;
-		if (func_name.empty())
-		    continue;
-		func_code_size[func_name]  = code_size;
-		errs() << func_name << " " << func_code_size[func_name] << "\n";
-	    }
-
 	    cgn_main = cg[mod.getFunction("main")];
 
 	    // Extract all the paths from call graph root at main function
@@ -165,21 +156,8 @@ namespace {
 	    }
 
 
-	    // Print the execution trace with loop information
+	    // Record the execution trace with loop information
 	    errs() << "Generating the execution trace...\n";
-	    ofs.open ("_exec_trace", std::ofstream::out | std::ofstream::trunc | std::ofstream::binary);
-
-	    /*
-	    for (auto ii = loop2call.begin(), ie = loop2call.end(); ii != ie; ++ii) {
-		CallGraphNode *cgn1 = ii->second.front()->second;
-		CallGraphNode *cgn2 = ii->second.back()->second;
-		ofs << ii->first << " " << ii->second.front() << " " << cgn1->getFunction()->getName().str() << " " << ii->second.back() << " " << cgn2->getFunction()->getName().str() << "\n";
-	    }*/
-
-	    for (auto ii = func_code_size.begin(), ie = func_code_size.end(); ii != ie; ii++) {
-		ofs << ii->first << " " << ii->second << "\n";
-	    }
-	    ofs << "#\n";
 
 	    long int lp_nest = 0;
 	    for (size_t i = 0; i < exec_trace.size(); i++) {
@@ -190,8 +168,7 @@ namespace {
 		std::string callee_name = callee->getName().str();
 
 		if (callee_name == "main") {
-		    //ofs << callee_name << " " << func_code_size[callee_name] << " 1 ";
-		    ofs << "main 1 ";
+		    trace.push_back({SMMTraceEntry::Call, "main", 0, 1, 0});
 		    continue;
 		}
 
@@ -216,12 +193,14 @@ namespace {
 
 		while (lp_stack.size() > 0) {
 		    ++lp_nest;
-		    ofs << "{" << lp_stack.top() << " " << lp_nest << " ";
+		    // Number the loops in the order they are first entered
+		    unsigned lp_id = loop_ids.insert(std::make_pair(lp_stack.top(), loop_ids.size())).first->second;
+		    trace.push_back({SMMTraceEntry::LoopBegin, "", lp_id, 0, (unsigned)lp_nest});
 		    lp_stack.pop();
 		}
 
 		// The information of the current function being visited
-		ofs << callee_name << " " << (unsigned long)pow(10, (double)lp_nest) << " ";
+		trace.push_back({SMMTraceEntry::Call, callee_name, 0, (uint64_t)pow(10, (double)lp_nest), 0});
 
 		lp = lpi.getLoopFor(call_bb);
 
@@ -231,7 +210,7 @@ namespace {
 		    if (i < exec_trace.size()-1) {
 			CallGraphNode * next_cgn = dyn_cast<CallGraphNode>(exec_trace[i+1]->second);
 			if (call_record == loop2call[lp_header].back() && next_cgn->getFunction() == lp_header->getParent()) {
-			    ofs << "}" << lp_header << " " << lp_nest << " ";
+			    trace.push_back({SMMTraceEntry::LoopEnd, "", loop_ids[lp_header], 0, (unsigned)lp_nest});
 			    --lp_nest;
 			    assert(lp_nest >= 0);
 			}
@@ -241,8 +220,15 @@ namespace {
 
 	    } 
 
-	    ofs << "\n";
-	    ofs.close();
+	    SMMInfo &info = getAnalysis<SMMInfo>();
+	    info.setExecTrace(trace);
+	    // The trace is only meaningful together with the code sizes, so keep the estimated ones if none were given
+	    if (!info.hasFuncSizes()) {
+		std::vector<SMMSizeEntry> sizes;
+		for (auto const &entry : info.getFuncSizes(mod))
+		    sizes.push_back({entry.first->getName().str(), entry.second});
+		info.setFuncSizes(sizes);
+	    }
 	    errs() << "The execution trace is generated!\n";
 
 	    /* Get the execution trace: end */
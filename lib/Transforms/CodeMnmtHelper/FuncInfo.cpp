@@ -34,9 +34,8 @@
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Support/YAMLTraits.h"
 
-#include <fstream>
-
 #include "FuncType.h"
+#include "../SMMCommon/SMMInfo.h"
 
 
 using namespace llvm;
@@ -48,14 +47,14 @@ namespace {
 
     virtual void getAnalysisUsage(AnalysisUsage &AU) const {
         AU.addRequired<CallGraphWrapperPass>();
+        AU.addRequired<SMMInfo>();
     }
 
 
     virtual bool runOnModule (Module &mod) {
-        std::ofstream ofs;
+        std::vector<std::string> funcNames;
         // Call graph
         CallGraph &cg = getAnalysis<CallGraphWrapperPass>().getCallGraph(); 
-        ofs.open ("_func_names", std::ofstream::out | std::ofstream::trunc);
         // Get the function calls within loops
         for (CallGraph::iterator cgi = cg.begin(), cge = cg.end(); cgi != cge; cgi++) {
         //if(CallGraphNode *cgn = dyn_cast<CallGraphNode>(cgi->second)) {
@@ -69,10 +68,10 @@ namespace {
             // Skip code management functions
             if (isCodeManagementFunction(fi))
             continue;
-            ofs << fi->getName().str() << "\n";
+            funcNames.push_back(fi->getName().str());
         //}
         }
-        ofs.close();
+        getAnalysis<SMMInfo>().setUserFunctions(funcNames);
 
         return false;
     }
@@ -51,6 +51,7 @@
 #include <unordered_set>
 
 #include "FuncType.h"
+#include "../SMMCommon/SMMInfo.h"
 
 
 using namespace llvm;
@@ -74,6 +75,8 @@ class CallPathFinder {
 	void concatenate(std::set< PathType > &dest, NodeType &src);
 	std::unordered_set <Function *> referredFuncs;
 	std::unordered_map <Function *, std::set< PathType > > funcCallPaths;
+	// Functions whose call paths are being calculated, i.e. the current call chain
+	std::unordered_set <Function *> activeFuncs;
 
 	Pass *pass;
 	CallGraph &cg;
@@ -141,6 +144,7 @@ PathsType CallPathFinder::getCallPaths(Function *root) {
     }
 
     referredFuncs.insert(root);
+    activeFuncs.insert(root);
 
 
     // Return if this function does not call any user functions
@@ -156,6 +160,9 @@ PathsType CallPathFinder::getCallPaths(Function *root) {
 	    continue;
 	if (isLibraryFunction(calledFunc))
 	    continue;
+	// Skip recursive calls back into the functions being expanded
+	if (activeFuncs.count(calledFunc))
+	    continue;
 	hasUserFunctionCalls = true;
 	break;
     }
@@ -197,6 +204,9 @@ PathsType CallPathFinder::getCallPaths(Function *root) {
 			continue;
 		    if (isLibraryFunction(callee))
 			continue;
+		    // Skip recursive calls back into the functions being expanded
+		    if (activeFuncs.count(callee))
+			continue;
 
 		    // Found an user function call
 		    LoopInfo &lpi = pass->getAnalysis<LoopInfoWrapperPass>(*root).getLoopInfo();
@@ -315,6 +325,7 @@ PathsType CallPathFinder::getCallPaths(Function *root) {
     DEBUG(errs() << root->getName() << " ends\n");
     funcCallPaths[root] = result;
     funcCallPaths[root] = paths;
+    activeFuncs.erase(root);
     return paths;
     return result;
 }
@@ -381,8 +392,6 @@ void CostCalculator::getCallPaths() {
 
 void CostCalculator::calculateCost(unsigned long spmSize) {
 
-    std::ifstream ifs;
-    std::ofstream ofs;
     Region *src, *dest;
 
     getCallPaths();
@@ -406,20 +415,13 @@ void CostCalculator::calculateCost(unsigned long spmSize) {
     DEBUG(errs() << "\n\n");
 
 
-    ifs.open ("_func_size", std::ifstream::in | std::ifstream::binary);
-    while (ifs.good()) {
-	unsigned long size;
-	std::string name;
-	ifs >> name >> size;
-	if (name.empty())
-	    continue;
-	Function *func = mod.getFunction(name);
-	assert(func);
+    std::unordered_map <Function *, unsigned long> sizes = pass->getAnalysis<SMMInfo>().getFuncSizes(mod);
+    for (auto ii = sizes.begin(), ie = sizes.end(); ii != ie; ++ii) {
+	Function *func = ii->first;
 	if (referredFuncs.find(func) == referredFuncs.end())
 	    continue;
-	funcSize[func]  = size;
-	referredFuncs.insert(func);
-	//errs() << func->getName() << " " << size << "\n";
+	funcSize[func]  = ii->second;
+	//errs() << func->getName() << " " << ii->second << "\n";
     }
 
     // Initially place each function in a seperate region
@@ -480,6 +482,8 @@ void CostCalculator::findMerger(Region* &src, Region* &dest) {
 }
 
 unsigned long CostCalculator::calculateMergerCost(Region *r1, Region *r2) {
+    // Each function loaded into a region is copied by DMA
+    const SMMDMAModel &dma = pass->getAnalysis<SMMInfo>().getDMAModel();
     unsigned long maxCost = 0;
     unsigned long cost = 0;
 
@@ -666,7 +670,7 @@ unsigned long CostCalculator::calculateMergerCost(Region *r1, Region *r2) {
 	    }
 	    DEBUG(errs() << func->getName() << " ( " << depth << " )\n");
 	    unsigned long numExec = (unsigned long)pow(100, (double)depth);
-	    cost += funcSize[func] * numExec;
+	    cost += dma.getTransferCost(funcSize[func]) * numExec;
 	}
 	DEBUG(errs() << "\n");
 	DEBUG(errs() << "\nAfter step 5: cost = " << cost << "\n");
@@ -697,18 +701,17 @@ unsigned long CostCalculator::getMaxRegionSize() {
 
 void CostCalculator::dump() {
     unsigned long regionId = 0;
-    std::ofstream ofs;
-    ofs.open ("_mapping", std::ofstream::out | std::ofstream::trunc | std::ofstream::binary);
-    ofs << regions.size() << "\n";
+    std::vector<SMMRegionEntry> mapping;
     for(std::set<Region *>::iterator ii = regions.begin(), ie = regions.end(); ii != ie; ++ii) {
 	Region *region = *ii;
 	std::set<Function *> funcs = region->getFunctions();
 	for (std::set<Function*>::iterator ji = funcs.begin(), je = funcs.end(); ji != je; ++ji) {
 	    Function *func = *ji;
-	    ofs << func->getName().str() << " " << regionId << "\n";
+	    mapping.push_back({func->getName().str(), (unsigned)regionId});
 	}
 	++regionId;
     }
+    pass->getAnalysis<SMMInfo>().setMapping(regions.size(), mapping);
 }
 
 namespace {
@@ -720,6 +723,7 @@ namespace {
 	    AU.addRequired<CallGraphWrapperPass>();
 	    AU.addRequired<DominatorTreeWrapperPass>();
 	    AU.addRequired<LoopInfoWrapperPass>();
+	    AU.addRequired<SMMInfo>();
 	}
 
 	virtual bool runOnModule (Module &mod) {
@@ -0,0 +1,138 @@
+//===- Simulate.cpp - Simulate the DMA traffic of code overlays -----------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file replays the emulated execution trace (smmcmh-exec) against the
+// overlay mapping (smmcmh-overlay or smmmo) the way the code management
+// runtime would: a call to a function that is not resident in its region
+// loads the function, which costs one DMA transfer of the function size. The
+// traffic is reported as statistics, so mappings can be compared without
+// running the program.
+//
+// Loops are simulated for two iterations, and the traffic of the second one
+// is taken as the steady state of the remaining iterations.
+//
+//===----------------------------------------------------------------------===//
+
+#define DEBUG_TYPE "smmcmh-sim"
+
+#include "llvm/Pass.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "../SMMCommon/SMMInfo.h"
+
+// Iterations of each loop, as assumed by the execution trace
+#define LOOP_TRIP_COUNT 10
+
+using namespace llvm;
+
+STATISTIC(NumTransfers, "Number of simulated code DMA transfers");
+STATISTIC(NumBytes, "Number of simulated code DMA bytes");
+STATISTIC(NumCycles, "Number of simulated code DMA cycles");
+
+namespace {
+    struct Simulate : public ModulePass {
+	static char ID; // Pass identification, replacement for typeid
+	Simulate() : ModulePass(ID) {}
+
+	struct Traffic {
+	    uint64_t transfers;
+	    uint64_t bytes;
+	    uint64_t cycles;
+	};
+
+	std::unordered_map <std::string, unsigned> func2reg;
+	std::unordered_map <std::string, uint64_t> funcSize;
+	// The function that is loaded in each region
+	std::unordered_map <unsigned, std::string> resident;
+
+	virtual void getAnalysisUsage(AnalysisUsage &AU) const {
+	    AU.addRequired<SMMInfo>();
+	    AU.setPreservesAll();
+	}
+
+	// Make the specified function resident in its region
+	void load(const std::string &func, const SMMDMAModel &dma, Traffic &traffic) {
+	    auto ri = func2reg.find(func);
+	    // Skip functions that are not managed
+	    if (ri == func2reg.end())
+		return;
+	    if (resident[ri->second] == func)
+		return;
+	    DEBUG(dbgs() << "\tload " << func << " to region " << ri->second << "\n");
+	    resident[ri->second] = func;
+	    traffic.transfers++;
+	    traffic.bytes += funcSize[func];
+	    traffic.cycles += dma.getTransferCost(funcSize[func]);
+	}
+
+	// Simulate the trace entries in [begin, end) once
+	void simulate(const std::vector<SMMTraceEntry> &trace, size_t begin, size_t end, const SMMDMAModel &dma, Traffic &traffic) {
+	    for (size_t i = begin; i < end; i++) {
+		const SMMTraceEntry &entry = trace[i];
+		if (entry.Kind == SMMTraceEntry::Call) {
+		    load(entry.Name, dma, traffic);
+		    continue;
+		}
+		if (entry.Kind != SMMTraceEntry::LoopBegin)
+		    continue;
+		// Find the end of the loop
+		size_t j = i + 1;
+		for (unsigned nest = 1; j < end; j++) {
+		    if (trace[j].Kind == SMMTraceEntry::LoopBegin)
+			nest++;
+		    else if (trace[j].Kind == SMMTraceEntry::LoopEnd && --nest == 0)
+			break;
+		}
+		// The first iteration
+		simulate(trace, i + 1, j, dma, traffic);
+		// The other iterations behave like the second one
+		Traffic steady = {0, 0, 0};
+		simulate(trace, i + 1, j, dma, steady);
+		traffic.transfers += steady.transfers * (LOOP_TRIP_COUNT - 1);
+		traffic.bytes += steady.bytes * (LOOP_TRIP_COUNT - 1);
+		traffic.cycles += steady.cycles * (LOOP_TRIP_COUNT - 1);
+		i = j;
+	    }
+	}
+
+	virtual bool runOnModule (Module &mod) {
+	    SMMInfo &info = getAnalysis<SMMInfo>();
+	    if (!info.hasMapping())
+		report_fatal_error("no overlay mapping available, run smmcmh-overlay or pass -smm-info-input");
+
+	    for (const SMMRegionEntry &entry : info.getMapping())
+		func2reg[entry.Name] = entry.Region;
+	    for (auto const &entry : info.getFuncSizes(mod))
+		funcSize[entry.first->getName().str()] = entry.second;
+
+	    Traffic traffic = {0, 0, 0};
+	    const std::vector<SMMTraceEntry> &trace = info.getExecTrace();
+	    simulate(trace, 0, trace.size(), info.getDMAModel(), traffic);
+
+	    NumTransfers += traffic.transfers;
+	    NumBytes += traffic.bytes;
+	    NumCycles += traffic.cycles;
+	    errs() << "Simulated code traffic: " << traffic.transfers << " transfers, " << traffic.bytes << " bytes, " << traffic.cycles << " DMA cycles\n";
+	    return false;
+	}
+
+    };
+}
+
+char Simulate::ID = 0;
+static RegisterPass<Simulate> X("smmcmh-sim", "Simulate the DMA traffic of code overlays", false, true);
@@ -0,0 +1,221 @@
+//===- SplitCold.cpp - Split cold code off managed functions --------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file moves the cold blocks of user functions, like error paths, into
+// functions of their own that stay in main memory (.user_text). Every function
+// that is loaded into a region is copied as a whole, so code that does not run
+// in steady state only makes each transfer longer and keeps other functions
+// from being co-resident. Cold functions are not managed, so the overlay
+// mapping and code management only see the hot parts. They are marked with the
+// "smm-main-memory" attribute for that, as user-code places managed functions
+// in .user_text too.
+//
+// Blocks are cold if their profile count is zero, or their frequency relative
+// to the entry of their function is below -cold-ratio. Block frequencies come
+// from profile data (branch weights and function entry counts) where
+// available, and from static estimates otherwise. A cold block is split off
+// together with all the blocks it dominates, which are no hotter. Cold code
+// that calls user functions is kept, since managed functions cannot be called
+// from code that is not managed.
+//
+// The pass has to run before smmcmh-funcinfo.
+//
+//===----------------------------------------------------------------------===//
+
+#define DEBUG_TYPE "smmcmh-split-cold"
+
+#include "llvm/Pass.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/BlockFrequencyInfo.h"
+#include "llvm/IR/CallSite.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/CodeExtractor.h"
+
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "FuncType.h"
+#include "../SMMCommon/SMMInfo.h"
+
+using namespace llvm;
+
+STATISTIC(NumColdFunctions, "Number of cold functions split off");
+STATISTIC(NumColdBlocks, "Number of cold blocks moved to main memory");
+
+static cl::opt<double> ColdRatio("cold-ratio", cl::init(0.001),
+	cl::desc("Blocks that run less often than this fraction of the entries to their function are cold"));
+
+static cl::opt<unsigned> MinColdSize("min-cold-size", cl::init(4),
+	cl::desc("Minimum number of instructions worth splitting off"));
+
+namespace {
+    struct SplitCold : public ModulePass {
+	static char ID; // Pass identification, replacement for typeid
+	SplitCold() : ModulePass(ID) {}
+
+	virtual void getAnalysisUsage(AnalysisUsage &AU) const {
+	    AU.addRequired<BlockFrequencyInfoWrapperPass>();
+	    AU.addRequired<SMMInfo>();
+	}
+
+	// Check if the specified blocks call user functions
+	bool callsUserFunction(ArrayRef<BasicBlock *> blocks) {
+	    for (BasicBlock *bb : blocks) {
+		for (Instruction &inst : *bb) {
+		    CallSite cs(&inst);
+		    if (!cs || isa<IntrinsicInst>(inst))
+			continue;
+		    Function *callee = cs.getCalledFunction();
+		    // Calls through pointers may reach user functions as well
+		    if (!callee || !isLibraryFunction(callee))
+			return true;
+		}
+	    }
+	    return false;
+	}
+
+	// Find the cold blocks of the specified function
+	std::unordered_set <BasicBlock *> getColdBlocks(Function &func) {
+	    BlockFrequencyInfo &BFI = getAnalysis<BlockFrequencyInfoWrapperPass>(func).getBFI();
+	    std::unordered_set <BasicBlock *> coldBlocks;
+	    uint64_t entryFreq = BFI.getEntryFreq();
+	    for (BasicBlock &bb : func) {
+		if (&bb == &func.getEntryBlock())
+		    continue;
+		Optional<uint64_t> count = BFI.getBlockProfileCount(&bb);
+		if ((count && *count == 0) || BFI.getBlockFreq(&bb).getFrequency() < ColdRatio * entryFreq)
+		    coldBlocks.insert(&bb);
+	    }
+	    return coldBlocks;
+	}
+
+	// Split the cold code off the specified function, and return the sizes of the parts
+	std::unordered_map <Function *, unsigned long> split(Module &mod, Function &func) {
+	    std::unordered_map <Function *, unsigned long> numInsts;
+	    std::unordered_set <BasicBlock *> coldBlocks = getColdBlocks(func);
+	    if (coldBlocks.empty())
+		return numInsts;
+
+	    bool changed = true;
+	    while (changed) {
+		changed = false;
+		// The dominator tree changes with every split
+		DominatorTree DT(func);
+		for (BasicBlock &bb : func) {
+		    if (!coldBlocks.count(&bb))
+			continue;
+		    // Start from the outermost cold blocks
+		    DomTreeNode *idom = DT.getNode(&bb)->getIDom();
+		    if (idom && coldBlocks.count(idom->getBlock()))
+			continue;
+		    SmallVector <BasicBlock *, 16> blocks;
+		    DT.getDescendants(&bb, blocks);
+		    unsigned long n = 0;
+		    for (BasicBlock *block : blocks)
+			n += block->size();
+		    CodeExtractor extractor(blocks, &DT);
+		    Function *cold = NULL;
+		    if (n >= MinColdSize && !callsUserFunction(blocks) && extractor.isEligible())
+			cold = extractor.extractCodeRegion();
+		    if (!cold) {
+			// Try the cold blocks it dominates instead
+			coldBlocks.erase(&bb);
+			changed = true;
+			continue;
+		    }
+		    // Names become section names, so they must not contain dots
+		    std::string prefix = func.getName().str() + "_cold";
+		    unsigned i = 0;
+		    while (mod.getFunction(prefix + std::to_string(i)))
+			i++;
+		    cold->setName(prefix + std::to_string(i));
+		    // Placed with the code in main memory, and marked so that no pass manages it
+		    cold->setSection(".user_text");
+		    cold->addFnAttr("smm-main-memory");
+		    cold->addFnAttr(Attribute::Cold);
+		    cold->addFnAttr(Attribute::NoInline);
+		    DEBUG(dbgs() << "split " << blocks.size() << " cold blocks (" << n << " instructions) of " << func.getName() << " into " << cold->getName() << "\n");
+		    NumColdFunctions++;
+		    NumColdBlocks += blocks.size();
+		    numInsts[cold] = n;
+		    for (BasicBlock *block : blocks)
+			coldBlocks.erase(block);
+		    changed = true;
+		    break;
+		}
+	    }
+	    if (!numInsts.empty()) {
+		unsigned long n = 0;
+		for (BasicBlock &bb : func)
+		    n += bb.size();
+		numInsts[&func] = n;
+	    }
+	    return numInsts;
+	}
+
+	virtual bool runOnModule (Module &mod) {
+	    SMMInfo &info = getAnalysis<SMMInfo>();
+	    // Measured sizes are split among the parts in proportion to their instructions
+	    std::unordered_map <Function *, unsigned long> funcSize;
+	    if (info.hasFuncSizes())
+		funcSize = info.getFuncSizes(mod);
+
+	    std::vector <Function *> funcs;
+	    for (Function &func : mod) {
+		if (isLibraryFunction(&func) || isCodeManagementFunction(&func))
+		    continue;
+		funcs.push_back(&func);
+	    }
+
+	    bool changed = false;
+	    for (Function *func : funcs) {
+		std::unordered_map <Function *, unsigned long> numInsts = split(mod, *func);
+		if (numInsts.empty())
+		    continue;
+		changed = true;
+		auto fi = funcSize.find(func);
+		if (fi == funcSize.end())
+		    continue;
+		unsigned long total = 0;
+		for (auto const &entry : numInsts)
+		    total += entry.second;
+		unsigned long size = fi->second;
+		for (auto const &entry : numInsts)
+		    funcSize[entry.first] = size * entry.second / total;
+	    }
+
+	    if (changed && info.hasFuncSizes()) {
+		std::vector <SMMSizeEntry> sizes;
+		for (Function &func : mod) {
+		    auto fi = funcSize.find(&func);
+		    if (fi == funcSize.end())
+			continue;
+		    SMMSizeEntry entry;
+		    entry.Name = func.getName();
+		    entry.Size = fi->second;
+		    sizes.push_back(entry);
+		}
+		info.setFuncSizes(sizes);
+	    }
+	    return changed;
+	}
+
+    };
+}
+
+char SplitCold::ID = 0;
+static RegisterPass<SplitCold> X("smmcmh-split-cold", "Split cold code off managed functions");
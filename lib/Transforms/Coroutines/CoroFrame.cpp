@@ -14,7 +14,9 @@
 // GEP + load from the coroutine frame. At the point of the definition we spill
 // the value into the coroutine frame.
 //
-// TODO: pack values tightly using liveness info.
+// Values whose frame storage is never live at the same time share a field,
+// much like StackColoring shares stack slots, and the fields are ordered by
+// alignment to keep padding to a minimum.
 //===----------------------------------------------------------------------===//
 
 #include "CoroInternal.h"
@@ -23,6 +25,7 @@
 #include "llvm/IR/Dominators.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/InstIterator.h"
+#include "llvm/IR/IntrinsicInst.h"
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/MathExtras.h"
 #include "llvm/Support/circular_raw_ostream.h"
@@ -130,6 +133,30 @@ struct SuspendCrossingInfo {
   bool isDefinitionAcrossSuspend(Instruction &I, User *U) const {
     return isDefinitionAcrossSuspend(I.getParent(), U);
   }
+
+  // Returns the set of blocks that lie on a path from one of the From blocks
+  // to one of the To blocks, including those blocks themselves.
+  BitVector blocksBetween(ArrayRef<BasicBlock *> From,
+                          ArrayRef<BasicBlock *> To) const {
+    const size_t N = Mapping.size();
+    BitVector Result(N);
+    for (BasicBlock *BB : To)
+      Result |= Block[Mapping.blockToIndex(BB)].Consumes;
+
+    SmallVector<size_t, 4> FromIndices;
+    for (BasicBlock *BB : From)
+      FromIndices.push_back(Mapping.blockToIndex(BB));
+    for (size_t I = 0; I < N; ++I)
+      if (Result[I] && none_of(FromIndices, [&](size_t FromIndex) {
+            return Block[I].Consumes[FromIndex];
+          }))
+        Result.reset(I);
+    return Result;
+  }
+
+  bool contains(BitVector const &BV, BasicBlock *BB) const {
+    return BV[Mapping.blockToIndex(BB)];
+  }
 };
 } // end anonymous namespace
 
@@ -294,6 +321,77 @@ static void dump(StringRef Title, SpillInfo const &Spills) {
 }
 #endif
 
+// Maps every value that lives in the coroutine frame to its field index.
+using FieldIndexMap = SmallDenseMap<Value *, unsigned, 8>;
+
+// Collects the lifetime markers of an alloca, looking through bitcasts, and
+// the other instructions using it.
+static void collectLifetimeMarkers(AllocaInst *AI,
+                                   SmallVectorImpl<IntrinsicInst *> &Starts,
+                                   SmallVectorImpl<IntrinsicInst *> &Ends,
+                                   SmallVectorImpl<Instruction *> &Others) {
+  SmallVector<Instruction *, 4> Worklist{AI};
+  while (!Worklist.empty()) {
+    Instruction *I = Worklist.pop_back_val();
+    for (User *U : I->users()) {
+      auto *UI = cast<Instruction>(U);
+      if (isa<BitCastInst>(UI)) {
+        Worklist.push_back(UI);
+        continue;
+      }
+      if (auto *II = dyn_cast<IntrinsicInst>(UI)) {
+        if (II->getIntrinsicID() == Intrinsic::lifetime_start) {
+          Starts.push_back(II);
+          continue;
+        }
+        if (II->getIntrinsicID() == Intrinsic::lifetime_end) {
+          Ends.push_back(II);
+          continue;
+        }
+      }
+      Others.push_back(UI);
+    }
+  }
+}
+
+// Returns the blocks in which the frame storage of an alloca must be
+// preserved, i.e. the blocks between its lifetime.start and lifetime.end
+// markers. Allocas without markers, or used outside of them, are live
+// everywhere.
+static BitVector getAllocaLiveBlocks(AllocaInst *AI,
+                                     SuspendCrossingInfo const &Checker) {
+  SmallVector<IntrinsicInst *, 4> Starts, Ends;
+  SmallVector<Instruction *, 8> Others;
+  collectLifetimeMarkers(AI, Starts, Ends, Others);
+
+  SmallVector<BasicBlock *, 4> StartBBs, EndBBs;
+  for (IntrinsicInst *II : Starts)
+    StartBBs.push_back(II->getParent());
+  for (IntrinsicInst *II : Ends)
+    EndBBs.push_back(II->getParent());
+
+  BitVector Live = Checker.blocksBetween(StartBBs, EndBBs);
+  if (Starts.empty() || Ends.empty() || any_of(Others, [&](Instruction *I) {
+        return !Checker.contains(Live, I->getParent());
+      }))
+    Live.set();
+  return Live;
+}
+
+// Returns the blocks in which the frame storage of a spilled value must be
+// preserved, i.e. the blocks between its definition and its reloads.
+static BitVector getSpillLiveBlocks(Value *Def, SpillInfo const &Spills,
+                                    SuspendCrossingInfo const &Checker) {
+  BasicBlock *DefBB = isa<Argument>(Def)
+                          ? &cast<Argument>(Def)->getParent()->getEntryBlock()
+                          : cast<Instruction>(Def)->getParent();
+  SmallVector<BasicBlock *, 4> UseBBs;
+  for (auto const &S : Spills)
+    if (S.def() == Def)
+      UseBBs.push_back(S.userBlock());
+  return Checker.blocksBetween(DefBB, UseBBs);
+}
+
 // Build a struct that will keep state for an active coroutine.
 //   struct f.frame {
 //     ResumeFnTy ResumeFnAddr;
@@ -302,8 +400,14 @@ static void dump(StringRef Title, SpillInfo const &Spills) {
 //     ... promise (if present) ...
 //     ... spills ...
 //   };
+//
+// Spilled values and allocas that are never live in the same block share a
+// field, which is sized by its largest member. The shared fields are ordered
+// by decreasing alignment. The field of every spill is recorded in FieldIndex.
 static StructType *buildFrameType(Function &F, coro::Shape &Shape,
-                                  SpillInfo &Spills) {
+                                  SpillInfo &Spills,
+                                  SuspendCrossingInfo const &Checker,
+                                  FieldIndexMap &FieldIndex) {
   LLVMContext &C = F.getContext();
   SmallString<32> Name(F.getName());
   Name.append(".Frame");
@@ -320,9 +424,10 @@ static StructType *buildFrameType(Function &F, coro::Shape &Shape,
                           : Type::getInt1Ty(C);
   SmallVector<Type *, 8> Types{FnPtrTy, FnPtrTy, PromiseType,
                                Type::getIntNTy(C, IndexBits)};
+  SmallVector<std::pair<Value *, Type *>, 8> Defs;
   Value *CurrentDef = nullptr;
 
-  // Create an entry for every spilled value.
+  // Find the type stored for every spilled value.
   for (auto const &S : Spills) {
     if (CurrentDef == S.def())
       continue;
@@ -338,10 +443,84 @@ static StructType *buildFrameType(Function &F, coro::Shape &Shape,
     else
       Ty = CurrentDef->getType();
 
-    Types.push_back(Ty);
+    Defs.emplace_back(CurrentDef, Ty);
+  }
+
+  // Assign the values to fields, largest first, so that a field is never
+  // smaller or less aligned than a value added to it later.
+  const DataLayout &DL = F.getParent()->getDataLayout();
+  std::stable_sort(Defs.begin(), Defs.end(),
+                   [&](std::pair<Value *, Type *> const &L,
+                       std::pair<Value *, Type *> const &R) {
+                     return DL.getTypeAllocSize(L.second) >
+                            DL.getTypeAllocSize(R.second);
+                   });
+
+  struct FrameField {
+    Type *Ty;
+    BitVector Live;
+    SmallVector<Value *, 2> Members;
+  };
+  SmallVector<FrameField, 8> Fields;
+
+  for (auto const &D : Defs) {
+    auto *AI = dyn_cast<AllocaInst>(D.first);
+    BitVector Live = AI ? getAllocaLiveBlocks(AI, Checker)
+                        : getSpillLiveBlocks(D.first, Spills, Checker);
+    uint64_t Size = DL.getTypeAllocSize(D.second);
+    unsigned Align = DL.getABITypeAlignment(D.second);
+    if (AI)
+      Align = std::max(Align, AI->getAlignment());
+
+    auto It = find_if(Fields, [&](FrameField const &Field) {
+      return !Field.Live.anyCommon(Live) &&
+             DL.getTypeAllocSize(Field.Ty) >= Size &&
+             DL.getABITypeAlignment(Field.Ty) >= Align;
+    });
+    if (It == Fields.end()) {
+      Fields.push_back({D.second, Live, {D.first}});
+      continue;
+    }
+    DEBUG(dbgs() << "sharing frame field of " << It->Members.front()->getName()
+                 << " with " << D.first->getName() << "\n");
+    It->Live |= Live;
+    It->Members.push_back(D.first);
+  }
+
+  // Lay the fields out by decreasing alignment to minimize padding.
+  std::stable_sort(Fields.begin(), Fields.end(),
+                   [&](FrameField const &L, FrameField const &R) {
+                     return DL.getABITypeAlignment(L.Ty) >
+                            DL.getABITypeAlignment(R.Ty);
+                   });
+
+  // Lifetime markers of an alloca would describe storage that is now shared
+  // with other values, so they are dropped.
+  SmallPtrSet<Instruction *, 8> DeadMarkers;
+  for (auto const &Field : Fields) {
+    for (Value *V : Field.Members) {
+      FieldIndex[V] = Types.size();
+      if (Field.Members.size() > 1)
+        if (auto *AI = dyn_cast<AllocaInst>(V)) {
+          SmallVector<IntrinsicInst *, 4> Starts, Ends;
+          SmallVector<Instruction *, 8> Others;
+          collectLifetimeMarkers(AI, Starts, Ends, Others);
+          DeadMarkers.insert(Starts.begin(), Starts.end());
+          DeadMarkers.insert(Ends.begin(), Ends.end());
+        }
+    }
+    Types.push_back(Field.Ty);
   }
   FrameTy->setBody(Types);
 
+  Spills.erase(remove_if(Spills,
+                         [&](Spill const &S) {
+                           return DeadMarkers.count(S.user());
+                         }),
+               Spills.end());
+  for (Instruction *I : DeadMarkers)
+    I->eraseFromParent();
+
   return FrameTy;
 }
 
@@ -367,7 +546,8 @@ static StructType *buildFrameType(Function &F, coro::Shape &Shape,
 //    whatever
 //
 //
-static Instruction *insertSpills(SpillInfo &Spills, coro::Shape &Shape) {
+static Instruction *insertSpills(SpillInfo &Spills, coro::Shape &Shape,
+                                 FieldIndexMap const &FieldIndex) {
   auto *CB = Shape.CoroBegin;
   IRBuilder<> Builder(CB->getNextNode());
   PointerType *FramePtrTy = Shape.FrameTy->getPointerTo();
@@ -380,6 +560,19 @@ static Instruction *insertSpills(SpillInfo &Spills, coro::Shape &Shape) {
   Value *CurrentReload = nullptr;
   unsigned Index = coro::Shape::LastKnownField;
 
+  // Returns the address of field FieldNo as a pointer to the type of V, which
+  // differs from the field type when the field is shared.
+  auto CreateFieldAddr = [&](unsigned FieldNo, Value *V, const Twine &Name) {
+    Type *PtrTy =
+        isa<AllocaInst>(V) ? V->getType() : V->getType()->getPointerTo();
+    auto *G = Builder.CreateConstInBoundsGEP2_32(FrameTy, FramePtr, 0, FieldNo,
+                                                 Name);
+    if (G->getType() == PtrTy)
+      return G;
+    G->setName(Name + Twine(".field"));
+    return Builder.CreateBitCast(G, PtrTy, Name);
+  };
+
   // We need to keep track of any allocas that need "spilling"
   // since they will live in the coroutine frame now, all access to them
   // need to be changed, not just the access across suspend points
@@ -394,9 +587,8 @@ static Instruction *insertSpills(SpillInfo &Spills, coro::Shape &Shape) {
   // frame.
   auto CreateReload = [&](Instruction *InsertBefore) {
     Builder.SetInsertPoint(InsertBefore);
-    auto *G = Builder.CreateConstInBoundsGEP2_32(FrameTy, FramePtr, 0, Index,
-                                                 CurrentValue->getName() +
-                                                     Twine(".reload.addr"));
+    auto *G = CreateFieldAddr(Index, CurrentValue,
+                              CurrentValue->getName() + Twine(".reload.addr"));
     return isa<AllocaInst>(CurrentValue)
                ? G
                : Builder.CreateLoad(G,
@@ -410,7 +602,7 @@ static Instruction *insertSpills(SpillInfo &Spills, coro::Shape &Shape) {
       CurrentBlock = nullptr;
       CurrentReload = nullptr;
 
-      ++Index;
+      Index = FieldIndex.lookup(CurrentValue);
 
       if (auto *AI = dyn_cast<AllocaInst>(CurrentValue)) {
         // Spilled AllocaInst will be replaced with GEP from the coroutine frame
@@ -429,9 +621,9 @@ static Instruction *insertSpills(SpillInfo &Spills, coro::Shape &Shape) {
                 ? FramePtr->getNextNode()
                 : dyn_cast<Instruction>(E.def())->getNextNode());
 
-        auto *G = Builder.CreateConstInBoundsGEP2_32(
-            FrameTy, FramePtr, 0, Index,
-            CurrentValue->getName() + Twine(".spill.addr"));
+        auto *G = CreateFieldAddr(Index, CurrentValue,
+                                  CurrentValue->getName() +
+                                      Twine(".spill.addr"));
         Builder.CreateStore(CurrentValue, G);
       }
     }
@@ -466,8 +658,7 @@ static Instruction *insertSpills(SpillInfo &Spills, coro::Shape &Shape) {
   Builder.SetInsertPoint(&Shape.AllocaSpillBlock->front());
   // If we found any allocas, replace all of their remaining uses with Geps.
   for (auto &P : Allocas) {
-    auto *G =
-        Builder.CreateConstInBoundsGEP2_32(FrameTy, FramePtr, 0, P.second);
+    auto *G = CreateFieldAddr(P.second, P.first, P.first->getName());
     // We are not using ReplaceInstWithInst(P.first, cast<Instruction>(G)) here,
     // as we are changing location of the instruction.
     G->takeName(P.first);
@@ -722,6 +913,7 @@ void coro::buildCoroutineFrame(Function &F, Shape &Shape) {
   std::sort(Spills.begin(), Spills.end());
   DEBUG(dump("Spills", Spills));
   moveSpillUsesAfterCoroBegin(F, Spills, Shape.CoroBegin);
-  Shape.FrameTy = buildFrameType(F, Shape, Spills);
-  Shape.FramePtr = insertSpills(Spills, Shape);
+  FieldIndexMap FieldIndex;
+  Shape.FrameTy = buildFrameType(F, Shape, Spills, Checker, FieldIndex);
+  Shape.FramePtr = insertSpills(Spills, Shape, FieldIndex);
 }
@@ -40,6 +40,12 @@
 // overridable, we move the functionality into a new internal function and
 // leave two overridable thunks to it.
 //
+// With -mergefunc-parameterize, the functions left over are compared once more
+// within their hash buckets, this time allowing a few constant operands (such
+// as immediates or direct callees) to differ. Such a group is folded into one
+// private function taking the differing constants as extra arguments, and each
+// member becomes a thunk passing its own constants.
+//
 //===----------------------------------------------------------------------===//
 //
 // Future work:
@@ -98,6 +104,7 @@
 #include "llvm/IR/DataLayout.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/ValueHandle.h"
@@ -108,6 +115,7 @@
 #include "llvm/Support/ErrorHandling.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Transforms/IPO.h"
+#include "llvm/Transforms/Utils/Cloning.h"
 #include "llvm/Transforms/Utils/FunctionComparator.h"
 #include <vector>
 
@@ -119,6 +127,8 @@ STATISTIC(NumFunctionsMerged, "Number of functions merged");
 STATISTIC(NumThunksWritten, "Number of thunks generated");
 STATISTIC(NumAliasesWritten, "Number of aliases generated");
 STATISTIC(NumDoubleWeak, "Number of new functions created");
+STATISTIC(NumParameterizedMerged,
+          "Number of functions merged by parameterizing constants");
 
 static cl::opt<unsigned> NumFunctionsForSanityCheck(
     "mergefunc-sanity",
@@ -127,6 +137,18 @@ static cl::opt<unsigned> NumFunctionsForSanityCheck(
              "'0' disables this check. Works only with '-debug' key."),
     cl::init(0), cl::Hidden);
 
+static cl::opt<bool> MergeParameterized(
+    "mergefunc-parameterize",
+    cl::desc("Also merge functions that differ only in a few constant "
+             "operands, passing the constants as extra arguments"),
+    cl::init(false), cl::Hidden);
+
+static cl::opt<unsigned> MaxMergeParams(
+    "mergefunc-max-params",
+    cl::desc("Maximum number of arguments added to a function merged by "
+             "parameterizing its constants"),
+    cl::init(3), cl::Hidden);
+
 namespace {
 
 class FunctionNode {
@@ -148,6 +170,45 @@ public:
   void release() { F = nullptr; }
 };
 
+/// A constant operand of the left function of a comparison which differs from
+/// the corresponding operand of the right function.
+struct OperandDiff {
+  const Instruction *Inst;
+  unsigned OpIdx;
+  Constant *Other;
+};
+
+/// An operand of the leader of a group of functions at which some members
+/// differ, with the constant every function of the group has there (the
+/// leader first) and the extra argument that replaces it.
+struct ParamSite {
+  const Instruction *Inst;
+  unsigned OpIdx;
+  SmallVector<Constant *, 4> Consts;
+  unsigned ParamNo;
+};
+
+/// ParameterizingComparator compares two functions like FunctionComparator,
+/// except that constant operands which could as well be passed in as arguments
+/// are allowed to differ. Those are collected instead of ending the comparison.
+class ParameterizingComparator : public FunctionComparator {
+public:
+  ParameterizingComparator(const Function *F1, const Function *F2,
+                           GlobalNumberState *GN)
+      : FunctionComparator(F1, F2, GN), NumDistinct(0) {}
+
+  /// Returns true if the functions are equal apart from the operands added to
+  /// Diffs, and those hold no more than Limit distinct pairs of constants.
+  bool compareWithDiffs(SmallVectorImpl<OperandDiff> &Diffs, unsigned Limit);
+
+private:
+  bool cmpBasicBlocksWithDiffs(const BasicBlock *BBL, const BasicBlock *BBR,
+                               SmallVectorImpl<OperandDiff> &Diffs,
+                               unsigned Limit);
+
+  unsigned NumDistinct;
+};
+
 /// MergeFunctions finds functions which will generate identical machine code,
 /// by considering all pointer types to be equivalent. Once identified,
 /// MergeFunctions will fold them by replacing a call to one to a call to a
@@ -215,9 +276,11 @@ private:
   /// Replace G with a thunk or an alias to F. Deletes G.
   void writeThunkOrAlias(Function *F, Function *G);
 
-  /// Replace G with a simple tail call to bitcast(F). Also replace direct uses
-  /// of G with bitcast(F). Deletes G.
-  void writeThunk(Function *F, Function *G);
+  /// Replace G with a simple tail call to bitcast(F), passing ExtraArgs after
+  /// G's own arguments. Without extra arguments, also replace direct uses of G
+  /// with bitcast(F). Deletes G.
+  void writeThunk(Function *F, Function *G,
+                  ArrayRef<Constant *> ExtraArgs = None);
 
   /// Replace G with an alias to F. Deletes G.
   void writeAlias(Function *F, Function *G);
@@ -225,6 +288,16 @@ private:
   /// Replace function F with function G in the function tree.
   void replaceFunctionInTree(const FunctionNode &FN, Function *G);
 
+  /// Merge the functions that differ from one another only in a few constant
+  /// operands. Runs after all identical functions have been merged.
+  bool mergeParameterized(Module &M);
+
+  /// Fold F and the Members, which differ from F only at the given sites, into
+  /// a new function taking the constants at the sites as extra arguments.
+  /// Returns false if that would not make the module smaller.
+  bool mergeGroup(Function *F, ArrayRef<Function *> Members,
+                  ArrayRef<ParamSite> Sites, unsigned NumParams);
+
   /// The set of all distinct functions. Use the insert() and remove() methods
   /// to modify it. The map allows efficient lookup and deferring of Functions.
   FnTreeType FnTree;
@@ -375,11 +448,309 @@ bool MergeFunctions::runOnModule(Module &M) {
   } while (!Deferred.empty());
 
   FnTree.clear();
+  FNodesInTree.clear();
+
+  if (MergeParameterized)
+    Changed |= mergeParameterized(M);
+
   GlobalNumbers.clear();
 
   return Changed;
 }
 
+// Returns true if operand OpIdx of I may be replaced by a function argument
+// without changing what I means. Operands that must stay constant, such as
+// GEP struct indices, switch cases or intrinsic immediates, are excluded.
+static bool isParameterizableOperand(const Instruction *I, unsigned OpIdx) {
+  if (isa<BinaryOperator>(I) || isa<CmpInst>(I) || isa<SelectInst>(I) ||
+      isa<CastInst>(I) || isa<LoadInst>(I) || isa<StoreInst>(I) ||
+      isa<ReturnInst>(I) || isa<PHINode>(I))
+    return true;
+  if (const auto *CI = dyn_cast<CallInst>(I)) {
+    if (isa<IntrinsicInst>(CI) || CI->isInlineAsm() ||
+        CI->hasOperandBundles())
+      return false;
+    // The arguments and the callee.
+    return OpIdx <= CI->getNumArgOperands();
+  }
+  return false;
+}
+
+static bool isParameterizableConstant(const Constant *C) {
+  if (isa<BlockAddress>(C) || C->getType()->isTokenTy())
+    return false;
+  // Intrinsics can't be called indirectly.
+  if (const auto *F = dyn_cast<Function>(C->stripPointerCasts()))
+    return !F->isIntrinsic();
+  return true;
+}
+
+// Returns true if F may be a member of a parameterized group. The merged body
+// is a copy of the leader, so a function referring to itself would end up
+// referring to the leader, and musttail calls need the original prototype.
+static bool isParameterizableFunction(const Function &F) {
+  if (F.isDeclaration() || F.hasAvailableExternallyLinkage() ||
+      F.isInterposable() || F.isVarArg() ||
+      F.hasFnAttribute(Attribute::Naked))
+    return false;
+  for (const BasicBlock &BB : F)
+    for (const Instruction &I : BB) {
+      if (const auto *CI = dyn_cast<CallInst>(&I))
+        if (CI->isMustTailCall())
+          return false;
+      for (const Value *Op : I.operands())
+        if (Op->stripPointerCasts() == &F)
+          return false;
+    }
+  return true;
+}
+
+bool ParameterizingComparator::cmpBasicBlocksWithDiffs(
+    const BasicBlock *BBL, const BasicBlock *BBR,
+    SmallVectorImpl<OperandDiff> &Diffs, unsigned Limit) {
+  BasicBlock::const_iterator InstL = BBL->begin(), InstLE = BBL->end();
+  BasicBlock::const_iterator InstR = BBR->begin(), InstRE = BBR->end();
+
+  for (; InstL != InstLE && InstR != InstRE; ++InstL, ++InstR) {
+    bool needToCmpOperands = true;
+    if (cmpOperations(&*InstL, &*InstR, needToCmpOperands))
+      return false;
+    if (!needToCmpOperands)
+      continue;
+    assert(InstL->getNumOperands() == InstR->getNumOperands());
+
+    for (unsigned i = 0, e = InstL->getNumOperands(); i != e; ++i) {
+      Value *OpL = InstL->getOperand(i);
+      Value *OpR = InstR->getOperand(i);
+      if (!cmpValues(OpL, OpR))
+        continue;
+
+      auto *CL = dyn_cast<Constant>(OpL);
+      auto *CR = dyn_cast<Constant>(OpR);
+      if (!CL || !CR || CL->getType() != CR->getType() ||
+          !isParameterizableOperand(&*InstL, i) ||
+          !isParameterizableConstant(CL) || !isParameterizableConstant(CR))
+        return false;
+
+      // Operands with the same pair of constants will share an argument.
+      bool Seen = any_of(Diffs, [&](const OperandDiff &D) {
+        return D.Inst->getOperand(D.OpIdx) == CL && D.Other == CR;
+      });
+      if (!Seen && ++NumDistinct > Limit)
+        return false;
+      Diffs.push_back({&*InstL, i, CR});
+    }
+  }
+  return InstL == InstLE && InstR == InstRE;
+}
+
+bool ParameterizingComparator::compareWithDiffs(
+    SmallVectorImpl<OperandDiff> &Diffs, unsigned Limit) {
+  beginCompare();
+  NumDistinct = 0;
+
+  if (compareSignature())
+    return false;
+
+  // Walk the CFG in the same order as FunctionComparator::compare.
+  SmallVector<const BasicBlock *, 8> FnLBBs, FnRBBs;
+  SmallPtrSet<const BasicBlock *, 32> VisitedBBs;
+
+  FnLBBs.push_back(&FnL->getEntryBlock());
+  FnRBBs.push_back(&FnR->getEntryBlock());
+
+  VisitedBBs.insert(FnLBBs[0]);
+  while (!FnLBBs.empty()) {
+    const BasicBlock *BBL = FnLBBs.pop_back_val();
+    const BasicBlock *BBR = FnRBBs.pop_back_val();
+
+    if (cmpValues(BBL, BBR))
+      return false;
+
+    if (!cmpBasicBlocksWithDiffs(BBL, BBR, Diffs, Limit))
+      return false;
+
+    const TerminatorInst *TermL = BBL->getTerminator();
+    const TerminatorInst *TermR = BBR->getTerminator();
+
+    assert(TermL->getNumSuccessors() == TermR->getNumSuccessors());
+    for (unsigned i = 0, e = TermL->getNumSuccessors(); i != e; ++i) {
+      if (!VisitedBBs.insert(TermL->getSuccessor(i)).second)
+        continue;
+
+      FnLBBs.push_back(TermL->getSuccessor(i));
+      FnRBBs.push_back(TermR->getSuccessor(i));
+    }
+  }
+  return true;
+}
+
+// Collect the sites at which the members differ from the leader, given the
+// differences of each member, and assign the extra arguments to them. Returns
+// the number of extra arguments needed.
+static unsigned collectSites(ArrayRef<SmallVector<OperandDiff, 4>> MemberDiffs,
+                             std::vector<ParamSite> &Sites) {
+  Sites.clear();
+  for (unsigned M = 0, E = MemberDiffs.size(); M != E; ++M) {
+    for (const OperandDiff &D : MemberDiffs[M]) {
+      auto It = find_if(Sites, [&](const ParamSite &S) {
+        return S.Inst == D.Inst && S.OpIdx == D.OpIdx;
+      });
+      if (It == Sites.end()) {
+        auto *C = cast<Constant>(D.Inst->getOperand(D.OpIdx));
+        Sites.push_back({D.Inst, D.OpIdx,
+                         SmallVector<Constant *, 4>(MemberDiffs.size() + 1, C),
+                         0});
+        It = std::prev(Sites.end());
+      }
+      It->Consts[M + 1] = D.Other;
+    }
+  }
+
+  // Sites that see the same constants in every function share an argument.
+  unsigned NumParams = 0;
+  for (auto I = Sites.begin(), E = Sites.end(); I != E; ++I) {
+    auto Same = std::find_if(Sites.begin(), I, [&](const ParamSite &S) {
+      return S.Consts == I->Consts;
+    });
+    I->ParamNo = Same == I ? NumParams++ : Same->ParamNo;
+  }
+  return NumParams;
+}
+
+bool MergeFunctions::mergeParameterized(Module &M) {
+  // Functions differing only in operands have the same hash, so candidates
+  // are only compared against the other functions in their bucket.
+  std::vector<std::pair<FunctionComparator::FunctionHash, Function *>>
+    HashedFuncs;
+  for (Function &Func : M) {
+    if (isParameterizableFunction(Func))
+      HashedFuncs.push_back({FunctionComparator::functionHash(Func), &Func});
+  }
+
+  std::stable_sort(
+      HashedFuncs.begin(), HashedFuncs.end(),
+      [](const std::pair<FunctionComparator::FunctionHash, Function *> &a,
+         const std::pair<FunctionComparator::FunctionHash, Function *> &b) {
+        return a.first < b.first;
+      });
+
+  bool Changed = false;
+  for (auto I = HashedFuncs.begin(), IE = HashedFuncs.end(); I != IE;) {
+    std::vector<Function *> Bucket;
+    FunctionComparator::FunctionHash Hash = I->first;
+    for (; I != IE && I->first == Hash; ++I)
+      Bucket.push_back(I->second);
+
+    // The first function of the bucket leads a group of all the functions it
+    // can be merged with. The rest are tried against each other next.
+    while (Bucket.size() > 1) {
+      Function *F = Bucket.front();
+      std::vector<Function *> Rest;
+      SmallVector<Function *, 4> Members;
+      SmallVector<SmallVector<OperandDiff, 4>, 4> MemberDiffs;
+      std::vector<ParamSite> Sites;
+      unsigned NumParams = 0;
+
+      for (Function *G : makeArrayRef(Bucket).slice(1)) {
+        SmallVector<OperandDiff, 4> Diffs;
+        ParameterizingComparator PCmp(F, G, &GlobalNumbers);
+        if (PCmp.compareWithDiffs(Diffs, MaxMergeParams)) {
+          // The group as a whole must not need too many arguments either.
+          MemberDiffs.push_back(std::move(Diffs));
+          unsigned N = collectSites(MemberDiffs, Sites);
+          if (N <= MaxMergeParams) {
+            Members.push_back(G);
+            NumParams = N;
+            continue;
+          }
+          MemberDiffs.pop_back();
+        }
+        Rest.push_back(G);
+      }
+
+      if (!Members.empty()) {
+        collectSites(MemberDiffs, Sites);
+        Changed |= mergeGroup(F, Members, Sites, NumParams);
+      }
+      Bucket = std::move(Rest);
+    }
+  }
+  return Changed;
+}
+
+bool MergeFunctions::mergeGroup(Function *F, ArrayRef<Function *> Members,
+                                ArrayRef<ParamSite> Sites, unsigned NumParams) {
+  // The thunks are written one after another, so none of the constants passed
+  // may be a function of the group that is deleted in the meantime.
+  for (const ParamSite &S : Sites)
+    for (Constant *C : S.Consts) {
+      Value *V = C->stripPointerCasts();
+      if (V == F || is_contained(Members, V))
+        return false;
+    }
+
+  // Every function of the group becomes a thunk about as large as the call
+  // passing its arguments and constants, while only one body remains.
+  unsigned Size = 0;
+  for (BasicBlock &BB : *F)
+    Size += BB.size();
+  unsigned ThunkSize = F->arg_size() + NumParams + 2;
+  if (Members.size() * Size <= (Members.size() + 1) * ThunkSize) {
+    DEBUG(dbgs() << F->getName() << " is too small to bother merging\n");
+    return false;
+  }
+
+  FunctionType *FTy = F->getFunctionType();
+  SmallVector<Type *, 8> ParamTys(FTy->param_begin(), FTy->param_end());
+  for (const ParamSite &S : Sites)
+    if (S.ParamNo == ParamTys.size() - FTy->getNumParams())
+      ParamTys.push_back(S.Consts[0]->getType());
+
+  Function *Merged = Function::Create(
+      FunctionType::get(FTy->getReturnType(), ParamTys, false),
+      GlobalValue::PrivateLinkage, F->getName() + ".merged", F->getParent());
+
+  ValueToValueMapTy VMap;
+  Function::arg_iterator NewArg = Merged->arg_begin();
+  for (Argument &A : F->args()) {
+    NewArg->setName(A.getName());
+    VMap[&A] = &*NewArg++;
+  }
+  SmallVector<Argument *, 4> ExtraArgs;
+  for (; NewArg != Merged->arg_end(); ++NewArg)
+    ExtraArgs.push_back(&*NewArg);
+
+  SmallVector<ReturnInst *, 4> Returns;
+  CloneFunctionInto(Merged, F, VMap, /*ModuleLevelChanges=*/false, Returns);
+  Merged->setLinkage(GlobalValue::PrivateLinkage);
+  Merged->setVisibility(GlobalValue::DefaultVisibility);
+  Merged->setDLLStorageClass(GlobalValue::DefaultStorageClass);
+  Merged->setUnnamedAddr(GlobalValue::UnnamedAddr::Global);
+
+  for (const ParamSite &S : Sites)
+    cast<Instruction>(VMap[S.Inst])->setOperand(S.OpIdx,
+                                                ExtraArgs[S.ParamNo]);
+
+  DEBUG(dbgs() << "mergeGroup: " << Merged->getName() << " with "
+               << NumParams << " extra arguments\n");
+
+  unsigned MaxAlignment = F->getAlignment();
+  for (Function *G : Members)
+    MaxAlignment = std::max(MaxAlignment, G->getAlignment());
+  Merged->setAlignment(MaxAlignment);
+
+  for (unsigned I = 0, E = Members.size(); I <= E; ++I) {
+    SmallVector<Constant *, 4> Consts(NumParams);
+    for (const ParamSite &S : Sites)
+      Consts[S.ParamNo] = S.Consts[I];
+    writeThunk(Merged, I ? Members[I - 1] : F, Consts);
+  }
+
+  NumParameterizedMerged += Members.size() + 1;
+  return true;
+}
+
 // Replace direct callers of Old with New.
 void MergeFunctions::replaceDirectCallers(Function *Old, Function *New) {
   Constant *BitcastNew = ConstantExpr::getBitCast(New, Old->getType());
@@ -461,10 +832,12 @@ static Value *createCast(IRBuilder<> &Builder, Value *V, Type *DestTy) {
     return Builder.CreateBitCast(V, DestTy);
 }
 
-// Replace G with a simple tail call to bitcast(F). Also replace direct uses
-// of G with bitcast(F). Deletes G.
-void MergeFunctions::writeThunk(Function *F, Function *G) {
-  if (!G->isInterposable()) {
+// Replace G with a simple tail call to bitcast(F), appending ExtraArgs to the
+// arguments. Without extra arguments, also replace direct uses of G with
+// bitcast(F). Deletes G.
+void MergeFunctions::writeThunk(Function *F, Function *G,
+                                ArrayRef<Constant *> ExtraArgs) {
+  if (ExtraArgs.empty() && !G->isInterposable()) {
     // Redirect direct callers of G to F.
     replaceDirectCallers(G, F);
   }
@@ -488,6 +861,7 @@ void MergeFunctions::writeThunk(Function *F, Function *G) {
     Args.push_back(createCast(Builder, &AI, FFTy->getParamType(i)));
     ++i;
   }
+  Args.append(ExtraArgs.begin(), ExtraArgs.end());
 
   CallInst *CI = Builder.CreateCall(F, Args);
   CI->setTailCall();
@@ -8,20 +8,29 @@
 //===----------------------------------------------------------------------===//
 //
 // This pass performs partial inlining, typically by inlining an if statement
-// that surrounds the body of the function.
+// that surrounds the body of the function.  Functions without such a guard
+// have their cold regions, found with block frequencies and profile data,
+// outlined into functions that are shared by the copies of the hot remainder
+// inlined at hot call sites.
 //
 //===----------------------------------------------------------------------===//
 
 #include "llvm/Transforms/IPO/PartialInlining.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/PostOrderIterator.h"
 #include "llvm/ADT/Statistic.h"
 #include "llvm/Analysis/BlockFrequencyInfo.h"
 #include "llvm/Analysis/BranchProbabilityInfo.h"
 #include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ProfileSummaryInfo.h"
 #include "llvm/IR/CFG.h"
+#include "llvm/IR/CallSite.h"
 #include "llvm/IR/Dominators.h"
 #include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
 #include "llvm/IR/Module.h"
 #include "llvm/Pass.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Transforms/IPO.h"
 #include "llvm/Transforms/Utils/Cloning.h"
 #include "llvm/Transforms/Utils/CodeExtractor.h"
@@ -30,15 +39,47 @@ using namespace llvm;
 #define DEBUG_TYPE "partialinlining"
 
 STATISTIC(NumPartialInlined, "Number of functions partially inlined");
+STATISTIC(NumColdRegionsOutlined, "Number of cold regions outlined");
+
+static cl::opt<unsigned> ColdRegionFreqPercent(
+    "partial-inlining-cold-percent", cl::init(1), cl::Hidden,
+    cl::desc("A block executed at most this percentage of the times the "
+             "function is entered starts a cold region"));
+
+static cl::opt<unsigned> MaxRemainderSize(
+    "partial-inlining-max-size", cl::init(50), cl::Hidden,
+    cl::desc("Maximum number of instructions left in a function after its "
+             "cold regions are outlined for it to be partially inlined"));
 
 namespace {
+/// Block frequencies of a function, computed from scratch as the function is
+/// changed under us.
+struct FunctionFrequencies {
+  DominatorTree DT;
+  LoopInfo LI;
+  BranchProbabilityInfo BPI;
+  BlockFrequencyInfo BFI;
+
+  explicit FunctionFrequencies(Function &F)
+      : DT(F), LI(DT), BPI(F, LI), BFI(F, BPI, LI) {}
+};
+
 struct PartialInlinerImpl {
-  PartialInlinerImpl(InlineFunctionInfo IFI) : IFI(IFI) {}
+  PartialInlinerImpl(InlineFunctionInfo IFI, ProfileSummaryInfo *PSI)
+      : IFI(IFI), PSI(PSI) {}
   bool run(Module &M);
   Function *unswitchFunction(Function *F);
+  bool outlineColdRegions(Function *F);
 
 private:
+  bool isColdBlock(const BasicBlock *BB, const FunctionFrequencies &FF) const;
+  bool isHotCallSite(CallSite CS, const FunctionFrequencies &CallerFF) const;
+  unsigned getRegionCost(ArrayRef<BasicBlock *> Region,
+                         const FunctionFrequencies &FF) const;
+
   InlineFunctionInfo IFI;
+  ProfileSummaryInfo *PSI;
+  bool HasProfileSummary = false;
 };
 struct PartialInlinerLegacyPass : public ModulePass {
   static char ID; // Pass identification, replacement for typeid
@@ -48,6 +89,7 @@ struct PartialInlinerLegacyPass : public ModulePass {
 
   void getAnalysisUsage(AnalysisUsage &AU) const override {
     AU.addRequired<AssumptionCacheTracker>();
+    AU.addRequired<ProfileSummaryInfoWrapperPass>();
   }
   bool runOnModule(Module &M) override {
     if (skipModule(M))
@@ -59,7 +101,9 @@ struct PartialInlinerLegacyPass : public ModulePass {
       return ACT->getAssumptionCache(F);
     };
     InlineFunctionInfo IFI(nullptr, &GetAssumptionCache);
-    return PartialInlinerImpl(IFI).run(M);
+    ProfileSummaryInfo *PSI =
+        getAnalysis<ProfileSummaryInfoWrapperPass>().getPSI();
+    return PartialInlinerImpl(IFI, PSI).run(M);
   }
 };
 }
@@ -165,7 +209,176 @@ Function *PartialInlinerImpl::unswitchFunction(Function *F) {
   return ExtractedFunction;
 }
 
+/// Return true if \p BB runs rarely enough, compared to its function's entry,
+/// to be moved out of line.
+bool PartialInlinerImpl::isColdBlock(const BasicBlock *BB,
+                                     const FunctionFrequencies &FF) const {
+  if (HasProfileSummary)
+    if (Optional<uint64_t> Count = FF.BFI.getBlockProfileCount(BB))
+      if (PSI->isColdCount(*Count))
+        return true;
+  uint64_t EntryFreq =
+      FF.BFI.getBlockFreq(&BB->getParent()->getEntryBlock()).getFrequency();
+  uint64_t Freq = FF.BFI.getBlockFreq(BB).getFrequency();
+  return Freq * 100 <= EntryFreq * ColdRegionFreqPercent;
+}
+
+/// Return true if the remainder of the callee is worth inlining at \p CS,
+/// given the frequencies \p CallerFF of its caller.  With a profile only hot
+/// call sites qualify; without one, any call site that is not itself cold in
+/// its caller.
+bool PartialInlinerImpl::isHotCallSite(
+    CallSite CS, const FunctionFrequencies &CallerFF) const {
+  BasicBlock *CallBB = CS.getInstruction()->getParent();
+  if (HasProfileSummary && CS.getCaller()->getEntryCount()) {
+    Optional<uint64_t> Count = CallerFF.BFI.getBlockProfileCount(CallBB);
+    return Count && PSI->isHotCount(*Count);
+  }
+  return CallBB == &CS.getCaller()->getEntryBlock() ||
+         !isColdBlock(CallBB, CallerFF);
+}
+
+/// Return the number of instructions outlining \p Region removes from its
+/// function, net of the call and the arguments that replace it.
+unsigned
+PartialInlinerImpl::getRegionCost(ArrayRef<BasicBlock *> Region,
+                                  const FunctionFrequencies &FF) const {
+  unsigned Size = 0;
+  for (BasicBlock *BB : Region)
+    for (Instruction &I : *BB)
+      if (!isa<DbgInfoIntrinsic>(I))
+        ++Size;
+
+  SetVector<Value *> Inputs, Outputs;
+  CodeExtractor(Region, const_cast<DominatorTree *>(&FF.DT))
+      .findInputsOutputs(Inputs, Outputs);
+  unsigned CallSize = 1 + Inputs.size() + 2 * Outputs.size();
+  return Size > CallSize ? Size - CallSize : 0;
+}
+
+/// Outline the cold regions of \p F, which are the blocks dominated by a cold
+/// block that never return, into one function each, and inline what is left
+/// of F at its hot call sites.  All inlined copies call the same outlined
+/// functions.  Return true if F was partially inlined anywhere.
+bool PartialInlinerImpl::outlineColdRegions(Function *F) {
+  if (F->hasFnAttribute(Attribute::NoInline) ||
+      F->hasFnAttribute(Attribute::OptimizeNone) || F->isVarArg())
+    return false;
+
+  // Find the cold regions, outermost first, and what outlining them saves.
+  FunctionFrequencies FF(*F);
+  SmallPtrSet<BasicBlock *, 16> InRegion;
+  std::vector<SmallVector<BasicBlock *, 8>> Regions;
+  unsigned Saved = 0;
+  ReversePostOrderTraversal<Function *> RPOT(F);
+  for (BasicBlock *BB : RPOT) {
+    if (BB == &F->getEntryBlock() || InRegion.count(BB) ||
+        !isColdBlock(BB, FF))
+      continue;
+
+    SmallVector<BasicBlock *, 8> Region;
+    FF.DT.getDescendants(BB, Region);
+    bool Valid = all_of(Region, [](BasicBlock *RegionBB) {
+      return !isa<ReturnInst>(RegionBB->getTerminator()) &&
+             CodeExtractor::isBlockValidForExtraction(*RegionBB);
+    });
+    if (!Valid)
+      continue;
+
+    // The region entry must come first for the CodeExtractor.
+    std::swap(*find(Region, BB), Region.front());
+    unsigned Cost = getRegionCost(Region, FF);
+    if (!Cost)
+      continue;
+
+    InRegion.insert(Region.begin(), Region.end());
+    Regions.push_back(std::move(Region));
+    Saved += Cost;
+  }
+  if (Regions.empty())
+    return false;
+
+  unsigned Size = 0;
+  for (BasicBlock &BB : *F)
+    for (Instruction &I : BB)
+      if (!isa<DbgInfoIntrinsic>(I))
+        ++Size;
+  if (Size - Saved > MaxRemainderSize)
+    return false;
+
+  // Only now that F is known to be worth it are its callers looked at.  They
+  // do not change until all call sites are classified, so the frequencies of
+  // each caller are computed once.
+  DenseMap<Function *, std::unique_ptr<FunctionFrequencies>> CallerFFs;
+  SmallVector<CallSite, 8> HotCallSites;
+  for (User *U : F->users()) {
+    CallSite CS(U);
+    if (!CS || CS.getCalledFunction() != F)
+      continue;
+    std::unique_ptr<FunctionFrequencies> &CallerFF = CallerFFs[CS.getCaller()];
+    if (!CallerFF)
+      CallerFF = make_unique<FunctionFrequencies>(*CS.getCaller());
+    if (isHotCallSite(CS, *CallerFF))
+      HotCallSites.push_back(CS);
+  }
+  CallerFFs.clear();
+  if (HotCallSites.empty())
+    return false;
+
+  DEBUG(dbgs() << "Partially inlining " << F->getName() << " at "
+               << HotCallSites.size() << " call sites, outlining "
+               << Regions.size() << " cold regions\n");
+
+  // Outline the regions from a copy of F, which is then inlined in place of
+  // F at the hot call sites.
+  ValueToValueMapTy VMap;
+  Function *DuplicateFunction = CloneFunction(F, VMap);
+  DuplicateFunction->setLinkage(GlobalValue::InternalLinkage);
+  SmallVector<Function *, 4> ExtractedFunctions;
+  for (auto &Region : Regions) {
+    SmallVector<BasicBlock *, 8> ToExtract;
+    for (BasicBlock *BB : Region)
+      ToExtract.push_back(cast<BasicBlock>(VMap[BB]));
+
+    FunctionFrequencies DupFF(*DuplicateFunction);
+    Function *ExtractedFunction =
+        CodeExtractor(ToExtract, &DupFF.DT, /*AggregateArgs*/ false,
+                      &DupFF.BFI, &DupFF.BPI)
+            .extractCodeRegion();
+    if (!ExtractedFunction)
+      continue;
+
+    // Keep the cold code out of line, so every inlined copy shares it.
+    ExtractedFunction->addFnAttr(Attribute::Cold);
+    ExtractedFunction->addFnAttr(Attribute::NoInline);
+    ExtractedFunctions.push_back(ExtractedFunction);
+  }
+
+  bool Inlined = false;
+  for (CallSite CS : HotCallSites) {
+    CS.setCalledFunction(DuplicateFunction);
+    if (InlineFunction(CS, IFI))
+      Inlined = true;
+  }
+
+  // Call sites that could not be inlined go back to the original function.
+  DuplicateFunction->replaceAllUsesWith(F);
+  DuplicateFunction->eraseFromParent();
+
+  if (!Inlined) {
+    for (Function *ExtractedFunction : ExtractedFunctions)
+      ExtractedFunction->eraseFromParent();
+    return false;
+  }
+
+  NumColdRegionsOutlined += ExtractedFunctions.size();
+  ++NumPartialInlined;
+  return true;
+}
+
 bool PartialInlinerImpl::run(Module &M) {
+  HasProfileSummary = M.getProfileSummary() != nullptr;
+
   std::vector<Function *> Worklist;
   Worklist.reserve(M.size());
   for (Function &F : M)
@@ -193,7 +406,8 @@ bool PartialInlinerImpl::run(Module &M) {
     if (Function *NewFunc = unswitchFunction(CurrFunc)) {
       Worklist.push_back(NewFunc);
       Changed = true;
-    }
+    } else if (outlineColdRegions(CurrFunc))
+      Changed = true;
   }
 
   return Changed;
@@ -203,6 +417,7 @@ char PartialInlinerLegacyPass::ID = 0;
 INITIALIZE_PASS_BEGIN(PartialInlinerLegacyPass, "partial-inliner",
                       "Partial Inliner", false, false)
 INITIALIZE_PASS_DEPENDENCY(AssumptionCacheTracker)
+INITIALIZE_PASS_DEPENDENCY(ProfileSummaryInfoWrapperPass)
 INITIALIZE_PASS_END(PartialInlinerLegacyPass, "partial-inliner",
                     "Partial Inliner", false, false)
 
@@ -218,7 +433,8 @@ PreservedAnalyses PartialInlinerPass::run(Module &M,
     return FAM.getResult<AssumptionAnalysis>(F);
   };
   InlineFunctionInfo IFI(nullptr, &GetAssumptionCache);
-  if (PartialInlinerImpl(IFI).run(M))
+  ProfileSummaryInfo *PSI = &AM.getResult<ProfileSummaryAnalysis>(M);
+  if (PartialInlinerImpl(IFI, PSI).run(M))
     return PreservedAnalyses::none();
   return PreservedAnalyses::all();
 }
@@ -101,6 +101,18 @@ static cl::opt<bool> EnableLoopInterchange(
     "enable-loopinterchange", cl::init(false), cl::Hidden,
     cl::desc("Enable the new, experimental LoopInterchange Pass"));
 
+static cl::opt<bool> EnableLoopFusion(
+    "enable-loop-fusion", cl::init(false), cl::Hidden,
+    cl::desc("Enable the experimental LoopFusion Pass"));
+
+static cl::opt<bool> EnableUnrollAndJam(
+    "enable-unroll-and-jam", cl::init(false), cl::Hidden,
+    cl::desc("Enable the experimental unroll and jam Pass"));
+
+static cl::opt<bool> EnableLoopTiling(
+    "enable-loop-tiling", cl::init(false), cl::Hidden,
+    cl::desc("Enable the experimental LoopTiling Pass"));
+
 static cl::opt<bool> EnableNonLTOGlobalsModRef(
     "enable-non-lto-gmr", cl::init(true), cl::Hidden,
     cl::desc(
@@ -317,10 +329,14 @@ void PassManagerBuilder::addFunctionSimplificationPasses(
   MPM.add(createIndVarSimplifyPass());        // Canonicalize indvars
   MPM.add(createLoopIdiomPass());             // Recognize idioms like memset.
   MPM.add(createLoopDeletionPass());          // Delete dead loops
+  if (EnableLoopFusion)
+    MPM.add(createLoopFusionPass());          // Fuse adjacent loops
   if (EnableLoopInterchange) {
     MPM.add(createLoopInterchangePass()); // Interchange loops
     MPM.add(createCFGSimplificationPass());
   }
+  if (EnableLoopTiling)
+    MPM.add(createLoopTilingPass());          // Tile loop nests
   if (!DisableUnrollLoops)
     MPM.add(createSimpleLoopUnrollPass());    // Unroll small loops
   addExtensionsToPM(EP_LoopOptimizerEnd, MPM);
@@ -624,6 +640,8 @@ void PassManagerBuilder::populateModulePassManager(
   addInstructionCombiningPass(MPM);
 
   if (!DisableUnrollLoops) {
+    if (EnableUnrollAndJam)
+      MPM.add(createLoopUnrollAndJamPass()); // Unroll and jam outer loops
     MPM.add(createLoopUnrollPass());    // Unroll small loops
 
     // LoopUnroll may generate some redundency to cleanup.
@@ -771,15 +789,22 @@ void PassManagerBuilder::addLTOOptimizationPasses(legacy::PassManagerBase &PM) {
   // More loops are countable; try to optimize them.
   PM.add(createIndVarSimplifyPass());
   PM.add(createLoopDeletionPass());
+  if (EnableLoopFusion)
+    PM.add(createLoopFusionPass());
   if (EnableLoopInterchange)
     PM.add(createLoopInterchangePass());
+  if (EnableLoopTiling)
+    PM.add(createLoopTilingPass());
 
   if (!DisableUnrollLoops)
     PM.add(createSimpleLoopUnrollPass());   // Unroll small loops
   PM.add(createLoopVectorizePass(true, LoopVectorize));
   // The vectorizer may have significantly shortened a loop body; unroll again.
-  if (!DisableUnrollLoops)
+  if (!DisableUnrollLoops) {
+    if (EnableUnrollAndJam)
+      PM.add(createLoopUnrollAndJamPass());
     PM.add(createLoopUnrollPass());
+  }
 
   // Now that we've optimized loops (in particular loop induction variables),
   // we may have exposed more scalar opportunities. Run parts of the scalar
@@ -847,6 +872,8 @@ void PassManagerBuilder::populateLTOPassManager(legacy::PassManagerBase &PM) {
   if (VerifyInput)
     PM.add(createVerifierPass());
 
+  addExtensionsToPM(EP_FullLinkTimeOptimizationEarly, PM);
+
   if (OptLevel != 0)
     addLTOOptimizationPasses(PM);
 
@@ -863,6 +890,8 @@ void PassManagerBuilder::populateLTOPassManager(legacy::PassManagerBase &PM) {
   if (OptLevel != 0)
     addLateLTOOptimizationPasses(PM);
 
+  addExtensionsToPM(EP_FullLinkTimeOptimizationLast, PM);
+
   if (VerifyOutput)
     PM.add(createVerifierPass());
 }
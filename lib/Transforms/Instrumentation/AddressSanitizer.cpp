@@ -22,9 +22,15 @@
 #include "llvm/ADT/Statistic.h"
 #include "llvm/ADT/StringExtras.h"
 #include "llvm/ADT/Triple.h"
+#include "llvm/Analysis/AssumptionCache.h"
+#include "llvm/Analysis/LoopInfo.h"
 #include "llvm/Analysis/MemoryBuiltins.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ScalarEvolutionExpander.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
 #include "llvm/Analysis/TargetLibraryInfo.h"
 #include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/CFG.h"
 #include "llvm/IR/CallSite.h"
 #include "llvm/IR/DIBuilder.h"
 #include "llvm/IR/DataLayout.h"
@@ -246,6 +252,18 @@ static cl::opt<bool> ClOptGlobals("asan-opt-globals",
 static cl::opt<bool> ClOptStack(
     "asan-opt-stack", cl::desc("Don't instrument scalar stack variables"),
     cl::Hidden, cl::init(false));
+static cl::opt<bool> ClOptDominating(
+    "asan-opt-dominating",
+    cl::desc("Don't instrument accesses covered by a dominating check"),
+    cl::Hidden, cl::init(false));
+static cl::opt<bool> ClOptMergeAdjacent(
+    "asan-opt-merge-adjacent",
+    cl::desc("Check adjacent accesses to the same base with one range check"),
+    cl::Hidden, cl::init(false));
+static cl::opt<bool> ClOptHoistLoop(
+    "asan-opt-hoist-loop",
+    cl::desc("Check accesses with an affine address once before the loop"),
+    cl::Hidden, cl::init(false));
 
 static cl::opt<bool> ClDynamicAllocaStack(
     "asan-stack-dynamic-alloca",
@@ -288,6 +306,11 @@ STATISTIC(NumOptimizedAccessesToGlobalVar,
           "Number of optimized accesses to global vars");
 STATISTIC(NumOptimizedAccessesToStackVar,
           "Number of optimized accesses to stack vars");
+STATISTIC(NumDominatedChecks,
+          "Number of checks covered by a dominating check");
+STATISTIC(NumMergedChecks,
+          "Number of checks merged into the check of an adjacent access");
+STATISTIC(NumHoistedChecks, "Number of checks hoisted out of loops");
 
 namespace {
 /// Frontend-provided metadata for source location.
@@ -469,6 +492,34 @@ static size_t RedzoneSizeForScale(int MappingScale) {
   return std::max(32U, 1U << MappingScale);
 }
 
+/// A plain load or store whose check may be removed, merged with the checks of
+/// neighbouring accesses or hoisted out of its loop. The access covers the
+/// bytes [Offset, Offset + Size) relative to Base.
+struct AccessCheck {
+  Instruction *I;
+  Value *Addr;
+  Value *Base;
+  int64_t Offset;
+  uint64_t Size;
+  unsigned Alignment;
+  bool IsWrite;
+
+  int64_t end() const { return Offset + Size; }
+  bool covers(const AccessCheck &Other) const {
+    return Base == Other.Base && Offset <= Other.Offset &&
+           Other.end() <= end();
+  }
+};
+
+/// A check of a range of memory of a non-constant size.
+struct RangeCheck {
+  Instruction *OrigIns;
+  Instruction *InsertBefore;
+  Value *Addr;
+  Value *Size;
+  bool IsWrite;
+};
+
 /// AddressSanitizer: instrument the code in module to find memory bugs.
 struct AddressSanitizer : public FunctionPass {
   explicit AddressSanitizer(bool CompileKernel = false, bool Recover = false,
@@ -524,6 +575,8 @@ struct AddressSanitizer : public FunctionPass {
   Instruction *generateCrashCode(Instruction *InsertBefore, Value *Addr,
                                  bool IsWrite, size_t AccessSizeIndex,
                                  Value *SizeArgument, uint32_t Exp);
+  void instrumentRange(Instruction *OrigIns, Instruction *InsertBefore,
+                       Value *Addr, Value *Size, bool IsWrite, uint32_t Exp);
   void instrumentMemIntrinsic(MemIntrinsic *MI);
   Value *memToShadow(Value *Shadow, IRBuilder<> &IRB);
   bool runOnFunction(Function &F) override;
@@ -543,6 +596,22 @@ struct AddressSanitizer : public FunctionPass {
   bool GlobalIsLinkerInitialized(GlobalVariable *G);
   bool isSafeAccess(ObjectSizeOffsetVisitor &ObjSizeVis, Value *Addr,
                     uint64_t TypeSize) const;
+  bool isOptimizedAccess(ObjectSizeOffsetVisitor &ObjSizeVis, Value *Addr,
+                         uint64_t TypeSize, const DataLayout &DL);
+
+  /// Remove, merge and hoist the checks of the accesses in ToInstrument. The
+  /// accesses whose checks are no longer needed are dropped from ToInstrument.
+  void optimizeChecks(Function &F, ObjectSizeOffsetVisitor &ObjSizeVis,
+                      SmallVectorImpl<Instruction *> &ToInstrument,
+                      bool UseCalls);
+  void hoistLoopChecks(Function &F, ArrayRef<AccessCheck> Checks,
+                       SmallPtrSetImpl<Instruction *> &Removed,
+                       SmallVectorImpl<RangeCheck> &RangeChecks);
+  void removeDominatedChecks(ArrayRef<AccessCheck> Checks,
+                             SmallPtrSetImpl<Instruction *> &Removed);
+  void mergeAdjacentChecks(ArrayRef<AccessCheck> Checks,
+                           SmallPtrSetImpl<Instruction *> &Removed,
+                           bool UseCalls);
 
   /// Helper to cleanup per-function state.
   struct FunctionStateRAII {
@@ -1269,6 +1338,317 @@ void AddressSanitizer::instrumentMop(ObjectSizeOffsetVisitor &ObjSizeVis,
   }
 }
 
+// Returns true if I may free or poison memory, so that the result of a check
+// done before I doesn't hold after it.
+static bool mayInvalidateChecks(Instruction &I) {
+  CallSite CS(&I);
+  return CS && !isa<DbgInfoIntrinsic>(I);
+}
+
+static bool mayInvalidateChecks(BasicBlock::iterator From,
+                                BasicBlock::iterator To) {
+  for (; From != To; ++From)
+    if (mayInvalidateChecks(*From))
+      return true;
+  return false;
+}
+
+// Returns true if an instruction that may invalidate checks can execute after
+// From and before To, where From dominates To.
+static bool mayInvalidateChecksOnPath(Instruction *From, Instruction *To) {
+  BasicBlock *FromBB = From->getParent();
+  BasicBlock *ToBB = To->getParent();
+  if (FromBB == ToBB)
+    return mayInvalidateChecks(From->getIterator(), To->getIterator());
+  if (mayInvalidateChecks(std::next(From->getIterator()), FromBB->end()) ||
+      mayInvalidateChecks(ToBB->begin(), To->getIterator()))
+    return true;
+
+  // The last execution of From before To is followed by blocks that are
+  // reachable from FromBB and reach ToBB without passing through FromBB. They
+  // include ToBB itself, all of it, if it is on a cycle that avoids FromBB,
+  // as an earlier execution of To is not checked again.
+  SmallPtrSet<BasicBlock *, 16> Reachable;
+  SmallVector<BasicBlock *, 16> Worklist(succ_begin(FromBB), succ_end(FromBB));
+  while (!Worklist.empty()) {
+    BasicBlock *BB = Worklist.pop_back_val();
+    if (BB == FromBB || !Reachable.insert(BB).second)
+      continue;
+    Worklist.append(succ_begin(BB), succ_end(BB));
+  }
+  SmallPtrSet<BasicBlock *, 16> Visited;
+  Worklist.append(pred_begin(ToBB), pred_end(ToBB));
+  while (!Worklist.empty()) {
+    BasicBlock *BB = Worklist.pop_back_val();
+    if (!Reachable.count(BB) || !Visited.insert(BB).second)
+      continue;
+    if (mayInvalidateChecks(BB->begin(), BB->end()))
+      return true;
+    Worklist.append(pred_begin(BB), pred_end(BB));
+  }
+  return false;
+}
+
+// Returns true if instrumentMop leaves the access unchecked because it is
+// known to be in bounds of a global or a stack variable.
+bool AddressSanitizer::isOptimizedAccess(ObjectSizeOffsetVisitor &ObjSizeVis,
+                                         Value *Addr, uint64_t TypeSize,
+                                         const DataLayout &DL) {
+  Value *Obj = GetUnderlyingObject(Addr, DL);
+  if (ClOptGlobals) {
+    GlobalVariable *G = dyn_cast<GlobalVariable>(Obj);
+    if (G && (!ClInitializers || GlobalIsLinkerInitialized(G)) &&
+        isSafeAccess(ObjSizeVis, Addr, TypeSize))
+      return true;
+  }
+  return ClOptStack && isa<AllocaInst>(Obj) &&
+         isSafeAccess(ObjSizeVis, Addr, TypeSize);
+}
+
+void AddressSanitizer::optimizeChecks(
+    Function &F, ObjectSizeOffsetVisitor &ObjSizeVis,
+    SmallVectorImpl<Instruction *> &ToInstrument, bool UseCalls) {
+  const DataLayout &DL = F.getParent()->getDataLayout();
+  SmallVector<AccessCheck, 16> Checks;
+  for (Instruction *I : ToInstrument) {
+    bool IsWrite;
+    uint64_t TypeSize;
+    unsigned Alignment;
+    Value *MaybeMask = nullptr;
+    Value *Addr = isInterestingMemoryAccess(I, &IsWrite, &TypeSize, &Alignment,
+                                            &MaybeMask);
+    if (!Addr || MaybeMask || TypeSize % 8 != 0 ||
+        isOptimizedAccess(ObjSizeVis, Addr, TypeSize, DL))
+      continue;
+    int64_t Offset = 0;
+    Value *Base = GetPointerBaseWithConstantOffset(Addr, Offset, DL);
+    Checks.push_back(
+        {I, Addr, Base, Offset, TypeSize / 8, Alignment, IsWrite});
+  }
+  if (Checks.empty())
+    return;
+
+  // Decide which checks to drop while the dominator tree is still valid, and
+  // only then emit the range checks, which split blocks.
+  SmallPtrSet<Instruction *, 16> Removed;
+  SmallVector<RangeCheck, 4> RangeChecks;
+  if (ClOptHoistLoop)
+    hoistLoopChecks(F, Checks, Removed, RangeChecks);
+  if (ClOptDominating)
+    removeDominatedChecks(Checks, Removed);
+  if (ClOptMergeAdjacent)
+    mergeAdjacentChecks(Checks, Removed, UseCalls);
+  for (const RangeCheck &RC : RangeChecks)
+    instrumentRange(RC.OrigIns, RC.InsertBefore, RC.Addr, RC.Size, RC.IsWrite,
+                    ClForceExperiment);
+
+  ToInstrument.erase(std::remove_if(ToInstrument.begin(), ToInstrument.end(),
+                                    [&](Instruction *I) {
+                                      return Removed.count(I);
+                                    }),
+                     ToInstrument.end());
+}
+
+// Replace the checks of accesses that run on every iteration of a loop with a
+// check of all memory they touch, done in the preheader. The address must be
+// loop invariant or advance by at most the access size per iteration, so that
+// no byte the loop doesn't access is checked. The loop must have a computable
+// trip count, exit only from its latch and contain no calls.
+void AddressSanitizer::hoistLoopChecks(
+    Function &F, ArrayRef<AccessCheck> Checks,
+    SmallPtrSetImpl<Instruction *> &Removed,
+    SmallVectorImpl<RangeCheck> &RangeChecks) {
+  const DataLayout &DL = F.getParent()->getDataLayout();
+  TargetLibraryInfo &TLI =
+      getAnalysis<TargetLibraryInfoWrapperPass>().getTLI();
+  AssumptionCache AC(F);
+  LoopInfo LI(*DT);
+  ScalarEvolution SE(F, TLI, AC, *DT, LI);
+  SCEVExpander Expander(SE, DL, "asan.range");
+
+  DenseMap<Loop *, bool> CanHoist;
+  for (const AccessCheck &A : Checks) {
+    Loop *L = LI.getLoopFor(A.I->getParent());
+    if (!L)
+      continue;
+    auto It = CanHoist.find(L);
+    if (It == CanHoist.end()) {
+      bool Hoistable = L->getLoopPreheader() && L->getLoopLatch() &&
+                       L->getExitingBlock() == L->getLoopLatch() &&
+                       !isa<SCEVCouldNotCompute>(SE.getBackedgeTakenCount(L));
+      for (BasicBlock *BB : L->blocks())
+        if (Hoistable && mayInvalidateChecks(BB->begin(), BB->end()))
+          Hoistable = false;
+      It = CanHoist.insert({L, Hoistable}).first;
+    }
+    if (!It->second || !DT->dominates(A.I->getParent(), L->getLoopLatch()))
+      continue;
+
+    const SCEV *AddrSCEV = SE.getSCEV(A.Addr);
+    const SCEV *Lo = nullptr;
+    const SCEV *Size = SE.getConstant(IntptrTy, A.Size);
+    if (SE.isLoopInvariant(AddrSCEV, L)) {
+      Lo = AddrSCEV;
+    } else {
+      auto *AR = dyn_cast<SCEVAddRecExpr>(AddrSCEV);
+      if (!AR || AR->getLoop() != L || !AR->isAffine())
+        continue;
+      auto *Step = dyn_cast<SCEVConstant>(AR->getStepRecurrence(SE));
+      if (!Step)
+        continue;
+      int64_t Stride = Step->getAPInt().getSExtValue();
+      uint64_t AbsStride = Stride < 0 ? -uint64_t(Stride) : Stride;
+      const SCEV *BTC = SE.getBackedgeTakenCount(L);
+      if (AbsStride > A.Size ||
+          SE.getTypeSizeInBits(BTC->getType()) > DL.getPointerSizeInBits())
+        continue;
+      const SCEV *Span =
+          SE.getMulExpr(SE.getNoopOrZeroExtend(BTC, IntptrTy),
+                        SE.getConstant(IntptrTy, AbsStride));
+      Lo = Stride < 0 ? SE.getMinusSCEV(AR->getStart(), Span) : AR->getStart();
+      Size = SE.getAddExpr(Span, Size);
+    }
+    if (!isSafeToExpand(Lo, SE) || !isSafeToExpand(Size, SE))
+      continue;
+
+    Instruction *InsertPt = L->getLoopPreheader()->getTerminator();
+    Value *LoV = Expander.expandCodeFor(Lo, A.Addr->getType(), InsertPt);
+    Value *SizeV = Expander.expandCodeFor(Size, IntptrTy, InsertPt);
+    RangeChecks.push_back({A.I, InsertPt, LoV, SizeV, A.IsWrite});
+    Removed.insert(A.I);
+    NumHoistedChecks++;
+  }
+}
+
+// Drop the checks of accesses whose bytes are covered by the check of a
+// dominating access on the same base, when nothing that may free or poison
+// memory can run in between. The checks are visited in dominator tree order,
+// so a check is only ever dropped in favour of one that is kept.
+void AddressSanitizer::removeDominatedChecks(
+    ArrayRef<AccessCheck> Checks, SmallPtrSetImpl<Instruction *> &Removed) {
+  // Only the latest kept checks on a base are scanned, and only the nearest
+  // one that covers and dominates the access has the paths between them
+  // walked, so each access costs at most one CFG walk however many checks
+  // share its base.
+  const unsigned MaxScanned = 16;
+
+  DenseMap<BasicBlock *, SmallVector<const AccessCheck *, 4>> BlockChecks;
+  for (const AccessCheck &A : Checks)
+    if (!Removed.count(A.I))
+      BlockChecks[A.I->getParent()].push_back(&A);
+
+  DenseMap<Value *, SmallVector<const AccessCheck *, 4>> KeptChecks;
+  for (DomTreeNode *Node : depth_first(DT->getRootNode())) {
+    auto It = BlockChecks.find(Node->getBlock());
+    if (It == BlockChecks.end())
+      continue;
+    for (const AccessCheck *A : It->second) {
+      auto &Kept = KeptChecks[A->Base];
+      unsigned NumScanned = 0;
+      bool Covered = false;
+      for (auto KI = Kept.rbegin(), KE = Kept.rend();
+           KI != KE && NumScanned < MaxScanned; ++KI, ++NumScanned) {
+        const AccessCheck *K = *KI;
+        if (!K->covers(*A) || !DT->dominates(K->I, A->I))
+          continue;
+        Covered = !mayInvalidateChecksOnPath(K->I, A->I);
+        break;
+      }
+      if (Covered) {
+        Removed.insert(A->I);
+        NumDominatedChecks++;
+      } else {
+        Kept.push_back(A);
+      }
+    }
+  }
+}
+
+// Check overlapping or adjacent accesses to the same base in a block, such as
+// the fields of a struct, with one check of the bytes they cover together. The
+// combined check is done at the first access, so there must be nothing that
+// may free or poison memory between the accesses. The range is kept within the
+// minimal redzone size, so it can't span a redzone between two objects when
+// only its first and last bytes are checked.
+void AddressSanitizer::mergeAdjacentChecks(
+    ArrayRef<AccessCheck> Checks, SmallPtrSetImpl<Instruction *> &Removed,
+    bool UseCalls) {
+  const int64_t MaxMergedSize = 16;
+
+  struct CheckGroup {
+    SmallVector<const AccessCheck *, 4> Members;
+    int64_t Start, End;
+  };
+  SmallVector<CheckGroup, 8> Groups;
+  DenseMap<Value *, unsigned> OpenGroups;
+  const AccessCheck *Prev = nullptr;
+  for (const AccessCheck &A : Checks) {
+    if (Removed.count(A.I))
+      continue;
+    if (!Prev || Prev->I->getParent() != A.I->getParent() ||
+        mayInvalidateChecks(Prev->I->getIterator(), A.I->getIterator()))
+      OpenGroups.clear();
+    Prev = &A;
+
+    auto It = OpenGroups.find(A.Base);
+    if (It != OpenGroups.end()) {
+      CheckGroup &G = Groups[It->second];
+      int64_t Start = std::min(G.Start, A.Offset);
+      int64_t End = std::max(G.End, A.end());
+      if (A.Offset <= G.End && A.end() >= G.Start &&
+          End - Start <= MaxMergedSize) {
+        G.Members.push_back(&A);
+        G.Start = Start;
+        G.End = End;
+        continue;
+      }
+    }
+    OpenGroups[A.Base] = Groups.size();
+    Groups.push_back({{&A}, A.Offset, A.end()});
+  }
+
+  unsigned Granularity = 1 << Mapping.Scale;
+  for (const CheckGroup &G : Groups) {
+    if (G.Members.size() < 2)
+      continue;
+    const AccessCheck *First = G.Members.front();
+    unsigned Alignment = 1;
+    for (const AccessCheck *A : G.Members)
+      if (A->Offset == G.Start && A->Alignment) {
+        Alignment = A->Alignment;
+        break;
+      }
+    IRBuilder<> IRB(First->I);
+    Value *Addr = IRB.CreateConstGEP1_64(
+        IRB.CreatePointerCast(First->Base, IRB.getInt8PtrTy()), G.Start);
+    doInstrumentAddress(this, First->I, First->I, Addr, Alignment, Granularity,
+                        (G.End - G.Start) * 8, First->IsWrite, nullptr,
+                        UseCalls, ClForceExperiment);
+    for (const AccessCheck *A : G.Members)
+      Removed.insert(A->I);
+    NumMergedChecks += G.Members.size() - 1;
+  }
+}
+
+// Check a range of memory of a non-constant size with the sized callback,
+// which looks at every byte of the range.
+void AddressSanitizer::instrumentRange(Instruction *OrigIns,
+                                       Instruction *InsertBefore, Value *Addr,
+                                       Value *Size, bool IsWrite,
+                                       uint32_t Exp) {
+  IRBuilder<> IRB(InsertBefore);
+  Value *AddrLong = IRB.CreatePointerCast(Addr, IntptrTy);
+  CallInst *Call;
+  if (Exp == 0)
+    Call = IRB.CreateCall(AsanMemoryAccessCallbackSized[IsWrite][0],
+                          {AddrLong, Size});
+  else
+    Call = IRB.CreateCall(
+        AsanMemoryAccessCallbackSized[IsWrite][1],
+        {AddrLong, Size, ConstantInt::get(IRB.getInt32Ty(), Exp)});
+  Call->setDebugLoc(OrigIns->getDebugLoc());
+}
+
 Instruction *AddressSanitizer::generateCrashCode(Instruction *InsertBefore,
                                                  Value *Addr, bool IsWrite,
                                                  size_t AccessSizeIndex,
@@ -2178,6 +2558,9 @@ bool AddressSanitizer::runOnFunction(Function &F) {
   ObjectSizeOffsetVisitor ObjSizeVis(DL, TLI, F.getContext(),
                                      /*RoundToAlign=*/true);
 
+  if (ClOpt && (ClOptDominating || ClOptMergeAdjacent || ClOptHoistLoop))
+    optimizeChecks(F, ObjSizeVis, ToInstrument, UseCalls);
+
   // Instrument.
   int NumInstrumented = 0;
   for (auto Inst : ToInstrument) {
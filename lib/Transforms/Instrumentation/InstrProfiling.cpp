@@ -14,13 +14,17 @@
 //===----------------------------------------------------------------------===//
 
 #include "llvm/Transforms/InstrProfiling.h"
+#include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/ADT/Triple.h"
+#include "llvm/Analysis/LoopInfo.h"
 #include "llvm/Analysis/TargetLibraryInfo.h"
+#include "llvm/IR/Dominators.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/IntrinsicInst.h"
 #include "llvm/IR/Module.h"
 #include "llvm/ProfileData/InstrProf.h"
 #include "llvm/Transforms/Utils/ModuleUtils.h"
+#include "llvm/Transforms/Utils/SSAUpdater.h"
 
 using namespace llvm;
 
@@ -51,6 +55,21 @@ cl::opt<double> NumCountersPerValueSite(
     // is usually smaller than 2.
     cl::init(1.0));
 
+cl::opt<bool> DoCounterPromotion(
+    "do-counter-promotion", cl::ZeroOrMore,
+    cl::desc("Keep the profile counters updated in loops in registers"),
+    cl::init(false));
+cl::opt<unsigned> MaxNumOfPromotionsPerLoop(
+    "max-counter-promotions-per-loop", cl::ZeroOrMore,
+    cl::desc("Max number of counters promoted per loop, to avoid increasing "
+             "register pressure too much"),
+    cl::init(20));
+cl::opt<int> MaxNumOfPromotions(
+    "max-counter-promotions", cl::ZeroOrMore,
+    cl::desc("Max number of counters promoted in the module ('-1' means no "
+             "limit)"),
+    cl::init(-1));
+
 class InstrProfilingLegacyPass : public ModulePass {
   InstrProfiling InstrProf;
 
@@ -157,18 +176,7 @@ bool InstrProfiling::run(Module &M, const TargetLibraryInfo &TLI) {
   }
 
   for (Function &F : M)
-    for (BasicBlock &BB : F)
-      for (auto I = BB.begin(), E = BB.end(); I != E;) {
-        auto Instr = I++;
-        InstrProfIncrementInst *Inc = castToIncrementInst(&*Instr);
-        if (Inc) {
-          lowerIncrement(Inc);
-          MadeChange = true;
-        } else if (auto *Ind = dyn_cast<InstrProfValueProfileInst>(Instr)) {
-          lowerValueProfileInst(Ind);
-          MadeChange = true;
-        }
-      }
+    MadeChange |= lowerIntrinsics(&F);
 
   if (GlobalVariable *CoverageNamesVar =
           M.getNamedGlobal(getCoverageUnusedNamesVarName())) {
@@ -188,6 +196,144 @@ bool InstrProfiling::run(Module &M, const TargetLibraryInfo &TLI) {
   return true;
 }
 
+bool InstrProfiling::lowerIntrinsics(Function *F) {
+  bool MadeChange = false;
+  PromotionCandidates.clear();
+  for (BasicBlock &BB : *F) {
+    for (auto I = BB.begin(), E = BB.end(); I != E;) {
+      auto Instr = I++;
+      InstrProfIncrementInst *Inc = castToIncrementInst(&*Instr);
+      if (Inc) {
+        lowerIncrement(Inc);
+        MadeChange = true;
+      } else if (auto *Ind = dyn_cast<InstrProfValueProfileInst>(Instr)) {
+        lowerValueProfileInst(Ind);
+        MadeChange = true;
+      }
+    }
+  }
+
+  if (!MadeChange)
+    return false;
+
+  promoteCounterLoadStores(F);
+  return true;
+}
+
+namespace {
+
+typedef std::pair<LoadInst *, StoreInst *> LoadStorePair;
+
+/// Promotes the load and store of a counter updated in a loop to SSA values.
+/// The loop then sums up its increments in registers, starting from zero in
+/// the preheader, and the sum is added to the counter in every exit block.
+class PGOCounterPromoterHelper : public LoadAndStorePromoter {
+public:
+  PGOCounterPromoterHelper(LoadInst *L, StoreInst *S, SSAUpdater &SSA,
+                           BasicBlock *PH, ArrayRef<BasicBlock *> ExitBlocks,
+                           SmallVectorImpl<LoadStorePair> &Flushes)
+      : LoadAndStorePromoter({L, S}, SSA), Store(S), ExitBlocks(ExitBlocks),
+        Flushes(Flushes) {
+    SSA.AddAvailableValue(PH, ConstantInt::get(L->getType(), 0));
+  }
+
+  void doExtraRewritesBeforeFinalDeletion() const override {
+    Value *Addr = Store->getPointerOperand();
+    for (BasicBlock *ExitBlock : ExitBlocks) {
+      // The exits are dedicated, so the value live into one is the sum of the
+      // increments made on the way there.
+      Value *LiveInValue = SSA.GetValueInMiddleOfBlock(ExitBlock);
+      IRBuilder<> Builder(&*ExitBlock->getFirstInsertionPt());
+      LoadInst *OldVal = Builder.CreateLoad(Addr, "pgocount.promoted");
+      Value *NewVal = Builder.CreateAdd(OldVal, LiveInValue);
+      Flushes.emplace_back(OldVal, Builder.CreateStore(NewVal, Addr));
+    }
+  }
+
+private:
+  StoreInst *Store;
+  ArrayRef<BasicBlock *> ExitBlocks;
+  SmallVectorImpl<LoadStorePair> &Flushes;
+};
+
+} // end anonymous namespace
+
+// Promote the counter updates of loop L, within the per-loop and per-module
+// limits. The updates that flush the counters at the exits are added to
+// Flushes.
+static void promoteCounters(Loop &L, ArrayRef<LoadStorePair> Candidates,
+                            SmallVectorImpl<LoadStorePair> &Flushes,
+                            int64_t &TotalPromoted) {
+  BasicBlock *PH = L.getLoopPreheader();
+  if (!PH || !L.hasDedicatedExits())
+    return;
+
+  // A loop without exits would never flush its counters, and nothing can be
+  // inserted into a block holding a catchswitch.
+  SmallVector<BasicBlock *, 8> ExitBlocks;
+  L.getUniqueExitBlocks(ExitBlocks);
+  if (ExitBlocks.empty() || any_of(ExitBlocks, [](BasicBlock *BB) {
+        return isa<CatchSwitchInst>(BB->getFirstNonPHI());
+      }))
+    return;
+
+  unsigned Promoted = 0;
+  for (const LoadStorePair &Cand : Candidates) {
+    if (Promoted >= MaxNumOfPromotionsPerLoop ||
+        (MaxNumOfPromotions >= 0 && TotalPromoted >= MaxNumOfPromotions))
+      break;
+
+    SmallVector<PHINode *, 4> NewPHIs;
+    SSAUpdater SSA(&NewPHIs);
+    PGOCounterPromoterHelper Promoter(Cand.first, Cand.second, SSA, PH,
+                                      ExitBlocks, Flushes);
+    Promoter.run(SmallVector<Instruction *, 2>({Cand.first, Cand.second}));
+    ++Promoted;
+    ++TotalPromoted;
+  }
+}
+
+void InstrProfiling::promoteCounterLoadStores(Function *F) {
+  if (!isCounterPromotionEnabled())
+    return;
+
+  DominatorTree DT(*F);
+  LoopInfo LI(DT);
+  DenseMap<Loop *, SmallVector<LoadStorePair, 8>> LoopPromotionCandidates;
+  for (const LoadStorePair &LoadStore : PromotionCandidates)
+    if (Loop *L = LI.getLoopFor(LoadStore.first->getParent()))
+      LoopPromotionCandidates[L].push_back(LoadStore);
+
+  // Visit inner loops before outer ones, so that the updates flushed at the
+  // exits of an inner loop get promoted out of the enclosing loop as well.
+  SmallVector<Loop *, 8> Loops;
+  SmallVector<Loop *, 8> Worklist(LI.begin(), LI.end());
+  while (!Worklist.empty()) {
+    Loop *L = Worklist.pop_back_val();
+    Loops.push_back(L);
+    Worklist.append(L->begin(), L->end());
+  }
+
+  for (Loop *L : reverse(Loops)) {
+    auto It = LoopPromotionCandidates.find(L);
+    if (It == LoopPromotionCandidates.end())
+      continue;
+    SmallVector<LoadStorePair, 8> Candidates = std::move(It->second);
+    SmallVector<LoadStorePair, 8> Flushes;
+    promoteCounters(*L, Candidates, Flushes, TotalCountersPromoted);
+    for (const LoadStorePair &Flush : Flushes)
+      if (Loop *Outer = LI.getLoopFor(Flush.first->getParent()))
+        LoopPromotionCandidates[Outer].push_back(Flush);
+  }
+}
+
+bool InstrProfiling::isCounterPromotionEnabled() const {
+  if (DoCounterPromotion.getNumOccurrences() > 0)
+    return DoCounterPromotion;
+
+  return Options.DoCounterPromotion;
+}
+
 static Constant *getOrInsertValueProfilingCall(Module &M,
                                                const TargetLibraryInfo &TLI) {
   LLVMContext &Ctx = M.getContext();
@@ -252,9 +398,12 @@ void InstrProfiling::lowerIncrement(InstrProfIncrementInst *Inc) {
   IRBuilder<> Builder(Inc);
   uint64_t Index = Inc->getIndex()->getZExtValue();
   Value *Addr = Builder.CreateConstInBoundsGEP2_64(Counters, 0, Index);
-  Value *Count = Builder.CreateLoad(Addr, "pgocount");
-  Count = Builder.CreateAdd(Count, Inc->getStep());
-  Inc->replaceAllUsesWith(Builder.CreateStore(Count, Addr));
+  LoadInst *Load = Builder.CreateLoad(Addr, "pgocount");
+  Value *Count = Builder.CreateAdd(Load, Inc->getStep());
+  StoreInst *Store = Builder.CreateStore(Count, Addr);
+  Inc->replaceAllUsesWith(Store);
+  if (isCounterPromotionEnabled())
+    PromotionCandidates.emplace_back(Load, Store);
   Inc->eraseFromParent();
 }
 
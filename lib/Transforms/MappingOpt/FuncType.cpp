@@ -3,8 +3,9 @@
 using namespace llvm;
 
 // Checks whether a function is a library function (including intrinsic functions)
+// or other code marked to stay in main memory, like cold code split off by smmcmh-split-cold
 bool isLibraryFunction(Function *func) {
-    return (func->isDeclaration()); 
+    return (func->isDeclaration() || func->hasFnAttribute("smm-main-memory")); 
 } 
 
 // Check if a function is code management function  
@@ -27,6 +27,7 @@
 #include "llvm/Support/CommandLine.h"
 
 #include "Overlay.h"
+#include "../SMMCommon/SMMInfo.h"
 
 using namespace llvm;
 
@@ -52,25 +53,7 @@ namespace {
             AU.addRequired<DominatorTreeWrapperPass>();
             AU.addRequired<CallGraphWrapperPass>();
             AU.addRequired<DominanceFrontierWrapperPass>();
-        }
-
-
-        bool readFuncSizes(Module &mod, std::string fileName) {
-            std::ifstream ifs;
-            ifs.open(fileName, std::ifstream::in | std::ifstream::binary);
-            if(!ifs.good()) return false;
-
-            while(ifs.good()) {
-                unsigned long size;
-                std::string name;
-                ifs >> name >> size;
-                if (name.empty()) continue;
-
-                Function *function = mod.getFunction(name);
-                funcSize[function] = size;
-            }
-
-            return true;
+            AU.addRequired<SMMInfo>();
         }
 
 
@@ -381,12 +364,8 @@ namespace {
 
         bool runOnModule(Module &mod) override {
 
-            //read function sizes
-            std::string fileName = "_func_size";
-            if(!readFuncSizes(mod, fileName)) {
-                errs() << "Error reading " << fileName << "\n";
-                return false;
-            }
+            //get function sizes
+            funcSize = getAnalysis<SMMInfo>().getFuncSizes(mod);
 
             //make callgraph
             callGraph = &getAnalysis<CallGraphWrapperPass>().getCallGraph();
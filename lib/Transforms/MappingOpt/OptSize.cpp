@@ -26,6 +26,7 @@
 #include "llvm/Support/CommandLine.h"
 
 #include "Overlay.h"
+#include "../SMMCommon/SMMInfo.h"
 
 using namespace llvm;
 
@@ -50,25 +51,7 @@ namespace {
             AU.addRequired<LoopInfoWrapperPass>();
             AU.addRequired<DominatorTreeWrapperPass>();
             AU.addRequired<CallGraphWrapperPass>();
-        }
-
-
-        bool readFuncSizes(Module &mod, std::string fileName) {
-            std::ifstream ifs;
-            ifs.open(fileName, std::ifstream::in | std::ifstream::binary);
-            if(!ifs.good()) return false;
-
-            while(ifs.good()) {
-                unsigned long size;
-                std::string name;
-                ifs >> name >> size;
-                if (name.empty()) continue;
-
-                Function *function = mod.getFunction(name);
-                funcSize[function] = size;
-            }
-
-            return true;
+            AU.addRequired<SMMInfo>();
         }
 
 
@@ -203,11 +186,11 @@ namespace {
             optimalSize = mappingConfigs[i-1].first;
             optimalCost = mappingConfigs[i-1].second;
 
-            std::ofstream outFile("_opt_size", std::ios::out);
-            outFile << "min\t" << mappingConfigs[0].first << "\t" << mappingConfigs[0].second << "\n";
-            outFile << "max\t" << mappingConfigs[mappingConfigs.size()-1].first << "\t" << 0 << "\n";
-            outFile << "opt\t" << optimalSize << "\t" << optimalCost << "\n";
-            outFile.close();
+            std::vector<SMMSPMSizeEntry> spmSizes;
+            spmSizes.push_back({"min", mappingConfigs[0].first, mappingConfigs[0].second});
+            spmSizes.push_back({"max", mappingConfigs[mappingConfigs.size()-1].first, 0});
+            spmSizes.push_back({"opt", optimalSize, optimalCost});
+            getAnalysis<SMMInfo>().setSPMSizes(spmSizes);
 
             return optimalSize;
         }
@@ -217,13 +200,7 @@ namespace {
 
             errs() << "opt-size pass called\n";
 
-            //read function sizes
-            std::string fileName = "_func_size";
-            if(!readFuncSizes(mod, fileName)) {
-                errs() << "Error reading " << fileName << "\n";
-                return false;
-            }
-
+            //function sizes are read from SMMInfo by the cost calculator
             //make callgraph
             callGraph = &getAnalysis<CallGraphWrapperPass>().getCallGraph();
 
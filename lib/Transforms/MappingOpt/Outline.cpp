@@ -0,0 +1,262 @@
+//===- Outline.cpp - Split large functions into overlay units -------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements a pass that makes overlay units smaller than a
+// function. A region is as large as the largest function mapped to it, so a
+// single large function dictates the minimum SPM size even if only a small
+// loop of it is hot. Functions larger than a size limit are therefore split:
+// loops and single-entry single-exit regions are outlined by the
+// CodeExtractor into functions of their own, which the overlay mapping
+// (smmcmh-overlay, smmmo) treats like any other function. Whether an outlined
+// unit shares a region with its parent or gets a region of its own is then
+// up to the region merger, so mapping decides at the best granularity.
+//
+// The candidate that balances the sizes of the parent and the new unit best
+// is outlined first. Among candidates that balance them about equally well,
+// the one with the lowest DMA cost in the worst case is chosen, which is the
+// cost of loading the unit and reloading the parent on every entry if both
+// end up in one region.
+//
+// The pass has to run before the execution trace and the mapping are made,
+// since the outlined units are new functions. Measured function sizes are
+// split among the parent and its units in proportion to their instructions.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/DominanceFrontier.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/PostDominators.h"
+#include "llvm/Analysis/RegionInfo.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Pass.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/CodeExtractor.h"
+
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "FuncType.h"
+#include "../SMMCommon/Helper.h"
+#include "../SMMCommon/SMMInfo.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "smmmo-outline"
+
+STATISTIC(NumOutlinedLoops, "Number of loops outlined into overlay units");
+STATISTIC(NumOutlinedRegions, "Number of SESE regions outlined into overlay units");
+
+static cl::opt<unsigned long long> OutlineSizeLimit(
+        "outline-size-limit", cl::init(0),
+        cl::desc("Split functions larger than this many bytes into overlay units "
+            "(twice the average function size by default)"));
+
+namespace {
+    struct Outline : public ModulePass {
+        static char ID; // Pass identification, replacement for typeid
+        Outline() : ModulePass(ID) {}
+
+        struct Candidate {
+            std::vector <BasicBlock *> blocks;
+            bool isLoop;
+            unsigned long size;
+            // Larger of the sizes of the parent and the unit after outlining
+            unsigned long maxSize;
+            // Cost of loading the unit and reloading the parent on every entry
+            uint64_t worstCost;
+        };
+
+        std::unordered_map <Function *, unsigned long> funcSize;
+
+        virtual void getAnalysisUsage(AnalysisUsage &AU) const override {
+            AU.addRequired<SMMInfo>();
+        }
+
+        static unsigned long getNumInsts(ArrayRef<BasicBlock *> blocks) {
+            unsigned long n = 0;
+            for (BasicBlock *bb : blocks)
+                n += bb->size();
+            return n;
+        }
+
+        void addCandidate(std::vector <Candidate> &candidates, ArrayRef<BasicBlock *> blocks, bool isLoop,
+                Function *func, unsigned long numInsts, LoopInfo &LI, DominatorTree &DT, const SMMDMAModel &dma) {
+            // The entry block cannot be outlined
+            if (std::find(blocks.begin(), blocks.end(), &func->getEntryBlock()) != blocks.end())
+                return;
+            CodeExtractor extractor(blocks, &DT);
+            if (!extractor.isEligible())
+                return;
+            unsigned long size = funcSize[func] * getNumInsts(blocks) / numInsts;
+            unsigned long parentSize = funcSize[func] - size;
+            // Splitting off almost nothing or almost everything does not help
+            if (size == 0 || parentSize == 0)
+                return;
+            uint64_t entries = std::pow(DEFAULT_TRIP_COUNT, LI.getLoopDepth(blocks.front()));
+            Candidate c;
+            c.blocks = blocks;
+            c.isLoop = isLoop;
+            c.size = size;
+            c.maxSize = std::max(size, parentSize);
+            c.worstCost = entries * (dma.getTransferCost(size) + dma.getTransferCost(parentSize));
+            candidates.push_back(c);
+        }
+
+        void addLoopCandidates(std::vector <Candidate> &candidates, Loop *loop, Function *func,
+                unsigned long numInsts, LoopInfo &LI, DominatorTree &DT, const SMMDMAModel &dma) {
+            // The header comes first, so the loop depth of the unit is the one of its entry
+            addCandidate(candidates, loop->getBlocks(), true, func, numInsts, LI, DT, dma);
+            for (Loop *subLoop : *loop)
+                addLoopCandidates(candidates, subLoop, func, numInsts, LI, DT, dma);
+        }
+
+        void addRegionCandidates(std::vector <Candidate> &candidates, Region *region, Function *func,
+                unsigned long numInsts, LoopInfo &LI, DominatorTree &DT, const SMMDMAModel &dma) {
+            for (const std::unique_ptr<Region> &subRegion : *region) {
+                std::vector <BasicBlock *> blocks;
+                // The entry comes first
+                for (BasicBlock *bb : subRegion->blocks())
+                    blocks.push_back(bb);
+                // Loops are candidates already
+                Loop *loop = LI.getLoopFor(subRegion->getEntry());
+                if (!loop || loop->getHeader() != subRegion->getEntry() || loop->getNumBlocks() != blocks.size())
+                    addCandidate(candidates, blocks, false, func, numInsts, LI, DT, dma);
+                addRegionCandidates(candidates, subRegion.get(), func, numInsts, LI, DT, dma);
+            }
+        }
+
+        // Outline the best candidate of the specified function, and return the new unit
+        Function *outline(Module &mod, Function *func, const SMMDMAModel &dma) {
+            DominatorTree DT(*func);
+            LoopInfo LI(DT);
+            PostDominatorTree PDT;
+            PDT.recalculate(*func);
+            DominanceFrontier DF;
+            DF.analyze(DT);
+            RegionInfo RI;
+            RI.recalculate(*func, &DT, &PDT, &DF);
+
+            std::vector <BasicBlock *> body;
+            for (BasicBlock &bb : *func)
+                body.push_back(&bb);
+            unsigned long numInsts = getNumInsts(body);
+
+            std::vector <Candidate> candidates;
+            for (Loop *loop : LI)
+                addLoopCandidates(candidates, loop, func, numInsts, LI, DT, dma);
+            addRegionCandidates(candidates, RI.getTopLevelRegion(), func, numInsts, LI, DT, dma);
+            if (candidates.empty())
+                return NULL;
+
+            // Among the candidates that split the function about as evenly as the best one, choose the cheapest
+            unsigned long minMaxSize = ~0UL;
+            for (const Candidate &c : candidates)
+                minMaxSize = std::min(minMaxSize, c.maxSize);
+            const Candidate *best = NULL;
+            for (const Candidate &c : candidates) {
+                if (c.maxSize > minMaxSize + minMaxSize / 10)
+                    continue;
+                if (!best || c.worstCost < best->worstCost)
+                    best = &c;
+            }
+            DEBUG(dbgs() << "outline " << (best->isLoop ? "loop " : "region ") << best->blocks.front()->getName()
+                    << " of " << func->getName() << ": " << best->size << " of " << funcSize[func] << " bytes\n");
+
+            CodeExtractor extractor(best->blocks, &DT);
+            Function *unit = extractor.extractCodeRegion();
+            if (!unit)
+                return NULL;
+
+            // Names become section names, so they must not contain dots
+            std::string prefix = func->getName().str() + (best->isLoop ? "_loop" : "_region");
+            unsigned n = 0;
+            while (mod.getFunction(prefix + std::to_string(n)))
+                n++;
+            unit->setName(prefix + std::to_string(n));
+
+            if (best->isLoop)
+                NumOutlinedLoops++;
+            else
+                NumOutlinedRegions++;
+            funcSize[unit] = best->size;
+            funcSize[func] -= best->size;
+            return unit;
+        }
+
+        bool runOnModule(Module &mod) override {
+            SMMInfo &info = getAnalysis<SMMInfo>();
+            funcSize = info.getFuncSizes(mod);
+
+            // Functions are split in module order, so the names of the units do not depend on hashing
+            std::deque <Function *> worklist;
+            unsigned long sizeSum = 0, numFuncs = 0;
+            for (Function &func : mod) {
+                auto fi = funcSize.find(&func);
+                if (fi == funcSize.end() || isLibraryFunction(&func) || isCodeManagementFunction(&func))
+                    continue;
+                worklist.push_back(&func);
+                sizeSum += fi->second;
+                numFuncs++;
+            }
+            if (numFuncs == 0)
+                return false;
+            unsigned long limit = OutlineSizeLimit ? (unsigned long)OutlineSizeLimit : 2 * sizeSum / numFuncs;
+            DEBUG(dbgs() << "outline functions larger than " << limit << " bytes\n");
+
+            std::vector <std::string> units;
+            while (!worklist.empty()) {
+                Function *func = worklist.front();
+                worklist.pop_front();
+                while (funcSize[func] > limit) {
+                    Function *unit = outline(mod, func, info.getDMAModel());
+                    if (!unit)
+                        break;
+                    units.push_back(unit->getName());
+                    // Large loops may be split further
+                    worklist.push_back(unit);
+                }
+            }
+            if (units.empty())
+                return false;
+
+            // Keep the information of later passes in line with the new functions
+            if (info.hasFuncSizes()) {
+                std::vector <SMMSizeEntry> sizes;
+                for (Function &func : mod) {
+                    auto fi = funcSize.find(&func);
+                    if (fi == funcSize.end())
+                        continue;
+                    SMMSizeEntry entry;
+                    entry.Name = func.getName();
+                    entry.Size = fi->second;
+                    sizes.push_back(entry);
+                }
+                info.setFuncSizes(sizes);
+            }
+            if (!info.getUserFunctions().empty()) {
+                std::vector <std::string> funcs = info.getUserFunctions();
+                funcs.insert(funcs.end(), units.begin(), units.end());
+                info.setUserFunctions(funcs);
+            }
+            return true;
+        }
+    };
+}
+
+char Outline::ID = 0;
+static RegisterPass<Outline> X("smmmo-outline", "Split large functions into overlay units");
@@ -15,6 +15,7 @@
 #define DEBUG_TYPE "smmcmh-overlay"
 
 #include "Overlay.h"
+#include "../SMMCommon/SMMInfo.h"
 
 static std::unordered_map <Function *, unsigned long> funcSize;
 
@@ -38,6 +39,7 @@ PathsType CallPathFinder::getCallPaths(Function *root) {
     }
 
     referredFuncs.insert(root);
+    activeFuncs.insert(root);
 
 
     // Return if this function does not call any user functions
@@ -58,8 +60,8 @@ PathsType CallPathFinder::getCallPaths(Function *root) {
             DEBUG(errs() << calledFunc->getName() << " is LibFunction" << "\n");
             continue;
         }
-        //TODO Skip self-recursive calls
-        if (calledFunc == root)
+        // Skip recursive calls back into the functions being expanded
+        if (activeFuncs.count(calledFunc))
             continue;
         hasUserFunctionCalls = true;
         break;
@@ -104,8 +106,8 @@ PathsType CallPathFinder::getCallPaths(Function *root) {
                         continue;
                     if (isLibraryFunction(callee))
                         continue;
-                    // TODO: Skip self-recursive calls
-                    if (callee == root)
+                    // Skip recursive calls back into the functions being expanded
+                    if (activeFuncs.count(callee))
                         continue;
 
                     // Found an user function call
@@ -225,6 +227,7 @@ PathsType CallPathFinder::getCallPaths(Function *root) {
     DEBUG(errs() << root->getName() << " ends\n");
     funcCallPaths[root] = result;
     funcCallPaths[root] = paths;
+    activeFuncs.erase(root);
     return paths;
     return result;
 }
@@ -295,8 +298,6 @@ void CostCalculator::getCallPaths() {
 
 unsigned long CostCalculator::calculateCost(unsigned long spmSize, MappingConfig *configs) {
 
-    std::ifstream ifs;
-    std::ofstream ofs;
     Region *src, *dest;
 
     funcSize.clear();
@@ -322,22 +323,15 @@ unsigned long CostCalculator::calculateCost(unsigned long spmSize, MappingConfig
     DEBUG(errs() << "\n\n");
 
 
-    ifs.open ("_func_size", std::ifstream::in | std::ifstream::binary);
-    while (ifs.good()) {
-        unsigned long size;
-        std::string name;
-        ifs >> name >> size;
-        if (name.empty())
-            continue;
-        Function *func = mod.getFunction(name);
-        assert(func);
+    std::unordered_map <Function *, unsigned long> sizes = pass->getAnalysis<SMMInfo>().getFuncSizes(mod);
+    for (auto ii = sizes.begin(), ie = sizes.end(); ii != ie; ++ii) {
+        Function *func = ii->first;
         if (referredFuncs.find(func) == referredFuncs.end()) {
             DEBUG(errs() << "skip function " << func->getName() << "\n");
             continue;
         }
-        funcSize[func]  = size;
-        referredFuncs.insert(func);
-        //errs() << func->getName() << " " << size << "\n";
+        funcSize[func]  = ii->second;
+        //errs() << func->getName() << " " << ii->second << "\n";
     }
 
     // Initially place each function in a seperate region
@@ -449,6 +443,8 @@ long CostCalculator::getNextSpmSize() {
 
 
 CostInfo CostCalculator::analyzeCost() {
+    // Each function loaded into a region is copied by DMA
+    const SMMDMAModel &dma = pass->getAnalysis<SMMInfo>().getDMAModel();
     unsigned long maxCost = 0;
     unsigned long cost = 0;
 
@@ -625,7 +621,7 @@ CostInfo CostCalculator::analyzeCost() {
             DEBUG(errs() << func->getName() << " ( " << depth << " )\n");
             unsigned long numExec = (unsigned long)pow(10, (double)depth);
 
-            unsigned long currentCost = funcSize[func] * numExec;
+            unsigned long currentCost = dma.getTransferCost(funcSize[func]) * numExec;
 
             /*
                if(prev && current) {
@@ -667,6 +663,8 @@ CostInfo CostCalculator::analyzeCost() {
 
 
 unsigned long CostCalculator::calculateMergerCost(Region *r1, Region *r2) {
+    // Each function loaded into a region is copied by DMA
+    const SMMDMAModel &dma = pass->getAnalysis<SMMInfo>().getDMAModel();
     unsigned long maxCost = 0;
     unsigned long cost = 0;
 
@@ -853,7 +851,7 @@ unsigned long CostCalculator::calculateMergerCost(Region *r1, Region *r2) {
             }
             DEBUG(errs() << func->getName() << " ( " << depth << " )\n");
             unsigned long numExec = (unsigned long)pow(10, (double)depth);
-            cost += funcSize[func] * numExec;
+            cost += dma.getTransferCost(funcSize[func]) * numExec;
         }
         DEBUG(errs() << "\n");
         DEBUG(errs() << "\nAfter step 5: cost = " << cost << "\n");
@@ -884,15 +882,13 @@ unsigned long CostCalculator::getMaxRegionSize() {
 
 void CostCalculator::dump() {
     unsigned long regionId = 0;
-    std::ofstream ofs;
-    ofs.open ("_mapping", std::ofstream::out | std::ofstream::trunc | std::ofstream::binary);
-    ofs << regions.size() << "\n";
+    dbgs() << "Mapping (" << regions.size() << " regions):\n";
     for(std::set<Region *>::iterator ii = regions.begin(), ie = regions.end(); ii != ie; ++ii) {
         Region *region = *ii;
         std::set<Function *> funcs = region->getFunctions();
         for (std::set<Function*>::iterator ji = funcs.begin(), je = funcs.end(); ji != je; ++ji) {
             Function *func = *ji;
-            ofs << func->getName().str() << " " << regionId << "\n";
+            dbgs() << "\t" << func->getName() << " " << regionId << "\n";
         }
         ++regionId;
     }
@@ -60,6 +60,8 @@ class CallPathFinder {
     void concatenate(std::set< PathType > &dest, NodeType &src);
     std::unordered_set <Function *> referredFuncs;
     std::unordered_map <Function *, std::set< PathType > > funcCallPaths;
+    // Functions whose call paths are being calculated, i.e. the current call chain
+    std::unordered_set <Function *> activeFuncs;
 
     Pass *pass;
     CallGraph &cg;
@@ -1,3 +1,4 @@
+#include "llvm/ADT/SCCIterator.h"
 #include "llvm/Analysis/CallGraph.h"
 #include "llvm/Analysis/LoopInfo.h"
 #include "llvm/Analysis/ScalarEvolution.h"
@@ -7,19 +8,23 @@
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/Support/Debug.h"
+#include "llvm/Support/ErrorHandling.h"
 
 #include <queue>
 #include <stack>
+#include <tuple>
 #include <unordered_set>
 
 #include "Helper.h"
 
+#define DEBUG_TYPE "smm-helper"
 
 using namespace llvm;
 
 // Checks whether a function is a library function (including intrinsic functions)
+// or other code marked to stay in main memory
 bool isLibraryFunction(Function *func) {
-    return (func->isDeclaration() || func->getName().count("_allocate") == 1); 
+    return (func->isDeclaration() || func->getName().count("_allocate") == 1 || func->hasFnAttribute("smm-main-memory")); 
 } 
 
 // Check if a function is any management function	
@@ -49,6 +54,9 @@ bool isManagementFunction(Function *func) {
     // heap
     if (func->getName().count("_heap_size") == 1)
 	return true;
+    // thread
+    if (func->getName().count("_smm_thread") == 1)
+	return true;
 
     return false;
 }
@@ -104,141 +112,139 @@ bool isManagementVariable(GlobalVariable *gvar) {
     return false;
 }
 
+// Check if a global variable keeps management state that is private to a thread
+bool isThreadPrivateVariable(GlobalVariable *gvar) {
+    // stack
+    if (gvar->getName() == "_spm_stack_base")
+	return true;
+    if (gvar->getName() == "_mem_stack_base")
+	return true;
+    if (gvar->getName() == "_mem_stack_depth")
+	return true;
+    if (gvar->getName() == "_mem_stack")
+	return true;
+    if (gvar->getName() == "_stack_pointer")
+	return true;
+    if (gvar->getName() == "gaddr")
+	return true;
+    if (gvar->getName() == "laddr")
+	return true;
+    if (gvar->getName().count("_gvar_ret") ==1)
+	return true;
+    if (gvar->getName() == "_cacheable_sp")
+	return true;
+    if (gvar->getName() == "_cacheable_stack_base")
+	return true;
+    if (gvar->getName() == "_noncacheable_sp")
+	return true;
+    if (gvar->getName() == "_noncacheable_stack_base")
+	return true;
+    // code
+    if (gvar->getName() == "_region_table")
+	return true;
+
+    return false;
+}
+
 // Get the size of specified type by bytes
 uint64_t getTypeSize(const DataLayout *dl, Type * ty) {
     return (uint64_t)ceil((double)(dl->getTypeSizeInBits(ty))/8);
 }
 
+// Return the call graph nodes that belong to recursive SCCs, mapped to the ID of their SCC
+std::unordered_map <CallGraphNode *, unsigned> getRecursiveSCCs(CallGraph &cg) {
+    std::unordered_map <CallGraphNode *, unsigned> scc_ids;
+    unsigned scc_id = 0;
+    for (scc_iterator<CallGraph *> scci = scc_begin(&cg); !scci.isAtEnd(); ++scci) {
+	// Skip SCCs without self-recursive or mutually recursive calls
+	if (!scci.hasLoop())
+	    continue;
+	const std::vector<CallGraphNode *> &scc = *scci;
+	for (size_t i = 0; i < scc.size(); i++)
+	    scc_ids[scc[i]] = scc_id;
+	scc_id++;
+    }
+    return scc_ids;
+}
+
 //Return all the paths iteratively from a graph rooted at the node specified and recursive functions
-std::pair<std::vector<std::vector<CallGraphNode::CallRecord *> >, std::unordered_set<CallGraphNode *> > getPaths(CallGraphNode::CallRecord *root) {
-    unsigned int current_path_sel = 0; // This number always leads to next node of path that is going to be traversed
-    unsigned int next_path_sel = 0; // This number always leads to the leftmost path that has not been traversed
+std::pair<std::vector<std::vector<CallGraphNode::CallRecord *> >, std::unordered_set<CallGraphNode *> > getPaths(CallGraph &cg, CallGraphNode::CallRecord *root) {
     std::vector<std::vector<CallGraphNode::CallRecord *> > paths; // Used to keep the result
     std::unordered_set <CallGraphNode *> undecidable_cgns; // Used to keep undecidable functions
-    std::queue <CallGraphNode::CallRecord *> current_path; // Used to keep a record of current path
-    std::stack < std::pair< std::queue <CallGraphNode::CallRecord *>, unsigned int > > next_path; // Used to keep a record of paths that has not been completely traversed, the first element of each pair saves the nodes that have been visited, and second element indicates the next node to visit
+    std::unordered_map <CallGraphNode *, unsigned> scc_ids = getRecursiveSCCs(cg); // Used to find recursive edges
+    std::unordered_set <unsigned> visited_sccs; // Used to keep recursive SCCs that have been reached
+    std::queue <CallGraphNode::CallRecord *> roots; // Used to keep the roots of paths that have not been traversed
+    // Used to keep a record of paths that has not been completely traversed, the first element of each tuple saves the nodes that have been visited, the second element indicates the next edge to visit, and the third element indicates whether the path has been extended
+    std::stack < std::tuple< std::vector <CallGraphNode::CallRecord *>, unsigned int, bool > > next_path;
 
     // Check on validity of root node
-    if ((root == NULL || root->second == NULL) ) {
-	errs() << "Try to generate paths for an empty graph!\n";
-	exit(-1);
-    }
+    if (root == NULL || root->second == NULL)
+	report_fatal_error("Try to generate paths for an empty graph!");
 
-    // Initialize the call stack
-    current_path.push(root);
-    int counter = 0; // This counter is used to stop the loop in case of mutual recurrsion is present
-    int mutual_recursion_threshold = 500;
-    while(!current_path.empty() && counter++ < mutual_recursion_threshold) { 
-	// Pick up a node to visit
-	CallGraphNode::CallRecord *v = current_path.back(); 
+    // Calls into and within recursive SCCs are always managed, so paths end
+    // where they enter a recursive SCC, and every function of the SCC starts
+    // new paths. All the cycles of a call graph are within recursive SCCs,
+    // so the traversal terminates.
+    roots.push(root);
+    while (!roots.empty()) {
+	next_path.push(std::make_tuple(std::vector <CallGraphNode::CallRecord *>(1, roots.front()), 0, false));
+	roots.pop();
 
-	bool only_recursive_edges = false;
+	while (!next_path.empty()) {
+	    std::vector <CallGraphNode::CallRecord *> &current_path = std::get<0>(next_path.top());
+	    unsigned int &current_path_sel = std::get<1>(next_path.top());
+	    CallGraphNode *v = current_path.back()->second;
+	    auto vi = scc_ids.find(v);
 
-	// Check if a node has only self-recursive edges
-	if(v->second->size() > 0) {
-	    unsigned int i;
-	    for (i = 0; i < v->second->size(); i++) {
-		if ((*v->second)[i] != v->second) {
-		    break;
+	    // Find the next edge of the node being visited that extends the path
+	    CallGraphNode::CallRecord *w = NULL;
+	    while (w == NULL && current_path_sel < v->size()) {
+		CallGraphNode::CallRecord *e = &*(v->begin() + current_path_sel++);
+		Function *callee = e->second->getFunction();
+		// Keep a record of calls to external nodes (inline assemblies and function pointers)
+		if (!callee) {
+		    undecidable_cgns.insert(e->second);
+		    continue;
 		}
-	    }
-	    if( i >= v->second->size())
-		only_recursive_edges = true;
-	}
-
-	// Deal with endpoints - library function calls, leaf nodes, nodes with only recursive edges
-	if ( (v->second->getFunction() && isLibraryFunction(v->second->getFunction())) || v->second->size() == 0 || only_recursive_edges) {
-	    std::vector<CallGraphNode::CallRecord *> path;
-	    counter = 0;
-	    // Add current path to result if the endpoint is not an inline asm
-	    bool is_valid_path = true;
-	    if (current_path.back()->first) {
-		CallInst *call_inst = dyn_cast<CallInst>(v->first);
-		assert(call_inst);
-		if (call_inst->isInlineAsm())
-		    is_valid_path = false;
-		
-	    }
-	    if (is_valid_path) {
-		while(!current_path.empty()) {
-		    CallGraphNode::CallRecord *call_record = current_path.front();
-		    if(call_record->second->getFunction() && !isLibraryFunction(call_record->second->getFunction()))
-			path.push_back(call_record);
-		    current_path.pop();
+		// Skip library function calls
+		if (isLibraryFunction(callee))
+		    continue;
+		auto wi = scc_ids.find(e->second);
+		if (wi == scc_ids.end()) {
+		    w = e;
+		    continue;
 		}
-		if (path.size() > 1)
-		    paths.push_back(path);
-
-		// Keep a record if the the node is self-recursive or external
-		if (only_recursive_edges || !v->second->getFunction()) {
-		    undecidable_cgns.insert(v->second);
+		// Skip recursive edges and calls into recursive SCCs that have been reached
+		if ((vi != scc_ids.end() && vi->second == wi->second) || !visited_sccs.insert(wi->second).second)
+		    continue;
+		// Start new paths from the recursive calls of the SCC
+		std::unordered_set <CallGraphNode *> rooted;
+		for (auto si = scc_ids.begin(), se = scc_ids.end(); si != se; si++) {
+		    if (si->second != wi->second)
+			continue;
+		    undecidable_cgns.insert(si->first);
+		    for (CallGraphNode::iterator cgni = si->first->begin(), cgne = si->first->end(); cgni != cgne; cgni++) {
+			auto ri = scc_ids.find(cgni->second);
+			if (ri != scc_ids.end() && ri->second == wi->second && rooted.insert(cgni->second).second)
+			    roots.push(&*cgni);
+		    }
 		}
 	    }
-	    // Go to next path that has not been completely travsed
-	    if (!next_path.empty()) { 
-		auto temp = next_path.top();
-		next_path.pop();
-		// Restore nodes that have been visited on this path
-		current_path = temp.first;
-		// Restore the next node to visit
-		current_path_sel = temp.second;
-	    }
-	    // Finish current iteration
-	    continue;
-	}
 
-	// If the node being visited is not an endpoint
-	bool is_recursive = false;
-	// Find the first non-recursursive edge of the node
-	while ( current_path_sel < v->second->size()) { 
-	    // Skip recursive edges
-	    if ((*v->second)[current_path_sel] == v->second) {
-		//undecidable_cgns.insert(v->second);
-		is_recursive = true;
-		current_path_sel++; 
+	    if (w) {
+		// Add selected node to current path
+		std::get<2>(next_path.top()) = true;
+		std::vector <CallGraphNode::CallRecord *> path = current_path;
+		path.push_back(w);
+		next_path.push(std::make_tuple(path, 0, false));
+		continue;
 	    }
-	    else {
-		break;
-	    }
-	}
-	next_path_sel = current_path_sel + 1;
 
-	// Decide next path to explore if there are any
-	while ( next_path_sel < v->second->size()) { 
-	    // Skip self-recursive edges
-	    if ( (*v->second)[next_path_sel] == v->second ) {
-		//undecidable_cgns.insert(v->second);
-		is_recursive = true;
-		next_path_sel++;
-	    }
-	    else { 
-		// Record the next path to explore
-		next_path.push(std::make_pair(current_path, next_path_sel));
-		break;
-	    }
+	    // Add current path to result if it ends at an endpoint
+	    if (!std::get<2>(next_path.top()) && current_path.size() > 1)
+		paths.push_back(current_path);
+	    next_path.pop();
 	}
-	//Keep a record of the found recursive node 
-	if (is_recursive)
-	    undecidable_cgns.insert(v->second);
-
-	//Add selected node to current path
-	unsigned int i = 0; 
-	CallGraphNode::iterator cgni = v->second->begin();
-	do {
-	    if (i == current_path_sel) {
-		current_path.push(&*cgni);
-		break;
-	    }
-	    i++;
-	    cgni++;
-	} while (i < v->second->size());
-	// Reset selector of next node to visit in current path
-	current_path_sel = 0;
-    }
-    // Check the presence of mutual recursion
-    if (counter >= mutual_recursion_threshold) {
-	errs() << "Too many iterations, possible presence of mutual recursion\n";
-	exit(-1);
     }
 
     return std::make_pair(paths, undecidable_cgns);
@@ -255,10 +261,15 @@ inline bool isHeapData(Value *val) {
 std::vector <std::pair<Value *, Segment> > getDeclarations(Value *val, std::unordered_map <Function *, std::vector<CallInst *> > &call_sites) {
     static std::unordered_set <Value *> def_stack;
     std::vector <std::pair<Value *, Segment> > res;
-    def_stack.insert(val);
 
-    if(def_stack.size() > 100)
-	exit(-1);
+    // Give up on definitions that are too deep, e.g. arguments passed around mutually recursive functions
+    if (def_stack.size() >= MAX_DEF_DEPTH) {
+	DEBUG(dbgs() << "too deep to find the declarations of " << *val << "\n");
+	res.push_back(std::make_pair(val, UNDEF));
+	return res;
+    }
+    def_stack.insert(val);
+    Value *def = val;
 
     if (ConstantExpr *const_expr = dyn_cast<ConstantExpr>(val)) {
 	//inst = const_expr->getAsInstruction();
@@ -291,6 +302,7 @@ std::vector <std::pair<Value *, Segment> > getDeclarations(Value *val, std::unor
 	if( PointerType *ptr_ty = dyn_cast<PointerType>(val->getType())) {
 	    if (ptr_ty->getElementType()->isFunctionTy()) {
 		res.push_back(std::make_pair(val, HEAP));
+		def_stack.erase(def);
 		return res;
 	    }
 	}
@@ -354,6 +366,6 @@ std::vector <std::pair<Value *, Segment> > getDeclarations(Value *val, std::unor
 		res.push_back(std::make_pair(val, UNDEF));
 	}
     }
-    def_stack.erase(val);
+    def_stack.erase(def);
     return res;
 }
@@ -10,6 +10,8 @@
 #include <unordered_set>
 
 #define DEFAULT_TRIP_COUNT 100
+// Maximum number of nested values followed to find a declaration
+#define MAX_DEF_DEPTH 100
 
 using namespace llvm;
 
@@ -21,10 +23,14 @@ bool isLibraryFunction(Function *);
 bool isManagementFunction(Function *);
 // Check if the specified global variable is introduced by management
 bool isManagementVariable(GlobalVariable *gvar);
+// Check if the specified global variable keeps management state of a thread
+bool isThreadPrivateVariable(GlobalVariable *gvar);
 // Get the size of specified type by bytes
 uint64_t getTypeSize(const DataLayout *dl, Type * ty);
+// Return the call graph nodes that belong to recursive SCCs, mapped to the ID of their SCC
+std::unordered_map <CallGraphNode *, unsigned> getRecursiveSCCs(CallGraph &cg);
 //Return all the paths iteratively from a graph rooted at the node specified and recursive functions
-std::pair<std::vector<std::vector<CallGraphNode::CallRecord *> >, std::unordered_set<CallGraphNode *> > getPaths(CallGraphNode::CallRecord *root);
+std::pair<std::vector<std::vector<CallGraphNode::CallRecord *> >, std::unordered_set<CallGraphNode *> > getPaths(CallGraph &cg, CallGraphNode::CallRecord *root);
 // Return the possible declarations of the specified value
 inline bool isHeapData(Value *val);
 std::vector <std::pair<Value *, Segment> > getDeclarations(Value *, std::unordered_map <Function *, std::vector<CallInst *> > &);
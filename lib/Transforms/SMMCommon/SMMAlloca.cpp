@@ -0,0 +1,358 @@
+//===- SMMAlloca.cpp - Place hot stack variables in the SPM ---------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file places single stack variables (allocas) of user functions in the
+// SPM. user-stack and smmssm move whole stacks or frames, so a large cold
+// buffer takes as much SPM as a small hot array of the same frame. Here each
+// variable is chosen on its own: its accesses are estimated from the profile
+// where available and from its loop depth otherwise, scaled by how often its
+// function is called, and a 0/1 knapsack picks the variables with the most
+// accesses that fit in -spm-frame-size bytes.
+//
+// Chosen variables are moved into a statically allocated SPM frame area
+// (_spm_frame_area, section .spm_data), which is only valid while one
+// activation of the function exists at a time and nothing holds on to the
+// address. So functions that may be re-entered (recursive, address taken, or
+// reaching an indirect call or a library call given a callback) are skipped,
+// as are variables whose address escapes, and programs with threads.
+//
+// The pass has to run before the stack managers, which then see the smaller
+// frames.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Pass.h"
+#include "llvm/ADT/SCCIterator.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/BlockFrequencyInfo.h"
+#include "llvm/Analysis/CallGraph.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/IR/CallSite.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "Helper.h"
+
+#define DEBUG_TYPE "smm-alloca"
+
+// Granularity of the SPM frame area in the knapsack, in bytes
+#define FRAME_GRANULE 8
+
+using namespace llvm;
+
+STATISTIC(NumSPMAllocas, "Number of stack variables placed in the SPM");
+STATISTIC(NumSPMAllocaBytes, "Bytes of stack variables placed in the SPM");
+
+static cl::opt<unsigned long long> spmFrameSize("spm-frame-size", cl::init(0),
+	cl::desc("Bytes of SPM for the hot stack variables of functions"), cl::value_desc("number of bytes"));
+
+namespace {
+    struct SMMAllocaPass : public ModulePass {
+	static char ID; // Pass identification, replacement for typeid
+	SMMAllocaPass() : ModulePass(ID) {}
+
+	struct Candidate {
+	    AllocaInst *alloca;
+	    uint64_t size;
+	    unsigned align;
+	    // Estimated number of accesses in a run of the program
+	    double accesses;
+	};
+
+	virtual void getAnalysisUsage(AnalysisUsage &AU) const {
+	    AU.addRequired<CallGraphWrapperPass>();
+	    AU.addRequired<LoopInfoWrapperPass>();
+	    AU.addRequired<BlockFrequencyInfoWrapperPass>();
+	}
+
+	// Number of times each block runs per call to its function
+	std::unordered_map <BasicBlock *, double> blockWeights;
+
+	// Estimate the number of times each block of the specified function runs per call
+	void computeBlockWeights(Function &func) {
+	    Optional<uint64_t> entryCount = func.getEntryCount();
+	    if (entryCount && *entryCount) {
+		BlockFrequencyInfo &BFI = getAnalysis<BlockFrequencyInfoWrapperPass>(func).getBFI();
+		for (BasicBlock &bb : func) {
+		    Optional<uint64_t> count = BFI.getBlockProfileCount(&bb);
+		    blockWeights[&bb] = count ? (double)*count / *entryCount : 0;
+		}
+		return;
+	    }
+	    LoopInfo &LI = getAnalysis<LoopInfoWrapperPass>(func).getLoopInfo();
+	    for (BasicBlock &bb : func)
+		blockWeights[&bb] = std::pow(DEFAULT_TRIP_COUNT, LI.getLoopDepth(&bb));
+	}
+
+	double getBlockWeight(BasicBlock *bb) {
+	    return blockWeights[bb];
+	}
+
+	// Check if the specified function calls a function that is not known at compile time,
+	// or hands a function to a library function that may call it back
+	bool callsUnknownCode(Function *func) {
+	    for (BasicBlock &bb : *func) {
+		for (Instruction &inst : bb) {
+		    CallSite cs(&inst);
+		    if (!cs || isa<IntrinsicInst>(inst))
+			continue;
+		    Function *callee = dyn_cast<Function>(cs.getCalledValue()->stripPointerCasts());
+		    if (!callee) {
+			if (!cs.isInlineAsm())
+			    return true;
+			continue;
+		    }
+		    if (!isLibraryFunction(callee))
+			continue;
+		    for (Value *arg : cs.args()) {
+			if (isa<Function>(arg->stripPointerCasts()))
+			    return true;
+		    }
+		}
+	    }
+	    return false;
+	}
+
+	// Find the functions that may have more than one activation at a time
+	std::unordered_set <Function *> getReenterableFunctions(CallGraph &cg) {
+	    std::unordered_set <Function *> reenterable;
+	    // Functions that reach unknown code, which may call back any function
+	    std::unordered_set <Function *> reachUnknown;
+	    // Callees come before their callers
+	    for (scc_iterator<CallGraph *> scci = scc_begin(&cg); !scci.isAtEnd(); ++scci) {
+		const std::vector<CallGraphNode *> &scc = *scci;
+		bool reenter = scci.hasLoop();
+		bool unknown = false;
+		for (CallGraphNode *cgn : scc) {
+		    Function *func = cgn->getFunction();
+		    if (!func || func->isDeclaration())
+			continue;
+		    if (func->hasAddressTaken())
+			reenter = true;
+		    if (callsUnknownCode(func))
+			unknown = true;
+		    for (CallGraphNode::iterator cgni = cgn->begin(), cgne = cgn->end(); cgni != cgne; cgni++) {
+			Function *callee = cgni->second->getFunction();
+			if (callee && reachUnknown.count(callee))
+			    unknown = true;
+		    }
+		}
+		for (CallGraphNode *cgn : scc) {
+		    Function *func = cgn->getFunction();
+		    if (!func)
+			continue;
+		    if (unknown)
+			reachUnknown.insert(func);
+		    if (reenter || unknown)
+			reenterable.insert(func);
+		}
+	    }
+	    return reenterable;
+	}
+
+	// Estimate how many times each function is called in a run of the program
+	std::unordered_map <Function *, double> getCallWeights(CallGraph &cg) {
+	    std::vector<CallGraphNode *> order;
+	    for (scc_iterator<CallGraph *> scci = scc_begin(&cg); !scci.isAtEnd(); ++scci)
+		order.insert(order.end(), (*scci).begin(), (*scci).end());
+	    // Callers come before their callees
+	    std::reverse(order.begin(), order.end());
+
+	    std::unordered_map <Function *, double> weights;
+	    for (CallGraphNode *cgn : order) {
+		Function *func = cgn->getFunction();
+		if (!func || func->isDeclaration())
+		    continue;
+		if (Optional<uint64_t> entryCount = func->getEntryCount())
+		    weights[func] = *entryCount;
+		// Functions without known callers, like main, run once
+		else if (!weights.count(func))
+		    weights[func] = 1;
+		for (CallGraphNode::iterator cgni = cgn->begin(), cgne = cgn->end(); cgni != cgne; cgni++) {
+		    Function *callee = cgni->second->getFunction();
+		    Instruction *call = dyn_cast_or_null<Instruction>(cgni->first);
+		    if (!callee || callee->isDeclaration() || !call || callee == func)
+			continue;
+		    weights[callee] += weights[func] * getBlockWeight(call->getParent());
+		}
+	    }
+	    return weights;
+	}
+
+	// Add up the accesses through the specified pointer, and return false if it escapes
+	bool getAccesses(Value *ptr, double &accesses) {
+	    for (User *user : ptr->users()) {
+		Instruction *inst = cast<Instruction>(user);
+		if (isa<LoadInst>(inst)) {
+		    accesses += getBlockWeight(inst->getParent());
+		} else if (StoreInst *store = dyn_cast<StoreInst>(inst)) {
+		    // Storing the address itself lets it escape
+		    if (store->getValueOperand() == ptr)
+			return false;
+		    accesses += getBlockWeight(inst->getParent());
+		} else if (isa<GetElementPtrInst>(inst) || isa<BitCastInst>(inst)) {
+		    if (!getAccesses(inst, accesses))
+			return false;
+		} else if (isa<MemIntrinsic>(inst)) {
+		    accesses += getBlockWeight(inst->getParent());
+		} else if (IntrinsicInst *intr = dyn_cast<IntrinsicInst>(inst)) {
+		    if (intr->getIntrinsicID() != Intrinsic::lifetime_start && intr->getIntrinsicID() != Intrinsic::lifetime_end)
+			return false;
+		} else if (!isa<ICmpInst>(inst)) {
+		    return false;
+		}
+	    }
+	    return true;
+	}
+
+	// Remove the lifetime markers of the specified pointer, which does not point to the stack any more
+	void removeLifetimeMarkers(Value *ptr) {
+	    std::vector<Instruction *> markers;
+	    for (User *user : ptr->users()) {
+		if (isa<GetElementPtrInst>(user) || isa<BitCastInst>(user))
+		    removeLifetimeMarkers(user);
+		else if (IntrinsicInst *intr = dyn_cast<IntrinsicInst>(user)) {
+		    if (intr->getIntrinsicID() == Intrinsic::lifetime_start || intr->getIntrinsicID() == Intrinsic::lifetime_end)
+			markers.push_back(intr);
+		}
+	    }
+	    for (Instruction *marker : markers)
+		marker->eraseFromParent();
+	}
+
+	// Choose the candidates with the most accesses that fit in the specified number of granules
+	std::vector<Candidate *> select(std::vector<Candidate> &candidates, unsigned long capacity) {
+	    std::vector<unsigned long> weight;
+	    for (Candidate &c : candidates) {
+		uint64_t granule = std::max<uint64_t>(FRAME_GRANULE, c.align);
+		// Round up, so padding for alignment never exceeds the budget
+		weight.push_back((c.size + granule - 1) / granule * granule / FRAME_GRANULE);
+	    }
+	    std::vector<double> best(capacity + 1, 0);
+	    std::vector<std::vector<bool> > taken(candidates.size(), std::vector<bool>(capacity + 1, false));
+	    for (size_t i = 0; i < candidates.size(); i++) {
+		for (unsigned long c = capacity; c >= weight[i]; c--) {
+		    double value = best[c - weight[i]] + candidates[i].accesses;
+		    if (value > best[c]) {
+			best[c] = value;
+			taken[i][c] = true;
+		    }
+		}
+	    }
+	    std::vector<Candidate *> chosen;
+	    unsigned long c = capacity;
+	    for (size_t i = candidates.size(); i-- > 0;) {
+		if (taken[i][c]) {
+		    chosen.push_back(&candidates[i]);
+		    c -= weight[i];
+		}
+	    }
+	    return chosen;
+	}
+
+	virtual bool runOnModule (Module &mod) {
+	    if (!spmFrameSize)
+		report_fatal_error("the size of the SPM frame area is missing, pass -spm-frame-size");
+	    // Threads would share the statically allocated variables
+	    if (mod.getFunction("pthread_create")) {
+		DEBUG(dbgs() << "skip multi-threaded program\n");
+		return false;
+	    }
+
+	    const DataLayout &dl = mod.getDataLayout();
+	    for (Function &func : mod) {
+		if (!func.isDeclaration())
+		    computeBlockWeights(func);
+	    }
+	    CallGraph &cg = getAnalysis<CallGraphWrapperPass>().getCallGraph();
+	    std::unordered_set <Function *> reenterable = getReenterableFunctions(cg);
+	    std::unordered_map <Function *, double> callWeights = getCallWeights(cg);
+
+	    std::vector<Candidate> candidates;
+	    for (Function &func : mod) {
+		if (isLibraryFunction(&func) || isManagementFunction(&func))
+		    continue;
+		if (reenterable.count(&func)) {
+		    DEBUG(dbgs() << func.getName() << " may be re-entered\n");
+		    continue;
+		}
+		for (Instruction &inst : func.getEntryBlock()) {
+		    AllocaInst *alloca = dyn_cast<AllocaInst>(&inst);
+		    if (!alloca || !alloca->isStaticAlloca())
+			continue;
+		    Candidate c;
+		    c.alloca = alloca;
+		    c.size = dl.getTypeAllocSize(alloca->getAllocatedType()) * cast<ConstantInt>(alloca->getArraySize())->getZExtValue();
+		    c.align = std::max(alloca->getAlignment(), dl.getPrefTypeAlignment(alloca->getAllocatedType()));
+		    c.accesses = 0;
+		    if (!getAccesses(alloca, c.accesses)) {
+			DEBUG(dbgs() << "address of " << func.getName() << ":" << alloca->getName() << " escapes\n");
+			continue;
+		    }
+		    c.accesses *= callWeights[&func];
+		    if (c.size == 0 || c.size > spmFrameSize || c.accesses == 0)
+			continue;
+		    candidates.push_back(c);
+		}
+	    }
+	    std::vector<Candidate *> chosen = select(candidates, spmFrameSize / FRAME_GRANULE);
+	    if (chosen.empty())
+		return false;
+
+	    // Lay the chosen variables out with the most aligned first
+	    std::stable_sort(chosen.begin(), chosen.end(), [](Candidate *a, Candidate *b) { return a->align > b->align; });
+	    std::vector<uint64_t> offsets;
+	    uint64_t size = 0;
+	    unsigned align = 1;
+	    for (Candidate *c : chosen) {
+		size = alignTo(size, c->align);
+		offsets.push_back(size);
+		size += c->size;
+		align = std::max(align, c->align);
+	    }
+
+	    LLVMContext &context = mod.getContext();
+	    ArrayType *ty_area = ArrayType::get(Type::getInt8Ty(context), size);
+	    GlobalVariable *area = new GlobalVariable(mod, ty_area, false, GlobalValue::InternalLinkage,
+		    ConstantAggregateZero::get(ty_area), "_spm_frame_area");
+	    area->setSection(".spm_data");
+	    area->setAlignment(align);
+
+	    for (size_t i = 0; i < chosen.size(); i++) {
+		AllocaInst *alloca = chosen[i]->alloca;
+		DEBUG(dbgs() << alloca->getFunction()->getName() << ":" << alloca->getName() << " (" << chosen[i]->size
+			<< " bytes, " << chosen[i]->accesses << " accesses) at offset " << offsets[i] << "\n");
+		Constant *indices[] = {ConstantInt::get(Type::getInt64Ty(context), 0), ConstantInt::get(Type::getInt64Ty(context), offsets[i])};
+		Constant *addr = ConstantExpr::getInBoundsGetElementPtr(ty_area, area, indices);
+		removeLifetimeMarkers(alloca);
+		alloca->replaceAllUsesWith(ConstantExpr::getBitCast(addr, alloca->getType()));
+		alloca->eraseFromParent();
+		NumSPMAllocas++;
+		NumSPMAllocaBytes += chosen[i]->size;
+	    }
+	    return true;
+	}
+    };
+}
+
+char SMMAllocaPass::ID = 0;
+static RegisterPass<SMMAllocaPass> X("smm-alloca", "Place hot stack variables in the SPM");
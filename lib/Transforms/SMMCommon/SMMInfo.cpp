@@ -0,0 +1,199 @@
+//===- SMMInfo.cpp - Results shared between the SPM management passes -----===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements the SMMInfo immutable pass, see SMMInfo.h.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DataLayout.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <fstream>
+
+#include "SMMInfo.h"
+
+#define DEBUG_TYPE "smm-info"
+
+using namespace llvm;
+
+static cl::opt<std::string> infoInput("smm-info-input", cl::desc("Read the SPM management information from a YAML file"), cl::value_desc("filename"));
+static cl::opt<std::string> infoOutput("smm-info-output", cl::desc("Write the SPM management information to a YAML file"), cl::value_desc("filename"));
+static cl::opt<std::string> funcSizeFile("smm-func-size", cl::desc("Specify the file that stores the code sizes of functions"), cl::value_desc("filename"));
+static cl::opt<std::string> dmaModelFile("smm-dma-model", cl::desc("Read the DMA cost model from a YAML file"), cl::value_desc("filename"));
+static cl::opt<unsigned long long> dmaSetupCycles("smm-dma-setup-cycles", cl::init(0), cl::desc("Fixed cycles to start a DMA transfer"), cl::value_desc("number of cycles"));
+static cl::opt<unsigned long long> dmaBytesPerCycle("smm-dma-bytes-per-cycle", cl::init(1), cl::desc("DMA bandwidth"), cl::value_desc("number of bytes"));
+static cl::opt<unsigned long long> dmaAlignment("smm-dma-alignment", cl::init(1), cl::desc("Granularity DMA transfers are padded to"), cl::value_desc("number of bytes"));
+static cl::opt<unsigned long long> dmaMaxBurst("smm-dma-max-burst", cl::init(0), cl::desc("Largest DMA transfer of one command, 0 if unlimited"), cl::value_desc("number of bytes"));
+static cl::opt<unsigned> instSize("smm-inst-size", cl::init(4), cl::desc("Bytes per IR instruction when estimating code sizes"), cl::value_desc("number of bytes"));
+
+// Return address and saved frame pointer
+#define FRAME_LINKAGE_SIZE 16
+
+char SMMInfo::ID = 0;
+static RegisterPass<SMMInfo> X("smm-info", "SPM Management Information", false, true);
+
+uint64_t SMMDMAModel::getTransferCost(uint64_t bytes) const {
+    if (bytes == 0)
+        return 0;
+    bytes = alignTo(bytes, Alignment);
+    uint64_t bursts = MaxBurst ? (bytes + MaxBurst - 1) / MaxBurst : 1;
+    return bursts * SetupCycles + (bytes + BytesPerCycle - 1) / BytesPerCycle;
+}
+
+SMMInfo::SMMInfo() : ImmutablePass(ID) {
+    data.NumRegions = 0;
+}
+
+// Initialize the DMA cost model, options given on the command line override the YAML description
+static void initDMAModel(SMMDMAModel &model) {
+    model.SetupCycles = dmaSetupCycles;
+    model.BytesPerCycle = dmaBytesPerCycle;
+    model.Alignment = dmaAlignment;
+    model.MaxBurst = dmaMaxBurst;
+
+    if (!dmaModelFile.empty()) {
+        ErrorOr<std::unique_ptr<MemoryBuffer>> buf = MemoryBuffer::getFile(dmaModelFile);
+        if (std::error_code ec = buf.getError())
+            report_fatal_error("cannot open " + dmaModelFile + ": " + ec.message());
+        yaml::Input in((*buf)->getBuffer());
+        in >> model;
+        if (in.error())
+            report_fatal_error("cannot parse " + dmaModelFile);
+        if (dmaSetupCycles.getNumOccurrences())
+            model.SetupCycles = dmaSetupCycles;
+        if (dmaBytesPerCycle.getNumOccurrences())
+            model.BytesPerCycle = dmaBytesPerCycle;
+        if (dmaAlignment.getNumOccurrences())
+            model.Alignment = dmaAlignment;
+        if (dmaMaxBurst.getNumOccurrences())
+            model.MaxBurst = dmaMaxBurst;
+    }
+
+    if (model.BytesPerCycle == 0 || model.Alignment == 0)
+        report_fatal_error("DMA bandwidth and alignment must be non-zero");
+    DEBUG(dbgs() << "DMA cost model: setup " << model.SetupCycles << " cycles, " << model.BytesPerCycle << " bytes/cycle, alignment " << model.Alignment << ", max burst " << model.MaxBurst << "\n");
+}
+
+bool SMMInfo::doInitialization(Module &mod) {
+    initDMAModel(dmaModel);
+
+    if (!infoInput.empty()) {
+        ErrorOr<std::unique_ptr<MemoryBuffer>> buf = MemoryBuffer::getFile(infoInput);
+        if (std::error_code ec = buf.getError())
+            report_fatal_error("cannot open " + infoInput + ": " + ec.message());
+        yaml::Input in((*buf)->getBuffer());
+        in >> data;
+        if (in.error())
+            report_fatal_error("cannot parse " + infoInput);
+    }
+
+    if (!funcSizeFile.empty()) {
+        std::vector<SMMSizeEntry> sizes;
+        if (!readSizeList(funcSizeFile, sizes))
+            report_fatal_error("cannot read " + funcSizeFile);
+        setFuncSizes(sizes);
+    }
+    return false;
+}
+
+bool SMMInfo::doFinalization(Module &mod) {
+    if (infoOutput.empty())
+        return false;
+    std::error_code ec;
+    raw_fd_ostream os(infoOutput, ec, sys::fs::F_Text);
+    if (ec)
+        report_fatal_error("cannot open " + infoOutput + ": " + ec.message());
+    yaml::Output out(os);
+    out << data;
+    return false;
+}
+
+bool SMMInfo::readSizeList(StringRef fileName, std::vector<SMMSizeEntry> &sizes) {
+    std::ifstream ifs;
+    ifs.open(fileName.str(), std::ifstream::in | std::ifstream::binary);
+    if (!ifs.good())
+        return false;
+    while (ifs.good()) {
+        SMMSizeEntry entry;
+        entry.Size = 0;
+        ifs >> entry.Name >> entry.Size;
+        // Ignore white spaces after the last line
+        if (entry.Name.empty())
+            continue;
+        sizes.push_back(entry);
+    }
+    return true;
+}
+
+std::unordered_map <Function *, unsigned long> SMMInfo::getFuncSizes(Module &mod) {
+    std::unordered_map <Function *, unsigned long> funcSize;
+
+    if (hasFuncSizes()) {
+        for (const SMMSizeEntry &entry : data.FuncSizes) {
+            if (Function *func = mod.getFunction(entry.Name))
+                funcSize[func] = entry.Size;
+        }
+        return funcSize;
+    }
+
+    // No measured sizes, so approximate them by the number of IR instructions
+    DEBUG(dbgs() << "estimating function sizes from IR\n");
+    for (Function &func : mod) {
+        if (func.isDeclaration())
+            continue;
+        unsigned long size = 0;
+        for (BasicBlock &bb : func)
+            size += bb.size() * instSize;
+        funcSize[&func] = size;
+    }
+    return funcSize;
+}
+
+std::unordered_map <Function *, size_t> SMMInfo::getStackFrameSizes(Module &mod) {
+    std::unordered_map <Function *, size_t> frameSize;
+
+    if (hasStackFrameSizes()) {
+        for (const SMMSizeEntry &entry : data.StackFrameSizes) {
+            if (Function *func = mod.getFunction(entry.Name))
+                frameSize[func] = entry.Size;
+        }
+        return frameSize;
+    }
+
+    // No measured sizes, so approximate them by the static allocas of each function
+    DEBUG(dbgs() << "estimating stack frame sizes from IR\n");
+    const DataLayout &dl = mod.getDataLayout();
+    for (Function &func : mod) {
+        if (func.isDeclaration())
+            continue;
+        size_t size = FRAME_LINKAGE_SIZE;
+        for (Instruction &inst : func.getEntryBlock()) {
+            AllocaInst *alloca = dyn_cast<AllocaInst>(&inst);
+            if (!alloca || !alloca->isStaticAlloca())
+                continue;
+            uint64_t count = cast<ConstantInt>(alloca->getArraySize())->getZExtValue();
+            size += alignTo(dl.getTypeAllocSize(alloca->getAllocatedType()) * count, 8);
+        }
+        frameSize[&func] = size;
+    }
+    return frameSize;
+}
+
+void SMMInfo::setMapping(unsigned numRegions, const std::vector<SMMRegionEntry> &mapping) {
+    data.NumRegions = numRegions;
+    data.Mapping = mapping;
+}
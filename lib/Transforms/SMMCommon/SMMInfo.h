@@ -0,0 +1,218 @@
+//===- SMMInfo.h - Results shared between the SPM management passes -------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// SMMInfo is an immutable pass that holds the information the SPM passes
+// exchange with each other: the user functions of the program, function code
+// sizes, stack frame sizes, the overlay mapping of functions to regions, the
+// emulated execution trace, the SPM size chosen by smmmo-opt-size and the DMA
+// cost model of the target. Producer passes (smmcmh-funcinfo, smmcmh-overlay,
+// smmcmh-exec, smmmo-opt-size) store their results here, and consumer passes
+// (smmmo, smmcm, smmssm) read them back within the same opt invocation.
+//
+// The contents can be loaded from and saved to YAML with -smm-info-input and
+// -smm-info-output, and code sizes measured by external tools can be read
+// with -smm-func-size. The DMA cost model is described by -smm-dma-* options
+// or a YAML file given with -smm-dma-model.
+//
+// SMMInfo lives in the SMMCommon plugin; the other SPM plugins resolve it from
+// there, so SMMCommon has to be loaded first.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef __SMM_INFO_H__
+#define __SMM_INFO_H__
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Pass.h"
+#include "llvm/Support/YAMLTraits.h"
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace llvm;
+
+// A size in bytes associated with a function
+struct SMMSizeEntry {
+    std::string Name;
+    uint64_t Size;
+};
+
+// An SPM size considered by smmmo-opt-size and the cost of the mapping for it.
+// Name is "min" or "max" for the range of sizes and "opt" for the chosen one.
+struct SMMSPMSizeEntry {
+    std::string Name;
+    uint64_t Size;
+    uint64_t Cost;
+};
+
+// The overlay region a function is mapped to
+struct SMMRegionEntry {
+    std::string Name;
+    unsigned Region;
+};
+
+// One event of the emulated execution trace: a call to a function executed
+// Count times, or the beginning or end of a loop at nesting level Depth
+struct SMMTraceEntry {
+    enum EntryKind { Call, LoopBegin, LoopEnd };
+
+    EntryKind Kind;
+    std::string Name;
+    unsigned Loop;
+    uint64_t Count;
+    unsigned Depth;
+};
+
+// Cost of DMA transfers between SPM and main memory. A transfer is padded to
+// the alignment granularity and split into bursts of at most MaxBurst bytes,
+// and each burst pays a fixed setup latency.
+struct SMMDMAModel {
+    uint64_t SetupCycles;
+    uint64_t BytesPerCycle;
+    uint64_t Alignment;
+    uint64_t MaxBurst; // 0 if unlimited
+
+    // Cycles taken to transfer the specified number of bytes
+    uint64_t getTransferCost(uint64_t bytes) const;
+};
+
+LLVM_YAML_IS_SEQUENCE_VECTOR(std::string)
+LLVM_YAML_IS_SEQUENCE_VECTOR(SMMSizeEntry)
+LLVM_YAML_IS_SEQUENCE_VECTOR(SMMSPMSizeEntry)
+LLVM_YAML_IS_SEQUENCE_VECTOR(SMMRegionEntry)
+LLVM_YAML_IS_SEQUENCE_VECTOR(SMMTraceEntry)
+
+struct SMMInfoData {
+    std::vector<std::string> Functions;
+    std::vector<SMMSizeEntry> FuncSizes;
+    std::vector<SMMSizeEntry> StackFrameSizes;
+    unsigned NumRegions;
+    std::vector<SMMRegionEntry> Mapping;
+    std::vector<SMMTraceEntry> ExecTrace;
+    std::vector<SMMSPMSizeEntry> SPMSizes;
+};
+
+class SMMInfo : public ImmutablePass {
+    public:
+    static char ID; // Pass identification, replacement for typeid
+    SMMInfo();
+
+    bool doInitialization(Module &mod) override;
+    bool doFinalization(Module &mod) override;
+
+    // User functions of the program
+    void setUserFunctions(const std::vector<std::string> &funcs) { data.Functions = funcs; }
+    const std::vector<std::string> &getUserFunctions() const { return data.Functions; }
+
+    // Code sizes of functions, estimated from the IR if they are not given
+    void setFuncSizes(const std::vector<SMMSizeEntry> &sizes) { data.FuncSizes = sizes; }
+    bool hasFuncSizes() const { return !data.FuncSizes.empty(); }
+    std::unordered_map <Function *, unsigned long> getFuncSizes(Module &mod);
+
+    // Stack frame sizes of functions, estimated from the IR if they are not given
+    void setStackFrameSizes(const std::vector<SMMSizeEntry> &sizes) { data.StackFrameSizes = sizes; }
+    bool hasStackFrameSizes() const { return !data.StackFrameSizes.empty(); }
+    std::unordered_map <Function *, size_t> getStackFrameSizes(Module &mod);
+
+    // Mapping from functions to overlay regions
+    void setMapping(unsigned numRegions, const std::vector<SMMRegionEntry> &mapping);
+    bool hasMapping() const { return !data.Mapping.empty(); }
+    unsigned getNumRegions() const { return data.NumRegions; }
+    const std::vector<SMMRegionEntry> &getMapping() const { return data.Mapping; }
+
+    // Emulated execution trace
+    void setExecTrace(const std::vector<SMMTraceEntry> &trace) { data.ExecTrace = trace; }
+    const std::vector<SMMTraceEntry> &getExecTrace() const { return data.ExecTrace; }
+
+    // SPM sizes chosen by smmmo-opt-size
+    void setSPMSizes(const std::vector<SMMSPMSizeEntry> &sizes) { data.SPMSizes = sizes; }
+    const std::vector<SMMSPMSizeEntry> &getSPMSizes() const { return data.SPMSizes; }
+
+    // DMA cost model of the target
+    const SMMDMAModel &getDMAModel() const { return dmaModel; }
+
+    // Read a list of "<function name> <size>" lines as produced by the size measurement scripts
+    static bool readSizeList(StringRef fileName, std::vector<SMMSizeEntry> &sizes);
+
+    private:
+    SMMInfoData data;
+    SMMDMAModel dmaModel;
+};
+
+namespace llvm {
+namespace yaml {
+
+template <> struct MappingTraits<SMMSizeEntry> {
+    static void mapping(IO &io, SMMSizeEntry &entry) {
+        io.mapRequired("Name", entry.Name);
+        io.mapRequired("Size", entry.Size);
+    }
+};
+
+template <> struct MappingTraits<SMMSPMSizeEntry> {
+    static void mapping(IO &io, SMMSPMSizeEntry &entry) {
+        io.mapRequired("Name", entry.Name);
+        io.mapRequired("Size", entry.Size);
+        io.mapRequired("Cost", entry.Cost);
+    }
+};
+
+template <> struct MappingTraits<SMMRegionEntry> {
+    static void mapping(IO &io, SMMRegionEntry &entry) {
+        io.mapRequired("Name", entry.Name);
+        io.mapRequired("Region", entry.Region);
+    }
+};
+
+template <> struct ScalarEnumerationTraits<SMMTraceEntry::EntryKind> {
+    static void enumeration(IO &io, SMMTraceEntry::EntryKind &kind) {
+        io.enumCase(kind, "Call", SMMTraceEntry::Call);
+        io.enumCase(kind, "LoopBegin", SMMTraceEntry::LoopBegin);
+        io.enumCase(kind, "LoopEnd", SMMTraceEntry::LoopEnd);
+    }
+};
+
+template <> struct MappingTraits<SMMTraceEntry> {
+    static void mapping(IO &io, SMMTraceEntry &entry) {
+        io.mapRequired("Kind", entry.Kind);
+        io.mapOptional("Name", entry.Name, std::string());
+        io.mapOptional("Loop", entry.Loop, 0u);
+        io.mapOptional("Count", entry.Count, (uint64_t)0);
+        io.mapOptional("Depth", entry.Depth, 0u);
+    }
+};
+
+template <> struct MappingTraits<SMMDMAModel> {
+    static void mapping(IO &io, SMMDMAModel &model) {
+        io.mapOptional("SetupCycles", model.SetupCycles);
+        io.mapOptional("BytesPerCycle", model.BytesPerCycle);
+        io.mapOptional("Alignment", model.Alignment);
+        io.mapOptional("MaxBurst", model.MaxBurst);
+    }
+};
+
+template <> struct MappingTraits<SMMInfoData> {
+    static void mapping(IO &io, SMMInfoData &data) {
+        io.mapOptional("Functions", data.Functions);
+        io.mapOptional("FunctionSizes", data.FuncSizes);
+        io.mapOptional("StackFrameSizes", data.StackFrameSizes);
+        io.mapOptional("NumRegions", data.NumRegions, 0u);
+        io.mapOptional("Mapping", data.Mapping);
+        io.mapOptional("ExecTrace", data.ExecTrace);
+        io.mapOptional("SPMSizes", data.SPMSizes);
+    }
+};
+
+} // end namespace yaml
+} // end namespace llvm
+
+#endif
@@ -0,0 +1,160 @@
+//===- SMMLTO.cpp - Whole-program SPM management at link time -------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file runs the SPM managers inside the LTO pipeline, on the module that
+// the linker merged from all bitcode inputs. The passes treat every
+// declaration as a library function, so run on one translation unit they
+// never manage code of the others; at link time they see the whole program.
+//
+// The plugins are loaded into llvm-lto or llvm-lto2 like into opt, e.g.
+//   llvm-lto -load SMMCommon.so -load LLVMSMMCMH.so -load LLVMSMMCM.so
+//            -smm-lto=code -spm-size=4096 ...
+// and -smm-lto selects the managers. libLTO and the gold plugin only export
+// their C API, so the plugins cannot resolve LLVM against them and are not
+// supported there; link through llvm-lto or llvm-lto2 instead.
+//
+// The managers are added after the LTO optimizations, so they see the code
+// that is emitted. Passes are looked up by name when the pipeline is built, so every
+// plugin only has to be loaded by then.
+//
+// The linker drops the declarations of the runtime that no input uses yet, so
+// smm-lto-runtime declares the functions and variables the managers call and
+// access before they run. The LTO optimizations also give functions that are
+// only called directly the fast calling convention, while code management
+// calls them through pointers with the C one, so smm-lto-runtime turns them
+// back into C functions.
+//
+// Support libraries built as bitcode are managed like the program if they
+// are linked in. Inputs named by -lto-main-memory-input are left in main
+// memory (section .user_text, marked "smm-main-memory") instead, like the SPM
+// runtime has to be.
+//
+// Only regular LTO has a whole-program module; ThinLTO backends do not run
+// these passes.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/IR/CallSite.h"
+#include "llvm/IR/DerivedTypes.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Pass.h"
+#include "llvm/PassInfo.h"
+#include "llvm/PassRegistry.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/ErrorHandling.h"
+#include "llvm/Transforms/IPO/PassManagerBuilder.h"
+
+using namespace llvm;
+
+namespace {
+    enum Manager { HeapMnmt, StackMnmt, CodeMnmt, ThreadMnmt };
+}
+
+static cl::bits<Manager> smmLTO("smm-lto", cl::CommaSeparated,
+	cl::desc("SPM managers to run on the whole program at link time"),
+	cl::values(
+	    clEnumValN(HeapMnmt, "heap", "Heap management (user-heap)"),
+	    clEnumValN(StackMnmt, "stack", "Stack management (smm-prolog, smmssm)"),
+	    clEnumValN(CodeMnmt, "code", "Code management (smmcmh-funcinfo, smmcmh-exec, smmcmh-overlay, smmcm)"),
+	    clEnumValN(ThreadMnmt, "thread", "Thread-private management state (smm-thread)")));
+
+namespace {
+    // Declare the runtime of the selected managers where the module lacks it,
+    // and undo calling conventions the managers do not preserve
+    struct SMMLTORuntime : public ModulePass {
+	static char ID; // Pass identification, replacement for typeid
+	SMMLTORuntime() : ModulePass(ID) {}
+
+	void declareVariable(Module &mod, StringRef name, Type *ty) {
+	    if (!mod.getNamedValue(name))
+		new GlobalVariable(mod, ty, false, GlobalValue::ExternalLinkage, nullptr, name);
+	}
+
+	virtual bool runOnModule(Module &mod) {
+	    LLVMContext &context = mod.getContext();
+	    Type *ty_void = Type::getVoidTy(context);
+	    Type *ty_int32 = Type::getInt32Ty(context);
+	    Type *ty_int64 = Type::getInt64Ty(context);
+	    PointerType *ptrTy_int8 = Type::getInt8PtrTy(context);
+	    unsigned numGlobals = mod.getGlobalList().size() + mod.getFunctionList().size();
+
+	    if (smmLTO.isSet(HeapMnmt))
+		mod.getOrInsertFunction("_allocate", ptrTy_int8, ty_int64, nullptr);
+	    if (smmLTO.isSet(StackMnmt)) {
+		mod.getOrInsertFunction("_sstore", ty_void, nullptr);
+		mod.getOrInsertFunction("_sload", ty_void, nullptr);
+		mod.getOrInsertFunction("_g2l", ptrTy_int8, ptrTy_int8, ty_int64, nullptr);
+		mod.getOrInsertFunction("_l2g", ptrTy_int8, ptrTy_int8, nullptr);
+		declareVariable(mod, "_stack_pointer", ptrTy_int8);
+		declareVariable(mod, "_mem_stack_base", ptrTy_int8);
+		declareVariable(mod, "_spm_stack_base", ptrTy_int8);
+		declareVariable(mod, "_mem_stack_depth", ty_int64);
+		// Elements are the SPM and main memory addresses of a saved stack
+		declareVariable(mod, "_mem_stack", ArrayType::get(StructType::get(ptrTy_int8, ptrTy_int8, nullptr), 0));
+	    }
+	    if (smmLTO.isSet(CodeMnmt)) {
+		mod.getOrInsertFunction("c_get", ptrTy_int8, ptrTy_int8, nullptr);
+		mod.getOrInsertFunction("c_init_reg", ty_void, ty_int32, nullptr);
+		mod.getOrInsertFunction("c_init_map", FunctionType::get(ty_void, ty_int32, true));
+		declareVariable(mod, "_region_table", ptrTy_int8);
+	    }
+	    bool changed = mod.getGlobalList().size() + mod.getFunctionList().size() != numGlobals;
+
+	    if (smmLTO.isSet(CodeMnmt)) {
+		for (Function &func : mod) {
+		    if (func.isDeclaration() || func.getCallingConv() != CallingConv::Fast)
+			continue;
+		    func.setCallingConv(CallingConv::C);
+		    for (User *user : func.users()) {
+			CallSite cs(user);
+			if (cs && cs.getCalledFunction() == &func)
+			    cs.setCallingConv(CallingConv::C);
+		    }
+		    changed = true;
+		}
+	    }
+	    return changed;
+	}
+    };
+}
+
+char SMMLTORuntime::ID = 0;
+static RegisterPass<SMMLTORuntime> Y("smm-lto-runtime", "Declare the SPM management runtime for -smm-lto");
+
+// Add the pass registered as the specified argument
+static void addPass(legacy::PassManagerBase &PM, StringRef arg, StringRef plugin) {
+    const PassInfo *info = PassRegistry::getPassRegistry()->getPassInfo(arg);
+    if (!info)
+	report_fatal_error("-smm-lto needs pass " + arg + ", load " + plugin);
+    PM.add(info->createPass());
+}
+
+static void addSMMPasses(const PassManagerBuilder &, legacy::PassManagerBase &PM) {
+    if (!smmLTO.getBits())
+	return;
+    PM.add(new SMMLTORuntime());
+    if (smmLTO.isSet(HeapMnmt))
+	addPass(PM, "user-heap", "SMMCommon");
+    if (smmLTO.isSet(StackMnmt)) {
+	addPass(PM, "smm-prolog", "SMMCommon");
+	addPass(PM, "smmssm", "SMMSSM");
+    }
+    if (smmLTO.isSet(CodeMnmt)) {
+	addPass(PM, "smmcmh-funcinfo", "LLVMSMMCMH");
+	addPass(PM, "smmcmh-exec", "LLVMSMMCMH");
+	addPass(PM, "smmcmh-overlay", "LLVMSMMCMH");
+	addPass(PM, "smmcm", "LLVMSMMCM");
+    }
+    // Has to run after all the other SPM passes
+    if (smmLTO.isSet(ThreadMnmt))
+	addPass(PM, "smm-thread", "SMMCommon");
+}
+
+static RegisterStandardPasses X(PassManagerBuilder::EP_FullLinkTimeOptimizationLast, addSMMPasses);
@@ -101,9 +101,7 @@ namespace {
 		}
 
 		// Create the new body of main function which calls smm_main and return 0
-        static LLVMContext TheContext;
-        static IRBuilder<> Builder(TheContext);
-		BasicBlock* entry_block = BasicBlock::Create(TheContext, "EntryBlock", func_main);
+		BasicBlock* entry_block = BasicBlock::Create(context, "EntryBlock", func_main);
 		builder.SetInsertPoint(entry_block);
 		builder.CreateCall(func_smm_main, args);
 		Value *zero = builder.getInt32(0);
@@ -0,0 +1,202 @@
+//===- SMMThread.cpp - Multi-threading support of SPM management ----------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file makes the SPM management state thread-private so that programs
+// using pthreads can be managed. It has to run after all the other SPM passes.
+//
+// Every thread runs on its own core with its own SPM, so the management state
+// of stacks and the code region table become thread-local variables, and each
+// core owns the code regions in its SPM. Functions started by pthread_create
+// are called through wrappers that ask the runtime to set up the SPM stack
+// window of the current core (_smm_thread_init) and switch the stack pointer
+// to it, like the main function does for the main thread. The wrappers also
+// repeat the code management initialization of main (c_init_reg, c_init_map
+// and their code cache counterparts), which fills in the region and mapping
+// tables of the thread.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Pass.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/InlineAsm.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Type.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/ValueMapper.h"
+
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "Helper.h"
+
+#define DEBUG_TYPE "smm-thread"
+
+using namespace llvm;
+
+namespace {
+
+    struct SMMThreadPass : public ModulePass {
+	static char ID; // Pass identification, replacement for typeid
+
+	// The code management initialization of main, and what it is computed from, in program order
+	std::vector<Instruction *> mainInit;
+
+	SMMThreadPass() : ModulePass(ID) {
+	}
+
+	// Collect the calls that initialize code management in main along with the instructions their
+	// arguments come from, like the loads of the region table
+	void collectManagementInit(Module &mod) {
+	    mainInit.clear();
+	    Function *func_main = mod.getFunction("main");
+	    if (!func_main || func_main->isDeclaration())
+		return;
+	    std::unordered_set<Instruction *> needed;
+	    std::vector<Instruction *> worklist;
+	    for (BasicBlock &bb : *func_main) {
+		for (Instruction &inst : bb) {
+		    CallInst *call_inst = dyn_cast<CallInst>(&inst);
+		    if (!call_inst || !call_inst->getCalledFunction())
+			continue;
+		    StringRef callee_name = call_inst->getCalledFunction()->getName();
+		    if (callee_name == "c_init_reg" || callee_name == "c_init_map" || callee_name == "c_init_cache" || callee_name == "c_init_cache_map")
+			worklist.push_back(call_inst);
+		}
+	    }
+	    while (!worklist.empty()) {
+		Instruction *inst = worklist.back();
+		worklist.pop_back();
+		if (!needed.insert(inst).second)
+		    continue;
+		for (Use &op : inst->operands()) {
+		    if (Instruction *op_inst = dyn_cast<Instruction>(op.get()))
+			worklist.push_back(op_inst);
+		}
+	    }
+	    for (BasicBlock &bb : *func_main) {
+		for (Instruction &inst : bb) {
+		    if (needed.count(&inst))
+			mainInit.push_back(&inst);
+		}
+	    }
+	}
+
+	// Create a wrapper that runs the specified thread function on the SPM stack of the current core
+	Function *getOrInsertThreadWrapper(Module &mod, Function *func) {
+	    LLVMContext &context = mod.getContext();
+	    std::string wrapper_name = "_smm_thread." + func->getName().str();
+	    if (Function *wrapper = mod.getFunction(wrapper_name))
+		return wrapper;
+
+	    // Pointer Types
+	    PointerType* ptrty_int8 = PointerType::get(IntegerType::get(context, 8), 0);
+	    PointerType* ptrty_ptrint8 = PointerType::get(ptrty_int8, 0);
+	    // Function Types
+	    std::vector<Type*> call_args;
+	    call_args.push_back(ptrty_ptrint8);
+	    FunctionType* functy_inline_asm = FunctionType::get(
+		    Type::getVoidTy(context), // Results
+		    call_args, // Params
+		    false); //isVarArg
+
+	    // Inline Assembly
+	    InlineAsm *func_putSP = InlineAsm::get(functy_inline_asm, "mov $0, %rsp;", "*m,~{rsp},~{dirflag},~{fpsr},~{flags}",true);
+	    InlineAsm *func_getSP = InlineAsm::get(functy_inline_asm, "mov %rsp, $0;", "=*m,~{dirflag},~{fpsr},~{flags}",true);
+
+	    // Global Variables
+	    GlobalVariable* mem_stack_base = mod.getGlobalVariable("_mem_stack_base");
+	    GlobalVariable* spm_stack_base = mod.getGlobalVariable("_spm_stack_base");
+	    assert(mem_stack_base && spm_stack_base);
+
+	    // Functions
+	    Constant *func_thread_init = mod.getOrInsertFunction("_smm_thread_init", Type::getVoidTy(context), nullptr);
+
+	    Function *wrapper = Function::Create(func->getFunctionType(), GlobalValue::InternalLinkage, wrapper_name, &mod);
+	    std::vector<Value*> args;
+	    for (Function::arg_iterator ai = wrapper->arg_begin(), ae = wrapper->arg_end(); ai != ae; ++ai)
+		args.push_back(&*ai);
+
+	    BasicBlock* entry_block = BasicBlock::Create(context, "entry", wrapper);
+	    IRBuilder<> builder(entry_block);
+	    // Set up the SPM stack window of the core the thread runs on
+	    builder.CreateCall(func_thread_init);
+	    // Initialize the code management state of the thread like main does for the main thread
+	    ValueToValueMapTy vmap;
+	    for (Instruction *inst : mainInit) {
+		Instruction *new_inst = inst->clone();
+		RemapInstruction(new_inst, vmap, RF_NoModuleLevelChanges | RF_IgnoreMissingLocals);
+		builder.Insert(new_inst, inst->getName());
+		vmap[inst] = new_inst;
+	    }
+	    builder.CreateCall(func_getSP, mem_stack_base);
+	    builder.CreateCall(func_putSP, spm_stack_base);
+	    CallInst *ret_val = builder.CreateCall(func, args);
+	    builder.CreateCall(func_putSP, mem_stack_base);
+	    if (ret_val->getType()->isVoidTy())
+		builder.CreateRetVoid();
+	    else
+		builder.CreateRet(ret_val);
+	    return wrapper;
+	}
+
+	virtual bool runOnModule(Module &mod) {
+	    bool changed = false;
+
+	    // Step 1: make the management state of the stack and code regions thread-local
+
+	    DEBUG(dbgs() << "Thread-local variables {\n");
+	    for (Module::global_iterator gi = mod.global_begin(), ge = mod.global_end(); gi != ge; ++gi) {
+		GlobalVariable *gvar = &*gi;
+		if (!isThreadPrivateVariable(gvar) || gvar->isThreadLocal())
+		    continue;
+		DEBUG(dbgs() << "\t" << gvar->getName() << "\n");
+		gvar->setThreadLocal(true);
+		changed = true;
+	    }
+	    DEBUG(dbgs() << "}\n");
+
+	    // Step 2: start threads on the SPM stack of their cores
+
+	    Function *func_pthread_create = mod.getFunction("pthread_create");
+	    if (!func_pthread_create)
+		return changed;
+
+	    collectManagementInit(mod);
+	    DEBUG(dbgs() << "Thread functions {\n");
+	    for (Value::user_iterator ui = func_pthread_create->user_begin(), ue = func_pthread_create->user_end(); ui != ue; ++ui) {
+		CallInst *call_inst = dyn_cast<CallInst>(*ui);
+		// Skip uses other than calls
+		if (!call_inst || call_inst->getCalledFunction() != func_pthread_create)
+		    continue;
+		// The third argument is the function the thread starts with
+		Value *start_routine = call_inst->getArgOperand(2);
+		Function *func = dyn_cast<Function>(start_routine->stripPointerCasts());
+		// Skip thread functions that are not known or not managed
+		if (!func || isLibraryFunction(func) || isManagementFunction(func))
+		    continue;
+		DEBUG(dbgs() << "\t" << func->getName() << "\n");
+		Function *wrapper = getOrInsertThreadWrapper(mod, func);
+		call_inst->setArgOperand(2, ConstantExpr::getBitCast(wrapper, start_routine->getType()));
+		changed = true;
+	    }
+	    DEBUG(dbgs() << "}\n");
+
+	    return changed;
+	}
+    };
+}
+
+char SMMThreadPass::ID = 0; //Id the pass.
+static RegisterPass<SMMThreadPass> X("smm-thread", "SMM Multi-threading Pass"); //Register the pass.
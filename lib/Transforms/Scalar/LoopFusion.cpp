@@ -0,0 +1,468 @@
+//===- LoopFusion.cpp - Loop fusion pass ----------------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This pass fuses adjacent loops with the same trip count into one, the
+// inverse of LoopDistribute:
+//
+//   for (i = 0; i < N; i++)              for (i = 0; i < N; i++) {
+//     A[i] = B[i] + 1;            =>       A[i] = B[i] + 1;
+//   for (i = 0; i < N; i++)                C[i] = A[i] * 2;
+//     C[i] = A[i] * 2;                   }
+//
+// Two loops are adjacent if the exit block of the first is the preheader of
+// the second, so whenever the first one runs the second one runs right after
+// it. Code between them is moved before the first loop if that is safe.
+//
+// The fused loop runs iteration i of the second loop before iteration i + 1
+// of the first one. A dependence between the loops that DependenceAnalysis
+// reports is therefore only kept if the second loop accesses the location
+// in the same or a later iteration than the first one.
+//
+// Fusion has to pay off: a reuse model counts the cache lines (or blocks of
+// -loop-fusion-line-size bytes, e.g. the DMA unit of a scratchpad memory)
+// the loops transfer with and without fusion. Accesses of both loops to the
+// same stream share their transfers in the fused loop; without fusion they
+// do only if the data of the first loop still fits the cache when the
+// second one starts.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/DependenceAnalysis.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/OptimizationDiagnosticInfo.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Pass.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Scalar.h"
+#include "llvm/Transforms/Utils/Local.h"
+#include "llvm/Transforms/Utils/LoopUtils.h"
+using namespace llvm;
+
+#define DEBUG_TYPE "loop-fusion"
+
+STATISTIC(NumFusedLoops, "Number of loops fused");
+
+static cl::opt<unsigned> LineSize(
+    "loop-fusion-line-size", cl::init(0), cl::Hidden,
+    cl::desc("Bytes of one memory transfer in the reuse model (default: the "
+             "cache line size of the target, or 64)"));
+
+static cl::opt<unsigned> Capacity(
+    "loop-fusion-capacity", cl::init(0), cl::Hidden,
+    cl::desc("Bytes of data that stay cached from one loop to the next "
+             "(default: the L1 data cache of the target)"));
+
+namespace {
+
+// Trip count the reuse model assumes for loops whose trip count is not a
+// constant.
+static const uint64_t UnknownTripCount = 1024;
+
+/// Accesses to one stream of data: addresses that start less than a line
+/// apart and advance by the same step. The loops transfer each stream once.
+struct RefGroup {
+  const SCEV *Start;
+  /// Bytes the address advances per iteration, 0 if it is loop invariant.
+  int64_t Step;
+  bool InFirst;
+  bool InSecond;
+};
+
+struct LoopFusion : public FunctionPass {
+  static char ID; // Pass identification, replacement for typeid
+
+  ScalarEvolution *SE = nullptr;
+  LoopInfo *LI = nullptr;
+  DependenceInfo *DI = nullptr;
+  DominatorTree *DT = nullptr;
+  const TargetTransformInfo *TTI = nullptr;
+  OptimizationRemarkEmitter *ORE = nullptr;
+
+  LoopFusion() : FunctionPass(ID) {
+    initializeLoopFusionPass(*PassRegistry::getPassRegistry());
+  }
+
+  void getAnalysisUsage(AnalysisUsage &AU) const override {
+    AU.addRequiredID(LoopSimplifyID);
+    AU.addRequiredID(LCSSAID);
+    AU.addRequired<ScalarEvolutionWrapperPass>();
+    AU.addRequired<DominatorTreeWrapperPass>();
+    AU.addRequired<LoopInfoWrapperPass>();
+    AU.addRequired<DependenceAnalysisWrapperPass>();
+    AU.addRequired<TargetTransformInfoWrapperPass>();
+    AU.addRequired<OptimizationRemarkEmitterWrapperPass>();
+  }
+
+  bool runOnFunction(Function &F) override {
+    if (skipFunction(F))
+      return false;
+
+    SE = &getAnalysis<ScalarEvolutionWrapperPass>().getSE();
+    LI = &getAnalysis<LoopInfoWrapperPass>().getLoopInfo();
+    DI = &getAnalysis<DependenceAnalysisWrapperPass>().getDI();
+    DT = &getAnalysis<DominatorTreeWrapperPass>().getDomTree();
+    TTI = &getAnalysis<TargetTransformInfoWrapperPass>().getTTI(F);
+    ORE = &getAnalysis<OptimizationRemarkEmitterWrapperPass>().getORE();
+
+    std::vector<Loop *> TopLevelLoops(LI->begin(), LI->end());
+    return fuseSiblings(TopLevelLoops);
+  }
+
+  /// Fuse the loops nested in \p Loops, then adjacent loops of \p Loops.
+  bool fuseSiblings(const std::vector<Loop *> &Loops) {
+    bool Changed = false;
+    for (Loop *L : Loops) {
+      std::vector<Loop *> SubLoops(L->begin(), L->end());
+      Changed |= fuseSiblings(SubLoops);
+    }
+
+    DenseMap<BasicBlock *, Loop *> ByPreheader;
+    for (Loop *L : Loops)
+      if (BasicBlock *Preheader = L->getLoopPreheader())
+        ByPreheader[Preheader] = L;
+
+    // A fused loop keeps the first loop, so it can be fused again with the
+    // loop that followed the second one.
+    SmallPtrSet<Loop *, 8> Removed;
+    for (Loop *L : Loops) {
+      if (Removed.count(L))
+        continue;
+      while (BasicBlock *Exit = L->getExitBlock()) {
+        Loop *Next = ByPreheader.lookup(Exit);
+        if (!Next || !tryFuse(L, Next))
+          break;
+        Removed.insert(Next);
+        Changed = true;
+      }
+    }
+    return Changed;
+  }
+
+  /// Report why \p L0 and the loop after it are not fused and return false.
+  bool fail(Loop *L0, StringRef RemarkName, StringRef Message) {
+    DEBUG(dbgs() << "Not fusing loop at " << L0->getHeader()->getName()
+                 << ": " << Message << "\n");
+    ORE->emit(OptimizationRemarkMissed(DEBUG_TYPE, RemarkName,
+                                       L0->getStartLoc(), L0->getHeader())
+              << "loop not fused with the loop that follows it: " << Message);
+    return false;
+  }
+
+  /// Check that \p L has a preheader, a single latch that is its only
+  /// exiting block, and a single exit block.
+  static bool isSimpleLoop(Loop *L) {
+    BasicBlock *Latch = L->getLoopLatch();
+    if (!L->getLoopPreheader() || !Latch || L->getExitingBlock() != Latch ||
+        !L->getExitBlock())
+      return false;
+    auto *BI = dyn_cast<BranchInst>(Latch->getTerminator());
+    return BI && BI->isConditional();
+  }
+
+  /// Collect the memory accesses of \p L into \p MemInstrs. Returns false if
+  /// \p L has other instructions with side effects.
+  static bool collectMemInstrs(Loop *L,
+                               SmallVectorImpl<Instruction *> &MemInstrs) {
+    for (BasicBlock *BB : L->blocks()) {
+      for (Instruction &I : *BB) {
+        if (!I.mayReadOrWriteMemory()) {
+          if (I.mayHaveSideEffects())
+            return false;
+          continue;
+        }
+        auto *Ld = dyn_cast<LoadInst>(&I);
+        auto *St = dyn_cast<StoreInst>(&I);
+        if ((!Ld || !Ld->isSimple()) && (!St || !St->isSimple()))
+          return false;
+        MemInstrs.push_back(&I);
+      }
+    }
+    return true;
+  }
+
+  static Value *getPointerOperand(Instruction *I) {
+    if (auto *Ld = dyn_cast<LoadInst>(I))
+      return Ld->getPointerOperand();
+    return cast<StoreInst>(I)->getPointerOperand();
+  }
+
+  uint64_t getAccessSize(Instruction *I) {
+    const DataLayout &DL = I->getModule()->getDataLayout();
+    Type *Ty = cast<PointerType>(getPointerOperand(I)->getType())
+                   ->getElementType();
+    return DL.getTypeStoreSize(Ty);
+  }
+
+  /// Check that fusing \p L0 and \p L1 keeps the order of \p Src, in
+  /// \p L0, and \p Dst, in \p L1, which may access the same location. That
+  /// holds if every location \p Dst accesses in an iteration was accessed by
+  /// \p Src in the same or an earlier one, i.e. the dependence distance is
+  /// not negative.
+  bool isFusionPreserving(Instruction *Src, Instruction *Dst, Loop *L0,
+                          Loop *L1) {
+    auto *SrcAR = dyn_cast<SCEVAddRecExpr>(SE->getSCEV(getPointerOperand(Src)));
+    auto *DstAR = dyn_cast<SCEVAddRecExpr>(SE->getSCEV(getPointerOperand(Dst)));
+    if (!SrcAR || !DstAR || SrcAR->getLoop() != L0 || DstAR->getLoop() != L1 ||
+        !SrcAR->isAffine() || !DstAR->isAffine())
+      return false;
+    auto *SrcStep = dyn_cast<SCEVConstant>(SrcAR->getStepRecurrence(*SE));
+    auto *DstStep = dyn_cast<SCEVConstant>(DstAR->getStepRecurrence(*SE));
+    if (!SrcStep || !DstStep || SrcStep->getAPInt() != DstStep->getAPInt())
+      return false;
+    auto *Diff = dyn_cast<SCEVConstant>(
+        SE->getMinusSCEV(SrcAR->getStart(), DstAR->getStart()));
+    if (!Diff)
+      return false;
+
+    // Src accesses [SrcStart + Step * j, +SrcSize) in iteration j, Dst
+    // [DstStart + Step * i, +DstSize) in iteration i. They overlap only for
+    // j <= i if the start of the leading access is not behind and the
+    // accesses do not overlap their own next iteration.
+    int64_t Step = SrcStep->getAPInt().getSExtValue();
+    int64_t Distance = Diff->getAPInt().getSExtValue();
+    if (Step > 0)
+      return Distance >= 0 && uint64_t(Step) >= getAccessSize(Dst);
+    if (Step < 0)
+      return Distance <= 0 && uint64_t(-Step) >= getAccessSize(Src);
+    return false;
+  }
+
+  unsigned getLineSize() const {
+    if (LineSize)
+      return LineSize;
+    if (unsigned CacheLineSize = TTI->getCacheLineSize())
+      return CacheLineSize;
+    return 64;
+  }
+
+  /// Add the accesses \p MemInstrs of \p L to the streams \p Groups.
+  void addRefGroups(Loop *L, ArrayRef<Instruction *> MemInstrs, bool First,
+                    unsigned Line, SmallVectorImpl<RefGroup> &Groups) {
+    for (Instruction *I : MemInstrs) {
+      const SCEV *Ptr = SE->getSCEV(getPointerOperand(I));
+      RefGroup G = {Ptr, 0, First, !First};
+      auto *AR = dyn_cast<SCEVAddRecExpr>(Ptr);
+      auto *Step = AR && AR->getLoop() == L && AR->isAffine()
+                       ? dyn_cast<SCEVConstant>(AR->getStepRecurrence(*SE))
+                       : nullptr;
+      if (Step) {
+        G.Start = AR->getStart();
+        G.Step = Step->getAPInt().getSExtValue();
+      } else if (!SE->isLoopInvariant(Ptr, L)) {
+        // Addresses the model does not understand take a line per iteration.
+        G.Step = Line;
+      }
+
+      auto It = find_if(Groups, [&](const RefGroup &Other) {
+        if (Other.Step != G.Step)
+          return false;
+        auto *Diff =
+            dyn_cast<SCEVConstant>(SE->getMinusSCEV(G.Start, Other.Start));
+        return Diff && Diff->getAPInt().abs().ult(Line);
+      });
+      if (It == Groups.end()) {
+        Groups.push_back(G);
+        continue;
+      }
+      It->InFirst |= First;
+      It->InSecond |= !First;
+    }
+  }
+
+  /// Estimate the number of memory transfers with and without fusing \p L0
+  /// and \p L1.
+  void estimateTransfers(Loop *L0, ArrayRef<Instruction *> MemInstrs0,
+                         Loop *L1, ArrayRef<Instruction *> MemInstrs1,
+                         uint64_t &Unfused, uint64_t &Fused) {
+    unsigned Line = getLineSize();
+    uint64_t TripCount = UnknownTripCount;
+    auto *BTC = dyn_cast<SCEVConstant>(SE->getBackedgeTakenCount(L0));
+    if (BTC && BTC->getAPInt().ult(UINT32_MAX))
+      TripCount = BTC->getValue()->getZExtValue() + 1;
+
+    auto getLines = [&](const RefGroup &G) -> uint64_t {
+      uint64_t Bytes = TripCount * uint64_t(std::abs(G.Step));
+      return std::max<uint64_t>(1, (Bytes + Line - 1) / Line);
+    };
+
+    SmallVector<RefGroup, 16> Groups0, Groups1, FusedGroups;
+    addRefGroups(L0, MemInstrs0, true, Line, Groups0);
+    addRefGroups(L1, MemInstrs1, false, Line, Groups1);
+    addRefGroups(L0, MemInstrs0, true, Line, FusedGroups);
+    addRefGroups(L1, MemInstrs1, false, Line, FusedGroups);
+
+    uint64_t Lines0 = 0, Lines1 = 0;
+    for (const RefGroup &G : Groups0)
+      Lines0 += getLines(G);
+    for (const RefGroup &G : Groups1)
+      Lines1 += getLines(G);
+    Fused = 0;
+    for (const RefGroup &G : FusedGroups)
+      Fused += getLines(G);
+    Unfused = Lines0 + Lines1;
+
+    // If everything the first loop touches stays cached, the second loop
+    // reuses it without fusion.
+    uint64_t CacheBytes = Capacity;
+    if (!CacheBytes)
+      CacheBytes =
+          TTI->getCacheSize(TargetTransformInfo::CacheLevel::L1D).getValueOr(0);
+    if (BTC && Lines0 * Line <= CacheBytes)
+      for (const RefGroup &G : FusedGroups)
+        if (G.InFirst && G.InSecond)
+          Unfused -= getLines(G);
+  }
+
+  /// Fuse \p L1 into \p L0, whose exit block is the preheader of \p L1, if
+  /// that is legal and reduces memory transfers.
+  bool tryFuse(Loop *L0, Loop *L1) {
+    if (!isSimpleLoop(L0) || !isSimpleLoop(L1))
+      return fail(L0, "NotSimplified",
+                  "loops are not in simplified form with a single exit");
+
+    BasicBlock *Preheader1 = L1->getLoopPreheader();
+    if (isa<PHINode>(Preheader1->begin()))
+      return fail(L0, "LiveOut", "values of the first loop are used after it");
+    for (Instruction &I : *Preheader1)
+      if (&I != Preheader1->getTerminator() &&
+          (I.mayReadFromMemory() || !isSafeToSpeculativelyExecute(&I)))
+        return fail(L0, "CodeBetweenLoops",
+                    "code between the loops cannot be moved before them");
+
+    const SCEV *BTC0 = SE->getBackedgeTakenCount(L0);
+    const SCEV *BTC1 = SE->getBackedgeTakenCount(L1);
+    if (isa<SCEVCouldNotCompute>(BTC0) || isa<SCEVCouldNotCompute>(BTC1))
+      return fail(L0, "UnknownTripCount", "trip count is not computable");
+    if (BTC0 != BTC1)
+      return fail(L0, "DifferentTripCounts", "trip counts differ");
+
+    SmallVector<Instruction *, 16> MemInstrs0, MemInstrs1;
+    if (!collectMemInstrs(L0, MemInstrs0) || !collectMemInstrs(L1, MemInstrs1))
+      return fail(L0, "UnsafeInstruction",
+                  "loop has calls or non-simple memory accesses");
+
+    for (Instruction *Src : MemInstrs0) {
+      for (Instruction *Dst : MemInstrs1) {
+        if (isa<LoadInst>(Src) && isa<LoadInst>(Dst))
+          continue;
+        if (!DI->depends(Src, Dst, true))
+          continue;
+        if (!isFusionPreserving(Src, Dst, L0, L1)) {
+          DEBUG(dbgs() << "Dependence prevents fusion\n Src:" << *Src
+                       << "\n Dst:" << *Dst << "\n");
+          return fail(L0, "Dependence",
+                      "the second loop uses data of later iterations of the "
+                      "first loop");
+        }
+      }
+    }
+
+    uint64_t Unfused, Fused;
+    estimateTransfers(L0, MemInstrs0, L1, MemInstrs1, Unfused, Fused);
+    DEBUG(dbgs() << "Memory transfers: " << Unfused << " unfused, " << Fused
+                 << " fused\n");
+    if (Fused >= Unfused)
+      return fail(L0, "NoReuse",
+                  "fusion does not reduce the estimated memory transfers");
+
+    ORE->emit(OptimizationRemark(DEBUG_TYPE, "Fused", L0->getStartLoc(),
+                                 L0->getHeader())
+              << "fused with the loop that follows it, estimated memory "
+                 "transfers reduced from "
+              << ore::NV("Unfused", unsigned(Unfused)) << " to "
+              << ore::NV("Fused", unsigned(Fused)));
+    fuse(L0, L1);
+    NumFusedLoops++;
+    return true;
+  }
+
+  /// Append the body of \p L1 to the body of \p L0 and remove \p L1.
+  void fuse(Loop *L0, Loop *L1) {
+    BasicBlock *Preheader0 = L0->getLoopPreheader();
+    BasicBlock *Preheader1 = L1->getLoopPreheader();
+    BasicBlock *Header0 = L0->getHeader();
+    BasicBlock *Header1 = L1->getHeader();
+    BasicBlock *Latch0 = L0->getLoopLatch();
+    BasicBlock *Latch1 = L1->getLoopLatch();
+
+    SE->forgetLoop(L0);
+    SE->forgetLoop(L1);
+
+    // The code between the loops goes before the first one.
+    while (&Preheader1->front() != Preheader1->getTerminator())
+      Preheader1->front().moveBefore(Preheader0->getTerminator());
+
+    // The PHIs of the second loop move to the common header, whose backedge
+    // now comes from the latch of the second loop.
+    for (auto I = Header0->begin(); auto *PN = dyn_cast<PHINode>(I); ++I)
+      PN->setIncomingBlock(PN->getBasicBlockIndex(Latch0), Latch1);
+    while (auto *PN = dyn_cast<PHINode>(&Header1->front())) {
+      PN->moveBefore(Header0->getFirstNonPHI());
+      PN->setIncomingBlock(PN->getBasicBlockIndex(Preheader1), Preheader0);
+    }
+
+    // The first loop continues into the second one, whose latch decides for
+    // both; the trip counts are the same.
+    auto *BI0 = cast<BranchInst>(Latch0->getTerminator());
+    Value *Cond0 = BI0->getCondition();
+    BranchInst::Create(Header1, BI0);
+    BI0->eraseFromParent();
+    RecursivelyDeleteTriviallyDeadInstructions(Cond0);
+    Latch1->getTerminator()->replaceUsesOfWith(Header1, Header0);
+
+    DT->changeImmediateDominator(Header1, Latch0);
+    DT->eraseNode(Preheader1);
+    LI->removeBlock(Preheader1);
+    Preheader1->eraseFromParent();
+
+    // The blocks and subloops of the second loop now belong to the first.
+    for (BasicBlock *BB : L1->blocks()) {
+      if (LI->getLoopFor(BB) == L1)
+        LI->changeLoopFor(BB, L0);
+      L0->addBlockEntry(BB);
+    }
+    while (!L1->empty())
+      L0->addChildLoop(L1->removeChildLoop(std::prev(L1->end())));
+    if (Loop *Parent = L1->getParentLoop())
+      Parent->removeChildLoop(find(*Parent, L1));
+    else
+      LI->removeLoop(find(*LI, L1));
+    delete L1;
+  }
+};
+
+} // end of namespace
+
+char LoopFusion::ID = 0;
+INITIALIZE_PASS_BEGIN(LoopFusion, "loop-fusion", "Fuse adjacent loops", false,
+                      false)
+INITIALIZE_PASS_DEPENDENCY(DependenceAnalysisWrapperPass)
+INITIALIZE_PASS_DEPENDENCY(DominatorTreeWrapperPass)
+INITIALIZE_PASS_DEPENDENCY(ScalarEvolutionWrapperPass)
+INITIALIZE_PASS_DEPENDENCY(TargetTransformInfoWrapperPass)
+INITIALIZE_PASS_DEPENDENCY(OptimizationRemarkEmitterWrapperPass)
+INITIALIZE_PASS_DEPENDENCY(LoopSimplify)
+INITIALIZE_PASS_DEPENDENCY(LCSSAWrapperPass)
+INITIALIZE_PASS_DEPENDENCY(LoopInfoWrapperPass)
+INITIALIZE_PASS_END(LoopFusion, "loop-fusion", "Fuse adjacent loops", false,
+                    false)
+
+Pass *llvm::createLoopFusionPass() { return new LoopFusion(); }
@@ -70,6 +70,8 @@ using namespace llvm;
 
 STATISTIC(NumMemSet, "Number of memset's formed from loop stores");
 STATISTIC(NumMemCpy, "Number of memcpy's formed from loop load+stores");
+STATISTIC(NumMemCpy2D, "Number of memcpy.2d's formed from strided or nested "
+                       "copies");
 
 static cl::opt<bool> UseLIRCodeSizeHeurs(
     "use-lir-code-size-heurs",
@@ -132,6 +134,9 @@ private:
                                const SCEVAddRecExpr *Ev, const SCEV *BECount,
                                bool NegStride, bool IsLoopMemset = false);
   bool processLoopStoreOfLoopLoad(StoreInst *SI, const SCEV *BECount);
+  bool processLoopStridedCopy(StoreInst *SI, const SCEV *BECount);
+  bool processLoopMemCpy(MemCpyInst *MCI, const SCEV *BECount);
+  bool isProfitableStridedCopy(unsigned RowBytes) const;
   bool avoidLIRForMultiBlockLoop(bool IsMemset = false,
                                  bool IsLoopMemset = false);
 
@@ -399,10 +404,14 @@ bool LoopIdiomRecognize::isLegalStore(StoreInst *SI, bool &ForMemset,
   // Otherwise, see if the store can be turned into a memcpy.
   if (HasMemcpy) {
     // Check to see if the stride matches the size of the store.  If so, then we
-    // know that every byte is touched in the loop.
+    // know that every byte is touched in the loop.  Otherwise the rows of a
+    // strided copy must not overlap, and the target has to copy them well.
     APInt Stride = getStoreStride(StoreEv);
     unsigned StoreSize = getStoreSizeInBytes(SI, DL);
-    if (StoreSize != Stride && StoreSize != -Stride)
+    bool Contiguous = StoreSize == Stride || StoreSize == -Stride;
+    if (!Contiguous &&
+        (!Stride.isStrictlyPositive() || Stride.ult(StoreSize) ||
+         !isProfitableStridedCopy(StoreSize)))
       return false;
 
     // The store must be feeding a non-volatile load.
@@ -418,9 +427,17 @@ bool LoopIdiomRecognize::isLegalStore(StoreInst *SI, bool &ForMemset,
     if (!LoadEv || LoadEv->getLoop() != CurLoop || !LoadEv->isAffine())
       return false;
 
-    // The store and load must share the same stride.
-    if (StoreEv->getOperand(1) != LoadEv->getOperand(1))
-      return false;
+    // The store and load must share the same stride, unless this is a strided
+    // copy, where the load only needs a positive constant one of its own.
+    if (Contiguous) {
+      if (StoreEv->getOperand(1) != LoadEv->getOperand(1))
+        return false;
+    } else {
+      const SCEVConstant *LoadStride =
+          dyn_cast<SCEVConstant>(LoadEv->getOperand(1));
+      if (!LoadStride || !LoadStride->getAPInt().isStrictlyPositive())
+        return false;
+    }
 
     // Success.  This store can be converted into a memcpy.
     ForMemcpy = true;
@@ -505,6 +522,21 @@ bool LoopIdiomRecognize::runOnLoopBlock(
         I = BB->begin();
       continue;
     }
+
+    // Look for memcpy instructions, typically formed from an inner loop, which
+    // may be optimized to a larger memcpy or a 2D block copy.
+    if (MemCpyInst *MCI = dyn_cast<MemCpyInst>(Inst)) {
+      WeakVH InstPtr(&*I);
+      if (!processLoopMemCpy(MCI, BECount))
+        continue;
+      MadeChange = true;
+
+      // If processing the memcpy invalidated our iterator, start over from the
+      // top of the block.
+      if (!InstPtr)
+        I = BB->begin();
+      continue;
+    }
   }
 
   return MadeChange;
@@ -860,6 +892,8 @@ bool LoopIdiomRecognize::processLoopStoreOfLoopLoad(StoreInst *SI,
   const SCEVAddRecExpr *StoreEv = cast<SCEVAddRecExpr>(SE->getSCEV(StorePtr));
   APInt Stride = getStoreStride(StoreEv);
   unsigned StoreSize = getStoreSizeInBytes(SI, DL);
+  if (StoreSize != Stride && StoreSize != -Stride)
+    return processLoopStridedCopy(SI, BECount);
   bool NegStride = StoreSize == -Stride;
 
   // The store must be feeding a non-volatile load.
@@ -961,6 +995,232 @@ bool LoopIdiomRecognize::processLoopStoreOfLoopLoad(StoreInst *SI,
   return true;
 }
 
+/// Return true if copying rows of \p RowBytes bytes that are not adjacent in
+/// memory with llvm.memcpy.2d beats the scalar loop, i.e. if the target has a
+/// block copy DMA engine or can gather and scatter whole rows.
+bool LoopIdiomRecognize::isProfitableStridedCopy(unsigned RowBytes) const {
+  if (TTI->hasBlockCopyDMA())
+    return true;
+  if (RowBytes > 8 || !isPowerOf2_32(RowBytes))
+    return false;
+  Type *EltTy =
+      IntegerType::get(CurLoop->getHeader()->getContext(), RowBytes * 8);
+  return TTI->isLegalMaskedGather(EltTy) && TTI->isLegalMaskedScatter(EltTy);
+}
+
+static CallInst *createMemCpy2D(IRBuilder<> &Builder, Value *Dst, Value *Src,
+                                Value *RowBytes, Value *Rows, Value *DstStride,
+                                Value *SrcStride, unsigned Align) {
+  Module *M = Builder.GetInsertBlock()->getModule();
+  Type *Tys[] = {Dst->getType(), Src->getType(), RowBytes->getType()};
+  Function *MemCpy2D = Intrinsic::getDeclaration(M, Intrinsic::memcpy_2d, Tys);
+  Value *Ops[] = {Dst,       Src,       RowBytes,
+                  Rows,      DstStride, SrcStride,
+                  Builder.getInt32(Align), Builder.getFalse()};
+  return Builder.CreateCall(MemCpy2D, Ops);
+}
+
+/// If the stored value is a load with a different or non-unit constant stride,
+/// this may be transformable into a 2D block copy with one element per row.
+/// This kicks in for stuff like
+///   for (i) A[2*i] = B[3*i];
+///   for (i) A[i][0] = B[i][0];
+bool LoopIdiomRecognize::processLoopStridedCopy(StoreInst *SI,
+                                                const SCEV *BECount) {
+  const SCEVAddRecExpr *StoreEv =
+      cast<SCEVAddRecExpr>(SE->getSCEV(SI->getPointerOperand()));
+  LoadInst *LI = cast<LoadInst>(SI->getValueOperand());
+  const SCEVAddRecExpr *LoadEv =
+      cast<SCEVAddRecExpr>(SE->getSCEV(LI->getPointerOperand()));
+  unsigned StoreSize = getStoreSizeInBytes(SI, DL);
+  APInt DstStride = getStoreStride(StoreEv);
+  APInt SrcStride = cast<SCEVConstant>(LoadEv->getOperand(1))->getAPInt();
+  if (!DstStride.isIntN(32) || !SrcStride.isIntN(32))
+    return false;
+
+  BasicBlock *Preheader = CurLoop->getLoopPreheader();
+  IRBuilder<> Builder(Preheader->getTerminator());
+  SCEVExpander Expander(*SE, *DL, "loop-idiom");
+
+  unsigned StrAS = SI->getPointerAddressSpace();
+  unsigned LdAS = LI->getPointerAddressSpace();
+  Type *IntPtrTy = Builder.getIntPtrTy(*DL, StrAS);
+
+  // Each row claims a whole stride of the destination; nothing else in the
+  // loop, the load included, may touch it.
+  Value *StoreBasePtr =
+      Expander.expandCodeFor(StoreEv->getStart(), Builder.getInt8PtrTy(StrAS),
+                             Preheader->getTerminator());
+
+  SmallPtrSet<Instruction *, 1> Stores;
+  Stores.insert(SI);
+  if (mayLoopAccessLocation(StoreBasePtr, MRI_ModRef, CurLoop, BECount,
+                            DstStride.getZExtValue(), *AA, Stores)) {
+    Expander.clear();
+    // If we generated new code for the base pointer, clean up.
+    RecursivelyDeleteTriviallyDeadInstructions(StoreBasePtr, TLI);
+    return false;
+  }
+
+  Value *LoadBasePtr =
+      Expander.expandCodeFor(LoadEv->getStart(), Builder.getInt8PtrTy(LdAS),
+                             Preheader->getTerminator());
+
+  if (mayLoopAccessLocation(LoadBasePtr, MRI_Mod, CurLoop, BECount,
+                            SrcStride.getZExtValue(), *AA, Stores)) {
+    Expander.clear();
+    // If we generated new code for the base pointer, clean up.
+    RecursivelyDeleteTriviallyDeadInstructions(LoadBasePtr, TLI);
+    RecursivelyDeleteTriviallyDeadInstructions(StoreBasePtr, TLI);
+    return false;
+  }
+
+  if (avoidLIRForMultiBlockLoop())
+    return false;
+
+  // Okay, everything is safe.  The loop copies BECount+1 rows.
+  BECount = SE->getTruncateOrZeroExtend(BECount, IntPtrTy);
+  const SCEV *RowsS =
+      SE->getAddExpr(BECount, SE->getOne(IntPtrTy), SCEV::FlagNUW);
+  Value *Rows =
+      Expander.expandCodeFor(RowsS, IntPtrTy, Preheader->getTerminator());
+
+  CallInst *NewCall = createMemCpy2D(
+      Builder, StoreBasePtr, LoadBasePtr, ConstantInt::get(IntPtrTy, StoreSize),
+      Rows, ConstantInt::get(IntPtrTy, DstStride.getZExtValue()),
+      ConstantInt::get(IntPtrTy, SrcStride.getZExtValue()),
+      std::min(SI->getAlignment(), LI->getAlignment()));
+  NewCall->setDebugLoc(SI->getDebugLoc());
+
+  DEBUG(dbgs() << "  Formed memcpy.2d: " << *NewCall << "\n"
+               << "    from load ptr=" << *LoadEv << " at: " << *LI << "\n"
+               << "    from store ptr=" << *StoreEv << " at: " << *SI << "\n");
+
+  deleteDeadInstruction(SI);
+  ++NumMemCpy2D;
+  return true;
+}
+
+/// processLoopMemCpy - See if this memcpy, typically formed from an inner loop,
+/// copies consecutive rows of a block.  If both sides are contiguous it can be
+/// promoted to a large memcpy, otherwise to a 2D block copy.  This kicks in for
+/// stuff like
+///   for (i) for (j) A[i][j] = B[i][j];
+///   for (i) for (j < 16) A[i][j] = B[i + 4][j + 4];
+bool LoopIdiomRecognize::processLoopMemCpy(MemCpyInst *MCI,
+                                           const SCEV *BECount) {
+  // We can only handle non-volatile memcpys with a constant size.
+  if (MCI->isVolatile() || !isa<ConstantInt>(MCI->getLength()))
+    return false;
+
+  // Reject memcpys that are so large that they overflow an unsigned.
+  uint64_t SizeInBytes = cast<ConstantInt>(MCI->getLength())->getZExtValue();
+  if ((SizeInBytes >> 32) != 0)
+    return false;
+
+  // Both pointers must be AddRecs like {base,+,stride} on the current loop.
+  const SCEVAddRecExpr *DstEv =
+      dyn_cast<SCEVAddRecExpr>(SE->getSCEV(MCI->getDest()));
+  const SCEVAddRecExpr *SrcEv =
+      dyn_cast<SCEVAddRecExpr>(SE->getSCEV(MCI->getSource()));
+  if (!DstEv || DstEv->getLoop() != CurLoop || !DstEv->isAffine() || !SrcEv ||
+      SrcEv->getLoop() != CurLoop || !SrcEv->isAffine())
+    return false;
+
+  const SCEVConstant *DstStrideC = dyn_cast<SCEVConstant>(DstEv->getOperand(1));
+  const SCEVConstant *SrcStrideC = dyn_cast<SCEVConstant>(SrcEv->getOperand(1));
+  if (!DstStrideC || !SrcStrideC)
+    return false;
+
+  // Rows are copied forward and the destination rows must not overlap.
+  APInt DstStride = DstStrideC->getAPInt();
+  APInt SrcStride = SrcStrideC->getAPInt();
+  if (!DstStride.isStrictlyPositive() || !SrcStride.isStrictlyPositive() ||
+      !DstStride.isIntN(32) || !SrcStride.isIntN(32) ||
+      DstStride.ult(SizeInBytes))
+    return false;
+
+  bool Contiguous = DstStride == SizeInBytes && SrcStride == SizeInBytes;
+  if (Contiguous ? !HasMemcpy : !isProfitableStridedCopy(SizeInBytes))
+    return false;
+
+  BasicBlock *Preheader = CurLoop->getLoopPreheader();
+  IRBuilder<> Builder(Preheader->getTerminator());
+  SCEVExpander Expander(*SE, *DL, "loop-idiom");
+
+  unsigned DstAS = MCI->getDestAddressSpace();
+  unsigned SrcAS = MCI->getSourceAddressSpace();
+  Type *IntPtrTy = Builder.getIntPtrTy(*DL, DstAS);
+
+  Value *DstBasePtr =
+      Expander.expandCodeFor(DstEv->getStart(), Builder.getInt8PtrTy(DstAS),
+                             Preheader->getTerminator());
+  Value *SrcBasePtr =
+      Expander.expandCodeFor(SrcEv->getStart(), Builder.getInt8PtrTy(SrcAS),
+                             Preheader->getTerminator());
+
+  // Nothing else in the loop may touch the destination or write the source,
+  // and no row may read what an earlier row wrote.
+  uint64_t DstSize = MemoryLocation::UnknownSize;
+  uint64_t SrcSize = MemoryLocation::UnknownSize;
+  if (const SCEVConstant *BECst = dyn_cast<SCEVConstant>(BECount)) {
+    uint64_t NumRows = BECst->getValue()->getZExtValue() + 1;
+    DstSize = NumRows * DstStride.getZExtValue();
+    SrcSize = NumRows * SrcStride.getZExtValue();
+  }
+
+  SmallPtrSet<Instruction *, 1> MCIs;
+  MCIs.insert(MCI);
+  if (mayLoopAccessLocation(DstBasePtr, MRI_ModRef, CurLoop, BECount,
+                            DstStride.getZExtValue(), *AA, MCIs) ||
+      mayLoopAccessLocation(SrcBasePtr, MRI_Mod, CurLoop, BECount,
+                            SrcStride.getZExtValue(), *AA, MCIs) ||
+      AA->alias(MemoryLocation(DstBasePtr, DstSize),
+                MemoryLocation(SrcBasePtr, SrcSize)) != NoAlias) {
+    Expander.clear();
+    // If we generated new code for the base pointers, clean up.
+    RecursivelyDeleteTriviallyDeadInstructions(SrcBasePtr, TLI);
+    RecursivelyDeleteTriviallyDeadInstructions(DstBasePtr, TLI);
+    return false;
+  }
+
+  if (avoidLIRForMultiBlockLoop())
+    return false;
+
+  // Okay, everything is safe.  The loop copies BECount+1 rows.
+  BECount = SE->getTruncateOrZeroExtend(BECount, IntPtrTy);
+  const SCEV *RowsS =
+      SE->getAddExpr(BECount, SE->getOne(IntPtrTy), SCEV::FlagNUW);
+
+  CallInst *NewCall;
+  if (Contiguous) {
+    const SCEV *NumBytesS = SE->getMulExpr(
+        RowsS, SE->getConstant(IntPtrTy, SizeInBytes), SCEV::FlagNUW);
+    Value *NumBytes =
+        Expander.expandCodeFor(NumBytesS, IntPtrTy, Preheader->getTerminator());
+    NewCall = Builder.CreateMemCpy(DstBasePtr, SrcBasePtr, NumBytes,
+                                   MCI->getAlignment());
+    ++NumMemCpy;
+  } else {
+    Value *Rows =
+        Expander.expandCodeFor(RowsS, IntPtrTy, Preheader->getTerminator());
+    NewCall = createMemCpy2D(
+        Builder, DstBasePtr, SrcBasePtr,
+        ConstantInt::get(IntPtrTy, SizeInBytes), Rows,
+        ConstantInt::get(IntPtrTy, DstStride.getZExtValue()),
+        ConstantInt::get(IntPtrTy, SrcStride.getZExtValue()),
+        MCI->getAlignment());
+    ++NumMemCpy2D;
+  }
+  NewCall->setDebugLoc(MCI->getDebugLoc());
+
+  DEBUG(dbgs() << "  Formed " << *NewCall << "\n"
+               << "    from memcpy: " << *MCI << "\n");
+
+  deleteDeadInstruction(MCI);
+  return true;
+}
+
 // When compiling for codesize we avoid idiom recognition for a multi-block loop
 // unless it is a loop_memset idiom or a memset/memcpy idiom in a nested loop.
 //
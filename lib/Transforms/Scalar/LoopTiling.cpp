@@ -0,0 +1,532 @@
+//===- LoopTiling.cpp - Loop tiling pass ----------------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This pass tiles perfectly nested loops (strip-mine and interchange), so that
+// the data one tile touches stays in the cache, or in a scratchpad of the
+// given capacity, while the tile runs:
+//
+//   for (i = 0; i < N; i++)           for (ii = 0; ii < N; ii += T)
+//     for (j = 0; j < M; j++)    =>     for (jj = 0; jj < M; jj += T)
+//       S(i, j);                          for (i = ii; i < min(ii + T, N); i++)
+//                                           for (j = jj; j < min(jj + T, M); j++)
+//                                             S(i, j);
+//
+// The original loops become the point loops. They start at the tile and
+// leave at its end in addition to their own exit condition, so the innermost
+// loop stays a simple loop for the vectorizer.
+//
+// A nest is tiled if its loops have unit-stride induction variables and trip
+// counts that ScalarEvolution can compute and that do not change within the
+// nest, all memory accesses are in the innermost loop, and no dependence
+// between them has a negative distance in any of the loops, i.e. the nest is
+// fully permutable. Dependences come from DependenceAnalysis.
+//
+// The tile size is the largest power of two for which the data the accesses
+// of one tile touch fits half of the L1 data cache reported by
+// TargetTransformInfo, or all of -loop-tile-capacity bytes if given, e.g. the
+// size of a scratchpad memory.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/DependenceAnalysis.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ScalarEvolutionExpander.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/Pass.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Scalar.h"
+#include "llvm/Transforms/Utils/LoopUtils.h"
+using namespace llvm;
+
+#define DEBUG_TYPE "loop-tile"
+
+STATISTIC(NumTiledNests, "Number of loop nests tiled");
+STATISTIC(NumTiledLoops, "Number of loops tiled");
+
+static cl::opt<unsigned> TileSize(
+    "loop-tile-size", cl::init(0), cl::Hidden,
+    cl::desc("Use this tile size instead of the one the cache model picks"));
+
+static cl::opt<unsigned> TileCapacity(
+    "loop-tile-capacity", cl::init(0), cl::Hidden,
+    cl::desc("Bytes the data of one tile may take, e.g. the size of a "
+             "scratchpad memory (default: half of the L1 data cache)"));
+
+static cl::opt<unsigned> MaxTileDepth(
+    "loop-tile-max-depth", cl::init(3), cl::Hidden,
+    cl::desc("Maximum number of innermost loops of a nest to tile"));
+
+namespace {
+
+typedef SmallVector<Loop *, 4> LoopVector;
+
+// Maximum number of memory accesses whose dependences are checked.
+static const unsigned MaxMemInstrCount = 100;
+
+// Smallest and largest tile size the cache model picks.
+static const unsigned MinTileSize = 4;
+static const unsigned MaxTileSize = 1024;
+
+/// A loop of a nest to tile.
+struct TiledLoop {
+  Loop *L;
+  /// The induction variable, {Start,+,1}.
+  PHINode *IV;
+  /// The start of the induction variable, defined outside the nest.
+  Value *Start;
+  /// The backedge-taken count, the same for every execution of the loop.
+  const SCEV *BackedgeTakenCount;
+  /// The conditional branch of the latch, which is the only exiting block.
+  BranchInst *LatchBr;
+};
+
+struct LoopTiling : public FunctionPass {
+  static char ID; // Pass identification, replacement for typeid
+
+  ScalarEvolution *SE = nullptr;
+  LoopInfo *LI = nullptr;
+  DependenceInfo *DI = nullptr;
+  DominatorTree *DT = nullptr;
+  const TargetTransformInfo *TTI = nullptr;
+
+  LoopTiling() : FunctionPass(ID) {
+    initializeLoopTilingPass(*PassRegistry::getPassRegistry());
+  }
+
+  void getAnalysisUsage(AnalysisUsage &AU) const override {
+    AU.addRequired<ScalarEvolutionWrapperPass>();
+    AU.addRequired<DominatorTreeWrapperPass>();
+    AU.addRequired<LoopInfoWrapperPass>();
+    AU.addRequired<DependenceAnalysisWrapperPass>();
+    AU.addRequired<TargetTransformInfoWrapperPass>();
+    AU.addRequiredID(LoopSimplifyID);
+    AU.addRequiredID(LCSSAID);
+  }
+
+  bool runOnFunction(Function &F) override {
+    if (skipFunction(F))
+      return false;
+
+    SE = &getAnalysis<ScalarEvolutionWrapperPass>().getSE();
+    LI = &getAnalysis<LoopInfoWrapperPass>().getLoopInfo();
+    DI = &getAnalysis<DependenceAnalysisWrapperPass>().getDI();
+    DT = &getAnalysis<DominatorTreeWrapperPass>().getDomTree();
+    TTI = &getAnalysis<TargetTransformInfoWrapperPass>().getTTI(F);
+
+    SmallVector<LoopVector, 8> Nests;
+    for (Loop *L : *LI)
+      collectNests(*L, Nests);
+
+    // Analyze every nest before any is changed; the nests are disjoint, so
+    // tiling one does not change the others.
+    SmallVector<std::pair<SmallVector<TiledLoop, 4>, unsigned>, 8> Worklist;
+    for (LoopVector &Nest : Nests) {
+      SmallVector<TiledLoop, 4> Loops;
+      if (!analyzeNest(Nest, Loops))
+        continue;
+      unsigned Size = TileSize ? TileSize.getValue() : selectTileSize(Loops);
+      if (Size < 2) {
+        DEBUG(dbgs() << "No tile size fits the capacity\n");
+        continue;
+      }
+      if (any_of(Loops, [Size](const TiledLoop &TL) {
+            return !isUIntN(TL.IV->getType()->getIntegerBitWidth() - 1, Size);
+          }))
+        continue;
+      Worklist.push_back(std::make_pair(std::move(Loops), Size));
+    }
+
+    for (auto &Entry : Worklist)
+      tileNest(Entry.first, Entry.second, F.getParent()->getDataLayout());
+    return !Worklist.empty();
+  }
+
+  /// Collect the innermost chains of singly nested loops below \p L.
+  void collectNests(Loop &L, SmallVectorImpl<LoopVector> &Nests) {
+    LoopVector Chain;
+    Loop *CurrentLoop = &L;
+    Chain.push_back(CurrentLoop);
+    while (CurrentLoop->getSubLoops().size() == 1) {
+      CurrentLoop = CurrentLoop->getSubLoops().front();
+      Chain.push_back(CurrentLoop);
+    }
+    if (CurrentLoop->getSubLoops().empty()) {
+      if (Chain.size() < 2)
+        return;
+      unsigned Depth = std::min<unsigned>(Chain.size(), MaxTileDepth);
+      Nests.push_back(LoopVector(Chain.end() - Depth, Chain.end()));
+      return;
+    }
+    for (Loop *SubLoop : CurrentLoop->getSubLoops())
+      collectNests(*SubLoop, Nests);
+  }
+
+  /// Check the loop structure of \p L, the loop at position \p Pos of
+  /// \p Nest, and describe it in \p TL.
+  bool analyzeLoop(const LoopVector &Nest, unsigned Pos, TiledLoop &TL) {
+    Loop *L = Nest[Pos];
+    Loop *OuterMost = Nest.front();
+    BasicBlock *Preheader = L->getLoopPreheader();
+    BasicBlock *Latch = L->getLoopLatch();
+    if (!Preheader || !Latch || L->getExitingBlock() != Latch ||
+        !L->getExitBlock()) {
+      DEBUG(dbgs() << "Loop is not in simplified form with the latch as its "
+                      "only exit\n");
+      return false;
+    }
+    TL.L = L;
+    TL.LatchBr = dyn_cast<BranchInst>(Latch->getTerminator());
+    if (!TL.LatchBr || !TL.LatchBr->isConditional())
+      return false;
+
+    // The induction variable has to be the only PHI; other values carried
+    // from one iteration to the next would see the iterations reordered.
+    BasicBlock *Header = L->getHeader();
+    auto *IV = dyn_cast<PHINode>(Header->begin());
+    if (!IV || isa<PHINode>(IV->getNextNode()) ||
+        !IV->getType()->isIntegerTy()) {
+      DEBUG(dbgs() << "Header has to have exactly one integer PHI\n");
+      return false;
+    }
+    auto *AR = dyn_cast<SCEVAddRecExpr>(SE->getSCEV(IV));
+    if (!AR || AR->getLoop() != L || !AR->isAffine() ||
+        !AR->getStepRecurrence(*SE)->isOne()) {
+      DEBUG(dbgs() << "Induction variable does not have a unit step\n");
+      return false;
+    }
+    TL.IV = IV;
+    TL.Start = IV->getIncomingValueForBlock(Preheader);
+    if (!OuterMost->isLoopInvariant(TL.Start))
+      return false;
+
+    // The tiles of the loop are computed before the nest is entered.
+    TL.BackedgeTakenCount = SE->getBackedgeTakenCount(L);
+    if (isa<SCEVCouldNotCompute>(TL.BackedgeTakenCount) ||
+        !SE->isLoopInvariant(TL.BackedgeTakenCount, OuterMost) ||
+        !isSafeToExpand(TL.BackedgeTakenCount, *SE)) {
+      DEBUG(dbgs() << "Trip count is not computable or not invariant in the "
+                      "nest\n");
+      return false;
+    }
+
+    if (Pos > 0) {
+      // Every iteration of the enclosing loop runs this loop exactly once.
+      Loop *Outer = Nest[Pos - 1];
+      if (!DT->dominates(Preheader, Outer->getLoopLatch()) ||
+          isa<PHINode>(L->getExitBlock()->begin()))
+        return false;
+    } else if (isa<PHINode>(L->getExitBlock()->begin())) {
+      DEBUG(dbgs() << "Values live out of the nest are not handled\n");
+      return false;
+    }
+    return true;
+  }
+
+  /// Check if \p D allows to run the loops from \p FirstLevel to
+  /// \p FirstLevel + \p Depth - 1 in any order, i.e. every distance vector it
+  /// may have is non-negative in all of them once it points in the direction
+  /// of execution.
+  static bool isFullyPermutable(Dependence &D, unsigned FirstLevel,
+                                unsigned Depth) {
+    // A dependence carried by an enclosing loop is kept whatever order the
+    // nest runs in.
+    for (unsigned Level = 1; Level < FirstLevel; Level++)
+      if (!(D.getDirection(Level) & Dependence::DVEntry::EQ))
+        return true;
+
+    static const unsigned Dirs[] = {Dependence::DVEntry::LT,
+                                    Dependence::DVEntry::EQ,
+                                    Dependence::DVEntry::GT};
+    unsigned NumCombinations = 1;
+    for (unsigned i = 0; i < Depth; i++)
+      NumCombinations *= 3;
+    for (unsigned C = 0; C < NumCombinations; C++) {
+      SmallVector<unsigned, 4> Vector;
+      bool Possible = true;
+      for (unsigned i = 0, Digits = C; i < Depth; i++, Digits /= 3) {
+        unsigned Dir = Dirs[Digits % 3];
+        Possible &= (D.getDirection(FirstLevel + i) & Dir) != 0;
+        Vector.push_back(Dir);
+      }
+      if (!Possible)
+        continue;
+      // The leading direction tells which access runs first.
+      auto Leading = find_if(Vector, [](unsigned Dir) {
+        return Dir != Dependence::DVEntry::EQ;
+      });
+      if (Leading == Vector.end())
+        continue;
+      unsigned Negative = *Leading == Dependence::DVEntry::LT
+                              ? Dependence::DVEntry::GT
+                              : Dependence::DVEntry::LT;
+      if (is_contained(Vector, Negative))
+        return false;
+    }
+    return true;
+  }
+
+  /// Check if \p Nest can be tiled, and describe its loops in \p Loops.
+  bool analyzeNest(const LoopVector &Nest, SmallVectorImpl<TiledLoop> &Loops) {
+    DEBUG(dbgs() << "Analyzing nest of " << Nest.size() << " loops at "
+                 << Nest.front()->getHeader()->getName() << "\n");
+    for (unsigned Pos = 0; Pos < Nest.size(); Pos++) {
+      TiledLoop TL;
+      if (!analyzeLoop(Nest, Pos, TL))
+        return false;
+      Loops.push_back(TL);
+    }
+
+    Loop *OuterMost = Nest.front();
+    Loop *InnerMost = Nest.back();
+    SmallVector<Instruction *, 16> MemInstrs;
+    for (BasicBlock *BB : OuterMost->blocks()) {
+      for (Instruction &I : *BB) {
+        // Values of the nest are not used after it; the last iteration is
+        // not the same once tiled.
+        for (User *U : I.users())
+          if (!OuterMost->contains(cast<Instruction>(U)))
+            return false;
+        if (isa<DbgInfoIntrinsic>(I) || !I.mayReadOrWriteMemory()) {
+          if (I.mayHaveSideEffects())
+            return false;
+          continue;
+        }
+        // Memory accesses outside the innermost loop would run once per tile.
+        if (!InnerMost->contains(&I)) {
+          DEBUG(dbgs() << "Nest is not perfect\n");
+          return false;
+        }
+        auto *Ld = dyn_cast<LoadInst>(&I);
+        auto *St = dyn_cast<StoreInst>(&I);
+        if ((!Ld || !Ld->isSimple()) && (!St || !St->isSimple()))
+          return false;
+        MemInstrs.push_back(&I);
+      }
+    }
+    if (MemInstrs.empty() || MemInstrs.size() > MaxMemInstrCount)
+      return false;
+
+    unsigned FirstLevel = OuterMost->getLoopDepth();
+    for (unsigned I = 0, E = MemInstrs.size(); I != E; I++) {
+      for (unsigned J = I; J != E; J++) {
+        Instruction *Src = MemInstrs[I];
+        Instruction *Dst = MemInstrs[J];
+        if (isa<LoadInst>(Src) && isa<LoadInst>(Dst))
+          continue;
+        auto D = DI->depends(Src, Dst, true);
+        if (!D)
+          continue;
+        if (D->isConfused() ||
+            !isFullyPermutable(*D, FirstLevel, Nest.size())) {
+          DEBUG(dbgs() << "Dependence prevents tiling\n Src:" << *Src
+                       << "\n Dst:" << *Dst << "\n");
+          return false;
+        }
+      }
+    }
+    return true;
+  }
+
+  /// Pick the largest power of two for which the data of a tile of the
+  /// nest fits the capacity, or 0 if there is none.
+  unsigned selectTileSize(ArrayRef<TiledLoop> Loops) {
+    unsigned Capacity = TileCapacity;
+    if (!Capacity) {
+      Optional<unsigned> L1 =
+          TTI->getCacheSize(TargetTransformInfo::CacheLevel::L1D);
+      if (!L1) {
+        DEBUG(dbgs() << "Target has no cache model\n");
+        return 0;
+      }
+      // Leave room for conflict misses and other data.
+      Capacity = *L1 / 2;
+    }
+
+    // An access touches Size^K elements of a tile, with K the number of
+    // loops its address changes with. Accesses to the same object at the
+    // same loops are counted once.
+    const DataLayout &DL = Loops.front().IV->getModule()->getDataLayout();
+    SmallVector<std::pair<const SCEV *, unsigned>, 8> Objects;
+    SmallVector<uint64_t, 8> ElementSizes;
+    for (BasicBlock *BB : Loops.back().L->blocks()) {
+      for (Instruction &I : *BB) {
+        Value *Ptr;
+        if (auto *Ld = dyn_cast<LoadInst>(&I))
+          Ptr = Ld->getPointerOperand();
+        else if (auto *St = dyn_cast<StoreInst>(&I))
+          Ptr = St->getPointerOperand();
+        else
+          continue;
+        const SCEV *S = SE->getSCEV(Ptr);
+        unsigned K = 0;
+        for (const TiledLoop &TL : Loops)
+          if (!SE->isLoopInvariant(S, TL.L))
+            K++;
+        auto Key = std::make_pair(SE->getPointerBase(S), K);
+        uint64_t Size = DL.getTypeStoreSize(
+            cast<PointerType>(Ptr->getType())->getElementType());
+        auto It = find(Objects, Key);
+        if (It == Objects.end()) {
+          Objects.push_back(Key);
+          ElementSizes.push_back(Size);
+        } else {
+          uint64_t &Max = ElementSizes[It - Objects.begin()];
+          Max = std::max(Max, Size);
+        }
+      }
+    }
+
+    for (unsigned Size = MaxTileSize; Size >= MinTileSize; Size /= 2) {
+      uint64_t Footprint = 0;
+      for (unsigned i = 0; i < Objects.size(); i++) {
+        uint64_t Elements = 1;
+        for (unsigned K = 0; K < Objects[i].second; K++)
+          Elements *= Size;
+        Footprint += Elements * ElementSizes[i];
+      }
+      if (Footprint > Capacity)
+        continue;
+      // Tiles as large as the loops only add overhead.
+      bool Smaller = false;
+      for (const TiledLoop &TL : Loops) {
+        auto *C = dyn_cast<SCEVConstant>(TL.BackedgeTakenCount);
+        Smaller |= !C || C->getAPInt().uge(Size);
+      }
+      if (!Smaller)
+        return 0;
+      return Size;
+    }
+    return 0;
+  }
+
+  /// Tile the loops \p Loops of a nest with tiles of \p Size iterations.
+  void tileNest(MutableArrayRef<TiledLoop> Loops, unsigned Size,
+                const DataLayout &DL) {
+    Loop *OuterMost = Loops.front().L;
+    BasicBlock *NestPreheader = OuterMost->getLoopPreheader();
+    BasicBlock *NestExit = OuterMost->getExitBlock();
+    BasicBlock *NestHeader = OuterMost->getHeader();
+    Function *F = NestHeader->getParent();
+    LLVMContext &Ctx = F->getContext();
+    unsigned Depth = Loops.size();
+
+    DEBUG(dbgs() << "Tiling nest of " << Depth << " loops at "
+                 << NestHeader->getName() << " with tiles of " << Size
+                 << "\n");
+
+    // The tile loops step through the iterations of the loops from 0 to
+    // their backedge-taken count.
+    SCEVExpander Expander(*SE, DL, "tile");
+    SmallVector<Value *, 4> BackedgeTakenCounts;
+    for (TiledLoop &TL : Loops) {
+      const SCEV *BTC = SE->getTruncateOrZeroExtend(TL.BackedgeTakenCount,
+                                                    TL.IV->getType());
+      BackedgeTakenCounts.push_back(Expander.expandCodeFor(
+          BTC, TL.IV->getType(), NestPreheader->getTerminator()));
+    }
+
+    SmallVector<BasicBlock *, 4> TileHeaders, TileLatches;
+    for (TiledLoop &TL : Loops) {
+      TileHeaders.push_back(BasicBlock::Create(
+          Ctx, TL.L->getHeader()->getName() + ".tile", F, NestHeader));
+      TileLatches.push_back(BasicBlock::Create(
+          Ctx, TL.L->getLoopLatch()->getName() + ".tile", F, NestExit));
+    }
+    NestPreheader->getTerminator()->replaceUsesOfWith(NestHeader,
+                                                      TileHeaders.front());
+
+    SmallVector<Value *, 4> TileStarts;
+    for (unsigned k = 0; k < Depth; k++) {
+      TiledLoop &TL = Loops[k];
+      Type *Ty = TL.IV->getType();
+      Constant *TileSizeC = ConstantInt::get(Ty, Size);
+
+      IRBuilder<> HeaderBuilder(TileHeaders[k]);
+      PHINode *TileIV =
+          HeaderBuilder.CreatePHI(Ty, 2, TL.IV->getName() + ".tile");
+      TileIV->addIncoming(ConstantInt::get(Ty, 0),
+                          k ? TileHeaders[k - 1] : NestPreheader);
+      TileStarts.push_back(HeaderBuilder.CreateAdd(
+          TL.Start, TileIV, TL.IV->getName() + ".tile.start"));
+      HeaderBuilder.CreateBr(k + 1 < Depth ? TileHeaders[k + 1] : NestHeader);
+
+      // Another tile follows if it starts at or before the last iteration.
+      IRBuilder<> LatchBuilder(TileLatches[k]);
+      Value *Next = LatchBuilder.CreateAdd(TileIV, TileSizeC,
+                                           TL.IV->getName() + ".tile.next");
+      Value *Left = LatchBuilder.CreateSub(BackedgeTakenCounts[k], TileIV);
+      Value *More = LatchBuilder.CreateICmpUGE(Left, TileSizeC);
+      LatchBuilder.CreateCondBr(More, TileHeaders[k],
+                                k ? TileLatches[k - 1] : NestExit);
+      TileIV->addIncoming(Next, TileLatches[k]);
+    }
+
+    for (unsigned k = 0; k < Depth; k++) {
+      TiledLoop &TL = Loops[k];
+      Value *TileStart = TileStarts[k];
+
+      // The point loop starts at its tile, the outermost one is entered from
+      // the innermost tile loop. Its header is already entered from there, so
+      // its preheader is looked up by the block the PHI still refers to.
+      BasicBlock *Preheader = k ? TL.L->getLoopPreheader() : NestPreheader;
+      int Idx = TL.IV->getBasicBlockIndex(Preheader);
+      TL.IV->setIncomingValue(Idx, TileStart);
+      if (k == 0)
+        TL.IV->setIncomingBlock(Idx, TileHeaders.back());
+
+      // ...and leaves at the end of the tile.
+      BranchInst *BI = TL.LatchBr;
+      IRBuilder<> Builder(BI);
+      Constant *Last = ConstantInt::get(TL.IV->getType(), Size - 1);
+      Value *Offset = Builder.CreateSub(TL.IV, TileStart);
+      Value *Cond = BI->getCondition();
+      if (BI->getSuccessor(0) == TL.L->getHeader())
+        Cond = Builder.CreateAnd(Cond, Builder.CreateICmpULT(Offset, Last));
+      else
+        Cond = Builder.CreateOr(Cond, Builder.CreateICmpUGE(Offset, Last));
+      BI->setCondition(Cond);
+      NumTiledLoops++;
+    }
+
+    // When the outermost point loop is done, the next tile starts.
+    Loops.front().LatchBr->replaceUsesOfWith(NestExit, TileLatches.back());
+    NumTiledNests++;
+  }
+};
+
+} // end of namespace
+
+char LoopTiling::ID = 0;
+INITIALIZE_PASS_BEGIN(LoopTiling, "loop-tile",
+                      "Tile loop nests for cache and scratchpad reuse", false,
+                      false)
+INITIALIZE_PASS_DEPENDENCY(DependenceAnalysisWrapperPass)
+INITIALIZE_PASS_DEPENDENCY(DominatorTreeWrapperPass)
+INITIALIZE_PASS_DEPENDENCY(ScalarEvolutionWrapperPass)
+INITIALIZE_PASS_DEPENDENCY(TargetTransformInfoWrapperPass)
+INITIALIZE_PASS_DEPENDENCY(LoopSimplify)
+INITIALIZE_PASS_DEPENDENCY(LCSSAWrapperPass)
+INITIALIZE_PASS_DEPENDENCY(LoopInfoWrapperPass)
+INITIALIZE_PASS_END(LoopTiling, "loop-tile",
+                    "Tile loop nests for cache and scratchpad reuse", false,
+                    false)
+
+Pass *llvm::createLoopTilingPass() { return new LoopTiling(); }
@@ -0,0 +1,494 @@
+//===- LoopUnrollAndJam.cpp - Loop unroll and jam pass --------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This pass unrolls the outer loop of a two-level loop nest and fuses (jams)
+// the copies of the inner loop into one:
+//
+//   for (i = 0; i < N; i++)             for (i = 0; i < N; i += 2) {
+//     for (j = 0; j < M; j++)    =>       for (j = 0; j < M; j++) {
+//       C[i] += A[i][j] * B[j];              C[i] += A[i][j] * B[j];
+//                                            C[i+1] += A[i+1][j] * B[j];
+//                                          }
+//                                        }
+//
+// The copies of the inner body share the loads that do not depend on the
+// outer loop, B[j] above, which then stay in a register across them.
+//
+// The outer loop has three blocks: its header, which is the preheader of the
+// inner loop (fore), the inner loop of a single block (sub), and its latch,
+// which is the exit of the inner loop (aft). The header of copy k + 1 runs
+// before the inner loop of copy k, and the inner loops run one iteration of
+// each copy after the other. DependenceAnalysis has to show that this keeps
+// all dependences: none may point from sub or aft to an earlier phase of a
+// later outer iteration, and none between inner bodies may point forward in
+// one loop and backward in the other.
+//
+// The unroll count is the largest power of two that divides the trip count
+// of the outer loop and keeps the values live in the jammed inner loop
+// within the registers TargetTransformInfo reports.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/DependenceAnalysis.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Pass.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Scalar.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/Local.h"
+#include "llvm/Transforms/Utils/LoopUtils.h"
+#include "llvm/Transforms/Utils/ValueMapper.h"
+using namespace llvm;
+
+#define DEBUG_TYPE "loop-unroll-and-jam"
+
+STATISTIC(NumUnrolledAndJammed, "Number of loops unrolled and jammed");
+
+static cl::opt<unsigned> UnrollAndJamCount(
+    "unroll-and-jam-count", cl::init(0), cl::Hidden,
+    cl::desc("Use this unroll count instead of the one the cost model picks"));
+
+static cl::opt<unsigned> UnrollAndJamMaxCount(
+    "unroll-and-jam-max-count", cl::init(8), cl::Hidden,
+    cl::desc("Largest unroll count the cost model picks"));
+
+static cl::opt<unsigned> UnrollAndJamThreshold(
+    "unroll-and-jam-threshold", cl::init(120), cl::Hidden,
+    cl::desc("Maximum number of instructions of the jammed inner loop"));
+
+namespace {
+
+/// A loop nest to unroll and jam, with everything the transformation needs
+/// collected before any nest of the function is changed.
+struct JamCandidate {
+  Loop *Outer;
+  BasicBlock *Fore;
+  BasicBlock *Sub;
+  BasicBlock *Aft;
+  BasicBlock *Exit;
+  unsigned Count;
+  /// Instructions of the latch computing the values of the header PHIs for
+  /// the next iteration, in order; they move to the header.
+  SmallVector<Instruction *, 4> ForeInstrs;
+  /// PHIs of the inner loop with the same values in every outer iteration.
+  SmallPtrSet<PHINode *, 4> SharedPHIs;
+};
+
+struct LoopUnrollAndJam : public FunctionPass {
+  static char ID; // Pass identification, replacement for typeid
+
+  ScalarEvolution *SE = nullptr;
+  LoopInfo *LI = nullptr;
+  DependenceInfo *DI = nullptr;
+  const TargetTransformInfo *TTI = nullptr;
+
+  LoopUnrollAndJam() : FunctionPass(ID) {
+    initializeLoopUnrollAndJamPass(*PassRegistry::getPassRegistry());
+  }
+
+  void getAnalysisUsage(AnalysisUsage &AU) const override {
+    AU.addRequired<ScalarEvolutionWrapperPass>();
+    AU.addRequired<LoopInfoWrapperPass>();
+    AU.addRequired<DependenceAnalysisWrapperPass>();
+    AU.addRequired<TargetTransformInfoWrapperPass>();
+    AU.addRequiredID(LoopSimplifyID);
+    AU.addRequiredID(LCSSAID);
+  }
+
+  bool runOnFunction(Function &F) override {
+    if (skipFunction(F))
+      return false;
+
+    SE = &getAnalysis<ScalarEvolutionWrapperPass>().getSE();
+    LI = &getAnalysis<LoopInfoWrapperPass>().getLoopInfo();
+    DI = &getAnalysis<DependenceAnalysisWrapperPass>().getDI();
+    TTI = &getAnalysis<TargetTransformInfoWrapperPass>().getTTI(F);
+
+    SmallVector<Loop *, 8> Worklist(LI->begin(), LI->end());
+    SmallVector<std::unique_ptr<JamCandidate>, 4> Candidates;
+    while (!Worklist.empty()) {
+      Loop *L = Worklist.pop_back_val();
+      Worklist.append(L->begin(), L->end());
+      auto C = make_unique<JamCandidate>();
+      if (analyzeNest(L, *C))
+        Candidates.push_back(std::move(C));
+    }
+
+    // The candidates are disjoint: each has an innermost loop as its only
+    // subloop.
+    for (auto &C : Candidates)
+      unrollAndJam(*C);
+    return !Candidates.empty();
+  }
+
+  /// Check if the address \p S has the same value in every iteration of
+  /// \p Outer, given an iteration of its subloop \p Inner.
+  bool isOuterInvariant(const SCEV *S, Loop *Outer, Loop *Inner) {
+    if (auto *AR = dyn_cast<SCEVAddRecExpr>(S))
+      if (AR->getLoop() == Inner)
+        return AR->isAffine() && SE->isLoopInvariant(AR->getStart(), Outer) &&
+               SE->isLoopInvariant(AR->getStepRecurrence(*SE), Outer);
+    return SE->isLoopInvariant(S, Outer);
+  }
+
+  /// Collect the instructions of \p Aft that \p V needs into \p ForeInstrs,
+  /// operands first. Returns false if they cannot move to the header.
+  static bool collectForeInstrs(Value *V, BasicBlock *Aft, Loop *Outer,
+                                SmallVectorImpl<Instruction *> &ForeInstrs) {
+    auto *I = dyn_cast<Instruction>(V);
+    if (!I || !Outer->contains(I) || is_contained(ForeInstrs, I))
+      return true;
+    if (I->getParent() != Aft)
+      return I->getParent() == Outer->getHeader();
+    if (isa<PHINode>(I) || I->mayReadOrWriteMemory() || I->mayHaveSideEffects())
+      return false;
+    for (Value *Op : I->operands())
+      if (!collectForeInstrs(Op, Aft, Outer, ForeInstrs))
+        return false;
+    ForeInstrs.push_back(I);
+    return true;
+  }
+
+  /// Collect the memory accesses of \p BB into \p MemInstrs. Returns false if
+  /// \p BB has other instructions with side effects.
+  static bool collectMemInstrs(BasicBlock *BB,
+                               SmallVectorImpl<Instruction *> &MemInstrs) {
+    for (Instruction &I : *BB) {
+      if (!I.mayReadOrWriteMemory()) {
+        if (I.mayHaveSideEffects())
+          return false;
+        continue;
+      }
+      auto *Ld = dyn_cast<LoadInst>(&I);
+      auto *St = dyn_cast<StoreInst>(&I);
+      if ((!Ld || !Ld->isSimple()) && (!St || !St->isSimple()))
+        return false;
+      MemInstrs.push_back(&I);
+    }
+    return true;
+  }
+
+  /// Check the dependences of the accesses of the fore, sub and aft blocks
+  /// against the order of the unrolled and jammed loop.
+  bool checkDependences(ArrayRef<Instruction *> ForeMem,
+                        ArrayRef<Instruction *> SubMem,
+                        ArrayRef<Instruction *> AftMem, unsigned OuterLevel) {
+    // A later phase of an outer iteration now runs after an earlier phase of
+    // the following ones.
+    auto isReversed = [&](Instruction *Src, Instruction *Dst) {
+      if (isa<LoadInst>(Src) && isa<LoadInst>(Dst))
+        return false;
+      auto D = DI->depends(Src, Dst, true);
+      return D && (D->isConfused() ||
+                   (D->getDirection(OuterLevel) & Dependence::DVEntry::LT));
+    };
+    for (Instruction *Dst : ForeMem) {
+      for (Instruction *Src : SubMem)
+        if (isReversed(Src, Dst))
+          return false;
+      for (Instruction *Src : AftMem)
+        if (isReversed(Src, Dst))
+          return false;
+    }
+    for (Instruction *Dst : SubMem)
+      for (Instruction *Src : AftMem)
+        if (isReversed(Src, Dst))
+          return false;
+
+    // Iterations of the inner bodies of consecutive outer iterations are
+    // interleaved, which is only legal if no dependence goes forward in one
+    // loop and backward in the other.
+    for (unsigned I = 0, E = SubMem.size(); I != E; I++) {
+      for (unsigned J = I; J != E; J++) {
+        if (isa<LoadInst>(SubMem[I]) && isa<LoadInst>(SubMem[J]))
+          continue;
+        auto D = DI->depends(SubMem[I], SubMem[J], true);
+        if (!D)
+          continue;
+        if (D->isConfused())
+          return false;
+        unsigned OuterDir = D->getDirection(OuterLevel);
+        unsigned InnerDir = D->getDirection(OuterLevel + 1);
+        if (((OuterDir & Dependence::DVEntry::LT) &&
+             (InnerDir & Dependence::DVEntry::GT)) ||
+            ((OuterDir & Dependence::DVEntry::GT) &&
+             (InnerDir & Dependence::DVEntry::LT))) {
+          DEBUG(dbgs() << "Dependence prevents unroll and jam\n Src:"
+                       << *SubMem[I] << "\n Dst:" << *SubMem[J] << "\n");
+          return false;
+        }
+      }
+    }
+    return true;
+  }
+
+  /// Pick the unroll count of \p C, or return 0 if none pays off or fits.
+  unsigned selectCount(JamCandidate &C, Loop *Inner, unsigned TripMultiple) {
+    BasicBlock *Sub = C.Sub;
+    auto usesVectorRegister = [](Type *Ty) {
+      return Ty->isVectorTy() || Ty->isFloatingPointTy();
+    };
+
+    // Values live in the jammed inner loop: its PHIs and the values it uses
+    // from outside, once for values that are the same in every copy and
+    // once per copy for the others.
+    unsigned Shared[2] = {0, 0}, PerCopy[2] = {0, 0};
+    for (auto I = Sub->begin(); auto *PN = dyn_cast<PHINode>(I); ++I) {
+      bool IsVector = usesVectorRegister(PN->getType());
+      if (C.SharedPHIs.count(PN))
+        Shared[IsVector]++;
+      else
+        PerCopy[IsVector]++;
+    }
+    SmallPtrSet<Value *, 16> LiveIns;
+    unsigned Size = 0, ReusedLoads = 0;
+    for (Instruction &I : *Sub) {
+      if (isa<LoadInst>(I) &&
+          isOuterInvariant(SE->getSCEV(cast<LoadInst>(I).getPointerOperand()),
+                           C.Outer, Inner)) {
+        // The loaded value stays live across the bodies of all copies.
+        ReusedLoads++;
+        Shared[usesVectorRegister(I.getType())]++;
+      }
+      if (!isa<PHINode>(I))
+        Size++;
+      for (Value *Op : I.operands()) {
+        if (isa<Constant>(Op) || isa<BasicBlock>(Op))
+          continue;
+        auto *OpI = dyn_cast<Instruction>(Op);
+        if ((OpI && OpI->getParent() == Sub) || !LiveIns.insert(Op).second)
+          continue;
+        bool IsVector = usesVectorRegister(Op->getType());
+        if (OpI && C.Outer->contains(OpI))
+          PerCopy[IsVector]++;
+        else
+          Shared[IsVector]++;
+      }
+    }
+
+    if (UnrollAndJamCount) {
+      unsigned Count = UnrollAndJamCount;
+      return Count > 1 && TripMultiple % Count == 0 ? Count : 0;
+    }
+    if (!ReusedLoads) {
+      DEBUG(dbgs() << "No loads are shared between the jammed copies\n");
+      return 0;
+    }
+
+    unsigned Regs[2] = {TTI->getNumberOfRegisters(false),
+                        TTI->getNumberOfRegisters(true)};
+    for (unsigned Count = UnrollAndJamMaxCount; Count > 1; Count /= 2) {
+      if (TripMultiple % Count || Size * Count > UnrollAndJamThreshold)
+        continue;
+      // Keep one register of each class for temporaries.
+      bool Fits = true;
+      for (unsigned RC = 0; RC < 2; RC++)
+        if (Shared[RC] + Count * PerCopy[RC] &&
+            Shared[RC] + Count * PerCopy[RC] + 1 > Regs[RC])
+          Fits = false;
+      if (Fits)
+        return Count;
+    }
+    DEBUG(dbgs() << "No unroll count fits the registers\n");
+    return 0;
+  }
+
+  /// Check if the nest \p Outer can be unrolled and jammed, and describe it
+  /// in \p C.
+  bool analyzeNest(Loop *Outer, JamCandidate &C) {
+    if (Outer->getSubLoops().size() != 1)
+      return false;
+    Loop *Inner = Outer->getSubLoops().front();
+    if (!Inner->empty() || Outer->getNumBlocks() != 3 ||
+        Inner->getNumBlocks() != 1)
+      return false;
+
+    C.Outer = Outer;
+    C.Fore = Outer->getHeader();
+    C.Sub = Inner->getHeader();
+    C.Aft = Outer->getLoopLatch();
+    C.Exit = Outer->getExitBlock();
+    if (!Outer->getLoopPreheader() || !C.Aft || !C.Exit ||
+        Outer->getExitingBlock() != C.Aft ||
+        Inner->getLoopPreheader() != C.Fore || Inner->getExitBlock() != C.Aft)
+      return false;
+    auto *AftBr = dyn_cast<BranchInst>(C.Aft->getTerminator());
+    auto *SubBr = dyn_cast<BranchInst>(C.Sub->getTerminator());
+    if (!AftBr || !AftBr->isConditional() || !SubBr ||
+        !SubBr->isConditional() || !isa<BranchInst>(C.Fore->getTerminator()))
+      return false;
+    DEBUG(dbgs() << "Analyzing nest at " << C.Fore->getName() << "\n");
+
+    // Every copy runs the jammed inner loop the same number of times.
+    const SCEV *InnerBTC = SE->getBackedgeTakenCount(Inner);
+    if (isa<SCEVCouldNotCompute>(InnerBTC) ||
+        !SE->isLoopInvariant(InnerBTC, Outer)) {
+      DEBUG(dbgs() << "Inner trip count is not invariant in the outer loop\n");
+      return false;
+    }
+    // The copies of the latch branch are removed, so the outer loop has to
+    // run a multiple of the unroll count of times.
+    unsigned TripMultiple = SE->getSmallConstantTripMultiple(Outer);
+
+    // The header of the next copy needs the values of the header PHIs.
+    for (auto I = C.Fore->begin(); auto *PN = dyn_cast<PHINode>(I); ++I)
+      if (!collectForeInstrs(PN->getIncomingValueForBlock(C.Aft), C.Aft, Outer,
+                             C.ForeInstrs)) {
+        DEBUG(dbgs() << "Header PHI depends on the inner loop\n");
+        return false;
+      }
+
+    for (auto I = C.Sub->begin(); auto *PN = dyn_cast<PHINode>(I); ++I)
+      if (isOuterInvariant(SE->getSCEV(PN), Outer, Inner))
+        C.SharedPHIs.insert(PN);
+
+    SmallVector<Instruction *, 8> ForeMem, SubMem, AftMem;
+    if (!collectMemInstrs(C.Fore, ForeMem) || !collectMemInstrs(C.Sub, SubMem) ||
+        !collectMemInstrs(C.Aft, AftMem))
+      return false;
+    if (!checkDependences(ForeMem, SubMem, AftMem, Outer->getLoopDepth()))
+      return false;
+
+    C.Count = selectCount(C, Inner, TripMultiple);
+    return C.Count > 1;
+  }
+
+  static Value *getMappedValue(Value *V, ValueToValueMapTy *VMap) {
+    if (!VMap)
+      return V;
+    Value *Mapped = VMap->lookup(V);
+    return Mapped ? Mapped : V;
+  }
+
+  /// Unroll the outer loop of \p C and jam the copies of its inner loop.
+  void unrollAndJam(JamCandidate &C) {
+    BasicBlock *Fore = C.Fore, *Sub = C.Sub, *Aft = C.Aft;
+    Function *F = Fore->getParent();
+    DEBUG(dbgs() << "Unrolling and jamming nest at " << Fore->getName()
+                 << " by " << C.Count << "\n");
+
+    for (Instruction *I : C.ForeInstrs)
+      I->moveBefore(Fore->getTerminator());
+
+    SmallVector<BasicBlock *, 8> Fores(1, Fore), Subs(1, Sub), Afts(1, Aft);
+    SmallVector<std::unique_ptr<ValueToValueMapTy>, 8> VMaps;
+    ValueToValueMapTy *PrevVMap = nullptr;
+    for (unsigned Copy = 1; Copy < C.Count; Copy++) {
+      auto VMap = make_unique<ValueToValueMapTy>();
+      SmallVector<BasicBlock *, 3> NewBlocks;
+      for (BasicBlock *BB : {Fore, Sub, Aft}) {
+        BasicBlock *New = CloneBasicBlock(BB, *VMap, ".jam" + Twine(Copy), F);
+        (*VMap)[BB] = New;
+        NewBlocks.push_back(New);
+      }
+
+      // The header PHIs of a copy are the values the previous copy computed
+      // for the next iteration.
+      for (auto I = Fore->begin(); auto *PN = dyn_cast<PHINode>(I); ++I) {
+        auto *NewPN = cast<PHINode>((*VMap)[PN]);
+        (*VMap)[PN] =
+            getMappedValue(PN->getIncomingValueForBlock(Aft), PrevVMap);
+        NewPN->eraseFromParent();
+      }
+      for (PHINode *PN : C.SharedPHIs) {
+        auto *NewPN = cast<PHINode>((*VMap)[PN]);
+        (*VMap)[PN] = PN;
+        NewPN->eraseFromParent();
+      }
+      for (BasicBlock *New : NewBlocks)
+        for (Instruction &I : *New)
+          RemapInstruction(&I, *VMap,
+                           RF_NoModuleLevelChanges | RF_IgnoreMissingLocals);
+
+      Fores.push_back(NewBlocks[0]);
+      Subs.push_back(NewBlocks[1]);
+      Afts.push_back(NewBlocks[2]);
+      VMaps.push_back(std::move(VMap));
+      PrevVMap = VMaps.back().get();
+    }
+    BasicBlock *LastFore = Fores.back(), *LastAft = Afts.back();
+
+    // The headers of all copies run first...
+    for (unsigned Copy = 0; Copy < C.Count; Copy++)
+      cast<BranchInst>(Fores[Copy]->getTerminator())
+          ->setSuccessor(0, Copy + 1 < C.Count ? Fores[Copy + 1] : Sub);
+
+    // ...then the inner loop with the bodies of all copies, whose results the
+    // first latch receives...
+    for (unsigned Copy = 1; Copy < C.Count; Copy++)
+      while (auto *PN = dyn_cast<PHINode>(&Afts[Copy]->front())) {
+        PN->setIncomingBlock(0, Sub);
+        PN->moveBefore(Aft->getFirstNonPHI());
+      }
+    for (auto I = Sub->begin(); auto *PN = dyn_cast<PHINode>(I); ++I)
+      PN->setIncomingBlock(PN->getBasicBlockIndex(Fore), LastFore);
+    for (unsigned Copy = 1; Copy < C.Count; Copy++) {
+      BasicBlock *SubCopy = Subs[Copy];
+      while (auto *PN = dyn_cast<PHINode>(&SubCopy->front())) {
+        PN->setIncomingBlock(PN->getBasicBlockIndex(Fores[Copy]), LastFore);
+        PN->setIncomingBlock(PN->getBasicBlockIndex(SubCopy), Sub);
+        PN->moveBefore(Sub->getFirstNonPHI());
+      }
+      SubCopy->getTerminator()->eraseFromParent();
+      while (!SubCopy->empty())
+        SubCopy->front().moveBefore(Sub->getTerminator());
+      SubCopy->eraseFromParent();
+    }
+
+    // ...and the latches one after the other, the last one deciding whether
+    // the outer loop continues.
+    for (unsigned Copy = 0; Copy + 1 < C.Count; Copy++) {
+      auto *BI = cast<BranchInst>(Afts[Copy]->getTerminator());
+      Value *Cond = BI->getCondition();
+      BranchInst::Create(Afts[Copy + 1], BI);
+      BI->eraseFromParent();
+      RecursivelyDeleteTriviallyDeadInstructions(Cond);
+    }
+    LastAft->getTerminator()->replaceUsesOfWith(LastFore, Fore);
+
+    for (BasicBlock *BB : {Fore, C.Exit}) {
+      for (auto I = BB->begin(); auto *PN = dyn_cast<PHINode>(I); ++I) {
+        int Idx = PN->getBasicBlockIndex(Aft);
+        PN->setIncomingValue(Idx,
+                             getMappedValue(PN->getIncomingValue(Idx), PrevVMap));
+        PN->setIncomingBlock(Idx, LastAft);
+      }
+    }
+    NumUnrolledAndJammed++;
+  }
+};
+
+} // end of namespace
+
+char LoopUnrollAndJam::ID = 0;
+INITIALIZE_PASS_BEGIN(LoopUnrollAndJam, "loop-unroll-and-jam",
+                      "Unroll outer loops and jam their inner loops", false,
+                      false)
+INITIALIZE_PASS_DEPENDENCY(DependenceAnalysisWrapperPass)
+INITIALIZE_PASS_DEPENDENCY(ScalarEvolutionWrapperPass)
+INITIALIZE_PASS_DEPENDENCY(TargetTransformInfoWrapperPass)
+INITIALIZE_PASS_DEPENDENCY(LoopSimplify)
+INITIALIZE_PASS_DEPENDENCY(LCSSAWrapperPass)
+INITIALIZE_PASS_DEPENDENCY(LoopInfoWrapperPass)
+INITIALIZE_PASS_END(LoopUnrollAndJam, "loop-unroll-and-jam",
+                    "Unroll outer loops and jam their inner loops", false,
+                    false)
+
+Pass *llvm::createLoopUnrollAndJamPass() { return new LoopUnrollAndJam(); }
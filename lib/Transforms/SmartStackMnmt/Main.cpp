@@ -13,9 +13,11 @@
 //===----------------------------------------------------------------------===//
 #include "llvm/Pass.h"
 #include "llvm/IR/LegacyPassManager.h"
+#include "llvm/ADT/Statistic.h"
 #include "llvm/Analysis/CallGraph.h"
 #include "llvm/Analysis/LoopInfo.h"
 #include "llvm/IR/Attributes.h"
+#include "llvm/IR/DiagnosticInfo.h"
 #include "llvm/IR/InlineAsm.h"
 #include "llvm/IR/InstIterator.h"
 #include "llvm/IR/Instruction.h"
@@ -27,6 +29,7 @@
 #include "llvm/Transforms/Utils/ValueMapper.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Support/Debug.h"
+#include "llvm/Support/MathExtras.h"
 
 #include <fstream>
 #include <queue>
@@ -37,11 +40,15 @@
 
 #include "Mnmt.h"
 #include "../SMMCommon/Helper.h"
+#include "../SMMCommon/SMMInfo.h"
 
 #define DEBUG_TYPE "smmssm"
 
 using namespace llvm;
 
+STATISTIC(NumManagedCalls, "Number of calls with stack frame management");
+STATISTIC(NumCutCycles, "Estimated DMA cycles of stack frame management");
+
 cl::opt<std::string> size_constraint("size-constraint", cl::desc("Specify the size of available stack space in SPM"), cl::value_desc("a string"));
 cl::opt<std::string> stack_frame_size("stack-frame-size", cl::desc("Specify the file that stores the sizes of stack frames"), cl::value_desc("a string"));
 
@@ -56,11 +63,74 @@ namespace {
 	virtual void getAnalysisUsage(AnalysisUsage &AU) const {
 	    AU.addRequired<CallGraphWrapperPass>();
 	    AU.addRequired<LoopInfoWrapperPass>();
+	    AU.addRequired<SMMInfo>();
+	}
+
+	// Estimate the DMA cycles taken to save and restore stack frames at the cuts of paths
+	uint64_t getCutCost(std::vector<std::vector<CallGraphNode::CallRecord *> > &paths, std::unordered_map <unsigned, std::vector <std::pair<unsigned, std::string> > > &cuts, std::unordered_map <Function *, size_t> &stackFrameSizes, const SMMDMAModel &dma) {
+	    // A call shared by multiple paths is instrumented only once
+	    std::unordered_map <Value *, uint64_t> cut_costs;
+	    for (auto cutsi = cuts.begin(), cutse = cuts.end(); cutsi != cutse; cutsi++) {
+		std::vector<CallGraphNode::CallRecord *> &path = paths[cutsi->first];
+		std::vector <unsigned> positions;
+		for (size_t k = 0; k < cutsi->second.size(); k++)
+		    positions.push_back(cutsi->second[k].first);
+		std::sort(positions.begin(), positions.end());
+
+		size_t k = 0, start = 0;
+		uint64_t num_exec = 1;
+		for (size_t j = 1; j < path.size() && k < positions.size(); j++) {
+		    // Assume the same trip count for all the loops around the calls
+		    CallInst *call_inst = cast<CallInst>(path[j]->first);
+		    BasicBlock *bb = call_inst->getParent();
+		    LoopInfo &lpi = getAnalysis<LoopInfoWrapperPass>(*bb->getParent()).getLoopInfo();
+		    for (unsigned d = lpi.getLoopDepth(bb); d > 0; d--)
+			num_exec = SaturatingMultiply(num_exec, (uint64_t)DEFAULT_TRIP_COUNT);
+		    if (j != positions[k])
+			continue;
+		    // The frames since the last cut are copied out before the call and back after it
+		    uint64_t bytes = 0;
+		    for (size_t l = start; l < j; l++)
+			bytes += stackFrameSizes[path[l]->second->getFunction()];
+		    uint64_t cost = SaturatingMultiply(2 * dma.getTransferCost(bytes), num_exec);
+		    cut_costs[call_inst] = std::max(cut_costs[call_inst], cost);
+		    start = j;
+		    k++;
+		}
+	    }
+
+	    uint64_t total = 0;
+	    for (auto ci = cut_costs.begin(), ce = cut_costs.end(); ci != ce; ci++)
+		total = SaturatingAdd(total, ci->second);
+	    return total;
+	}
+
+	// Declare the runtime functions that are not called by the program yet, and
+	// check that the runtime variables are linked in
+	void checkRuntime(Module &mod) {
+	    LLVMContext &context = mod.getContext();
+	    Type *ty_void = Type::getVoidTy(context);
+	    Type *ty_int64 = Type::getInt64Ty(context);
+	    PointerType *ptrty_int8 = Type::getInt8PtrTy(context);
+
+	    mod.getOrInsertFunction("_sstore", ty_void, nullptr);
+	    mod.getOrInsertFunction("_sload", ty_void, nullptr);
+	    mod.getOrInsertFunction("_g2l", ptrty_int8, ptrty_int8, ty_int64, nullptr);
+	    mod.getOrInsertFunction("_l2g", ptrty_int8, ptrty_int8, nullptr);
+
+	    // Their types depend on the runtime, so they cannot be declared here
+	    static const char *const variables[] = {"_stack_pointer", "_mem_stack_base", "_spm_stack_base", "_mem_stack_depth", "_mem_stack"};
+	    for (const char *name : variables) {
+		if (!mod.getGlobalVariable(name))
+		    report_fatal_error(Twine("smmssm: the SPM runtime variable ") + name + " is missing, link the runtime into the program");
+	    }
 	}
 
 	virtual bool runOnModule(Module &mod) {
 	    LLVMContext &context = mod.getContext();
 
+	    checkRuntime(mod);
+
 	    // Pointer Types
 	    PointerType* ptrty_int8 = PointerType::get(IntegerType::get(context, 8), 0);
 	    PointerType* ptrty_ptrint8 = PointerType::get(ptrty_int8, 0);
@@ -117,7 +187,7 @@ namespace {
 	    assert(CallGraphNode::iterator(root) != cg.begin()->second->end());
 
 	    // Extarct all the paths from the root
-	    auto res = getPaths(root);
+	    auto res = getPaths(cg, root);
 	    paths = res.first;
 	    undecidable_cgns = res.second; 
 
@@ -139,30 +209,27 @@ namespace {
 
 	    std::unordered_map <Function *, size_t> stackFrameSizes;
 	    std::unordered_map <unsigned, std::vector <std::pair<unsigned, std::string> > > cuts;
-	    std::ifstream ifs;
+	    SMMInfo &info = getAnalysis<SMMInfo>();
 	    // Obtain stack frame sizes
-	    ifs.open(stack_frame_size, std::fstream::in);
-	    assert(ifs.good());
-	    while (ifs.good()) {
-		std::string func_name;
-		size_t frame_size;
-		ifs >> func_name >> frame_size;
-		// Ignore white spaces after the last line
-		if (func_name != "") {
-		    DEBUG(errs() << "\t" << func_name << " " << frame_size << "\n");
-		    if (func_name == "main") {
-			func_name = "smm_main";
+	    if (!stack_frame_size.empty()) {
+		std::vector<SMMSizeEntry> sizes;
+		if (!SMMInfo::readSizeList(stack_frame_size, sizes))
+		    report_fatal_error("cannot read " + stack_frame_size);
+		for (size_t i = 0; i < sizes.size(); i++) {
+		    DEBUG(errs() << "\t" << sizes[i].Name << " " << sizes[i].Size << "\n");
+		    if (sizes[i].Name == "main") {
+			sizes[i].Name = "smm_main";
 		    }
-		    stackFrameSizes[mod.getFunction(func_name)] = frame_size;
 		}
+		info.setStackFrameSizes(sizes);
 	    }
-	    ifs.close();
+	    stackFrameSizes = info.getStackFrameSizes(mod);
 
 	    // Decides locations of cuts
 	    bool foundSolution = true;
 	    // Try to avoid cuts in loops
 	    for (size_t i = 0; i < paths.size(); i++) {
-		size_t sum  = stackFrameSizes[func_smm_main];
+		size_t sum  = stackFrameSizes[paths[i][0]->second->getFunction()];
 		for (size_t j = 1; j < paths[i].size(); j++) {
 		    Function *func = paths[i][j]->second->getFunction();
 		    std::string func_name = func->getName();
@@ -206,22 +273,32 @@ namespace {
 		if (foundSolution == false)
 		    break;
 	    }
-	    // If cuts in loops are not avoidable, fall back to the default way of grouping
-	    if (!foundSolution) {
-		cuts.clear();
-		for (size_t i = 0; i < paths.size(); i++) {
-		    size_t sum  = stackFrameSizes[func_smm_main];
-		    for (size_t j = 1; j < paths[i].size(); j++) {
-			Function *func = paths[i][j]->second->getFunction();
-			std::string func_name = func->getName();
-			if (sum + stackFrameSizes[func] > sizeConstraint) {
-			    cuts[i].push_back( std::make_pair(j, func_name) );
-			    sum = 0;
-			} else 
-			    sum += stackFrameSizes[func];
-		    }
+	    // The default way of grouping
+	    std::unordered_map <unsigned, std::vector <std::pair<unsigned, std::string> > > default_cuts;
+	    for (size_t i = 0; i < paths.size(); i++) {
+		size_t sum  = stackFrameSizes[paths[i][0]->second->getFunction()];
+		for (size_t j = 1; j < paths[i].size(); j++) {
+		    Function *func = paths[i][j]->second->getFunction();
+		    std::string func_name = func->getName();
+		    if (sum + stackFrameSizes[func] > sizeConstraint) {
+			default_cuts[i].push_back( std::make_pair(j, func_name) );
+			sum = 0;
+		    } else 
+			sum += stackFrameSizes[func];
 		}
 	    }
+	    // If cuts in loops are not avoidable, fall back to the default way of grouping, otherwise take the cheaper one
+	    if (!foundSolution) {
+		cuts = default_cuts;
+	    } else {
+		const SMMDMAModel &dma = info.getDMAModel();
+		uint64_t cost = getCutCost(paths, cuts, stackFrameSizes, dma);
+		uint64_t default_cost = getCutCost(paths, default_cuts, stackFrameSizes, dma);
+		DEBUG(dbgs() << "\tDMA cost of cuts: " << cost << ", default: " << default_cost << "\n");
+		if (default_cost < cost)
+		    cuts = default_cuts;
+	    }
+	    NumCutCycles += getCutCost(paths, cuts, stackFrameSizes, info.getDMAModel());
 
 	    // Sort cuts acoording to paths
 	    for (auto cutsi = cuts.begin(), cutse = cuts.end(); cutsi != cutse; cutsi++) {
@@ -308,24 +385,41 @@ namespace {
 		DEBUG(dbgs() << call_inst->getParent()->getParent()->getName() << ":" << call_inst->getParent()->getName() <<  " -> " << call_inst->getCalledFunction()->getName() << "\n");
 		// Insert stack frame management functions
 		stack_frame_management_instrumentation(mod, call_inst);
+		++NumManagedCalls;
 	    }
 	    DEBUG(dbgs() << "}\n");
 
-	    // Step 4.1: Insert frame management functions at self-recursive calls
+	    // Step 4.1: Insert frame management functions at calls into and within recursive SCCs
 
 	    DEBUG(dbgs() << "Inserting frame management functions around recursive calls... {\n");
+	    // The recursion depth is unknown, so each stack frame of recursive functions starts from the SPM stack base
+	    std::unordered_map <CallGraphNode *, unsigned> scc_ids = getRecursiveSCCs(cg);
+	    std::unordered_set <unsigned> reported_sccs;
 	    for (std::unordered_set <CallGraphNode *>::iterator si = undecidable_cgns.begin(), se = undecidable_cgns.end(); si != se; si++) {
-		CallGraphNode * cgn = *si;
+		CallGraphNode *cgn = *si;
 		// Skip external nodes
-		if (!cgn->getFunction())
+		if (!cgn->getFunction() || !reported_sccs.insert(scc_ids[cgn]).second)
+		    continue;
+		std::string func_names;
+		for (auto ii = scc_ids.begin(), ie = scc_ids.end(); ii != ie; ii++) {
+		    if (ii->second == scc_ids[cgn])
+			func_names += (func_names.empty() ? "" : ", ") + ii->first->getFunction()->getName().str();
+		}
+		context.diagnose(DiagnosticInfoUnsupported(*cgn->getFunction(), "recursive functions (" + func_names + ") use one SPM stack frame at a time", DebugLoc(), DS_Warning));
+	    }
+	    for (CallGraph::iterator cgi = cg.begin(), cge = cg.end(); cgi != cge; cgi++) {
+		CallGraphNode *cgn = cgi->second.get();
+		Function *fi = cgn->getFunction();
+		// Skip external nodes, library functions, management functions and main function
+		if (!fi || isLibraryFunction(fi) || isManagementFunction(fi) || fi == func_main)
 		    continue;
-		DEBUG(dbgs() << cgn->getFunction()->getName() << "\n");
 		for (CallGraphNode::iterator cgni = cgn->begin(), cgne = cgn->end(); cgni != cgne; cgni++) {
-		    // Skip non-self-recursive calls
-		    if (cgni->second != cgn)
+		    // Skip calls to functions that are not recursive
+		    if (!cgni->second->getFunction() || undecidable_cgns.find(cgni->second) == undecidable_cgns.end())
 			continue;
 		    CallInst *call_inst = dyn_cast<CallInst> (cgni->first);
 		    assert(call_inst);
+		    DEBUG(dbgs() << fi->getName() << " -> " << cgni->second->getFunction()->getName() << "\n");
 
 		    // Check if stack frame management functions have been inserted
 		    BasicBlock::iterator ii(call_inst);
@@ -345,6 +439,7 @@ namespace {
 		    }
 		    // Insert stack frame management functions
 		    stack_frame_management_instrumentation(mod, call_inst);
+		    ++NumManagedCalls;
 		}
 	    }
 
@@ -1,4 +1,5 @@
 #include "llvm/Pass.h"
+#include "llvm/ADT/Triple.h"
 #include "llvm/IR/LegacyPassManager.h"
 #include "llvm/Analysis/CallGraph.h"
 #include "llvm/IR/Attributes.h"
@@ -10,6 +11,7 @@
 #include "llvm/IR/Module.h"
 #include "llvm/IR/Value.h"
 #include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
 #include "llvm/Transforms/Utils/ValueMapper.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Support/Debug.h"
@@ -203,6 +205,41 @@ void l2g_pointer_management_instrumentation(Module &mod, CallGraphNode *cgn) {
 
 }
 
+// Caller-saved registers of the System V x86-64 calling convention
+#define X86_64_CALL_CLOBBERS "~{rax},~{rcx},~{rdx},~{rsi},~{rdi},~{r8},~{r9},~{r10},~{r11}," \
+    "~{xmm0},~{xmm1},~{xmm2},~{xmm3},~{xmm4},~{xmm5},~{xmm6},~{xmm7}," \
+    "~{xmm8},~{xmm9},~{xmm10},~{xmm11},~{xmm12},~{xmm13},~{xmm14},~{xmm15}"
+
+// Check if a return value can stay in a callee-saved register across a stack frame management point
+static bool canPassReturnInRegister(Module &mod, Type *ty) {
+    // The SP switching code is x86-64 assembly, which has callee-saved general purpose registers only
+    if (Triple(mod.getTargetTriple()).getArch() != Triple::x86_64)
+	return false;
+    if (ty->isPointerTy())
+	return true;
+    if (IntegerType *int_ty = dyn_cast<IntegerType>(ty))
+	return int_ty->getBitWidth() <= 64;
+    return false;
+}
+
+// Get the slot that keeps return values of the specified type across a stack frame management point
+static GlobalVariable *getOrInsertReturnSlot(Module &mod, Type *ty) {
+    std::string type_name;
+    raw_string_ostream rso(type_name);
+    ty->print(rso);
+    std::string slot_name = "_gvar_ret." + rso.str();
+    GlobalVariable *gvar_ret = mod.getGlobalVariable(slot_name, true);
+    if (gvar_ret)
+	return gvar_ret;
+    gvar_ret = new GlobalVariable(mod, //Module
+	    ty, //Type
+	    false, //isConstant
+	    GlobalValue::InternalLinkage, //linkage
+	    Constant::getNullValue(ty), // Initializer
+	    slot_name); //Name
+    return gvar_ret;
+}
+
 void stack_frame_management_instrumentation (Module &mod, CallInst *call_inst) {
     LLVMContext &context = mod.getContext();
     IRBuilder<> builder(context);
@@ -232,6 +269,7 @@ void stack_frame_management_instrumentation (Module &mod, CallInst *call_inst) {
     // Functions
     Function *func_sstore = mod.getFunction("_sstore");
     Function *func_sload = mod.getFunction("_sload");
+    assert(func_sstore && func_sload);
 
     BasicBlock::iterator ii(call_inst);
     Instruction *next_inst = &*(++ii);
@@ -264,54 +302,55 @@ void stack_frame_management_instrumentation (Module &mod, CallInst *call_inst) {
     fieldidx.push_back(int32_0);
     fieldidx.push_back(int32_0);
     Value* then_stack_pointer = builder.CreateGEP(arrayelem, fieldidx, "then_stack_pointer");
+    Type * retty = call_inst->getType();
+    // Keep a used return value in a register across the SP switch if possible
+    if (!retty->isVoidTy() && call_inst->getNumUses() > 0 && canPassReturnInRegister(mod, retty)) {
+	// Restore the SP and call sload in one asm block. The return value is
+	// tied to a register that is not clobbered by the call, so it can neither
+	// be spilled to the SPM stack frame that sload overwrites nor be lost.
+	std::vector<Type*> asm_arg_types;
+	asm_arg_types.push_back(ptrty_ptrint8);
+	asm_arg_types.push_back(retty);
+	FunctionType* functy_sload_asm = FunctionType::get(retty, asm_arg_types, false);
+	InlineAsm *func_putSP_sload = InlineAsm::get(functy_sload_asm, "mov $1, %rsp; call " + func_sload->getName().str() + ";",
+		"=r,*m,0," X86_64_CALL_CLOBBERS ",~{rsp},~{memory},~{dirflag},~{fpsr},~{flags}", true);
+	// sload is now only referenced from inline assembly
+	appendToUsed(mod, func_sload);
+
+	std::vector<Value*> asm_args;
+	asm_args.push_back(then_stack_pointer);
+	asm_args.push_back(UndefValue::get(retty));
+	CallInst *ret_val = builder.CreateCall(func_putSP_sload, asm_args, "ret_val");
+	call_inst->replaceAllUsesWith(ret_val);
+	ret_val->setArgOperand(1, call_inst);
+	return;
+    }
+
     // Insert putSP(_mem_stack[_mem_stack_depth-1].spm_addr)
     builder.CreateCall(func_putSP, then_stack_pointer);
     // Insert a corresponding sload function
     builder.CreateCall(func_sload);
 
     // Skip if the function does not have return value
-    Type * retty = call_inst->getType();
     if (retty->isVoidTy())
 	return;
     // Skip if the return value is never used
     if (call_inst->getNumUses() == 0) 
 	return;
-    // Save return value in a global variable temporarily until sload is executed if it is used
-    // Always create a new global variable in case of recursive functions
-    GlobalVariable *gvar_ret = new GlobalVariable(mod, //Module
-	    retty, //Type
-	    false, //isConstant
-	    GlobalValue::ExternalLinkage, //linkage
-	    0, // Initializer
-	    "_gvar_ret"); //Name
-    // Initialize the temporary global variable
-    gvar_ret->setInitializer(Constant::getNullValue(retty));
-    // Save return value to the global variable before sload is called
+    // Otherwise save the return value in a slot outside of the managed stack
+    // until sload is executed. The slot is read back right after sload, before
+    // any other managed call can reuse it, so one slot per type is enough
+    // even for recursive functions.
+    GlobalVariable *gvar_ret = getOrInsertReturnSlot(mod, retty);
     StoreInst *st_ret = new StoreInst(call_inst, gvar_ret);
     st_ret->insertAfter(call_inst);
-
+    LoadInst *ret_val = builder.CreateLoad(gvar_ret, "ret_val");
     for (Value::use_iterator ui_ret = call_inst->use_begin(), ue_ret = call_inst->use_end(); ui_ret != ue_ret;) {
 	// Move iterator to next use before the current use is destroyed
 	Use *u = &*ui_ret++;
-	Instruction *user_inst = dyn_cast<Instruction>(u->getUser()); 
-	assert(user_inst);
-
-	DEBUG(errs() <<  "\t\t" << *user_inst << "\n");
-
-	if (StoreInst *st_inst = dyn_cast <StoreInst> (user_inst)) {
-	    if (st_inst->getPointerOperand()->getName().count("_gvar_ret") == 1) {
-		DEBUG(errs() << "\t\t\t" << st_inst->getPointerOperand()->getName() << "\n");
-		continue;
-	    }
-	}
-
-	Instruction *insert_point = user_inst;
-
-	if (PHINode *phi_inst = dyn_cast<PHINode>(user_inst))
-	    insert_point = phi_inst->getIncomingBlock(u->getOperandNo())->getTerminator();
-
-	// Read the global variable
-	LoadInst *ret_val = new LoadInst(gvar_ret, "", insert_point);
+	if (u->getUser() == st_ret)
+	    continue;
+	DEBUG(errs() <<  "\t\t" << *u->getUser() << "\n");
 	// Find the uses of return value and replace them
 	u->set(ret_val);
     }
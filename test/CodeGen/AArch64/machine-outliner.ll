@@ -0,0 +1,80 @@
+; RUN: llc -enable-machine-outliner -mtriple=aarch64-unknown-linux < %s | FileCheck %s
+
+; The common tail of @f1 and @f2 is branched to, the common sequence of @g1
+; and @g2 is called with the link register saved around the call.
+
+; CHECK-LABEL: f1:
+; CHECK: b [[TAIL:.*OUTLINED_FUNCTION_[0-9]+]]
+; CHECK-LABEL: f2:
+; CHECK: b [[TAIL]]
+; CHECK-LABEL: g1:
+; CHECK: str x30, [sp, #-16]!
+; CHECK-NEXT: bl [[CALL:.*OUTLINED_FUNCTION_[0-9]+]]
+; CHECK-NEXT: ldr x30, [sp], #16
+; CHECK-LABEL: g2:
+; CHECK: bl [[CALL]]
+
+; CHECK: [[TAIL]]:
+; CHECK: ret
+; CHECK: [[CALL]]:
+; CHECK: ret
+
+define void @f1(i32* %p) #0 {
+  %p1 = getelementptr i32, i32* %p, i64 1
+  %p2 = getelementptr i32, i32* %p, i64 2
+  %p3 = getelementptr i32, i32* %p, i64 3
+  %p4 = getelementptr i32, i32* %p, i64 4
+  store volatile i32 1, i32* %p
+  store volatile i32 2, i32* %p1
+  store volatile i32 3, i32* %p2
+  store volatile i32 4, i32* %p3
+  store volatile i32 5, i32* %p4
+  ret void
+}
+
+define void @f2(i32* %p) #0 {
+  %p1 = getelementptr i32, i32* %p, i64 1
+  %p2 = getelementptr i32, i32* %p, i64 2
+  %p3 = getelementptr i32, i32* %p, i64 3
+  %p4 = getelementptr i32, i32* %p, i64 4
+  store volatile i32 1, i32* %p
+  store volatile i32 2, i32* %p1
+  store volatile i32 3, i32* %p2
+  store volatile i32 4, i32* %p3
+  store volatile i32 5, i32* %p4
+  ret void
+}
+
+define void @g1(i32* %p) #0 {
+  %p1 = getelementptr i32, i32* %p, i64 1
+  %p2 = getelementptr i32, i32* %p, i64 2
+  %p3 = getelementptr i32, i32* %p, i64 3
+  %p4 = getelementptr i32, i32* %p, i64 4
+  %p5 = getelementptr i32, i32* %p, i64 5
+  store volatile i32 11, i32* %p
+  store volatile i32 12, i32* %p1
+  store volatile i32 13, i32* %p2
+  store volatile i32 14, i32* %p3
+  store volatile i32 15, i32* %p4
+  store volatile i32 16, i32* %p5
+  store volatile i32 0, i32* %p
+  ret void
+}
+
+define void @g2(i32* %p) #0 {
+  %p1 = getelementptr i32, i32* %p, i64 1
+  %p2 = getelementptr i32, i32* %p, i64 2
+  %p3 = getelementptr i32, i32* %p, i64 3
+  %p4 = getelementptr i32, i32* %p, i64 4
+  %p5 = getelementptr i32, i32* %p, i64 5
+  store volatile i32 11, i32* %p
+  store volatile i32 12, i32* %p1
+  store volatile i32 13, i32* %p2
+  store volatile i32 14, i32* %p3
+  store volatile i32 15, i32* %p4
+  store volatile i32 16, i32* %p5
+  store volatile i32 0, i32* %p1
+  ret void
+}
+
+attributes #0 = { nounwind }
@@ -0,0 +1,123 @@
+; RUN: llc -enable-machine-outliner -mtriple=x86_64-unknown-linux < %s | FileCheck %s
+; RUN: llc -enable-machine-outliner -mtriple=x86_64-unknown-linux -pass-remarks=machine-outliner -o /dev/null < %s 2>&1 | FileCheck %s --check-prefix=REMARK
+
+; @tail1 and @tail2 end in the same sequence, which is branched to. @call1 and
+; @call2 share a sequence that is followed by different code, so it is called.
+; @ov1 and @ov2 are identical, but in different sections.
+
+; CHECK-LABEL: tail1:
+; CHECK: jmp [[TAIL:.*OUTLINED_FUNCTION_[0-9]+]]
+; CHECK-LABEL: tail2:
+; CHECK: jmp [[TAIL]]
+; CHECK-LABEL: call1:
+; CHECK: callq [[CALL:.*OUTLINED_FUNCTION_[0-9]+]]
+; CHECK-NEXT: movl $17, 24(%rdi)
+; CHECK-LABEL: call2:
+; CHECK: callq [[CALL]]
+; CHECK-NEXT: movl $18, 24(%rdi)
+; CHECK-LABEL: ov1:
+; CHECK-NOT: OUTLINED_FUNCTION
+; CHECK: retq
+; CHECK-LABEL: ov2:
+; CHECK-NOT: OUTLINED_FUNCTION
+; CHECK: retq
+
+; CHECK: [[TAIL]]:
+; CHECK: movl $1, (%rdi)
+; CHECK: movl $6, 20(%rdi)
+; CHECK-NEXT: retq
+; CHECK: [[CALL]]:
+; CHECK: movl $11, (%rdi)
+; CHECK: movl $16, 20(%rdi)
+; CHECK-NEXT: retq
+
+; REMARK-DAG: remark: {{.*}}Saved {{[0-9]+}} bytes by outlining 7 instructions from 2 locations into {{.*}}OUTLINED_FUNCTION_{{[0-9]+}}
+; REMARK-DAG: remark: {{.*}}Saved {{[0-9]+}} bytes by outlining 6 instructions from 2 locations into {{.*}}OUTLINED_FUNCTION_{{[0-9]+}}
+
+define void @tail1(i32* %p) #0 {
+  %p1 = getelementptr i32, i32* %p, i64 1
+  %p2 = getelementptr i32, i32* %p, i64 2
+  %p3 = getelementptr i32, i32* %p, i64 3
+  %p4 = getelementptr i32, i32* %p, i64 4
+  %p5 = getelementptr i32, i32* %p, i64 5
+  store volatile i32 1, i32* %p
+  store volatile i32 2, i32* %p1
+  store volatile i32 3, i32* %p2
+  store volatile i32 4, i32* %p3
+  store volatile i32 5, i32* %p4
+  store volatile i32 6, i32* %p5
+  ret void
+}
+
+define void @tail2(i32* %p) #0 {
+  %p1 = getelementptr i32, i32* %p, i64 1
+  %p2 = getelementptr i32, i32* %p, i64 2
+  %p3 = getelementptr i32, i32* %p, i64 3
+  %p4 = getelementptr i32, i32* %p, i64 4
+  %p5 = getelementptr i32, i32* %p, i64 5
+  store volatile i32 1, i32* %p
+  store volatile i32 2, i32* %p1
+  store volatile i32 3, i32* %p2
+  store volatile i32 4, i32* %p3
+  store volatile i32 5, i32* %p4
+  store volatile i32 6, i32* %p5
+  ret void
+}
+
+define void @call1(i32* %p) #0 {
+  %p1 = getelementptr i32, i32* %p, i64 1
+  %p2 = getelementptr i32, i32* %p, i64 2
+  %p3 = getelementptr i32, i32* %p, i64 3
+  %p4 = getelementptr i32, i32* %p, i64 4
+  %p5 = getelementptr i32, i32* %p, i64 5
+  %p6 = getelementptr i32, i32* %p, i64 6
+  store volatile i32 11, i32* %p
+  store volatile i32 12, i32* %p1
+  store volatile i32 13, i32* %p2
+  store volatile i32 14, i32* %p3
+  store volatile i32 15, i32* %p4
+  store volatile i32 16, i32* %p5
+  store volatile i32 17, i32* %p6
+  ret void
+}
+
+define void @call2(i32* %p) #0 {
+  %p1 = getelementptr i32, i32* %p, i64 1
+  %p2 = getelementptr i32, i32* %p, i64 2
+  %p3 = getelementptr i32, i32* %p, i64 3
+  %p4 = getelementptr i32, i32* %p, i64 4
+  %p5 = getelementptr i32, i32* %p, i64 5
+  %p6 = getelementptr i32, i32* %p, i64 6
+  store volatile i32 11, i32* %p
+  store volatile i32 12, i32* %p1
+  store volatile i32 13, i32* %p2
+  store volatile i32 14, i32* %p3
+  store volatile i32 15, i32* %p4
+  store volatile i32 16, i32* %p5
+  store volatile i32 18, i32* %p6
+  ret void
+}
+
+define void @ov1(i32* %p) #0 section ".ov1" {
+  %p1 = getelementptr i32, i32* %p, i64 1
+  %p2 = getelementptr i32, i32* %p, i64 2
+  %p3 = getelementptr i32, i32* %p, i64 3
+  store volatile i32 21, i32* %p
+  store volatile i32 22, i32* %p1
+  store volatile i32 23, i32* %p2
+  store volatile i32 24, i32* %p3
+  ret void
+}
+
+define void @ov2(i32* %p) #0 section ".ov2" {
+  %p1 = getelementptr i32, i32* %p, i64 1
+  %p2 = getelementptr i32, i32* %p, i64 2
+  %p3 = getelementptr i32, i32* %p, i64 3
+  store volatile i32 21, i32* %p
+  store volatile i32 22, i32* %p1
+  store volatile i32 23, i32* %p2
+  store volatile i32 24, i32* %p3
+  ret void
+}
+
+attributes #0 = { nounwind }
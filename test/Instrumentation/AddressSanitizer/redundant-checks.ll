@@ -0,0 +1,208 @@
+; Test asan internal compiler flags:
+;   -asan-opt-dominating
+;   -asan-opt-merge-adjacent
+;   -asan-opt-hoist-loop
+
+; RUN: opt < %s -asan -asan-module -asan-instrumentation-with-call-threshold=0 -S | FileCheck %s --check-prefix=CHECK-NOOPT
+; RUN: opt < %s -asan -asan-module -asan-instrumentation-with-call-threshold=0 -asan-opt-dominating -S | FileCheck %s --check-prefix=CHECK-DOM
+; RUN: opt < %s -asan -asan-module -asan-instrumentation-with-call-threshold=0 -asan-opt-merge-adjacent -S | FileCheck %s --check-prefix=CHECK-MERGE
+; RUN: opt < %s -asan -asan-module -asan-instrumentation-with-call-threshold=0 -asan-opt-hoist-loop -S | FileCheck %s --check-prefix=CHECK-HOIST
+target datalayout = "e-p:64:64:64-i1:8:8-i8:8:8-i16:16:16-i32:32:32-i64:64:64-f32:32:32-f64:64:64-v64:64:64-v128:128:128-a0:0:64-s0:64:64-f80:128:128-n8:16:32:64"
+target triple = "x86_64-unknown-linux-gnu"
+
+declare void @foo()
+
+; The store is covered by the wider load in the dominating block. The last load
+; follows a call, which may free the memory, so it is checked again.
+define i32 @dominated(i64* %p, i1 %c) sanitize_address {
+entry:
+  %v = load i64, i64* %p, align 8
+  br i1 %c, label %then, label %exit
+
+then:
+  %q = bitcast i64* %p to i32*
+  %q1 = getelementptr i32, i32* %q, i64 1
+  store i32 0, i32* %q1, align 4
+  call void @foo()
+  %w = load i32, i32* %q1, align 4
+  br label %exit
+
+exit:
+  %r = phi i32 [ 0, %entry ], [ %w, %then ]
+  ret i32 %r
+}
+
+; CHECK-NOOPT-LABEL: @dominated
+; CHECK-NOOPT: call void @__asan_load8
+; CHECK-NOOPT: call void @__asan_store4
+; CHECK-NOOPT: call void @foo()
+; CHECK-NOOPT: call void @__asan_load4
+; CHECK-NOOPT: ret i32
+
+; CHECK-DOM-LABEL: @dominated
+; CHECK-DOM: call void @__asan_load8
+; CHECK-DOM-NOT: call void @__asan_store4
+; CHECK-DOM: call void @foo()
+; CHECK-DOM: call void @__asan_load4
+; CHECK-DOM: ret i32
+
+; The load in the loop follows the check in the entry, but the memory may be
+; freed in the latch before the next iteration, so it is checked again.
+declare void @free(i8*)
+
+define void @dominated_loop(i32* %p, i64 %n) sanitize_address {
+entry:
+  %v = load i32, i32* %p, align 4
+  br label %loop
+
+loop:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %latch ]
+  %w = load i32, i32* %p, align 4
+  %c = icmp eq i32 %w, 0
+  br i1 %c, label %latch, label %exit
+
+latch:
+  %q = bitcast i32* %p to i8*
+  call void @free(i8* %q)
+  %i.next = add i64 %i, 1
+  %done = icmp eq i64 %i.next, %n
+  br i1 %done, label %exit, label %loop
+
+exit:
+  ret void
+}
+
+; CHECK-DOM-LABEL: @dominated_loop
+; CHECK-DOM: call void @__asan_load4
+; CHECK-DOM: loop:
+; CHECK-DOM: call void @__asan_load4
+; CHECK-DOM: ret void
+
+; The two fields are checked together before the first access.
+define i32 @fields({ i32, i32 }* %s) sanitize_address {
+entry:
+  %a.addr = getelementptr { i32, i32 }, { i32, i32 }* %s, i64 0, i32 0
+  %b.addr = getelementptr { i32, i32 }, { i32, i32 }* %s, i64 0, i32 1
+  %a = load i32, i32* %a.addr, align 8
+  %b = load i32, i32* %b.addr, align 4
+  %r = add i32 %a, %b
+  ret i32 %r
+}
+
+; CHECK-MERGE-LABEL: @fields
+; CHECK-MERGE-NOT: call void @__asan_load4
+; CHECK-MERGE: call void @__asan_load8
+; CHECK-MERGE-NOT: call void @__asan_load4
+; CHECK-MERGE: ret i32
+
+; The stores in the loop are checked once, before the loop, with a check of the
+; whole array.
+define void @loop(i32* %p, i64 %n) sanitize_address {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %loop ]
+  %q = getelementptr i32, i32* %p, i64 %i
+  store i32 0, i32* %q, align 4
+  %i.next = add nuw nsw i64 %i, 1
+  %cond = icmp ult i64 %i.next, %n
+  br i1 %cond, label %loop, label %exit
+
+exit:
+  ret void
+}
+
+; CHECK-HOIST-LABEL: @loop
+; CHECK-HOIST: entry:
+; CHECK-HOIST: call void @__asan_storeN(i64 %{{.*}}, i64 %{{.*}})
+; CHECK-HOIST: loop:
+; CHECK-HOIST-NOT: call void @__asan_store
+; CHECK-HOIST: ret void
+
+; The loop contains a call, so the check stays in the loop.
+define void @loop_with_call(i32* %p, i64 %n) sanitize_address {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %loop ]
+  %q = getelementptr i32, i32* %p, i64 %i
+  store i32 0, i32* %q, align 4
+  call void @foo()
+  %i.next = add nuw nsw i64 %i, 1
+  %cond = icmp ult i64 %i.next, %n
+  br i1 %cond, label %loop, label %exit
+
+exit:
+  ret void
+}
+
+; CHECK-HOIST-LABEL: @loop_with_call
+; CHECK-HOIST: loop:
+; CHECK-HOIST: call void @__asan_store4
+; CHECK-HOIST: ret void
+
+; Only the latest 16 checks kept on a base are looked at, so the load at the
+; end is checked again although the first load covers it.
+define i32 @scan_limit(i8* %p) sanitize_address {
+entry:
+  %q = bitcast i8* %p to i64*
+  %v = load i64, i64* %q, align 8
+  %a0 = getelementptr i8, i8* %p, i64 8
+  store i8 0, i8* %a0, align 1
+  %a1 = getelementptr i8, i8* %p, i64 9
+  store i8 0, i8* %a1, align 1
+  %a2 = getelementptr i8, i8* %p, i64 10
+  store i8 0, i8* %a2, align 1
+  %a3 = getelementptr i8, i8* %p, i64 11
+  store i8 0, i8* %a3, align 1
+  %a4 = getelementptr i8, i8* %p, i64 12
+  store i8 0, i8* %a4, align 1
+  %a5 = getelementptr i8, i8* %p, i64 13
+  store i8 0, i8* %a5, align 1
+  %a6 = getelementptr i8, i8* %p, i64 14
+  store i8 0, i8* %a6, align 1
+  %a7 = getelementptr i8, i8* %p, i64 15
+  store i8 0, i8* %a7, align 1
+  %a8 = getelementptr i8, i8* %p, i64 16
+  store i8 0, i8* %a8, align 1
+  %a9 = getelementptr i8, i8* %p, i64 17
+  store i8 0, i8* %a9, align 1
+  %a10 = getelementptr i8, i8* %p, i64 18
+  store i8 0, i8* %a10, align 1
+  %a11 = getelementptr i8, i8* %p, i64 19
+  store i8 0, i8* %a11, align 1
+  %a12 = getelementptr i8, i8* %p, i64 20
+  store i8 0, i8* %a12, align 1
+  %a13 = getelementptr i8, i8* %p, i64 21
+  store i8 0, i8* %a13, align 1
+  %a14 = getelementptr i8, i8* %p, i64 22
+  store i8 0, i8* %a14, align 1
+  %a15 = getelementptr i8, i8* %p, i64 23
+  store i8 0, i8* %a15, align 1
+  %r.addr = bitcast i8* %p to i32*
+  %r = load i32, i32* %r.addr, align 8
+  ret i32 %r
+}
+
+; CHECK-DOM-LABEL: @scan_limit
+; CHECK-DOM: call void @__asan_load8
+; CHECK-DOM: call void @__asan_store1
+; CHECK-DOM: call void @__asan_store1
+; CHECK-DOM: call void @__asan_store1
+; CHECK-DOM: call void @__asan_store1
+; CHECK-DOM: call void @__asan_store1
+; CHECK-DOM: call void @__asan_store1
+; CHECK-DOM: call void @__asan_store1
+; CHECK-DOM: call void @__asan_store1
+; CHECK-DOM: call void @__asan_store1
+; CHECK-DOM: call void @__asan_store1
+; CHECK-DOM: call void @__asan_store1
+; CHECK-DOM: call void @__asan_store1
+; CHECK-DOM: call void @__asan_store1
+; CHECK-DOM: call void @__asan_store1
+; CHECK-DOM: call void @__asan_store1
+; CHECK-DOM: call void @__asan_store1
+; CHECK-DOM: call void @__asan_load4
+; CHECK-DOM: ret i32
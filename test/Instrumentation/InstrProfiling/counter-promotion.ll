@@ -0,0 +1,63 @@
+; RUN: opt < %s -instrprof -S | FileCheck %s --check-prefix=NOPROMO
+; RUN: opt < %s -instrprof -do-counter-promotion -S | FileCheck %s --check-prefix=PROMO
+; RUN: opt < %s -instrprof -do-counter-promotion -max-counter-promotions=1 -S | FileCheck %s --check-prefix=LIMIT
+
+target triple = "x86_64-unknown-linux-gnu"
+
+@__profn_nest = private constant [4 x i8] c"nest"
+
+; NOPROMO-LABEL: inner:
+; NOPROMO: %pgocount = load i64, i64* getelementptr inbounds ([2 x i64], [2 x i64]* @__profc_nest, i64 0, i64 0)
+; NOPROMO: store i64 %{{.*}}, i64* getelementptr inbounds ([2 x i64], [2 x i64]* @__profc_nest, i64 0, i64 0)
+
+; The inner counter is flushed at the inner loop exit, which is promoted again
+; together with the outer counter, so the counters are only updated in memory
+; after the loop nest.
+
+; PROMO-LABEL: inner:
+; PROMO-NOT: @__profc_nest
+; PROMO: br i1 %j.cond
+; PROMO-LABEL: outer.latch:
+; PROMO-NOT: @__profc_nest
+; PROMO: br i1 %i.cond
+; PROMO-LABEL: exit:
+; PROMO-DAG: store i64 %{{.*}}, i64* getelementptr inbounds ([2 x i64], [2 x i64]* @__profc_nest, i64 0, i64 0)
+; PROMO-DAG: store i64 %{{.*}}, i64* getelementptr inbounds ([2 x i64], [2 x i64]* @__profc_nest, i64 0, i64 1)
+; PROMO: ret void
+
+; LIMIT-LABEL: inner:
+; LIMIT-NOT: @__profc_nest
+; LIMIT: br i1 %j.cond
+; LIMIT-LABEL: outer.latch:
+; LIMIT: %pgocount.promoted = load i64, i64* getelementptr inbounds ([2 x i64], [2 x i64]* @__profc_nest, i64 0, i64 0)
+; LIMIT: %pgocount{{[0-9]*}} = load i64, i64* getelementptr inbounds ([2 x i64], [2 x i64]* @__profc_nest, i64 0, i64 1)
+; LIMIT-LABEL: exit:
+; LIMIT-NOT: @__profc_nest
+; LIMIT: ret void
+
+define void @nest(i32 %n, i32 %m) {
+entry:
+  br label %outer
+
+outer:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %outer.latch ]
+  br label %inner
+
+inner:
+  %j = phi i32 [ 0, %outer ], [ %j.next, %inner ]
+  call void @llvm.instrprof.increment(i8* getelementptr inbounds ([4 x i8], [4 x i8]* @__profn_nest, i32 0, i32 0), i64 0, i32 2, i32 0)
+  %j.next = add i32 %j, 1
+  %j.cond = icmp slt i32 %j.next, %m
+  br i1 %j.cond, label %inner, label %outer.latch
+
+outer.latch:
+  call void @llvm.instrprof.increment(i8* getelementptr inbounds ([4 x i8], [4 x i8]* @__profn_nest, i32 0, i32 0), i64 0, i32 2, i32 1)
+  %i.next = add i32 %i, 1
+  %i.cond = icmp slt i32 %i.next, %n
+  br i1 %i.cond, label %outer, label %exit
+
+exit:
+  ret void
+}
+
+declare void @llvm.instrprof.increment(i8*, i64, i32, i32)
@@ -0,0 +1,80 @@
+; RUN: opt < %s -partial-inliner -S | FileCheck %s
+; RUN: opt < %s -passes=partial-inliner -S | FileCheck %s
+; RUN: opt < %s -partial-inliner -partial-inlining-max-size=8 -S | FileCheck %s --check-prefix=LIMIT
+
+; This test checks that a function without an early-return guard has its
+; rarely executed error handling outlined, that the rest of it is inlined at
+; the hot call site only, and that the outlined code is shared.
+
+declare void @log(i32)
+declare void @abort() noreturn
+
+define i32 @accessor(i32* %p, i32 %i) {
+entry:
+  %null = icmp eq i32* %p, null
+  br i1 %null, label %err.null, label %check, !prof !0
+
+err.null:
+  call void @log(i32 1)
+  call void @log(i32 2)
+  call void @abort()
+  unreachable
+
+check:
+  %oob = icmp ugt i32 %i, 100
+  br i1 %oob, label %err.oob, label %body, !prof !0
+
+err.oob:
+  call void @log(i32 %i)
+  call void @log(i32 3)
+  br label %ret
+
+body:
+  %addr = getelementptr inbounds i32, i32* %p, i32 %i
+  %v = load i32, i32* %addr
+  br label %ret
+
+ret:
+  %r = phi i32 [ -1, %err.oob ], [ %v, %body ]
+  ret i32 %r
+}
+
+; CHECK-LABEL: define i32 @hot_caller(
+; CHECK-NOT: call i32 @accessor(
+; CHECK: call void @accessor.1_err.null()
+; CHECK: call void @accessor.1_err.oob(i32 %n)
+; CHECK: load i32, i32*
+; CHECK: ret i32
+
+; LIMIT-LABEL: define i32 @hot_caller(
+; LIMIT: call i32 @accessor(i32* %p, i32 %n)
+; LIMIT-NOT: define {{.*}} @accessor.1_
+
+define i32 @hot_caller(i32* %p, i32 %n) {
+entry:
+  %v = call i32 @accessor(i32* %p, i32 %n)
+  ret i32 %v
+}
+
+; CHECK-LABEL: define i32 @cold_caller(
+; CHECK: rare:
+; CHECK-NEXT: call i32 @accessor(i32* %p, i32 %n)
+
+define i32 @cold_caller(i32* %p, i32 %n, i1 %c) {
+entry:
+  br i1 %c, label %rare, label %done, !prof !0
+
+rare:
+  %v = call i32 @accessor(i32* %p, i32 %n)
+  br label %done
+
+done:
+  %r = phi i32 [ %v, %rare ], [ 0, %entry ]
+  ret i32 %r
+}
+
+; CHECK: define internal void @accessor.1_err.oob(i32 %i) [[COLD:#[0-9]+]]
+; CHECK: define internal void @accessor.1_err.null() [[COLD]]
+; CHECK: attributes [[COLD]] = { cold noinline }
+
+!0 = !{!"branch_weights", i32 1, i32 1000}
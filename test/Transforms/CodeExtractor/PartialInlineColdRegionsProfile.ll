@@ -0,0 +1,75 @@
+; RUN: opt < %s -partial-inliner -S | FileCheck %s
+; RUN: opt < %s -passes=partial-inliner -S | FileCheck %s
+
+; This test checks that with a profile the remainder is inlined at call sites
+; that the profile counts make hot only, and that call sites in blocks ending
+; in a return are classified like any other.
+
+declare void @log(i32)
+declare void @abort() noreturn
+
+define i32 @accessor(i32* %p, i32 %i) !prof !20 {
+entry:
+  %null = icmp eq i32* %p, null
+  br i1 %null, label %err.null, label %body, !prof !0
+
+err.null:
+  call void @log(i32 1)
+  call void @log(i32 2)
+  call void @log(i32 3)
+  call void @abort()
+  unreachable
+
+body:
+  %addr = getelementptr inbounds i32, i32* %p, i32 %i
+  %v = load i32, i32* %addr
+  br label %ret
+
+ret:
+  ret i32 %v
+}
+
+; CHECK-LABEL: define i32 @hot_caller(
+; CHECK-NOT: call i32 @accessor(
+; CHECK: call void @accessor.1_err.null()
+; CHECK: load i32, i32*
+; CHECK: ret i32
+
+define i32 @hot_caller(i32* %p, i32 %n) !prof !20 {
+entry:
+  %v = call i32 @accessor(i32* %p, i32 %n)
+  ret i32 %v
+}
+
+; CHECK-LABEL: define i32 @cold_caller(
+; CHECK-NEXT: entry:
+; CHECK-NEXT: call i32 @accessor(i32* %p, i32 %n)
+
+define i32 @cold_caller(i32* %p, i32 %n) !prof !21 {
+entry:
+  %v = call i32 @accessor(i32* %p, i32 %n)
+  ret i32 %v
+}
+
+; CHECK: define internal void @accessor.1_err.null() [[COLD:#[0-9]+]]
+; CHECK: attributes [[COLD]] = { cold noinline }
+
+!llvm.module.flags = !{!1}
+!0 = !{!"branch_weights", i32 1, i32 1000}
+!20 = !{!"function_entry_count", i64 300}
+!21 = !{!"function_entry_count", i64 1}
+
+!1 = !{i32 1, !"ProfileSummary", !2}
+!2 = !{!3, !4, !5, !6, !7, !8, !9, !10}
+!3 = !{!"ProfileFormat", !"InstrProf"}
+!4 = !{!"TotalCount", i64 10000}
+!5 = !{!"MaxCount", i64 1000}
+!6 = !{!"MaxInternalCount", i64 1}
+!7 = !{!"MaxFunctionCount", i64 1000}
+!8 = !{!"NumCounts", i64 3}
+!9 = !{!"NumFunctions", i64 3}
+!10 = !{!"DetailedSummary", !11}
+!11 = !{!12, !13, !14}
+!12 = !{i32 10000, i64 100, i32 1}
+!13 = !{i32 999000, i64 100, i32 1}
+!14 = !{i32 999999, i64 1, i32 2}
@@ -0,0 +1,139 @@
+; Tests that values and allocas in the coroutine frame share a field when their
+; frame storage is never live at the same time, and that fields are ordered by
+; alignment.
+; RUN: opt < %s -coro-split -S | FileCheck %s
+
+; CHECK: %f.Frame = type { void (%f.Frame*)*, void (%f.Frame*)*, i1, i1, i64, i1 }
+; CHECK: %g.Frame = type { void (%g.Frame*)*, void (%g.Frame*)*, i1, i1, i32 }
+
+; %a is reloaded before %b is defined, so they share the i64 field. %flag is
+; live together with %a and gets a field of its own, placed after the i64.
+define i8* @f() "coroutine.presplit"="1" {
+entry:
+  %id = call token @llvm.coro.id(i32 0, i8* null, i8* null, i8* null)
+  %size = call i32 @llvm.coro.size.i32()
+  %alloc = call i8* @malloc(i32 %size)
+  %hdl = call i8* @llvm.coro.begin(token %id, i8* %alloc)
+  %a = call i64 @get64()
+  %flag = call i1 @get1()
+  %s1 = call i8 @llvm.coro.suspend(token none, i1 false)
+  switch i8 %s1, label %suspend [i8 0, label %resume1
+                                 i8 1, label %cleanup]
+resume1:
+  call void @use64(i64 %a)
+  call void @use1(i1 %flag)
+  br label %next
+
+next:
+  %b = call i32 @get32()
+  %s2 = call i8 @llvm.coro.suspend(token none, i1 false)
+  switch i8 %s2, label %suspend [i8 0, label %resume2
+                                 i8 1, label %cleanup]
+resume2:
+  call void @use32(i32 %b)
+  br label %cleanup
+
+cleanup:
+  %mem = call i8* @llvm.coro.free(token %id, i8* %hdl)
+  call void @free(i8* %mem)
+  br label %suspend
+suspend:
+  call void @llvm.coro.end(i8* %hdl, i1 0)
+  ret i8* %hdl
+}
+
+; CHECK-LABEL: @f(
+; CHECK: %a.spill.addr = getelementptr inbounds %f.Frame, %f.Frame* %FramePtr, i32 0, i32 4
+; CHECK: store i64 %a, i64* %a.spill.addr
+; CHECK: %flag.spill.addr = getelementptr inbounds %f.Frame, %f.Frame* %FramePtr, i32 0, i32 5
+; CHECK: store i1 %flag, i1* %flag.spill.addr
+
+; The lifetimes of %x and %y don't overlap, so they share a field and their
+; lifetime markers are dropped.
+define i8* @g() "coroutine.presplit"="1" {
+entry:
+  %x = alloca i32
+  %y = alloca i32
+  %id = call token @llvm.coro.id(i32 0, i8* null, i8* null, i8* null)
+  %size = call i32 @llvm.coro.size.i32()
+  %alloc = call i8* @malloc(i32 %size)
+  %hdl = call i8* @llvm.coro.begin(token %id, i8* %alloc)
+  %x.i8 = bitcast i32* %x to i8*
+  call void @llvm.lifetime.start(i64 4, i8* %x.i8)
+  call void @escape(i32* %x)
+  %s1 = call i8 @llvm.coro.suspend(token none, i1 false)
+  switch i8 %s1, label %suspend [i8 0, label %resume1
+                                 i8 1, label %cleanup]
+resume1:
+  call void @escape(i32* %x)
+  call void @llvm.lifetime.end(i64 4, i8* %x.i8)
+  br label %next
+
+next:
+  %y.i8 = bitcast i32* %y to i8*
+  call void @llvm.lifetime.start(i64 4, i8* %y.i8)
+  call void @escape(i32* %y)
+  %s2 = call i8 @llvm.coro.suspend(token none, i1 false)
+  switch i8 %s2, label %suspend [i8 0, label %resume2
+                                 i8 1, label %cleanup]
+resume2:
+  call void @escape(i32* %y)
+  call void @llvm.lifetime.end(i64 4, i8* %y.i8)
+  br label %cleanup
+
+cleanup:
+  %mem = call i8* @llvm.coro.free(token %id, i8* %hdl)
+  call void @free(i8* %mem)
+  br label %suspend
+suspend:
+  call void @llvm.coro.end(i8* %hdl, i1 0)
+  ret i8* %hdl
+}
+
+; CHECK-LABEL: @g(
+; CHECK-NOT: call void @llvm.lifetime
+; CHECK: %x = getelementptr inbounds %g.Frame, %g.Frame* %FramePtr, i32 0, i32 4
+; CHECK-NOT: call void @llvm.lifetime
+; CHECK: ret i8* %hdl
+
+; The resume functions follow the ramp functions.
+
+; CHECK-LABEL: @f.resume(
+; CHECK: %a.reload.addr = getelementptr inbounds %f.Frame, %f.Frame* %FramePtr, i32 0, i32 4
+; CHECK: %b.spill.addr = bitcast i64* %a.reload.addr to i32*
+; CHECK: store i32 %b, i32* %b.spill.addr
+; CHECK: %b.reload.addr.field = getelementptr inbounds %f.Frame, %f.Frame* %FramePtr, i32 0, i32 4
+; CHECK: %b.reload.addr = bitcast i64* %b.reload.addr.field to i32*
+; CHECK: %b.reload = load i32, i32* %b.reload.addr
+; CHECK: call void @use32(i32 %b.reload)
+
+; CHECK-LABEL: @g.resume(
+; CHECK-NOT: call void @llvm.lifetime
+; CHECK: %x.reload.addr = getelementptr inbounds %g.Frame, %g.Frame* %FramePtr, i32 0, i32 4
+; CHECK-NOT: call void @llvm.lifetime
+; CHECK: %y.reload.addr{{[0-9]*}} = getelementptr inbounds %g.Frame, %g.Frame* %FramePtr, i32 0, i32 4
+; CHECK-NOT: call void @llvm.lifetime
+; CHECK: ret void
+
+declare i8* @llvm.coro.free(token, i8*)
+declare i32 @llvm.coro.size.i32()
+declare i8  @llvm.coro.suspend(token, i1)
+declare void @llvm.coro.resume(i8*)
+declare void @llvm.coro.destroy(i8*)
+
+declare token @llvm.coro.id(i32, i8*, i8*, i8*)
+declare i8* @llvm.coro.begin(token, i8*)
+declare void @llvm.coro.end(i8*, i1)
+
+declare void @llvm.lifetime.start(i64, i8* nocapture)
+declare void @llvm.lifetime.end(i64, i8* nocapture)
+
+declare noalias i8* @malloc(i32)
+declare void @free(i8*)
+declare i64 @get64()
+declare i32 @get32()
+declare i1 @get1()
+declare void @use64(i64)
+declare void @use32(i32)
+declare void @use1(i1)
+declare void @escape(i32*)
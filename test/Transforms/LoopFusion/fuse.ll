@@ -0,0 +1,150 @@
+; RUN: opt < %s -basicaa -loop-fusion -S | FileCheck %s
+; RUN: opt < %s -basicaa -loop-fusion -pass-remarks=loop-fusion -pass-remarks-missed=loop-fusion -disable-output 2>&1 | FileCheck %s --check-prefix=REMARK
+; RUN: opt < %s -basicaa -loop-fusion -loop-fusion-capacity=8192 -pass-remarks-missed=loop-fusion -disable-output 2>&1 | FileCheck %s --check-prefix=CACHED
+
+target datalayout = "e-m:e-i64:64-f80:128-n8:16:32:64-S128"
+
+; REMARK: remark: {{.*}}fused with the loop that follows it, estimated memory transfers reduced from 256 to 192
+; REMARK: remark: {{.*}}loop not fused with the loop that follows it: the second loop uses data of later iterations of the first loop
+; REMARK: remark: {{.*}}loop not fused with the loop that follows it: fusion does not reduce the estimated memory transfers
+
+; The data of the first loop fits 8K, so the second loop reuses it anyway.
+; CACHED: remark: {{.*}}loop not fused with the loop that follows it: fusion does not reduce the estimated memory transfers
+
+;; for (i = 0; i < 1024; i++)
+;;   a[i] = b[i] + 1;
+;; for (i = 0; i < 1024; i++)
+;;   c[i] = a[i] * 2;
+
+; CHECK-LABEL: @producer_consumer(
+; CHECK: loop1:
+; CHECK-NEXT: %i = phi i64 [ 0, %entry ], [ %i.next, %loop2 ]
+; CHECK-NEXT: %j = phi i64 [ 0, %entry ], [ %j.next, %loop2 ]
+; CHECK: store i32 %av, i32* %a.addr
+; CHECK-NEXT: %i.next = add nuw nsw i64 %i, 1
+; CHECK-NEXT: br label %loop2
+; CHECK-NOT: between:
+; CHECK: loop2:
+; CHECK: %av2 = load i32, i32* %a.addr2
+; CHECK: br i1 %cond2, label %loop1, label %exit
+
+define void @producer_consumer(i32* noalias %a, i32* noalias %b, i32* noalias %c) {
+entry:
+  br label %loop1
+
+loop1:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %loop1 ]
+  %b.addr = getelementptr inbounds i32, i32* %b, i64 %i
+  %bv = load i32, i32* %b.addr
+  %av = add i32 %bv, 1
+  %a.addr = getelementptr inbounds i32, i32* %a, i64 %i
+  store i32 %av, i32* %a.addr
+  %i.next = add nuw nsw i64 %i, 1
+  %cond1 = icmp ne i64 %i.next, 1024
+  br i1 %cond1, label %loop1, label %between
+
+between:
+  br label %loop2
+
+loop2:
+  %j = phi i64 [ 0, %between ], [ %j.next, %loop2 ]
+  %a.addr2 = getelementptr inbounds i32, i32* %a, i64 %j
+  %av2 = load i32, i32* %a.addr2
+  %cv = shl i32 %av2, 1
+  %c.addr = getelementptr inbounds i32, i32* %c, i64 %j
+  store i32 %cv, i32* %c.addr
+  %j.next = add nuw nsw i64 %j, 1
+  %cond2 = icmp ne i64 %j.next, 1024
+  br i1 %cond2, label %loop2, label %exit
+
+exit:
+  ret void
+}
+
+;; for (i = 0; i < 1023; i++)
+;;   a[i] = b[i] + 1;
+;; for (i = 0; i < 1023; i++)
+;;   c[i] = a[i + 1] * 2;
+;;
+;; Fused, iteration i would read a[i + 1] before the first loop stores it.
+
+; CHECK-LABEL: @backward(
+; CHECK: br i1 %cond1, label %loop1, label %between
+; CHECK: between:
+; CHECK: br i1 %cond2, label %loop2, label %exit
+
+define void @backward(i32* noalias %a, i32* noalias %b, i32* noalias %c) {
+entry:
+  br label %loop1
+
+loop1:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %loop1 ]
+  %b.addr = getelementptr inbounds i32, i32* %b, i64 %i
+  %bv = load i32, i32* %b.addr
+  %av = add i32 %bv, 1
+  %a.addr = getelementptr inbounds i32, i32* %a, i64 %i
+  store i32 %av, i32* %a.addr
+  %i.next = add nuw nsw i64 %i, 1
+  %cond1 = icmp ne i64 %i.next, 1023
+  br i1 %cond1, label %loop1, label %between
+
+between:
+  br label %loop2
+
+loop2:
+  %j = phi i64 [ 0, %between ], [ %j.next, %loop2 ]
+  %j.next = add nuw nsw i64 %j, 1
+  %a.addr2 = getelementptr inbounds i32, i32* %a, i64 %j.next
+  %av2 = load i32, i32* %a.addr2
+  %cv = shl i32 %av2, 1
+  %c.addr = getelementptr inbounds i32, i32* %c, i64 %j
+  store i32 %cv, i32* %c.addr
+  %cond2 = icmp ne i64 %j.next, 1023
+  br i1 %cond2, label %loop2, label %exit
+
+exit:
+  ret void
+}
+
+;; for (i = 0; i < 1024; i++)
+;;   a[i] = b[i];
+;; for (i = 0; i < 1024; i++)
+;;   c[i] = d[i];
+;;
+;; The loops share no data.
+
+; CHECK-LABEL: @disjoint(
+; CHECK: br i1 %cond1, label %loop1, label %between
+; CHECK: between:
+; CHECK: br i1 %cond2, label %loop2, label %exit
+
+define void @disjoint(i32* noalias %a, i32* noalias %b, i32* noalias %c, i32* noalias %d) {
+entry:
+  br label %loop1
+
+loop1:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %loop1 ]
+  %b.addr = getelementptr inbounds i32, i32* %b, i64 %i
+  %bv = load i32, i32* %b.addr
+  %a.addr = getelementptr inbounds i32, i32* %a, i64 %i
+  store i32 %bv, i32* %a.addr
+  %i.next = add nuw nsw i64 %i, 1
+  %cond1 = icmp ne i64 %i.next, 1024
+  br i1 %cond1, label %loop1, label %between
+
+between:
+  br label %loop2
+
+loop2:
+  %j = phi i64 [ 0, %between ], [ %j.next, %loop2 ]
+  %d.addr = getelementptr inbounds i32, i32* %d, i64 %j
+  %dv = load i32, i32* %d.addr
+  %c.addr = getelementptr inbounds i32, i32* %c, i64 %j
+  store i32 %dv, i32* %c.addr
+  %j.next = add nuw nsw i64 %j, 1
+  %cond2 = icmp ne i64 %j.next, 1024
+  br i1 %cond2, label %loop2, label %exit
+
+exit:
+  ret void
+}
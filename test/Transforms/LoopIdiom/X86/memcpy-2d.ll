@@ -0,0 +1,75 @@
+; RUN: opt -basicaa -loop-idiom < %s -mtriple=x86_64-unknown-linux-gnu -mattr=+avx512f -S | FileCheck %s
+; RUN: opt -basicaa -loop-idiom < %s -mtriple=x86_64-unknown-linux-gnu -mattr=+avx2 -S | FileCheck %s --check-prefix=AVX2
+
+target datalayout = "e-m:e-i64:64-f80:128-n8:16:32:64-S128"
+
+@C = common global [256 x i32] zeroinitializer
+@D = common global [256 x i32] zeroinitializer
+
+;; for (i = 0; i < 64; i++)
+;;   C[2 * i] = D[3 * i];
+;;
+;; AVX-512 gathers and scatters i32 rows, so the copy becomes a 2D block copy
+;; with one element per row.
+
+; CHECK-LABEL: @strided(
+; CHECK: entry:
+; CHECK-NEXT: call void @llvm.memcpy.2d.p0i8.p0i8.i64(i8* {{.*}}@C{{.*}}, i8* {{.*}}@D{{.*}}, i64 4, i64 64, i64 8, i64 12, i32 4, i1 false)
+; CHECK-NOT: store
+; CHECK: ret void
+
+; AVX2-LABEL: @strided(
+; AVX2-NOT: llvm.memcpy
+; AVX2: store i32 %v, i32* %dst
+; AVX2: ret void
+
+define void @strided() {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %loop ]
+  %i.src = mul nuw nsw i64 %i, 3
+  %src = getelementptr inbounds [256 x i32], [256 x i32]* @D, i64 0, i64 %i.src
+  %v = load i32, i32* %src, align 4
+  %i.dst = shl nuw nsw i64 %i, 1
+  %dst = getelementptr inbounds [256 x i32], [256 x i32]* @C, i64 0, i64 %i.dst
+  store i32 %v, i32* %dst, align 4
+  %i.next = add nuw nsw i64 %i, 1
+  %i.cond = icmp ne i64 %i.next, 64
+  br i1 %i.cond, label %loop, label %exit
+
+exit:
+  ret void
+}
+
+;; for (i = 0; i < 64; i++)
+;;   C[2 * i + 1] = C[2 * i];
+;;
+;; Every row reads the word next to the one it writes; the load touches the
+;; destination stride, so the copy is left alone.
+
+; CHECK-LABEL: @interleaved(
+; CHECK-NOT: llvm.memcpy
+; CHECK: store i32 %v, i32* %dst
+; CHECK: ret void
+
+define void @interleaved() {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %loop ]
+  %i.src = shl nuw nsw i64 %i, 1
+  %src = getelementptr inbounds [256 x i32], [256 x i32]* @C, i64 0, i64 %i.src
+  %v = load i32, i32* %src, align 4
+  %i.dst = or i64 %i.src, 1
+  %dst = getelementptr inbounds [256 x i32], [256 x i32]* @C, i64 0, i64 %i.dst
+  store i32 %v, i32* %dst, align 4
+  %i.next = add nuw nsw i64 %i, 1
+  %i.cond = icmp ne i64 %i.next, 64
+  br i1 %i.cond, label %loop, label %exit
+
+exit:
+  ret void
+}
@@ -0,0 +1,120 @@
+; RUN: opt -basicaa -loop-idiom < %s -S | FileCheck %s
+target datalayout = "e-m:e-i64:64-f80:128-n8:16:32:64-S128"
+
+@A = common global [64 x [64 x i32]] zeroinitializer
+@B = common global [64 x [64 x i32]] zeroinitializer
+@C = common global [256 x i32] zeroinitializer
+@D = common global [256 x i32] zeroinitializer
+
+;; for (i = 0; i < 64; i++)
+;;   for (j = 0; j < 64; j++)
+;;     A[i][j] = B[i][j];
+;;
+;; The inner loop becomes a memcpy of a row; the rows are adjacent, so the outer
+;; loop becomes a memcpy of the whole array.
+
+; CHECK-LABEL: @rows(
+; CHECK: entry:
+; CHECK-NEXT: call void @llvm.memcpy.p0i8.p0i8.i64(i8* {{.*}}@A{{.*}}, i8* {{.*}}@B{{.*}}, i64 16384, i32 4, i1 false)
+; CHECK-NOT: call void @llvm.memcpy
+; CHECK: ret void
+
+define void @rows() {
+entry:
+  br label %outer
+
+outer:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %outer.latch ]
+  br label %inner
+
+inner:
+  %j = phi i64 [ 0, %outer ], [ %j.next, %inner ]
+  %src = getelementptr inbounds [64 x [64 x i32]], [64 x [64 x i32]]* @B, i64 0, i64 %i, i64 %j
+  %v = load i32, i32* %src, align 4
+  %dst = getelementptr inbounds [64 x [64 x i32]], [64 x [64 x i32]]* @A, i64 0, i64 %i, i64 %j
+  store i32 %v, i32* %dst, align 4
+  %j.next = add nuw nsw i64 %j, 1
+  %j.cond = icmp ne i64 %j.next, 64
+  br i1 %j.cond, label %inner, label %outer.latch
+
+outer.latch:
+  %i.next = add nuw nsw i64 %i, 1
+  %i.cond = icmp ne i64 %i.next, 64
+  br i1 %i.cond, label %outer, label %exit
+
+exit:
+  ret void
+}
+
+;; for (i = 0; i < 16; i++)
+;;   for (j = 0; j < 16; j++)
+;;     A[i][j] = B[i + 4][j + 4];
+;;
+;; The rows of the sub-block are 256 bytes apart.  Without a block copy DMA
+;; engine the row memcpys stay in the outer loop.
+
+; CHECK-LABEL: @subblock(
+; CHECK: outer:
+; CHECK: call void @llvm.memcpy.p0i8.p0i8.i64(i8* {{.*}}, i8* {{.*}}, i64 64, i32 4, i1 false)
+; CHECK-NOT: llvm.memcpy.2d
+; CHECK: ret void
+
+define void @subblock() {
+entry:
+  br label %outer
+
+outer:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %outer.latch ]
+  %i.src = add nuw nsw i64 %i, 4
+  br label %inner
+
+inner:
+  %j = phi i64 [ 0, %outer ], [ %j.next, %inner ]
+  %j.src = add nuw nsw i64 %j, 4
+  %src = getelementptr inbounds [64 x [64 x i32]], [64 x [64 x i32]]* @B, i64 0, i64 %i.src, i64 %j.src
+  %v = load i32, i32* %src, align 4
+  %dst = getelementptr inbounds [64 x [64 x i32]], [64 x [64 x i32]]* @A, i64 0, i64 %i, i64 %j
+  store i32 %v, i32* %dst, align 4
+  %j.next = add nuw nsw i64 %j, 1
+  %j.cond = icmp ne i64 %j.next, 16
+  br i1 %j.cond, label %inner, label %outer.latch
+
+outer.latch:
+  %i.next = add nuw nsw i64 %i, 1
+  %i.cond = icmp ne i64 %i.next, 16
+  br i1 %i.cond, label %outer, label %exit
+
+exit:
+  ret void
+}
+
+;; for (i = 0; i < 64; i++)
+;;   C[2 * i] = D[3 * i];
+;;
+;; Without gather/scatter or a block copy DMA engine the strided copy stays
+;; scalar.
+
+; CHECK-LABEL: @strided(
+; CHECK-NOT: llvm.memcpy
+; CHECK: store i32 %v, i32* %dst
+; CHECK: ret void
+
+define void @strided() {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %loop ]
+  %i.src = mul nuw nsw i64 %i, 3
+  %src = getelementptr inbounds [256 x i32], [256 x i32]* @D, i64 0, i64 %i.src
+  %v = load i32, i32* %src, align 4
+  %i.dst = shl nuw nsw i64 %i, 1
+  %dst = getelementptr inbounds [256 x i32], [256 x i32]* @C, i64 0, i64 %i.dst
+  store i32 %v, i32* %dst, align 4
+  %i.next = add nuw nsw i64 %i, 1
+  %i.cond = icmp ne i64 %i.next, 64
+  br i1 %i.cond, label %loop, label %exit
+
+exit:
+  ret void
+}
@@ -0,0 +1,132 @@
+; RUN: opt < %s -basicaa -loop-tile -loop-tile-capacity=16384 -S | FileCheck %s
+; RUN: opt < %s -basicaa -loop-tile -loop-tile-size=8 -S | FileCheck %s --check-prefix=SIZE8
+; RUN: opt < %s -basicaa -loop-tile -S | FileCheck %s --check-prefix=NOCACHE
+
+target datalayout = "e-m:e-i64:64-f80:128-n8:16:32:64-S128"
+
+@A = common global [256 x [256 x i32]] zeroinitializer
+@B = common global [256 x [256 x i32]] zeroinitializer
+
+;; for (i = 0; i < 256; i++)
+;;   for (j = 0; j < 256; j++)
+;;     B[j][i] = A[i][j];
+;;
+;; Two 256x256 arrays of i32 are accessed with both loops, so 32x32 tiles fit
+;; 16K. Without a capacity, and no cache size from the target, nothing is tiled.
+
+; CHECK-LABEL: @transpose(
+; CHECK: entry:
+; CHECK-NEXT: br label %i.header.tile
+; CHECK: i.header.tile:
+; CHECK-NEXT: %i.tile = phi i64 [ 0, %entry ], [ %i.tile.next, %i.latch.tile ]
+; CHECK-NEXT: %i.tile.start = add i64 0, %i.tile
+; CHECK-NEXT: br label %j.header.tile
+; CHECK: j.header.tile:
+; CHECK-NEXT: %j.tile = phi i64 [ 0, %i.header.tile ], [ %j.tile.next, %j.latch.tile ]
+; CHECK-NEXT: %j.tile.start = add i64 0, %j.tile
+; CHECK-NEXT: br label %i.header
+; CHECK: i.header:
+; CHECK-NEXT: %i = phi i64 [ %i.tile.start, %j.header.tile ], [ %i.next, %i.latch ]
+; CHECK: j.header:
+; CHECK-NEXT: %j = phi i64 [ %j.tile.start, %i.header ], [ %j.next, %j.latch ]
+; CHECK: j.latch:
+; CHECK: [[JOFF:%.*]] = sub i64 %j, %j.tile.start
+; CHECK-NEXT: [[JIN:%.*]] = icmp ult i64 [[JOFF]], 31
+; CHECK-NEXT: [[JCOND:%.*]] = and i1 %j.cond, [[JIN]]
+; CHECK-NEXT: br i1 [[JCOND]], label %j.header, label %i.latch
+; CHECK: i.latch:
+; CHECK: [[IOFF:%.*]] = sub i64 %i, %i.tile.start
+; CHECK-NEXT: [[IIN:%.*]] = icmp ult i64 [[IOFF]], 31
+; CHECK-NEXT: [[ICOND:%.*]] = and i1 %i.cond, [[IIN]]
+; CHECK-NEXT: br i1 [[ICOND]], label %i.header, label %j.latch.tile
+; CHECK: i.latch.tile:
+; CHECK-NEXT: %i.tile.next = add i64 %i.tile, 32
+; CHECK-NEXT: [[ILEFT:%.*]] = sub i64 255, %i.tile
+; CHECK-NEXT: [[IMORE:%.*]] = icmp uge i64 [[ILEFT]], 32
+; CHECK-NEXT: br i1 [[IMORE]], label %i.header.tile, label %exit
+; CHECK: j.latch.tile:
+; CHECK-NEXT: %j.tile.next = add i64 %j.tile, 32
+; CHECK-NEXT: [[JLEFT:%.*]] = sub i64 255, %j.tile
+; CHECK-NEXT: [[JMORE:%.*]] = icmp uge i64 [[JLEFT]], 32
+; CHECK-NEXT: br i1 [[JMORE]], label %j.header.tile, label %i.latch.tile
+
+; SIZE8-LABEL: @transpose(
+; SIZE8: %i.tile.next = add i64 %i.tile, 8
+; SIZE8: %j.tile.next = add i64 %j.tile, 8
+
+; NOCACHE-LABEL: @transpose(
+; NOCACHE-NOT: .tile
+; NOCACHE: ret void
+
+define void @transpose() {
+entry:
+  br label %i.header
+
+i.header:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %i.latch ]
+  br label %j.header
+
+j.header:
+  %j = phi i64 [ 0, %i.header ], [ %j.next, %j.latch ]
+  %a = getelementptr inbounds [256 x [256 x i32]], [256 x [256 x i32]]* @A, i64 0, i64 %i, i64 %j
+  %v = load i32, i32* %a
+  %b = getelementptr inbounds [256 x [256 x i32]], [256 x [256 x i32]]* @B, i64 0, i64 %j, i64 %i
+  store i32 %v, i32* %b
+  br label %j.latch
+
+j.latch:
+  %j.next = add nuw nsw i64 %j, 1
+  %j.cond = icmp ne i64 %j.next, 256
+  br i1 %j.cond, label %j.header, label %i.latch
+
+i.latch:
+  %i.next = add nuw nsw i64 %i, 1
+  %i.cond = icmp ne i64 %i.next, 256
+  br i1 %i.cond, label %i.header, label %exit
+
+exit:
+  ret void
+}
+
+;; for (i = 1; i < 256; i++)
+;;   for (j = 0; j < 255; j++)
+;;     A[i][j] = A[i - 1][j + 1];
+;;
+;; The dependence has the distance (1, -1); running the j loop of a later i
+;; tile first would read values not yet written.
+
+; CHECK-LABEL: @skewed(
+; CHECK-NOT: .tile
+; CHECK: ret void
+
+; SIZE8-LABEL: @skewed(
+; SIZE8-NOT: .tile
+; SIZE8: ret void
+
+define void @skewed() {
+entry:
+  br label %i.header
+
+i.header:
+  %i = phi i64 [ 1, %entry ], [ %i.next, %i.latch ]
+  %i.prev = add nsw i64 %i, -1
+  br label %j.header
+
+j.header:
+  %j = phi i64 [ 0, %i.header ], [ %j.next, %j.header ]
+  %j.next = add nuw nsw i64 %j, 1
+  %a = getelementptr inbounds [256 x [256 x i32]], [256 x [256 x i32]]* @A, i64 0, i64 %i.prev, i64 %j.next
+  %v = load i32, i32* %a
+  %b = getelementptr inbounds [256 x [256 x i32]], [256 x [256 x i32]]* @A, i64 0, i64 %i, i64 %j
+  store i32 %v, i32* %b
+  %j.cond = icmp ne i64 %j.next, 255
+  br i1 %j.cond, label %j.header, label %i.latch
+
+i.latch:
+  %i.next = add nuw nsw i64 %i, 1
+  %i.cond = icmp ne i64 %i.next, 256
+  br i1 %i.cond, label %i.header, label %exit
+
+exit:
+  ret void
+}
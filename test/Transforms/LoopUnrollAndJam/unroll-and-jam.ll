@@ -0,0 +1,127 @@
+; RUN: opt < %s -basicaa -loop-unroll-and-jam -S | FileCheck %s
+; RUN: opt < %s -basicaa -loop-unroll-and-jam -unroll-and-jam-count=4 -S | FileCheck %s --check-prefix=COUNT4
+
+target datalayout = "e-m:e-i64:64-f80:128-n8:16:32:64-S128"
+
+@A = common global [64 x [64 x i32]] zeroinitializer
+@B = common global [64 x i32] zeroinitializer
+@C = common global [64 x i32] zeroinitializer
+@S = common global [65 x [64 x i32]] zeroinitializer
+
+;; for (i = 0; i < 64; i++) {
+;;   int sum = 0;
+;;   for (j = 0; j < 64; j++)
+;;     sum += A[i][j] * B[j];
+;;   C[i] = sum;
+;; }
+;;
+;; B[j] is loaded once for all copies. With the 8 registers of the default
+;; target, the sums and row indices of two copies fit.
+
+; CHECK-LABEL: @matvec(
+; CHECK: outer.header:
+; CHECK-NEXT: %i = phi i64 [ 0, %entry ], [ %i.next.jam1, %outer.latch.jam1 ]
+; CHECK: %i.next = add nuw nsw i64 %i, 1
+; CHECK-NEXT: br label %outer.header.jam1
+; CHECK: inner:
+; CHECK-NEXT: %j = phi i64 [ 0, %outer.header.jam1 ], [ %j.next, %inner ]
+; CHECK-NEXT: %sum = phi i32 [ 0, %outer.header.jam1 ], [ %sum.next, %inner ]
+; CHECK-NEXT: %sum.jam1 = phi i32 [ 0, %outer.header.jam1 ], [ %sum.next.jam1, %inner ]
+; CHECK: %a.addr = getelementptr inbounds [64 x [64 x i32]], [64 x [64 x i32]]* @A, i64 0, i64 %i, i64 %j
+; CHECK: %a.addr.jam1 = getelementptr inbounds [64 x [64 x i32]], [64 x [64 x i32]]* @A, i64 0, i64 %i.next, i64 %j
+; CHECK: br i1 %j.cond, label %inner, label %outer.latch
+; CHECK: outer.latch:
+; CHECK-NEXT: %sum.lcssa = phi i32 [ %sum.next, %inner ]
+; CHECK-NEXT: %sum.lcssa.jam1 = phi i32 [ %sum.next.jam1, %inner ]
+; CHECK-NEXT: store i32 %sum.lcssa, i32* %c.addr
+; CHECK-NEXT: br label %outer.latch.jam1
+; CHECK: outer.header.jam1:
+; CHECK-NEXT: %c.addr.jam1 = getelementptr inbounds [64 x i32], [64 x i32]* @C, i64 0, i64 %i.next
+; CHECK-NEXT: %i.next.jam1 = add nuw nsw i64 %i.next, 1
+; CHECK-NEXT: br label %inner
+; CHECK: outer.latch.jam1:
+; CHECK-NEXT: store i32 %sum.lcssa.jam1, i32* %c.addr.jam1
+; CHECK-NEXT: %i.cond.jam1 = icmp ne i64 %i.next.jam1, 64
+; CHECK-NEXT: br i1 %i.cond.jam1, label %outer.header, label %exit
+
+; COUNT4-LABEL: @matvec(
+; COUNT4: %sum.jam1 = phi
+; COUNT4: %sum.jam2 = phi
+; COUNT4: %sum.jam3 = phi
+; COUNT4: %i.cond.jam3 = icmp ne i64 %i.next.jam3, 64
+
+define void @matvec() {
+entry:
+  br label %outer.header
+
+outer.header:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %outer.latch ]
+  %c.addr = getelementptr inbounds [64 x i32], [64 x i32]* @C, i64 0, i64 %i
+  br label %inner
+
+inner:
+  %j = phi i64 [ 0, %outer.header ], [ %j.next, %inner ]
+  %sum = phi i32 [ 0, %outer.header ], [ %sum.next, %inner ]
+  %a.addr = getelementptr inbounds [64 x [64 x i32]], [64 x [64 x i32]]* @A, i64 0, i64 %i, i64 %j
+  %a = load i32, i32* %a.addr
+  %b.addr = getelementptr inbounds [64 x i32], [64 x i32]* @B, i64 0, i64 %j
+  %b = load i32, i32* %b.addr
+  %mul = mul nsw i32 %a, %b
+  %sum.next = add nsw i32 %sum, %mul
+  %j.next = add nuw nsw i64 %j, 1
+  %j.cond = icmp ne i64 %j.next, 64
+  br i1 %j.cond, label %inner, label %outer.latch
+
+outer.latch:
+  %sum.lcssa = phi i32 [ %sum.next, %inner ]
+  store i32 %sum.lcssa, i32* %c.addr
+  %i.next = add nuw nsw i64 %i, 1
+  %i.cond = icmp ne i64 %i.next, 64
+  br i1 %i.cond, label %outer.header, label %exit
+
+exit:
+  ret void
+}
+
+;; for (i = 1; i < 65; i++)
+;;   for (j = 0; j < 63; j++)
+;;     S[i][j] = S[i - 1][j + 1];
+;;
+;; The dependence has the direction (<, >): jammed, iteration (i, j + 1) of
+;; the first copy would run after iteration (i + 1, j), which reads it.
+
+; CHECK-LABEL: @skewed(
+; CHECK-NOT: .jam
+; CHECK: ret void
+
+; COUNT4-LABEL: @skewed(
+; COUNT4-NOT: .jam
+; COUNT4: ret void
+
+define void @skewed() {
+entry:
+  br label %outer.header
+
+outer.header:
+  %i = phi i64 [ 1, %entry ], [ %i.next, %outer.latch ]
+  %i.prev = add nsw i64 %i, -1
+  br label %inner
+
+inner:
+  %j = phi i64 [ 0, %outer.header ], [ %j.next, %inner ]
+  %j.next = add nuw nsw i64 %j, 1
+  %src = getelementptr inbounds [65 x [64 x i32]], [65 x [64 x i32]]* @S, i64 0, i64 %i.prev, i64 %j.next
+  %v = load i32, i32* %src
+  %dst = getelementptr inbounds [65 x [64 x i32]], [65 x [64 x i32]]* @S, i64 0, i64 %i, i64 %j
+  store i32 %v, i32* %dst
+  %j.cond = icmp ne i64 %j.next, 63
+  br i1 %j.cond, label %inner, label %outer.latch
+
+outer.latch:
+  %i.next = add nuw nsw i64 %i, 1
+  %i.cond = icmp ne i64 %i.next, 65
+  br i1 %i.cond, label %outer.header, label %exit
+
+exit:
+  ret void
+}
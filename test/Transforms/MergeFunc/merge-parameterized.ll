@@ -0,0 +1,105 @@
+; RUN: opt -S -mergefunc -mergefunc-parameterize < %s | FileCheck %s
+; RUN: opt -S -mergefunc -mergefunc-parameterize -mergefunc-max-params=1 < %s | FileCheck %s --check-prefix=MAX1
+; RUN: opt -S -mergefunc < %s | FileCheck %s --check-prefix=NOPARAM
+
+declare void @log_a(i32)
+declare void @log_b(i32)
+
+; The functions differ in the offset of a GEP, which can't be passed in.
+
+; CHECK-LABEL: define i32 @field_a(
+; CHECK: getelementptr inbounds { i32, i32 }, { i32, i32 }* %p, i32 0, i32 0
+; CHECK-LABEL: define i32 @field_b(
+; CHECK: getelementptr inbounds { i32, i32 }, { i32, i32 }* %p, i32 0, i32 1
+
+define i32 @field_a({ i32, i32 }* %p, i32 %x) {
+entry:
+  %q = getelementptr inbounds { i32, i32 }, { i32, i32 }* %p, i32 0, i32 0
+  %v = load i32, i32* %q
+  %a = mul i32 %v, %x
+  %b = add i32 %a, 17
+  %c = xor i32 %b, %x
+  %d = shl i32 %c, 2
+  %e = sub i32 %d, %a
+  %f = or i32 %e, %b
+  %g = and i32 %f, 255
+  %h = add i32 %g, %c
+  %i = mul i32 %h, %d
+  %j = add i32 %i, %e
+  ret i32 %j
+}
+
+define i32 @field_b({ i32, i32 }* %p, i32 %x) {
+entry:
+  %q = getelementptr inbounds { i32, i32 }, { i32, i32 }* %p, i32 0, i32 1
+  %v = load i32, i32* %q
+  %a = mul i32 %v, %x
+  %b = add i32 %a, 17
+  %c = xor i32 %b, %x
+  %d = shl i32 %c, 2
+  %e = sub i32 %d, %a
+  %f = or i32 %e, %b
+  %g = and i32 %f, 255
+  %h = add i32 %g, %c
+  %i = mul i32 %h, %d
+  %j = add i32 %i, %e
+  ret i32 %j
+}
+
+; The functions differ in a multiplier and in the callee, so they are merged
+; into one function taking both as arguments.
+
+; NOPARAM-LABEL: define i32 @scale_a(i32 %x)
+; NOPARAM: mul i32 %x, 3
+; NOPARAM-LABEL: define i32 @scale_b(i32 %x)
+; NOPARAM: mul i32 %x, 5
+
+; MAX1-LABEL: define i32 @scale_a(i32 %x)
+; MAX1: mul i32 %x, 3
+; MAX1-LABEL: define i32 @scale_b(i32 %x)
+; MAX1: mul i32 %x, 5
+
+define i32 @scale_a(i32 %x) {
+entry:
+  %a = mul i32 %x, 3
+  %b = add i32 %a, 17
+  %c = xor i32 %b, %x
+  %d = shl i32 %c, 2
+  %e = sub i32 %d, %a
+  %f = or i32 %e, %b
+  call void @log_a(i32 %f)
+  %g = and i32 %f, 255
+  %h = add i32 %g, %c
+  %i = mul i32 %h, %d
+  %j = add i32 %i, %e
+  ret i32 %j
+}
+
+define i32 @scale_b(i32 %x) {
+entry:
+  %a = mul i32 %x, 5
+  %b = add i32 %a, 17
+  %c = xor i32 %b, %x
+  %d = shl i32 %c, 2
+  %e = sub i32 %d, %a
+  %f = or i32 %e, %b
+  call void @log_b(i32 %f)
+  %g = and i32 %f, 255
+  %h = add i32 %g, %c
+  %i = mul i32 %h, %d
+  %j = add i32 %i, %e
+  ret i32 %j
+}
+
+; CHECK-LABEL: define private i32 @scale_a.merged(i32 %x, i32, void (i32)*) unnamed_addr
+; CHECK: %a = mul i32 %x, %0
+; CHECK: call void %1(i32 %f)
+; CHECK: ret i32 %j
+
+; CHECK-LABEL: define i32 @scale_a(i32)
+; CHECK-NEXT: tail call i32 @scale_a.merged(i32 %0, i32 3, void (i32)* @log_a)
+; CHECK-NEXT: ret i32
+
+; CHECK-LABEL: define i32 @scale_b(i32)
+; CHECK-NEXT: tail call i32 @scale_a.merged(i32 %0, i32 5, void (i32)* @log_b)
+; CHECK-NEXT: ret i32
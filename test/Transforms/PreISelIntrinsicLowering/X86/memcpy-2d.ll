@@ -0,0 +1,67 @@
+; RUN: opt -S -pre-isel-intrinsic-lowering -mattr=+avx512f < %s | FileCheck %s --check-prefix=AVX512
+; RUN: opt -S -passes=pre-isel-intrinsic-lowering -mattr=+avx512f < %s | FileCheck %s --check-prefix=AVX512
+; RUN: opt -S -pre-isel-intrinsic-lowering -mattr=+avx2 < %s | FileCheck %s --check-prefix=AVX2
+; RUN: llc -O0 < %s | FileCheck %s --check-prefix=O0
+
+target datalayout = "e-m:e-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-unknown"
+
+; x86 has no block copy DMA engine, so the intrinsic is always expanded, also
+; at -O0, where CodeGenPrepare does not run.  With AVX-512, 16 rows of one i32
+; each are gathered and scattered at a time.
+
+; AVX512-LABEL: @strided(
+; AVX512: [[ANY:%.*]] = icmp ne i64 %rows, 0
+; AVX512-NEXT: br i1 [[ANY]], label %memcpy2d.loop, label %memcpy2d.exit
+; AVX512: memcpy2d.loop:
+; AVX512-NEXT: %row = phi i64 [ 0, %entry ], [ %row.next, %memcpy2d.loop ]
+; AVX512: [[MASK:%.*]] = icmp ult <16 x i64> %row.vec, %{{.*}}
+; AVX512: [[SRC:%.*]] = getelementptr i8, i8* %src, <16 x i64> %{{.*}}
+; AVX512: [[ELTS:%.*]] = call <16 x i32> @llvm.masked.gather.v16i32(<16 x i32*> %{{.*}}, i32 4, <16 x i1> [[MASK]], <16 x i32> undef)
+; AVX512-NEXT: call void @llvm.masked.scatter.v16i32(<16 x i32> [[ELTS]], <16 x i32*> %{{.*}}, i32 4, <16 x i1> [[MASK]])
+; AVX512-NEXT: %row.next = add i64 %row, 16
+; AVX512-NEXT: [[MORE:%.*]] = icmp ult i64 %row.next, %rows
+; AVX512-NEXT: br i1 [[MORE]], label %memcpy2d.loop, label %memcpy2d.exit
+; AVX512: memcpy2d.exit:
+; AVX512-NOT: llvm.memcpy.2d
+; AVX512: ret void
+
+; Without gather and scatter every row is copied by a memcpy.
+
+; AVX2-LABEL: @strided(
+; AVX2: memcpy2d.loop:
+; AVX2-NEXT: %row = phi i64 [ 0, %entry ], [ %row.next, %memcpy2d.loop ]
+; AVX2: call void @llvm.memcpy.p0i8.p0i8.i64(i8* %{{.*}}, i8* %{{.*}}, i64 4, i32 4, i1 false)
+; AVX2-NEXT: %row.next = add i64 %row, 1
+; AVX2-NOT: llvm.memcpy.2d
+; AVX2: ret void
+
+; O0-LABEL: strided:
+; O0: jb
+
+define void @strided(i8* %dst, i8* %src, i64 %rows) {
+entry:
+  call void @llvm.memcpy.2d.p0i8.p0i8.i64(i8* %dst, i8* %src, i64 4, i64 %rows, i64 8, i64 12, i32 4, i1 false)
+  ret void
+}
+
+; Rows of 64 bytes are not a gatherable element.  Their alignment is what the
+; 96 byte source stride leaves of the 64 byte base alignment.
+
+; AVX512-LABEL: @block(
+; AVX512: memcpy2d.loop:
+; AVX512: call void @llvm.memcpy.p0i8.p0i8.i64(i8* %{{.*}}, i8* %{{.*}}, i64 64, i32 32, i1 false)
+; AVX512-NOT: llvm.memcpy.2d
+; AVX512: ret void
+
+; O0-LABEL: block:
+; O0: callq memcpy
+; O0: jb
+
+define void @block(i8* %dst, i8* %src) {
+entry:
+  call void @llvm.memcpy.2d.p0i8.p0i8.i64(i8* %dst, i8* %src, i64 64, i64 16, i64 256, i64 96, i32 64, i1 false)
+  ret void
+}
+
+declare void @llvm.memcpy.2d.p0i8.p0i8.i64(i8*, i8*, i64, i64, i64, i64, i32, i1)
@@ -0,0 +1,11 @@
+target datalayout = "e-m:e-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+declare void @lib(i32)
+
+define i32 @foo(i32 %x) noinline {
+entry:
+  %y = add i32 %x, 1
+  call void @lib(i32 %y)
+  ret i32 %y
+}
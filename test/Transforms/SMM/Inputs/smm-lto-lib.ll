@@ -0,0 +1,10 @@
+target datalayout = "e-m:e-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+declare void @ext(i32)
+
+define void @lib(i32 %y) noinline {
+entry:
+  call void @ext(i32 %y)
+  ret void
+}
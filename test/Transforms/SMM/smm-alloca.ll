@@ -0,0 +1,75 @@
+; REQUIRES: loadable_module
+; RUN: opt -load %llvmshlibdir/SMMCommon%shlibext -smm-alloca -spm-frame-size=64 -S %s | FileCheck %s
+
+; The budget fits the small array of @kernel, which is accessed in the loop,
+; but not the large buffer, which is also accessed less.
+; The address of %out escapes to @consume, so it stays on the stack, and
+; @recurse may have several activations at a time.
+
+; CHECK: @_spm_frame_area = internal global [{{[0-9]+}} x i8] zeroinitializer, section ".spm_data"
+
+; CHECK-LABEL: define i32 @kernel(
+; CHECK-NOT: alloca [16 x i32]
+; CHECK: %buf = alloca [1024 x i32]
+; CHECK-NOT: alloca [16 x i32]
+; CHECK: %out = alloca i32
+; CHECK-NOT: alloca [16 x i32]
+; CHECK: getelementptr [16 x i32], [16 x i32]* {{.*}}@_spm_frame_area
+
+; CHECK-LABEL: define i32 @recurse(
+; CHECK: %local = alloca i32
+
+declare void @consume(i32*)
+
+define i32 @kernel(i32 %n) {
+entry:
+  %hot = alloca [16 x i32]
+  %buf = alloca [1024 x i32]
+  %out = alloca i32
+  %first = getelementptr [1024 x i32], [1024 x i32]* %buf, i32 0, i32 0
+  store i32 %n, i32* %first
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]
+  %idx = and i32 %i, 15
+  %p = getelementptr [16 x i32], [16 x i32]* %hot, i32 0, i32 %idx
+  %v = load i32, i32* %p
+  %w = add i32 %v, %i
+  store i32 %w, i32* %p
+  %i.next = add i32 %i, 1
+  %cmp = icmp slt i32 %i.next, %n
+  br i1 %cmp, label %loop, label %exit
+
+exit:
+  %q = getelementptr [16 x i32], [16 x i32]* %hot, i32 0, i32 0
+  %r = load i32, i32* %q
+  store i32 %r, i32* %out
+  call void @consume(i32* %out)
+  ret i32 %r
+}
+
+define i32 @recurse(i32 %n) {
+entry:
+  %local = alloca i32
+  store i32 %n, i32* %local
+  %done = icmp eq i32 %n, 0
+  br i1 %done, label %exit, label %more
+
+more:
+  %m = sub i32 %n, 1
+  %r = call i32 @recurse(i32 %m)
+  br label %exit
+
+exit:
+  %v = load i32, i32* %local
+  ret i32 %v
+}
+
+define i32 @main() {
+entry:
+  %a = call i32 @kernel(i32 100)
+  %b = call i32 @recurse(i32 3)
+  %s = add i32 %a, %b
+  ret i32 %s
+}
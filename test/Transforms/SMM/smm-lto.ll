@@ -0,0 +1,32 @@
+; REQUIRES: loadable_module, x86-registered-target
+; RUN: llvm-as %s -o %t.main.bc
+; RUN: llvm-as %S/Inputs/smm-lto-foo.ll -o %t.foo.bc
+; RUN: llvm-as %S/Inputs/smm-lto-lib.ll -o %t.lib.bc
+; RUN: llvm-lto -load %llvmshlibdir/SMMCommon%shlibext -load %llvmshlibdir/LLVMSMMCMH%shlibext -load %llvmshlibdir/LLVMSMMCM%shlibext \
+; RUN:   -smm-lto=code -spm-size=4096 -lto-main-memory-input=.lib.bc -exported-symbol=main \
+; RUN:   -save-merged-module -o %t.o %t.main.bc %t.foo.bc %t.lib.bc
+; RUN: llvm-dis %t.o.merged.bc -o - | FileCheck %s
+
+; Code management runs on the module merged at link time, so @foo from another
+; translation unit is overlaid. @lib comes from an input named by
+; -lto-main-memory-input and stays in main memory. The runtime declarations
+; that the linker dropped are declared again.
+
+; CHECK-DAG: declare i8* @c_get(i8*)
+; CHECK-DAG: @__load_start_foo = external constant i8
+; CHECK-DAG: define i32 @foo(i32 %x) {{.*}}section ".foo"
+; CHECK-DAG: define {{.*}}void @lib(i32 %y) {{.*}}[[MAINMEM:#[0-9]+]] section ".user_text"
+; CHECK-DAG: attributes [[MAINMEM]] = { {{.*}}"smm-main-memory"{{.*}} }
+; CHECK-DAG: call void (i32, ...) @c_init_map(i32 2,
+; CHECK-DAG: call i32 @c_call_complete(
+
+target datalayout = "e-m:e-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+declare i32 @foo(i32)
+
+define i32 @main(i32 %argc, i8** %argv) {
+entry:
+  %r = call i32 @foo(i32 %argc)
+  ret i32 %r
+}
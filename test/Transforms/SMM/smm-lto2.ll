@@ -0,0 +1,32 @@
+; REQUIRES: loadable_module, x86-registered-target
+; RUN: llvm-as %s -o %t.main.bc
+; RUN: llvm-as %S/Inputs/smm-lto-foo.ll -o %t.foo.bc
+; RUN: llvm-as %S/Inputs/smm-lto-lib.ll -o %t.lib.bc
+; RUN: llvm-lto2 -load %llvmshlibdir/SMMCommon%shlibext -load %llvmshlibdir/LLVMSMMCMH%shlibext -load %llvmshlibdir/LLVMSMMCM%shlibext \
+; RUN:   -smm-lto=code -spm-size=4096 -lto-main-memory-input=.lib.bc -save-temps -o %t.o \
+; RUN:   %t.main.bc %t.foo.bc %t.lib.bc \
+; RUN:   -r=%t.main.bc,main,plx -r=%t.main.bc,foo, -r=%t.foo.bc,foo,pl -r=%t.foo.bc,lib, \
+; RUN:   -r=%t.lib.bc,lib,pl -r=%t.lib.bc,ext,
+; RUN: llvm-dis %t.o.0.4.opt.bc -o - | FileCheck %s
+
+; The lto::LTO backend runs the managers on the merged module too, once
+; llvm-lto2 has loaded the plugins.
+
+; CHECK-DAG: declare i8* @c_get(i8*)
+; CHECK-DAG: @__load_start_foo = external constant i8
+; CHECK-DAG: define i32 @foo(i32 %x) {{.*}}section ".foo"
+; CHECK-DAG: define {{.*}}void @lib(i32 %y) {{.*}}[[MAINMEM:#[0-9]+]] section ".user_text"
+; CHECK-DAG: attributes [[MAINMEM]] = { {{.*}}"smm-main-memory"{{.*}} }
+; CHECK-DAG: call void (i32, ...) @c_init_map(i32 2,
+; CHECK-DAG: call i32 @c_call_complete(
+
+target datalayout = "e-m:e-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+declare i32 @foo(i32)
+
+define i32 @main(i32 %argc, i8** %argv) {
+entry:
+  %r = call i32 @foo(i32 %argc)
+  ret i32 %r
+}
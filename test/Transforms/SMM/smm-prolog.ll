@@ -0,0 +1,25 @@
+; REQUIRES: loadable_module
+; RUN: opt -load %llvmshlibdir/SMMCommon%shlibext -smm-prolog -S < %s | FileCheck %s
+
+; The body of main moves to smm_main, and main becomes a wrapper that calls it.
+
+; CHECK-LABEL: define i32 @main(i32 %argc, i8** %argv)
+; CHECK-NEXT: EntryBlock:
+; CHECK-NEXT: %0 = call i32 @smm_main(i32 %argc, i8** %argv)
+; CHECK-NEXT: ret i32 0
+
+; CHECK-LABEL: define i32 @smm_main(i32 %argc, i8** %argv)
+; CHECK-NEXT: entry:
+; CHECK-NEXT: %r = call i32 @foo(i32 %argc)
+; CHECK-NEXT: ret i32 %r
+
+define i32 @foo(i32 %x) {
+entry:
+  ret i32 %x
+}
+
+define i32 @main(i32 %argc, i8** %argv) {
+entry:
+  %r = call i32 @foo(i32 %argc)
+  ret i32 %r
+}
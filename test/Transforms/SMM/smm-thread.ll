@@ -0,0 +1,79 @@
+; REQUIRES: loadable_module
+; RUN: opt -load %llvmshlibdir/SMMCommon%shlibext -smm-thread -S < %s | FileCheck %s
+
+; The stack and code management state is private to each thread, so it becomes
+; thread-local. Program data stays shared.
+
+; CHECK-DAG: @_spm_stack_base = thread_local global i8* null
+; CHECK-DAG: @_mem_stack_base = thread_local global i8* null
+; CHECK-DAG: @_stack_pointer = thread_local global i8* null
+; CHECK-DAG: @_gvar_ret.i32 = thread_local global i32 0
+; CHECK-DAG: @_region_table = external thread_local global i8*
+; CHECK-DAG: @counter = global i32 0
+
+@_spm_stack_base = global i8* null
+@_mem_stack_base = global i8* null
+@_stack_pointer = global i8* null
+@_gvar_ret.i32 = global i32 0
+@_region_table = external global i8*
+@counter = global i32 0
+
+@__load_start_worker = external constant i8
+@.str = private unnamed_addr constant [7 x i8] c"worker\00"
+
+%union.pthread_attr_t = type { i64, [48 x i8] }
+
+declare void @c_init_reg(i32)
+declare void @c_init_map(i32, ...)
+
+declare i32 @pthread_create(i64*, %union.pthread_attr_t*, i8* (i8*)*, i8*)
+declare i8* @lib_worker(i8*)
+
+; Threads of managed functions start through a wrapper that sets up the SPM
+; stack window of the core and runs the function on it. Library functions are
+; started as they are.
+
+; CHECK-LABEL: define i32 @main()
+; CHECK: call i32 @pthread_create(i64* %t, %union.pthread_attr_t* null, i8* (i8*)* @_smm_thread.worker, i8* null)
+; CHECK: call i32 @pthread_create(i64* %t, %union.pthread_attr_t* null, i8* (i8*)* @_smm_thread.worker, i8* null)
+; CHECK: call i32 @pthread_create(i64* %t, %union.pthread_attr_t* null, i8* (i8*)* @lib_worker, i8* null)
+
+define i8* @worker(i8* %arg) {
+entry:
+  %v = load i32, i32* @counter
+  %v.next = add i32 %v, 1
+  store i32 %v.next, i32* @counter
+  ret i8* %arg
+}
+
+define i32 @main() {
+entry:
+  call void @c_init_reg(i32 1)
+  %table = load i8*, i8** @_region_table
+  %region = getelementptr i8, i8* %table, i32 0
+  call void (i32, ...) @c_init_map(i32 1, i8* getelementptr ([7 x i8], [7 x i8]* @.str, i64 0, i64 0), i8* @__load_start_worker, i8* (i8*)* @worker, i64 64, i8* %region)
+  %t = alloca i64
+  %r1 = call i32 @pthread_create(i64* %t, %union.pthread_attr_t* null, i8* (i8*)* @worker, i8* null)
+  %r2 = call i32 @pthread_create(i64* %t, %union.pthread_attr_t* null, i8* (i8*)* @worker, i8* null)
+  %r3 = call i32 @pthread_create(i64* %t, %union.pthread_attr_t* null, i8* (i8*)* @lib_worker, i8* null)
+  ret i32 0
+}
+
+; One wrapper is shared by all the threads starting with the same function. It
+; fills in the region and mapping tables of the thread, as main does for the
+; main thread.
+
+; CHECK: declare void @_smm_thread_init()
+; CHECK-LABEL: define internal i8* @_smm_thread.worker(i8*)
+; CHECK-NEXT: entry:
+; CHECK-NEXT: call void @_smm_thread_init()
+; CHECK-NEXT: call void @c_init_reg(i32 1)
+; CHECK-NEXT: %table = load i8*, i8** @_region_table
+; CHECK-NEXT: %region = getelementptr i8, i8* %table, i32 0
+; CHECK-NEXT: call void (i32, ...) @c_init_map(i32 1, {{.*}}, i8* (i8*)* @worker, i64 64, i8* %region)
+; CHECK-NEXT: call void asm sideeffect "mov %rsp, $0;", "=*m,~{dirflag},~{fpsr},~{flags}"(i8** @_mem_stack_base)
+; CHECK-NEXT: call void asm sideeffect "mov $0, %rsp;", "*m,~{rsp},~{dirflag},~{fpsr},~{flags}"(i8** @_spm_stack_base)
+; CHECK-NEXT: %1 = call i8* @worker(i8* %0)
+; CHECK-NEXT: call void asm sideeffect "mov $0, %rsp;", "*m,~{rsp},~{dirflag},~{fpsr},~{flags}"(i8** @_mem_stack_base)
+; CHECK-NEXT: ret i8* %1
+; CHECK-NOT: @_smm_thread.
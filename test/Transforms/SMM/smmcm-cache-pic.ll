@@ -0,0 +1,86 @@
+; REQUIRES: loadable_module, x86-registered-target
+; RUN: opt -load %llvmshlibdir/SMMCommon%shlibext -load %llvmshlibdir/LLVMSMMCM%shlibext -smmcm -code-cache -code-cache-size=1024 -S < %s | FileCheck %s
+; RUN: opt -load %llvmshlibdir/SMMCommon%shlibext -load %llvmshlibdir/LLVMSMMCM%shlibext -smmcm -code-cache -code-cache-size=1024 < %s | llc -mtriple=x86_64-unknown-linux-gnu -O2 | FileCheck %s --check-prefix=ASM
+; RUN: sed -e s/x86_64/aarch64/ %s | not opt -load %llvmshlibdir/SMMCommon%shlibext -load %llvmshlibdir/LLVMSMMCM%shlibext -smmcm -code-cache -code-cache-size=1024 -disable-output 2>&1 | FileCheck %s --check-prefix=TRIPLE
+
+; Cached functions run wherever they are loaded, so they reach the wrappers,
+; the C library and global data through absolute addresses only.  Addresses
+; are 64-bit immediates, so only x86-64 code can be cached.
+
+; TRIPLE: -code-cache only supports x86-64 targets, not aarch64-unknown-linux-gnu
+
+target triple = "x86_64-unknown-linux-gnu"
+
+@counter = global i32 0
+@buf = global [16 x i8] zeroinitializer
+
+declare i8* @c_get(i8*)
+declare void @c_init_reg(i32)
+declare void @c_init_map(i32, ...)
+declare i32 @puts(i8*)
+declare void @llvm.memset.p0i8.i64(i8*, i8, i64, i32, i1)
+
+; CHECK-LABEL: define i32 @foo(i32 %x)
+; CHECK: %abs_addr = call i32* asm "movabsq $1, $0", "=r,i,{{.*}}"(i32* @counter)
+; CHECK: load i32, i32* %abs_addr
+; CHECK: [[MEMSET:%.*]] = call i8* (i8*, i32, i64)* asm "movabsq $1, $0", "=r,i,{{.*}}"(i8* (i8*, i32, i64)* @memset)
+; CHECK: call i8* [[MEMSET]](i8* {{.*}}, i32 0, i64 16)
+; CHECK-NOT: @llvm.memset
+; CHECK: [[PUTS:%.*]] = call i32 (i8*)* asm "movabsq $1, $0", "=r,i,{{.*}}"(i32 (i8*)* @puts)
+; CHECK: call i32 [[PUTS]](
+define i32 @foo(i32 %x) {
+entry:
+  %c = load i32, i32* @counter
+  %y = add i32 %c, %x
+  call void @llvm.memset.p0i8.i64(i8* getelementptr ([16 x i8], [16 x i8]* @buf, i64 0, i64 0), i8 0, i64 16, i32 1, i1 false)
+  %r = call i32 @puts(i8* getelementptr ([16 x i8], [16 x i8]* @buf, i64 0, i64 0))
+  ret i32 %y
+}
+
+; Constants that hold addresses are built from the materialized ones.
+
+; CHECK-LABEL: define void @table({ i32*, i64 }* %p, <2 x i8*>* %q)
+; CHECK: [[COUNTER:%.*]] = call i32* asm "movabsq $1, $0", "=r,i,{{.*}}"(i32* @counter)
+; CHECK: [[PAIR:%.*]] = insertvalue { i32*, i64 } undef, i32* [[COUNTER]], 0
+; CHECK: [[BUF:%.*]] = call i64 asm "movabsq $1, $0", "=r,i,{{.*}}"(i64 ptrtoint ([16 x i8]* @buf to i64))
+; CHECK: [[END:%.*]] = add i64 [[BUF]], 16
+; CHECK: [[FULL:%.*]] = insertvalue { i32*, i64 } [[PAIR]], i64 [[END]], 1
+; CHECK: store { i32*, i64 } [[FULL]], { i32*, i64 }* %p
+; CHECK: [[VEC:%.*]] = insertelement <2 x i8*> undef, i8* %{{.*}}, i32 0
+; CHECK: insertelement <2 x i8*> [[VEC]], i8* null, i32 1
+define void @table({ i32*, i64 }* %p, <2 x i8*>* %q) {
+entry:
+  store { i32*, i64 } { i32* @counter, i64 add (i64 ptrtoint ([16 x i8]* @buf to i64), i64 16) }, { i32*, i64 }* %p
+  store <2 x i8*> <i8* getelementptr ([16 x i8], [16 x i8]* @buf, i64 0, i64 0), i8* null>, <2 x i8*>* %q
+  ret void
+}
+
+; CHECK-LABEL: define i32 @smm_main()
+; CHECK: [[FOO:%.*]] = call i32 (i32)* asm "movabsq $1, $0", "=r,i,{{.*}}"(i32 (i32)* @foo)
+; CHECK: [[WRAPPER:%.*]] = call i32 (i8*, i8*, i32 (i32)*, i32)* asm "movabsq $1, $0", "=r,i,{{.*}}"(i32 (i8*, i8*, i32 (i32)*, i32)* @c_call_complete)
+; CHECK: call i32 [[WRAPPER]]({{.*}}, i32 (i32)* [[FOO]], i32 41)
+define i32 @main() {
+entry:
+  %r = call i32 @foo(i32 41)
+  ret i32 %r
+}
+
+; No PC-relative call or access is left in the cached code
+; ASM-LABEL: foo:
+; ASM-NOT: (%rip)
+; ASM-NOT: {{call|jmp}}q {{[^*]}}
+; ASM: movabsq $counter,
+; ASM: movabsq $memset, [[REG:%[a-z0-9]+]]
+; ASM: callq *[[REG]]
+; ASM-NOT: (%rip)
+; ASM-NOT: {{call|jmp}}q {{[^*]}}
+; ASM: .Lfunc_end
+; ASM-LABEL: smm_main:
+; ASM-NOT: (%rip)
+; ASM-NOT: {{call|jmp}}q {{[^*]}}
+; ASM: movabsq $foo,
+; ASM: movabsq $c_call_complete, [[REG:%[a-z0-9]+]]
+; ASM: callq *[[REG]]
+; ASM-NOT: (%rip)
+; ASM-NOT: {{call|jmp}}q {{[^*]}}
+; ASM: .Lfunc_end
@@ -0,0 +1,40 @@
+; REQUIRES: loadable_module
+; RUN: opt -load %llvmshlibdir/SMMCommon%shlibext -load %llvmshlibdir/LLVMSMMCM%shlibext -smmcm -code-cache -code-cache-size=1024 -code-cache-policy=cost -S < %s | FileCheck %s
+; RUN: not opt -load %llvmshlibdir/SMMCommon%shlibext -load %llvmshlibdir/LLVMSMMCM%shlibext -smmcm -code-cache -code-cache-size=4 -disable-output < %s 2>&1 | FileCheck %s --check-prefix=SMALL
+
+; With a code cache no overlay mapping is needed. Callers are brought back to
+; where they were when the callee returns, and main sets up the cache instead
+; of the code regions.
+
+; SMALL: the code cache is smaller than the largest function
+
+target triple = "x86_64-unknown-linux-gnu"
+
+declare i8* @c_get(i8*)
+declare void @c_init_reg(i32)
+declare void @c_init_map(i32, ...)
+
+; CHECK-LABEL: define i32 @foo(i32 %x) #0 section ".foo"
+define i32 @foo(i32 %x) {
+entry:
+  %y = add i32 %x, 1
+  ret i32 %y
+}
+
+; CHECK-LABEL: define i32 @main()
+; CHECK-NEXT: EntryBlock:
+; CHECK-NEXT: call void @c_init_cache(i64 1024, i32 2)
+; CHECK: call void (i32, ...) @c_init_cache_map(i32 2,
+; CHECK: call i32 @smm_main()
+define i32 @main() {
+entry:
+  %r = call i32 @foo(i32 41)
+  ret i32 %r
+}
+
+; CHECK-LABEL: define linkonce_odr i32 @c_call_complete(i8* %callername, i8* %calleename, i32 (i32)*, i32 %arg0)
+; CHECK: %callee_vma_int8 = call i8* @c_get_call(i8* %callername, i8* %calleename)
+; CHECK: %callee_ret_val = call i32 %callee_vma(
+; CHECK: call void @c_return(i8* %callername)
+
+; CHECK: attributes #0 = { "no-jump-tables"="true" }
@@ -0,0 +1,36 @@
+; REQUIRES: loadable_module
+; RUN: opt -load %llvmshlibdir/SMMCommon%shlibext -load %llvmshlibdir/LLVMSMMCM%shlibext -smmcm -smm-info-input=%S/Inputs/smmcm.yaml -smm-dma-alignment=64 -smm-linker-script=%t.ld -S < %s | FileCheck %s
+; RUN: FileCheck %s --check-prefix=SCRIPT < %t.ld
+
+; With 64-byte DMA units, managed functions are aligned to 64 bytes, their load
+; sizes are rounded up to whole units, and the generated linker script pads
+; each section of the overlay of region 0 to a multiple of 64 bytes.
+
+; CHECK-LABEL: define i32 @foo(i32 %x) section ".foo" align 64
+; CHECK-LABEL: define i32 @main()
+; CHECK: call void (i32, ...) @c_init_map(i32 2, {{.*}}i64 and (i64 add (i64 sub (
+; CHECK-LABEL: define i32 @smm_main() section ".main" align 64
+
+; SCRIPT: OVERLAY ALIGN(64) : NOCROSSREFS AT (ALIGN(_smm_load_address, 64))
+; SCRIPT-NEXT: {
+; SCRIPT-NEXT:   .main { *(.main) . = ALIGN(64); }
+; SCRIPT-NEXT:   .foo { *(.foo) . = ALIGN(64); }
+; SCRIPT-NEXT: }
+
+@_region_table = external global i8*
+
+declare i8* @c_get(i8*)
+declare void @c_init_reg(i32)
+declare void @c_init_map(i32, ...)
+
+define i32 @foo(i32 %x) {
+entry:
+  %y = add i32 %x, 1
+  ret i32 %y
+}
+
+define i32 @main() {
+entry:
+  %r = call i32 @foo(i32 41)
+  ret i32 %r
+}
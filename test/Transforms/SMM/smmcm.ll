@@ -0,0 +1,45 @@
+; REQUIRES: loadable_module
+; RUN: opt -load %llvmshlibdir/SMMCommon%shlibext -load %llvmshlibdir/LLVMSMMCM%shlibext -smmcm -smm-info-input=%S/Inputs/smmcm.yaml -S < %s | FileCheck %s
+
+; Calls to user functions go through c_call_complete, which loads the callee
+; and reloads the caller. Each function gets its own section, and main
+; initializes the code management runtime before calling smm_main.
+
+; CHECK: @__load_start_foo = external constant i8
+; CHECK: @__load_stop_foo = external constant i8
+
+@_region_table = external global i8*
+
+declare i8* @c_get(i8*)
+declare void @c_init_reg(i32)
+declare void @c_init_map(i32, ...)
+
+; CHECK-LABEL: define i32 @foo(i32 %x) section ".foo"
+define i32 @foo(i32 %x) {
+entry:
+  %y = add i32 %x, 1
+  ret i32 %y
+}
+
+; CHECK-LABEL: define i32 @main()
+; CHECK-NEXT: EntryBlock:
+; CHECK-NEXT: call void @c_init_reg(i32 1)
+; CHECK: call void (i32, ...) @c_init_map(i32 2,
+; CHECK: call void @llvm.memcpy.p0i8.p0i8.i64(i8* bitcast (i32 ()* @smm_main to i8*), i8* @__load_start_main,
+; CHECK-NEXT: %{{[0-9]+}} = call i32 @smm_main()
+; CHECK-NEXT: ret i32 0
+define i32 @main() {
+entry:
+  %r = call i32 @foo(i32 41)
+  ret i32 %r
+}
+
+; CHECK-LABEL: define i32 @smm_main() section ".main"
+; CHECK-NEXT: entry:
+; CHECK-NEXT: %r = call i32 @c_call_complete(i8* getelementptr inbounds ([5 x i8], [5 x i8]* @caller.name, i32 0, i32 0), i8* getelementptr inbounds ([4 x i8], [4 x i8]* @callee.name, i32 0, i32 0), i32 (i32)* @foo, i32 41)
+; CHECK-NEXT: ret i32 %r
+
+; CHECK-LABEL: define linkonce_odr i32 @c_call_complete(i8* %callername, i8* %calleename, i32 (i32)*, i32 %arg0)
+; CHECK: %callee_vma_int8 = call i8* @c_get(i8* %calleename)
+; CHECK: %callee_ret_val = call i32 %callee_vma(
+; CHECK: %caller_vma = call i8* @c_get(i8* %callername)
@@ -0,0 +1,27 @@
+; REQUIRES: loadable_module
+; RUN: opt -load %llvmshlibdir/SMMCommon%shlibext -load %llvmshlibdir/LLVMSMMCMH%shlibext -smmcmh-sim -smm-info-input=%S/Inputs/smmcmh-sim.yaml -disable-output %s 2>&1 | FileCheck %s
+; RUN: opt -load %llvmshlibdir/SMMCommon%shlibext -load %llvmshlibdir/LLVMSMMCMH%shlibext -smmcmh-sim -smm-info-input=%S/Inputs/smmcmh-sim.yaml -smm-dma-setup-cycles=10 -smm-dma-alignment=64 -disable-output %s 2>&1 | FileCheck %s --check-prefix=ALIGN
+
+; foo and bar share a region and evict each other in every iteration of the
+; loop, while main stays in its own region:
+;   main + 10 * (foo + bar) = 21 transfers, 64 + 10 * (100 + 30) = 1364 bytes.
+; CHECK: Simulated code traffic: 21 transfers, 1364 bytes, 1364 DMA cycles
+
+; Padded to 64 bytes and with a setup latency of 10 cycles per transfer:
+;   (64 + 10) + 10 * ((128 + 10) + (64 + 10)) = 2194 cycles.
+; ALIGN: Simulated code traffic: 21 transfers, 1364 bytes, 2194 DMA cycles
+
+define i32 @foo() {
+entry:
+  ret i32 0
+}
+
+define i32 @bar() {
+entry:
+  ret i32 0
+}
+
+define i32 @main() {
+entry:
+  ret i32 0
+}
@@ -0,0 +1,45 @@
+; REQUIRES: loadable_module
+; RUN: opt -load %llvmshlibdir/SMMCommon%shlibext -load %llvmshlibdir/LLVMSMMCMH%shlibext -smmcmh-split-cold -S %s | FileCheck %s
+; RUN: opt -load %llvmshlibdir/SMMCommon%shlibext -load %llvmshlibdir/LLVMSMMCMH%shlibext -smmcmh-split-cold -smmcmh-funcinfo -smm-info-output=%t.yaml -disable-output %s
+; RUN: FileCheck %s --check-prefix=INFO < %t.yaml
+
+; The profile says the error path of @work never runs, so it moves to a
+; function in main memory, which is not a user function to be managed.
+
+; CHECK-LABEL: define i32 @work(
+; CHECK: call void @work_cold0(
+; CHECK: define internal void @work_cold0({{.*}}) [[COLD:#[0-9]+]] section ".user_text"
+; CHECK: attributes [[COLD]] = { cold noinline "smm-main-memory" }
+
+; INFO: Functions:
+; INFO-NOT: work_cold0
+
+@msg = private constant [6 x i8] c"error\00"
+
+declare i32 @puts(i8*)
+declare void @exit(i32) noreturn
+
+define i32 @work(i32 %x) !prof !0 {
+entry:
+  %bad = icmp slt i32 %x, 0
+  br i1 %bad, label %error, label %ok, !prof !1
+
+error:
+  %code = add i32 %x, 100
+  %r = call i32 @puts(i8* getelementptr ([6 x i8], [6 x i8]* @msg, i32 0, i32 0))
+  call void @exit(i32 %code)
+  unreachable
+
+ok:
+  %y = mul i32 %x, 3
+  ret i32 %y
+}
+
+define i32 @main() !prof !0 {
+entry:
+  %r = call i32 @work(i32 14)
+  ret i32 %r
+}
+
+!0 = !{!"function_entry_count", i64 1000}
+!1 = !{!"branch_weights", i32 0, i32 1000}
@@ -0,0 +1,46 @@
+; REQUIRES: loadable_module
+; RUN: opt -load %llvmshlibdir/SMMCommon%shlibext -load %llvmshlibdir/LLVMSMMCMH%shlibext -smmcmh-funcinfo -smmcmh-exec -smmcmh-overlay -spm-size=100000 -smm-info-output=%t.yaml -disable-output %s 2>/dev/null
+; RUN: FileCheck %s < %t.yaml
+
+; The SPM is large enough to give every function its own region, and the
+; execution trace repeats the call in the loop 10 times.
+
+; CHECK: NumRegions: 2
+; CHECK-NEXT: Mapping:
+; CHECK-DAG: Name: main
+; CHECK-DAG: Name: foo
+; CHECK: ExecTrace:
+; CHECK-NEXT: - Kind: Call
+; CHECK-NEXT: Name: main
+; CHECK-NEXT: Count: 1
+; CHECK-NEXT: - Kind: LoopBegin
+; CHECK-NEXT: Depth: 1
+; CHECK-NEXT: - Kind: Call
+; CHECK-NEXT: Name: foo
+; CHECK-NEXT: Count: 10
+; CHECK-NEXT: - Kind: LoopEnd
+; CHECK-NEXT: Depth: 1
+; CHECK-NEXT: - Kind: Call
+; CHECK-NEXT: Name: main
+; CHECK-NEXT: Count: 1
+
+define i32 @foo(i32 %x) {
+entry:
+  %y = add i32 %x, 1
+  ret i32 %y
+}
+
+define i32 @main() {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]
+  %r = call i32 @foo(i32 %i)
+  %i.next = add i32 %i, 1
+  %cmp = icmp slt i32 %i.next, 10
+  br i1 %cmp, label %loop, label %exit
+
+exit:
+  ret i32 0
+}
@@ -0,0 +1,32 @@
+; REQUIRES: loadable_module
+; RUN: opt -load %llvmshlibdir/SMMCommon%shlibext -load %llvmshlibdir/LLVMSMMMO%shlibext -smmmo-opt-size -size-threshold=100 \
+; RUN:   -smm-info-output=%t.yaml -disable-output %s 2>&1
+; RUN: FileCheck %s < %t.yaml
+
+; The function sizes are estimated from the IR, and the chosen SPM size is
+; reported through SMMInfo. Holding both functions removes all DMA transfers,
+; which is worth the extra size at this threshold.
+
+; CHECK: SPMSizes:
+; CHECK-NEXT: - Name: min
+; CHECK-NEXT:   Size: 12
+; CHECK-NEXT:   Cost: 32
+; CHECK-NEXT: - Name: max
+; CHECK-NEXT:   Size: 20
+; CHECK-NEXT:   Cost: 0
+; CHECK-NEXT: - Name: opt
+; CHECK-NEXT:   Size: 20
+; CHECK-NEXT:   Cost: 0
+
+define i32 @foo(i32 %x) {
+entry:
+  %y = add i32 %x, 1
+  ret i32 %y
+}
+
+define i32 @main() {
+entry:
+  %r = call i32 @foo(i32 41)
+  %s = add i32 %r, 1
+  ret i32 %s
+}
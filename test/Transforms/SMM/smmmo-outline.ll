@@ -0,0 +1,43 @@
+; REQUIRES: loadable_module
+; RUN: opt -load %llvmshlibdir/SMMCommon%shlibext -load %llvmshlibdir/LLVMSMMMO%shlibext -smmmo-outline -outline-size-limit=40 -S %s | FileCheck %s
+; RUN: opt -load %llvmshlibdir/SMMCommon%shlibext -load %llvmshlibdir/LLVMSMMMO%shlibext -smmmo-outline -S %s | FileCheck %s --check-prefix=DEFAULT
+
+; @big takes 56 bytes, more than the limit, so its loop (28 bytes) becomes an
+; overlay unit of its own. By default, functions up to twice the average size
+; of 32 bytes are left alone.
+
+; CHECK-LABEL: define i32 @big(
+; CHECK: call void @big_loop0(
+; CHECK: define internal void @big_loop0(
+; CHECK: loop:
+
+; DEFAULT-NOT: @big_loop
+; DEFAULT: define i32 @main(
+
+define i32 @big(i32 %n) {
+entry:
+  %a = alloca i32
+  store i32 0, i32* %a
+  %m = mul i32 %n, 2
+  %k = add i32 %m, 1
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]
+  %v = load i32, i32* %a
+  %w = add i32 %v, %i
+  store i32 %w, i32* %a
+  %i.next = add i32 %i, 1
+  %cmp = icmp slt i32 %i.next, %n
+  br i1 %cmp, label %loop, label %exit
+
+exit:
+  %r = load i32, i32* %a
+  ret i32 %r
+}
+
+define i32 @main() {
+entry:
+  %r = call i32 @big(i32 10)
+  ret i32 %r
+}
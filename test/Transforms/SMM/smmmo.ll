@@ -0,0 +1,20 @@
+; REQUIRES: loadable_module
+; RUN: opt -load %llvmshlibdir/SMMCommon%shlibext -load %llvmshlibdir/LLVMSMMMO%shlibext -smmmo -disable-output %s 2>&1 | FileCheck %s
+
+; Without measured sizes, function sizes are estimated at 4 bytes per IR
+; instruction, and the smallest SPM holds the largest function, main.
+
+; CHECK: calculate cost for minSpmSize=12
+
+define i32 @foo(i32 %x) {
+entry:
+  %y = add i32 %x, 1
+  ret i32 %y
+}
+
+define i32 @main() {
+entry:
+  %r = call i32 @foo(i32 41)
+  %s = add i32 %r, 1
+  ret i32 %s
+}
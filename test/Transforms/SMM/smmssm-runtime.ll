@@ -0,0 +1,36 @@
+; REQUIRES: loadable_module
+; RUN: opt -load %llvmshlibdir/SMMCommon%shlibext -load %llvmshlibdir/SMMSSM%shlibext -smm-prolog -smmssm -size-constraint=16 -S < %s | FileCheck %s
+; RUN: sed -e '/^@_mem_stack_base =/d' %s | not opt -load %llvmshlibdir/SMMCommon%shlibext -load %llvmshlibdir/SMMSSM%shlibext \
+; RUN:   -smm-prolog -smmssm -size-constraint=16 -disable-output 2>&1 | FileCheck %s --check-prefix=MISSING
+
+; The program calls no runtime function yet, as after linking it with a runtime
+; whose unused declarations were dropped, so smmssm declares them. The runtime
+; variables cannot be declared without knowing their types, so they have to be
+; linked in.
+
+; MISSING: LLVM ERROR: smmssm: the SPM runtime variable _mem_stack_base is missing, link the runtime into the program
+
+@_mem_stack_base = global i8* null
+@_spm_stack_base = global i8* null
+@_stack_pointer = global i8* null
+@_mem_stack_depth = global i64 0
+@_mem_stack = global [16 x { i8*, i8* }] zeroinitializer
+
+; CHECK-LABEL: define i32 @smm_main()
+; CHECK: call void @_sstore()
+; CHECK: call i32 @foo()
+; CHECK: call void @_sload()
+
+; CHECK-DAG: declare void @_sstore()
+; CHECK-DAG: declare void @_sload()
+
+define i32 @foo() {
+entry:
+  ret i32 1
+}
+
+define i32 @main() {
+entry:
+  %r = call i32 @foo()
+  ret i32 %r
+}
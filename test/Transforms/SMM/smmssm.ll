@@ -0,0 +1,134 @@
+; REQUIRES: loadable_module
+; RUN: opt -load %llvmshlibdir/SMMCommon%shlibext -load %llvmshlibdir/SMMSSM%shlibext -smmssm -size-constraint=16 -S < %s 2>%t.err | FileCheck %s
+; RUN: FileCheck %s --check-prefix=WARN < %t.err
+
+; Every function has a 16-byte frame, so each call from smm_main needs stack
+; frame management, and so does every call within a recursive SCC.
+
+target triple = "x86_64-unknown-linux-gnu"
+
+@_mem_stack_base = global i8* null
+@_spm_stack_base = global i8* null
+@_stack_pointer = global i8* null
+@_mem_stack_depth = global i64 0
+@_mem_stack = global [16 x { i8*, i8* }] zeroinitializer
+
+; WARN-DAG: recursive functions (rec) use one SPM stack frame at a time
+; WARN-DAG: recursive functions ({{even, odd|odd, even}}) use one SPM stack frame at a time
+
+; CHECK-DAG: @_spm_stack_end = external global i8
+; CHECK-DAG: @_gvar_ret.double = internal global double 0.000000e+00
+; CHECK-DAG: @llvm.used = appending global [1 x i8*] [i8* bitcast (void ()* @_sload to i8*)], section "llvm.metadata"
+
+declare void @_sstore()
+declare void @_sload()
+
+define double @half(double %x) {
+entry:
+  %y = fmul double %x, 5.000000e-01
+  ret double %y
+}
+
+; A value returned in a self-recursive call stays in a register while the stack
+; pointer is restored and _sload runs.
+; CHECK-LABEL: define i32 @rec(i32 %n)
+; CHECK: %m = sub i32 %n, 1
+; CHECK-NEXT: call void asm sideeffect "mov %rsp, $0;", "=*m,~{dirflag},~{fpsr},~{flags}"(i8** @_stack_pointer)
+; CHECK-NEXT: call void @_sstore()
+; CHECK-NEXT: call void asm sideeffect "mov $0, %rsp;", "*m,~{rsp},~{dirflag},~{fpsr},~{flags}"(i8** @_spm_stack_base)
+; CHECK-NEXT: %r = call i32 @rec(i32 %m)
+; CHECK-NEXT: [[DEPTH:%[0-9]+]] = load i64, i64* @_mem_stack_depth
+; CHECK-NEXT: %sub = sub i64 [[DEPTH]], 1
+; CHECK-NEXT: %arrayelem = getelementptr [16 x { i8*, i8* }], [16 x { i8*, i8* }]* @_mem_stack, i32 0, i64 %sub
+; CHECK-NEXT: %then_stack_pointer = getelementptr { i8*, i8* }, { i8*, i8* }* %arrayelem, i32 0, i32 0
+; CHECK-NEXT: %ret_val = call i32 asm sideeffect "mov $1, %rsp; call _sload;", "=r,*m,0,~{rax},{{.*}},~{rsp},~{memory},~{dirflag},~{fpsr},~{flags}"(i8** %then_stack_pointer, i32 %r)
+; CHECK-NEXT: %s = add i32 %ret_val, %n
+define i32 @rec(i32 %n) {
+entry:
+  %cmp = icmp eq i32 %n, 0
+  br i1 %cmp, label %done, label %recurse
+
+recurse:
+  %m = sub i32 %n, 1
+  %r = call i32 @rec(i32 %m)
+  %s = add i32 %r, %n
+  ret i32 %s
+
+done:
+  ret i32 0
+}
+
+; Calls within a mutually recursive SCC are managed as well.
+; CHECK-LABEL: define i32 @even(i32 %n)
+; CHECK: call void @_sstore()
+; CHECK-NEXT: call void asm sideeffect "mov $0, %rsp;"{{.*}}(i8** @_spm_stack_base)
+; CHECK-NEXT: %r = call i32 @odd(i32 %m)
+define i32 @even(i32 %n) {
+entry:
+  %cmp = icmp eq i32 %n, 0
+  br i1 %cmp, label %done, label %recurse
+
+recurse:
+  %m = sub i32 %n, 1
+  %r = call i32 @odd(i32 %m)
+  ret i32 %r
+
+done:
+  ret i32 1
+}
+
+; CHECK-LABEL: define i32 @odd(i32 %n)
+; CHECK: call void @_sstore()
+; CHECK-NEXT: call void asm sideeffect "mov $0, %rsp;"{{.*}}(i8** @_spm_stack_base)
+; CHECK-NEXT: %r = call i32 @even(i32 %m)
+define i32 @odd(i32 %n) {
+entry:
+  %cmp = icmp eq i32 %n, 0
+  br i1 %cmp, label %done, label %recurse
+
+recurse:
+  %m = sub i32 %n, 1
+  %r = call i32 @even(i32 %m)
+  ret i32 %r
+
+done:
+  ret i32 0
+}
+
+; A floating-point return value is kept in a slot outside of the SPM stack.
+; CHECK-LABEL: define i32 @smm_main()
+; CHECK: call void @_sstore()
+; CHECK-NEXT: call void asm sideeffect "mov $0, %rsp;"{{.*}}(i8** @_spm_stack_base)
+; CHECK-NEXT: %h = call double @half(double 1.000000e+00)
+; CHECK-NEXT: store double %h, double* @_gvar_ret.double
+; CHECK: call void asm sideeffect "mov $0, %rsp;"{{.*}}(i8** %then_stack_pointer{{[0-9]*}})
+; CHECK-NEXT: call void @_sload()
+; CHECK-NEXT: [[HALF:%ret_val[0-9]*]] = load double, double* @_gvar_ret.double
+; CHECK-NEXT: %hi = fptosi double [[HALF]] to i32
+; CHECK: call void @_sstore()
+; CHECK: %r = call i32 @rec(i32 %hi)
+; CHECK: [[REC:%ret_val[0-9]*]] = call i32 asm sideeffect "mov $1, %rsp; call _sload;"
+; CHECK: call void @_sstore()
+; CHECK: %e = call i32 @even(i32 [[REC]])
+define i32 @smm_main() {
+entry:
+  %h = call double @half(double 1.000000e+00)
+  %hi = fptosi double %h to i32
+  %r = call i32 @rec(i32 %hi)
+  %e = call i32 @even(i32 %r)
+  ret i32 %e
+}
+
+; CHECK-LABEL: define i32 @main()
+; CHECK-NEXT: entry:
+; CHECK-NEXT: call void asm sideeffect "mov %rsp, $0;", "=*m,~{dirflag},~{fpsr},~{flags}"(i8** @_mem_stack_base)
+; CHECK-NEXT: store i8* @_spm_stack_end, i8** @_spm_stack_base
+; CHECK-NEXT: call void asm sideeffect "mov $0, %rsp;", "*m,~{rsp},~{dirflag},~{fpsr},~{flags}"(i8** @_spm_stack_base)
+; CHECK-NEXT: %r = call i32 @smm_main()
+; CHECK-NEXT: call void asm sideeffect "mov $0, %rsp;", "*m,~{rsp},~{dirflag},~{fpsr},~{flags}"(i8** @_mem_stack_base)
+; CHECK-NEXT: ret i32 0
+define i32 @main() {
+entry:
+  %r = call i32 @smm_main()
+  ret i32 0
+}
@@ -0,0 +1,35 @@
+; REQUIRES: loadable_module
+; RUN: opt -load %llvmshlibdir/SMMCommon%shlibext -user-code -S < %s | FileCheck %s
+
+; User functions are placed in the .user_text section and management
+; functions in the .management_text section. Library functions are left alone.
+
+; CHECK: define i32 @foo(i32 %x) section ".user_text"
+; CHECK: define i32 @main() section ".user_text"
+; CHECK: define void @_sload() section ".management_text"
+; CHECK: define void @bar() section ".keep"
+; CHECK: declare i32 @puts(i8*){{$}}
+
+define i32 @foo(i32 %x) {
+entry:
+  %y = add i32 %x, 1
+  ret i32 %y
+}
+
+define i32 @main() {
+entry:
+  %r = call i32 @foo(i32 41)
+  ret i32 %r
+}
+
+define void @_sload() {
+entry:
+  ret void
+}
+
+define void @bar() section ".keep" {
+entry:
+  ret void
+}
+
+declare i32 @puts(i8*)
@@ -0,0 +1,23 @@
+; REQUIRES: loadable_module
+; RUN: opt -load %llvmshlibdir/SMMCommon%shlibext -user-global -S < %s | FileCheck %s
+
+; User data is placed in the .user_data section, management state and string
+; literals are left alone.
+
+; CHECK: @counter = global i32 0, section ".user_data"
+; CHECK: @table = global [4 x i32] zeroinitializer, section ".user_data"
+; CHECK: @.str = private unnamed_addr constant [4 x i8] c"abc\00"
+; CHECK: @_spm_stack_base = global i8* null{{$}}
+; CHECK: @_gvar_ret.i32 = internal global i32 0{{$}}
+
+@counter = internal global i32 0
+@table = global [4 x i32] zeroinitializer
+@.str = private unnamed_addr constant [4 x i8] c"abc\00"
+@_spm_stack_base = global i8* null
+@_gvar_ret.i32 = internal global i32 0
+
+define i32 @main() {
+entry:
+  %0 = load i32, i32* @counter
+  ret i32 %0
+}
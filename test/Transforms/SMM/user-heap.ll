@@ -0,0 +1,37 @@
+; REQUIRES: loadable_module
+; RUN: opt -load %llvmshlibdir/SMMCommon%shlibext -user-heap -S < %s 2>/dev/null | FileCheck %s
+
+; Heap allocations of user code go through the heap manager, which never
+; releases memory.
+
+; CHECK-LABEL: define i32 @smm_main()
+; CHECK: %0 = call i8* @_allocate(i64 16)
+; CHECK-NEXT: %p = bitcast i8* %0 to i32*
+; CHECK-NOT: @malloc
+; CHECK-NOT: @free
+; CHECK: ret i32 %v
+
+; The wrapper of the main function is not user code.
+; CHECK-LABEL: define i32 @main()
+; CHECK: call i8* @malloc(i64 8)
+
+declare i8* @malloc(i64)
+declare void @free(i8*)
+declare i8* @_allocate(i64)
+
+define i32 @smm_main() {
+entry:
+  %m = call i8* @malloc(i64 16)
+  %p = bitcast i8* %m to i32*
+  store i32 7, i32* %p
+  %v = load i32, i32* %p
+  call void @free(i8* %m)
+  ret i32 %v
+}
+
+define i32 @main() {
+entry:
+  %m = call i8* @malloc(i64 8)
+  %r = call i32 @smm_main()
+  ret i32 %r
+}
@@ -0,0 +1,62 @@
+; REQUIRES: loadable_module
+; RUN: opt -load %llvmshlibdir/SMMCommon%shlibext -user-stack -S < %s 2>/dev/null | FileCheck %s
+; RUN: opt -load %llvmshlibdir/SMMCommon%shlibext -user-code -user-stack -S < %s 2>/dev/null | FileCheck %s
+
+; Library calls of user code run on the non-cacheable stack, and the main
+; function switches to the cacheable stack around the call to smm_main. User
+; code that user-code placed in .user_text is still user code.
+
+; CHECK: @_cacheable_sp = common global i8* null, align 8
+; CHECK: @_cacheable_stack_base = common global i8* null, align 8
+; CHECK: @_cacheable_stack_end = external global i8
+; CHECK: @_noncacheable_sp = common global i8* null, align 8
+; CHECK: @_noncacheable_stack_base = common global i8* null, align 8
+
+; CHECK-LABEL: define i32 @smm_main()
+; CHECK-NEXT: entry:
+; CHECK-NEXT: %old_sp = alloca i8*
+; CHECK-NEXT: %s = add i32 1, 2
+; CHECK-NEXT: call void asm sideeffect "mov %rsp, $0;", "=*m,~{dirflag},~{fpsr},~{flags}"(i8** %old_sp)
+; CHECK-NEXT: call void asm sideeffect "mov $0, %rsp;", "*m,~{rsp},~{dirflag},~{fpsr},~{flags}"(i8** @_noncacheable_sp)
+; CHECK-NEXT: %r = call i32 @puts(i8* getelementptr inbounds ([4 x i8], [4 x i8]* @.str, i32 0, i32 0))
+; CHECK-NEXT: call void asm sideeffect "mov $0, %rsp;", "*m,~{rsp},~{dirflag},~{fpsr},~{flags}"(i8** %old_sp)
+; CHECK-NEXT: %t = call i32 @foo(i32 %s)
+; CHECK-NEXT: ret i32 %t
+
+; User calls are left alone.
+; CHECK-LABEL: define i32 @foo(i32 %x)
+; CHECK-NOT: asm
+; CHECK: ret i32 %x
+
+; CHECK-LABEL: define i32 @main()
+; CHECK-NEXT: entry:
+; CHECK-NEXT: call void asm sideeffect "mov %rsp, $0;", "=*m,~{dirflag},~{fpsr},~{flags}"(i8** @_noncacheable_stack_base)
+; CHECK-NEXT: call void asm sideeffect "mov %rsp, $0;", "=*m,~{dirflag},~{fpsr},~{flags}"(i8** @_noncacheable_sp)
+; CHECK-NEXT: store i8* @_cacheable_stack_end, i8** @_cacheable_stack_base
+; CHECK-NEXT: call void asm sideeffect "mov $0, %rsp;", "*m,~{rsp},~{dirflag},~{fpsr},~{flags}"(i8** @_cacheable_stack_base)
+; CHECK-NEXT: %r = call i32 @smm_main()
+; CHECK-NEXT: call void asm sideeffect "mov $0, %rsp;", "*m,~{rsp},~{dirflag},~{fpsr},~{flags}"(i8** @_noncacheable_stack_base)
+; CHECK-NEXT: ret i32 %r
+
+@.str = private unnamed_addr constant [4 x i8] c"abc\00"
+
+declare i32 @puts(i8*)
+
+define i32 @smm_main() {
+entry:
+  %s = add i32 1, 2
+  %r = call i32 @puts(i8* getelementptr inbounds ([4 x i8], [4 x i8]* @.str, i32 0, i32 0))
+  %t = call i32 @foo(i32 %s)
+  ret i32 %t
+}
+
+define i32 @foo(i32 %x) {
+entry:
+  ret i32 %x
+}
+
+define i32 @main() {
+entry:
+  %r = call i32 @smm_main()
+  ret i32 %r
+}
@@ -0,0 +1,69 @@
+; REQUIRES: loadable_module
+; RUN: opt -load %llvmshlibdir/SMMCommon%shlibext -load %llvmshlibdir/SMMSSM%shlibext \
+; RUN:   -load %llvmshlibdir/LLVMSMMCMH%shlibext -load %llvmshlibdir/LLVMSMMCM%shlibext \
+; RUN:   -smm-prolog -smmssm -size-constraint=64 \
+; RUN:   -smmcmh-funcinfo -smmcmh-exec -smmcmh-overlay -spm-size=256 -smmcm %s -o %t.bc
+; RUN: lli -smm-emulate %t.bc 2>&1 | FileCheck %s
+
+; The program runs with the runtime of the emulator and returns 0 if it
+; computes the right sum. The copy of main into the SPM, which the program makes
+; itself, is accounted as the first code transfer and leaves the JIT code
+; intact. The other three are the loads of smm_main, sum and square by c_get.
+; The frame of square does not fit in the SPM stack next to the one of sum, so
+; the stack is saved before and restored after each of the 10 calls.
+
+; CHECK: SPM emulation memory traffic
+; CHECK: SPM      SPM bytes       memory   memory bytes
+; CHECK-NEXT: fetches
+; CHECK-NEXT: loads    {{ *}}33            132
+; CHECK-NEXT: stores   {{ *}}33            132
+; CHECK: transfers          bytes
+; CHECK-NEXT: code DMA  {{ *}}4            116
+; CHECK-NEXT: stack DMA {{ *}}20
+
+target triple = "x86_64-unknown-linux-gnu"
+
+@_region_table = external global i8*
+@_mem_stack_base = external global i8*
+@_spm_stack_base = external global i8*
+@_stack_pointer = external global i8*
+@_mem_stack_depth = external global i64
+@_mem_stack = external global [0 x { i8*, i8* }]
+
+declare i8* @c_get(i8*)
+declare void @c_init_reg(i32)
+declare void @c_init_map(i32, ...)
+
+define i32 @square(i32 %x) {
+entry:
+  %buf = alloca [16 x i32]
+  %p = getelementptr [16 x i32], [16 x i32]* %buf, i64 0, i64 0
+  store i32 %x, i32* %p
+  %v = load i32, i32* %p
+  %r = mul i32 %v, %v
+  ret i32 %r
+}
+
+define i32 @sum(i32 %n) {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]
+  %s = phi i32 [ 0, %entry ], [ %s.next, %loop ]
+  %q = call i32 @square(i32 %i)
+  %s.next = add i32 %s, %q
+  %i.next = add i32 %i, 1
+  %c = icmp slt i32 %i.next, %n
+  br i1 %c, label %loop, label %exit
+
+exit:
+  ret i32 %s.next
+}
+
+define i32 @main() {
+entry:
+  %r = call i32 @sum(i32 10)
+  %m = sub i32 %r, 285
+  ret i32 %m
+}
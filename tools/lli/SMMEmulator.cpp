@@ -0,0 +1,657 @@
+//===- SMMEmulator.cpp - Emulate the SPM of SPM-managed programs ----------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file lets lli run programs compiled by the SPM management passes on the
+// host and account their memory traffic. The SPM stack is emulated by an arena
+// in host memory, and the management runtime the passes call (_sstore, _sload,
+// _g2l, _l2g, c_get, ...) is provided by lli itself, so no target runtime has
+// to be linked in.
+//
+// The program is instrumented to report every basic block it executes and
+// every memory access it makes, which are classified as follows:
+//  - a load or store goes to the SPM if its address is in the arena, and to
+//    main memory otherwise;
+//  - a basic block is fetched from the SPM if its function is managed by the
+//    code management runtime (registered with c_init_map), and from main
+//    memory otherwise;
+//  - loading a function into its code region (c_get) and saving or restoring
+//    stack frames (_sstore, _sload) are DMA transfers.
+//
+// Code is not copied: managed functions run at their JIT address, and only the
+// occupant of each code region is tracked. The program copies main into its
+// region itself (a memcpy from __load_start_main), so that copy is replaced by
+// a call to the emulator, which accounts it like c_get. Stack frames, on the
+// other hand, really are copied between the arena and main memory. Programs
+// compiled with -code-cache manage their code space as a cache instead
+// (c_init_cache), in which only the offset of each loaded function is tracked.
+// All threads share one emulated SPM.
+//
+// The stack management calls _sload from inline assembly, with a PC-relative
+// call that cannot reach the emulator from JIT code, so the module gets a
+// _sload of its own that calls the emulator.
+//
+//===----------------------------------------------------------------------===//
+
+#include "SMMEmulator.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/DynamicLibrary.h"
+#include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cinttypes>
+#include <cstdarg>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <vector>
+
+using namespace llvm;
+
+namespace {
+
+  cl::opt<unsigned>
+  SPMStackSize("smm-emu-stack-size",
+               cl::desc("Size of the emulated SPM stack in bytes"),
+               cl::init(64 * 1024));
+
+  cl::opt<unsigned>
+  MaxSavedFrames("smm-emu-max-depth",
+                 cl::desc("Maximum number of times the SPM stack can be "
+                          "saved to main memory at once"),
+                 cl::init(256));
+
+  cl::opt<unsigned>
+  InstSize("smm-emu-inst-size",
+           cl::desc("Estimated size of an instruction in bytes"),
+           cl::init(4));
+
+  // Space below the SPM stack for the frames of unmanaged code, like library
+  // functions and the emulator itself, that runs on the SPM stack
+  const size_t GuardSize = 1 << 20;
+  // Size of the stack that the user stack management caches
+  const size_t CacheableStackSize = 1 << 20;
+  const unsigned MaxRegions = 4096;
+
+  struct Traffic {
+    uint64_t Accesses = 0;
+    uint64_t Bytes = 0;
+
+    void add(uint64_t N) {
+      ++Accesses;
+      Bytes += N;
+    }
+  };
+
+  struct {
+    Traffic FetchSPM, FetchMem;
+    Traffic LoadSPM, LoadMem;
+    Traffic StoreSPM, StoreMem;
+    Traffic CodeDMA, StackDMA;
+  } Stats;
+
+  // Layout of the elements of _mem_stack
+  struct SavedStack {
+    char *SPMAddr;
+    char *MemAddr;
+  };
+
+  struct ManagedFunction {
+    char *Addr;
+    uint64_t Size;
+    unsigned Region;
+    // State in the code cache
+    uint64_t Hint;
+    bool Cached;
+    uint64_t Offset;
+    uint64_t LoadTime, LastUse;
+  };
+
+  // Replacement policies of the code cache, as numbered by -code-cache-policy
+  enum CachePolicy { LRU, FIFO, CostAware };
+
+  // The SPM stack is [SPMBegin, SPMEnd)
+  std::unique_ptr<char[]> Arena;
+  char *SPMBegin, *SPMEnd;
+  // Main memory copies of the SPM stack, one for each depth
+  std::unique_ptr<char[]> MemStack;
+  std::unique_ptr<char[]> CacheableStack;
+  std::vector<std::unique_ptr<char[]>> LoadImages;
+
+  StringMap<ManagedFunction> ManagedFunctions;
+  DenseSet<const char *> ManagedCode;
+  // The function loaded in each code region
+  std::vector<const char *> Resident;
+
+  // The code cache, if the program uses one
+  bool CacheMode = false;
+  uint64_t CacheSize;
+  CachePolicy Policy;
+  uint64_t Clock;
+  // The functions in the cache by offset
+  std::map<uint64_t, ManagedFunction *> CacheBlocks;
+  // The caller of each active call, and the offset it returns to
+  std::vector<std::pair<ManagedFunction *, uint64_t>> ReturnStack;
+
+  // State of the runtime that the instrumented program accesses directly
+  char *MemStackBase, *SPMStackBase, *StackPointer;
+  uint64_t MemStackDepth;
+  std::unique_ptr<SavedStack[]> MemStackTable;
+  char RegionTable[MaxRegions];
+  char *RegionTablePtr = RegionTable;
+
+  bool inSPM(const char *Addr) { return Addr >= SPMBegin && Addr < SPMEnd; }
+
+  // Address of the main memory copy of the SPM address \p Addr at \p Depth
+  char *getMemAddr(uint64_t Depth, const char *Addr) {
+    return MemStack.get() + Depth * SPMStackSize + (Addr - SPMBegin);
+  }
+
+  // Hooks called by the instrumentation
+
+  void emuFetch(char *Func, uint64_t Bytes) {
+    (ManagedCode.count(Func) ? Stats.FetchSPM : Stats.FetchMem).add(Bytes);
+  }
+
+  void emuLoad(char *Addr, uint64_t Bytes) {
+    (inSPM(Addr) ? Stats.LoadSPM : Stats.LoadMem).add(Bytes);
+  }
+
+  void emuStore(char *Addr, uint64_t Bytes) {
+    (inSPM(Addr) ? Stats.StoreSPM : Stats.StoreMem).add(Bytes);
+  }
+
+  void emuCopyCode(char *Addr, uint64_t Bytes);
+
+  // Stack management runtime
+
+  void sstore() {
+    char *SP = StackPointer;
+    if (SP < SPMBegin || SP > SPMEnd)
+      report_fatal_error("SPM stack overflow, increase -smm-emu-stack-size");
+    if (MemStackDepth >= MaxSavedFrames)
+      report_fatal_error("SPM stack saved too many times, increase "
+                         "-smm-emu-max-depth");
+    char *Mem = getMemAddr(MemStackDepth, SP);
+    std::memcpy(Mem, SP, SPMEnd - SP);
+    MemStackTable[MemStackDepth++] = {SP, Mem};
+    Stats.StackDMA.add(SPMEnd - SP);
+  }
+
+  // Called with the stack pointer at the restored SPM address, so the frame of
+  // sload itself lies below the frames it restores
+  void sload() {
+    if (MemStackDepth == 0)
+      report_fatal_error("SPM stack restored more times than saved");
+    const SavedStack &Saved = MemStackTable[--MemStackDepth];
+    std::memcpy(Saved.SPMAddr, Saved.MemAddr, SPMEnd - Saved.SPMAddr);
+    Stats.StackDMA.add(SPMEnd - Saved.SPMAddr);
+  }
+
+  // Pointers to the SPM stack that are passed to callees point to the copy
+  // that the next sstore makes
+  char *l2g(char *Addr) {
+    return inSPM(Addr) ? getMemAddr(MemStackDepth, Addr) : Addr;
+  }
+
+  // Pointers to copies that have not been made yet still point to the SPM
+  char *g2l(char *Addr, uint64_t) {
+    char *Begin = MemStack.get();
+    char *End = Begin + uint64_t(MaxSavedFrames) * SPMStackSize;
+    if (Addr < Begin || Addr >= End)
+      return Addr;
+    uint64_t Offset = Addr - Begin;
+    if (Offset / SPMStackSize < MemStackDepth)
+      return Addr;
+    return SPMBegin + Offset % SPMStackSize;
+  }
+
+  // Code management runtime
+
+  void cInitReg(int NumRegions) {
+    if (NumRegions < 0 || unsigned(NumRegions) > MaxRegions)
+      report_fatal_error("too many code regions to emulate");
+    Resident.assign(NumRegions, nullptr);
+  }
+
+  void cInitMap(int NumMappings, ...) {
+    va_list AP;
+    va_start(AP, NumMappings);
+    for (int I = 0; I < NumMappings; ++I) {
+      char *Name = va_arg(AP, char *);
+      (void)va_arg(AP, char *); // Load address
+      char *Addr = va_arg(AP, char *);
+      uint64_t Size = va_arg(AP, uint64_t);
+      char *Region = va_arg(AP, char *);
+      ManagedFunctions[Name] = {Addr, Size, unsigned(Region - RegionTable), 0,
+                                false, 0, 0, 0};
+      ManagedCode.insert(Addr);
+    }
+    va_end(AP);
+  }
+
+  ManagedFunction &getManagedFunction(const char *Name, const char *Caller) {
+    auto I = ManagedFunctions.find(Name);
+    if (I == ManagedFunctions.end())
+      report_fatal_error(Twine(Caller) + " of unmanaged function " + Name);
+    return I->second;
+  }
+
+  // Code cache runtime
+
+  void cInitCache(uint64_t Size, int ReplacementPolicy) {
+    if (ReplacementPolicy < LRU || ReplacementPolicy > CostAware)
+      report_fatal_error("unknown code cache replacement policy");
+    CacheMode = true;
+    CacheSize = Size;
+    Policy = CachePolicy(ReplacementPolicy);
+  }
+
+  void evict(ManagedFunction &F) {
+    CacheBlocks.erase(F.Offset);
+    F.Cached = false;
+  }
+
+  void place(ManagedFunction &F, uint64_t Offset) {
+    F.Cached = true;
+    F.Offset = Offset;
+    F.LoadTime = F.LastUse = ++Clock;
+    CacheBlocks[Offset] = &F;
+  }
+
+  // First hole in the cache that fits \p Size bytes, or CacheSize if none does
+  uint64_t findHole(uint64_t Size) {
+    uint64_t Begin = 0;
+    for (auto &Block : CacheBlocks) {
+      if (Block.first - Begin >= Size)
+        return Begin;
+      Begin = Block.first + Block.second->Size;
+    }
+    return CacheSize - Begin >= Size ? Begin : CacheSize;
+  }
+
+  ManagedFunction &chooseVictim() {
+    ManagedFunction *Victim = nullptr;
+    for (auto &Block : CacheBlocks) {
+      ManagedFunction *F = Block.second;
+      if (!Victim) {
+        Victim = F;
+        continue;
+      }
+      switch (Policy) {
+      case LRU:
+        if (F->LastUse < Victim->LastUse)
+          Victim = F;
+        break;
+      case FIFO:
+        if (F->LoadTime < Victim->LoadTime)
+          Victim = F;
+        break;
+      case CostAware:
+        if (F->Hint < Victim->Hint ||
+            (F->Hint == Victim->Hint && F->LastUse < Victim->LastUse))
+          Victim = F;
+        break;
+      }
+    }
+    return *Victim;
+  }
+
+  // Load \p F anywhere in the cache
+  void cacheLoad(ManagedFunction &F) {
+    if (F.Cached) {
+      F.LastUse = ++Clock;
+      return;
+    }
+    if (F.Size > CacheSize)
+      report_fatal_error("function larger than the code cache");
+    uint64_t Offset;
+    while ((Offset = findHole(F.Size)) == CacheSize)
+      evict(chooseVictim());
+    place(F, Offset);
+    Stats.CodeDMA.add(F.Size);
+  }
+
+  // Load \p F at \p Offset, where the return addresses into it point
+  void cacheLoadAt(ManagedFunction &F, uint64_t Offset) {
+    if (F.Cached && F.Offset == Offset) {
+      F.LastUse = ++Clock;
+      return;
+    }
+    if (F.Cached)
+      evict(F);
+    // Evict the functions that overlap the range
+    auto I = CacheBlocks.lower_bound(Offset + F.Size);
+    while (I != CacheBlocks.begin()) {
+      --I;
+      if (I->first + I->second->Size <= Offset)
+        break;
+      I->second->Cached = false;
+      I = CacheBlocks.erase(I);
+    }
+    place(F, Offset);
+    Stats.CodeDMA.add(F.Size);
+  }
+
+  void cInitCacheMap(int NumMappings, ...) {
+    va_list AP;
+    va_start(AP, NumMappings);
+    for (int I = 0; I < NumMappings; ++I) {
+      char *Name = va_arg(AP, char *);
+      (void)va_arg(AP, char *); // Load address
+      char *Addr = va_arg(AP, char *);
+      uint64_t Size = va_arg(AP, uint64_t);
+      uint64_t Hint = va_arg(AP, uint64_t);
+      ManagedFunctions[Name] = {Addr, Size, 0, Hint, false, 0, 0, 0};
+      ManagedCode.insert(Addr);
+    }
+    va_end(AP);
+  }
+
+  // The program copies the main function into the SPM itself, at the start of
+  // the cache or into its region
+  void emuCopyCode(char *Addr, uint64_t Bytes) {
+    for (auto &Entry : ManagedFunctions) {
+      ManagedFunction &F = Entry.second;
+      if (F.Addr != Addr)
+        continue;
+      if (CacheMode) {
+        if (F.Size > CacheSize)
+          report_fatal_error("function larger than the code cache");
+        if (!F.Cached)
+          place(F, 0);
+      } else {
+        if (F.Region >= Resident.size())
+          report_fatal_error("code copied before c_init_reg");
+        Resident[F.Region] = F.Addr;
+      }
+      break;
+    }
+    Stats.CodeDMA.add(Bytes);
+  }
+
+  char *cGetCall(char *CallerName, char *CalleeName) {
+    ManagedFunction &Caller = getManagedFunction(CallerName, "c_get_call");
+    ManagedFunction &Callee = getManagedFunction(CalleeName, "c_get_call");
+    if (!CacheMode)
+      report_fatal_error("c_get_call before c_init_cache");
+    ReturnStack.push_back({&Caller, Caller.Offset});
+    cacheLoad(Callee);
+    return Callee.Addr;
+  }
+
+  void cReturn(char *CallerName) {
+    ManagedFunction &Caller = getManagedFunction(CallerName, "c_return");
+    if (ReturnStack.empty() || ReturnStack.back().first != &Caller)
+      report_fatal_error(Twine("c_return to ") + CallerName +
+                         " does not match its c_get_call");
+    uint64_t Offset = ReturnStack.back().second;
+    ReturnStack.pop_back();
+    cacheLoadAt(Caller, Offset);
+  }
+
+  char *cGet(char *Name) {
+    ManagedFunction &F = getManagedFunction(Name, "c_get");
+    if (CacheMode) {
+      cacheLoad(F);
+      return F.Addr;
+    }
+    if (F.Region >= Resident.size())
+      report_fatal_error(Twine("c_get of ") + Name + " before c_init_reg");
+    if (Resident[F.Region] != F.Addr) {
+      Resident[F.Region] = F.Addr;
+      Stats.CodeDMA.add(F.Size);
+    }
+    return F.Addr;
+  }
+
+  // Heap and thread management runtime
+
+  void *allocate(size_t Size) { return std::malloc(Size); }
+
+  void threadInit() {}
+
+  const char *const RuntimeFunctions[] = {
+    "_sstore", "_sload", "_g2l", "_l2g", "c_get", "c_init_reg", "c_init_map",
+    "c_init_cache", "c_init_cache_map", "c_get_call", "c_return", "_allocate",
+    "_smm_thread_init"
+  };
+
+  const char *const RuntimeVariables[] = {
+    "_mem_stack_base", "_spm_stack_base", "_stack_pointer", "_mem_stack_depth",
+    "_mem_stack", "_region_table", "_spm_stack_end", "_spm_begin",
+    "_cacheable_stack_end"
+  };
+
+  void addSymbol(StringRef Name, void *Addr) {
+    sys::DynamicLibrary::AddSymbol(Name, Addr);
+  }
+
+  void createRuntime() {
+    Arena.reset(new char[GuardSize + SPMStackSize + 16]);
+    SPMBegin = Arena.get() + GuardSize;
+    SPMBegin += -reinterpret_cast<uintptr_t>(SPMBegin) & 15;
+    SPMEnd = SPMBegin + SPMStackSize;
+    MemStack.reset(new char[uint64_t(MaxSavedFrames) * SPMStackSize]);
+    MemStackTable.reset(new SavedStack[MaxSavedFrames]);
+    CacheableStack.reset(new char[CacheableStackSize]);
+    SPMStackBase = SPMEnd;
+
+    addSymbol("_sstore", reinterpret_cast<void *>(&sstore));
+    addSymbol("_smm_emu_sload", reinterpret_cast<void *>(&sload));
+    addSymbol("_g2l", reinterpret_cast<void *>(&g2l));
+    addSymbol("_l2g", reinterpret_cast<void *>(&l2g));
+    addSymbol("c_get", reinterpret_cast<void *>(&cGet));
+    addSymbol("c_init_reg", reinterpret_cast<void *>(&cInitReg));
+    addSymbol("c_init_map", reinterpret_cast<void *>(&cInitMap));
+    addSymbol("c_init_cache", reinterpret_cast<void *>(&cInitCache));
+    addSymbol("c_init_cache_map", reinterpret_cast<void *>(&cInitCacheMap));
+    addSymbol("c_get_call", reinterpret_cast<void *>(&cGetCall));
+    addSymbol("c_return", reinterpret_cast<void *>(&cReturn));
+    addSymbol("_allocate", reinterpret_cast<void *>(&allocate));
+    addSymbol("_smm_thread_init", reinterpret_cast<void *>(&threadInit));
+
+    addSymbol("_mem_stack_base", &MemStackBase);
+    addSymbol("_spm_stack_base", &SPMStackBase);
+    addSymbol("_stack_pointer", &StackPointer);
+    addSymbol("_mem_stack_depth", &MemStackDepth);
+    addSymbol("_mem_stack", MemStackTable.get());
+    addSymbol("_region_table", &RegionTablePtr);
+    addSymbol("_spm_stack_end", SPMEnd);
+    addSymbol("_spm_begin", SPMBegin);
+    addSymbol("_cacheable_stack_end",
+              CacheableStack.get() + CacheableStackSize);
+
+    addSymbol("_smm_emu_fetch", reinterpret_cast<void *>(&emuFetch));
+    addSymbol("_smm_emu_load", reinterpret_cast<void *>(&emuLoad));
+    addSymbol("_smm_emu_store", reinterpret_cast<void *>(&emuStore));
+    addSymbol("_smm_emu_copy_code", reinterpret_cast<void *>(&emuCopyCode));
+  }
+
+  // Give each function loaded by the code management runtime a load image of
+  // its estimated size
+  void createLoadImages(Module &M, const StringMap<uint64_t> &CodeSizes) {
+    for (GlobalVariable &GV : M.globals()) {
+      if (!GV.isDeclaration() || !GV.getName().startswith("__load_start_"))
+        continue;
+      StringRef Name = GV.getName().substr(strlen("__load_start_"));
+      // The main function is loaded as smm_main
+      auto I = CodeSizes.find(Name == "main" ? "smm_main" : Name);
+      uint64_t Size = I == CodeSizes.end() ? 0 : I->second;
+      LoadImages.emplace_back(new char[Size + 1]);
+      addSymbol(GV.getName(), LoadImages.back().get());
+      addSymbol(("__load_stop_" + Name).str(), LoadImages.back().get() + Size);
+    }
+  }
+
+  void printTraffic(raw_ostream &OS, const char *Name, const Traffic &SPM,
+                    const Traffic &Mem) {
+    OS << format("  %-12s %12" PRIu64 " %14" PRIu64 " %12" PRIu64
+                 " %14" PRIu64 "\n",
+                 Name, SPM.Accesses, SPM.Bytes, Mem.Accesses, Mem.Bytes);
+  }
+
+  void printTransfers(raw_ostream &OS, const char *Name, const Traffic &DMA) {
+    OS << format("  %-12s %12" PRIu64 " %14" PRIu64 "\n", Name, DMA.Accesses,
+                 DMA.Bytes);
+  }
+
+} // end anonymous namespace
+
+void llvm::instrumentForSMMEmulation(Module &M) {
+  LLVMContext &Context = M.getContext();
+  const DataLayout &DL = M.getDataLayout();
+  Type *Int8PtrTy = Type::getInt8PtrTy(Context);
+  Type *Int64Ty = Type::getInt64Ty(Context);
+
+  createRuntime();
+
+  // The runtime is provided by the emulator, even if the program brings its
+  // own
+  for (const char *Name : RuntimeFunctions)
+    if (Function *F = M.getFunction(Name))
+      if (!F->isDeclaration()) {
+        F->deleteBody();
+        F->setLinkage(GlobalValue::ExternalLinkage);
+      }
+  for (const char *Name : RuntimeVariables)
+    if (GlobalVariable *GV = M.getGlobalVariable(Name)) {
+      if (GV->hasInitializer()) {
+        GV->setInitializer(nullptr);
+        GV->setLinkage(GlobalValue::ExternalLinkage);
+      }
+      GV->setThreadLocal(false);
+    }
+
+  // Estimate the code size before the instrumentation adds to it
+  StringMap<uint64_t> CodeSizes;
+  for (Function &F : M) {
+    uint64_t Size = 0;
+    for (BasicBlock &BB : F)
+      Size += BB.size() * InstSize;
+    CodeSizes[F.getName()] = Size;
+  }
+  createLoadImages(M, CodeSizes);
+
+  // Account the copy of code into the SPM instead of overwriting JIT code
+  Constant *CopyCodeFn =
+      M.getOrInsertFunction("_smm_emu_copy_code", Type::getVoidTy(Context),
+                            Int8PtrTy, Int64Ty, nullptr);
+  std::vector<MemTransferInst *> CodeCopies;
+  for (Function &F : M)
+    for (Instruction &I : instructions(F))
+      if (auto *MT = dyn_cast<MemTransferInst>(&I))
+        if (MT->getSource()->getName().startswith("__load_start_"))
+          CodeCopies.push_back(MT);
+  for (MemTransferInst *MT : CodeCopies) {
+    IRBuilder<> Builder(MT);
+    Builder.CreateCall(CopyCodeFn,
+                       {MT->getRawDest(),
+                        Builder.CreateZExtOrTrunc(MT->getLength(), Int64Ty)});
+    MT->eraseFromParent();
+  }
+
+  Constant *FetchFn = M.getOrInsertFunction(
+      "_smm_emu_fetch", Type::getVoidTy(Context), Int8PtrTy, Int64Ty, nullptr);
+  Constant *LoadFn = M.getOrInsertFunction(
+      "_smm_emu_load", Type::getVoidTy(Context), Int8PtrTy, Int64Ty, nullptr);
+  Constant *StoreFn = M.getOrInsertFunction(
+      "_smm_emu_store", Type::getVoidTy(Context), Int8PtrTy, Int64Ty, nullptr);
+
+  IRBuilder<> Builder(Context);
+  auto InsertAccess = [&](Instruction *I, Constant *Fn, Value *Addr,
+                          Value *Size) {
+    // Accesses outside the default address space never go to the SPM
+    if (Addr->getType()->getPointerAddressSpace() != 0)
+      return;
+    Builder.SetInsertPoint(I);
+    Builder.CreateCall(Fn, {Builder.CreatePointerCast(Addr, Int8PtrTy),
+                            Builder.CreateZExtOrTrunc(Size, Int64Ty)});
+  };
+
+  for (Function &F : M) {
+    if (F.isDeclaration())
+      continue;
+    // The management code switches the stack pointer in the middle of
+    // functions, so locals have to be addressed through the frame pointer
+    F.addFnAttr("no-frame-pointer-elim", "true");
+
+    std::vector<Instruction *> Accesses;
+    for (BasicBlock &BB : F)
+      for (Instruction &I : BB)
+        if (isa<LoadInst>(I) || isa<StoreInst>(I) || isa<AtomicRMWInst>(I) ||
+            isa<AtomicCmpXchgInst>(I) || isa<MemIntrinsic>(I))
+          Accesses.push_back(&I);
+
+    for (BasicBlock &BB : F) {
+      if (isa<CatchSwitchInst>(BB.getFirstNonPHI()))
+        continue;
+      Builder.SetInsertPoint(&*BB.getFirstInsertionPt());
+      Builder.CreateCall(FetchFn, {Builder.CreatePointerCast(&F, Int8PtrTy),
+                                   Builder.getInt64(BB.size() * InstSize)});
+    }
+
+    for (Instruction *I : Accesses) {
+      if (auto *LI = dyn_cast<LoadInst>(I)) {
+        InsertAccess(I, LoadFn, LI->getPointerOperand(),
+                     Builder.getInt64(DL.getTypeStoreSize(LI->getType())));
+      } else if (auto *SI = dyn_cast<StoreInst>(I)) {
+        Type *Ty = SI->getValueOperand()->getType();
+        InsertAccess(I, StoreFn, SI->getPointerOperand(),
+                     Builder.getInt64(DL.getTypeStoreSize(Ty)));
+      } else if (auto *RMW = dyn_cast<AtomicRMWInst>(I)) {
+        Value *Size = Builder.getInt64(DL.getTypeStoreSize(RMW->getType()));
+        InsertAccess(I, LoadFn, RMW->getPointerOperand(), Size);
+        InsertAccess(I, StoreFn, RMW->getPointerOperand(), Size);
+      } else if (auto *CX = dyn_cast<AtomicCmpXchgInst>(I)) {
+        Type *Ty = CX->getNewValOperand()->getType();
+        Value *Size = Builder.getInt64(DL.getTypeStoreSize(Ty));
+        InsertAccess(I, LoadFn, CX->getPointerOperand(), Size);
+        InsertAccess(I, StoreFn, CX->getPointerOperand(), Size);
+      } else if (auto *MT = dyn_cast<MemTransferInst>(I)) {
+        InsertAccess(I, LoadFn, MT->getRawSource(), MT->getLength());
+        InsertAccess(I, StoreFn, MT->getRawDest(), MT->getLength());
+      } else if (auto *MS = dyn_cast<MemSetInst>(I)) {
+        InsertAccess(I, StoreFn, MS->getRawDest(), MS->getLength());
+      }
+    }
+  }
+
+  // Forward _sload to the emulator from a function in JIT code, which the
+  // calls from inline assembly can reach
+  if (Function *SLoad = M.getFunction("_sload")) {
+    Constant *EmuSLoad = M.getOrInsertFunction(
+        "_smm_emu_sload", Type::getVoidTy(Context), nullptr);
+    SLoad->setLinkage(GlobalValue::InternalLinkage);
+    Builder.SetInsertPoint(BasicBlock::Create(Context, "entry", SLoad));
+    Builder.CreateCall(EmuSLoad);
+    Builder.CreateRetVoid();
+  }
+}
+
+void llvm::printSMMEmulationReport(raw_ostream &OS) {
+  OS << "===" << std::string(73, '-') << "===\n"
+     << "                       SPM emulation memory traffic\n"
+     << "===" << std::string(73, '-') << "===\n";
+  OS << "                        SPM      SPM bytes"
+     << "       memory   memory bytes\n";
+  printTraffic(OS, "fetches", Stats.FetchSPM, Stats.FetchMem);
+  printTraffic(OS, "loads", Stats.LoadSPM, Stats.LoadMem);
+  printTraffic(OS, "stores", Stats.StoreSPM, Stats.StoreMem);
+  OS << "                  transfers          bytes\n";
+  printTransfers(OS, "code DMA", Stats.CodeDMA);
+  printTransfers(OS, "stack DMA", Stats.StackDMA);
+}
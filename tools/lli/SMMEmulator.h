@@ -0,0 +1,33 @@
+//===- SMMEmulator.h - Emulate the SPM of SPM-managed programs --*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Emulation of the scratchpad memory (SPM) of programs compiled by the SPM
+// management passes, with accounting of their memory traffic.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_TOOLS_LLI_SMMEMULATOR_H
+#define LLVM_TOOLS_LLI_SMMEMULATOR_H
+
+namespace llvm {
+
+class Module;
+class raw_ostream;
+
+/// Instrument \p M to report its instruction fetches and data accesses to the
+/// SPM emulator, and bind the SPM management runtime it calls to the emulator.
+/// This has to be done before the module is handed to a JIT.
+void instrumentForSMMEmulation(Module &M);
+
+/// Print the memory traffic of the program executed so far.
+void printSMMEmulationReport(raw_ostream &OS);
+
+} // end namespace llvm
+
+#endif
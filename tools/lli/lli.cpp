@@ -15,6 +15,7 @@
 
 #include "OrcLazyJIT.h"
 #include "RemoteJITUtils.h"
+#include "SMMEmulator.h"
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/ADT/StringExtras.h"
 #include "llvm/ADT/Triple.h"
@@ -120,6 +121,12 @@ namespace {
            cl::ZeroOrMore,
            cl::init(' '));
 
+  cl::opt<bool>
+  SMMEmulate("smm-emulate",
+             cl::desc("Emulate the SPM of a program compiled by the SPM "
+                      "management passes and report its memory traffic"),
+             cl::init(false));
+
   cl::opt<std::string>
   TargetTriple("mtriple", cl::desc("Override target triple for module"));
 
@@ -366,6 +373,13 @@ static void reportError(SMDiagnostic Err, const char *ProgName) {
 //===----------------------------------------------------------------------===//
 // main Driver function
 //
+// Runs at exit, when errs() may already be destroyed if it was first used
+// after the handler was registered
+static void printSMMReport() {
+  raw_fd_ostream OS(2, /*shouldClose=*/false);
+  printSMMEmulationReport(OS);
+}
+
 int main(int argc, char **argv, char * const *envp) {
   sys::PrintStackTraceOnErrorSignal(argv[0]);
   PrettyStackTraceProgram X(argc, argv);
@@ -397,6 +411,15 @@ int main(int argc, char **argv, char * const *envp) {
   if (!Mod)
     reportError(Err, argv[0]);
 
+  if (SMMEmulate) {
+    if (ForceInterpreter || RemoteMCJIT) {
+      errs() << argv[0] << ": -smm-emulate requires an in-process JIT\n";
+      exit(1);
+    }
+    instrumentForSMMEmulation(*Mod);
+    atexit(printSMMReport);
+  }
+
   if (UseJITKind == JITKind::OrcLazy) {
     std::vector<std::unique_ptr<Module>> Ms;
     Ms.push_back(std::move(Owner));
@@ -17,6 +17,9 @@
 
 #include "gtest/gtest.h"
 
+#include <chrono>
+#include <thread>
+
 using namespace llvm;
 
 // Fixture for the unittests, allowing to *temporarily* disable the unittests
@@ -164,3 +167,97 @@ TEST_F(ThreadPoolTest, PoolDestruction) {
   }
   ASSERT_EQ(5, checked_in);
 }
+
+TEST_F(ThreadPoolTest, TaskGroupWait) {
+  CHECK_UNSUPPORTED();
+  // Test that a group can be waited on while other tasks of the pool are
+  // still blocked.
+  ThreadPool Pool{2};
+  std::atomic_int i{0};
+  std::atomic_bool Started{false};
+  Pool.async([this, &i, &Started] {
+    Started = true;
+    waitForMainThread();
+    ++i;
+  });
+  // The group waits by running queued tasks, so the blocked task must have
+  // been started by a thread of the pool.
+  while (!Started)
+    std::this_thread::yield();
+  {
+    TaskGroup Group(Pool);
+    for (size_t j = 0; j < 5; ++j)
+      Group.async([&i] { i += 2; });
+    Group.wait();
+    ASSERT_EQ(10, i.load());
+  }
+  setMainThreadReady();
+  Pool.wait();
+  ASSERT_EQ(11, i.load());
+}
+
+TEST_F(ThreadPoolTest, TaskGroupWaitWakesUp) {
+  CHECK_UNSUPPORTED();
+  // Test that a group waiting for a task of its own wakes up to run a task
+  // that this one queues and then depends on, as the only thread is busy.
+  ThreadPool Pool{1};
+  std::atomic_bool Started{false};
+  std::atomic_bool Ran{false};
+  {
+    TaskGroup Group(Pool);
+    Group.async([&Pool, &Started, &Ran] {
+      Started = true;
+      // Give the main thread time to go to sleep in Group.wait()
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      Pool.async([&Ran] { Ran = true; });
+      while (!Ran)
+        std::this_thread::yield();
+    });
+    while (!Started)
+      std::this_thread::yield();
+    Group.wait();
+  }
+  ASSERT_TRUE(Ran.load());
+  Pool.wait();
+}
+
+static void NestedSum(ThreadPool &Pool, int Depth, std::atomic_int &Sum) {
+  if (!Depth) {
+    ++Sum;
+    return;
+  }
+  TaskGroup Group(Pool);
+  for (size_t i = 0; i < 4; ++i)
+    Group.async(NestedSum, std::ref(Pool), Depth - 1, std::ref(Sum));
+  Group.wait();
+}
+
+TEST_F(ThreadPoolTest, TaskGroupNested) {
+  CHECK_UNSUPPORTED();
+  // Test that tasks can spawn subtasks and wait on them, even with fewer
+  // threads than nesting levels.
+  ThreadPool Pool{2};
+  std::atomic_int Sum{0};
+  {
+    TaskGroup Group(Pool);
+    Group.async(NestedSum, std::ref(Pool), 4, std::ref(Sum));
+  }
+  ASSERT_EQ(256, Sum.load());
+  Pool.wait();
+}
+
+TEST_F(ThreadPoolTest, WaitStress) {
+  CHECK_UNSUPPORTED();
+  // Test that wait() does not return while a task is still running, even
+  // when the task is being popped as wait() checks whether the pool is idle.
+  ThreadPool Pool{4};
+  std::atomic_int Done{0};
+  for (int Iter = 1; Iter <= 10000; ++Iter) {
+    Pool.async([&Done] {
+      std::this_thread::yield();
+      ++Done;
+    });
+    Pool.wait();
+    ASSERT_EQ(Iter, Done.load());
+  }
+}
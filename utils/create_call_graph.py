@@ -0,0 +1,171 @@
+#!/usr/bin/env python
+"""A call graph creation program.
+
+This is a python program that creates a program whose call graph is a layered
+DAG of the requested shape, optionally with back edges that form recursive
+SCCs. Each function calls functions of the next layer, some of the calls from
+within nested loops. Call graphs like these are the worst case for analyses
+that enumerate call paths (the SPM mapping passes, for one), whose number grows
+exponentially with the depth.
+
+The program is printed to stdout as C source, or as LLVM IR with --emit-llvm so
+it can be fed to opt directly. One good use of this program is to test whether
+an analysis scales with the number of functions the way it is supposed to.
+"""
+
+from __future__ import print_function
+
+import argparse
+import random
+
+TRIP_COUNT = 4
+
+class CallGraph(object):
+  def __init__(self, args):
+    rng = random.Random(args.seed)
+    n = max(args.functions, 1)
+    depth = max(min(args.depth, n), 1)
+    # f0 is the root, the other functions are spread evenly over the layers
+    self.layers = [[0]]
+    rest = list(range(1, n))
+    per_layer = len(rest) // (depth - 1) if depth > 1 else 0
+    for l in range(1, depth):
+      size = per_layer + (1 if l - 1 < len(rest) % (depth - 1) else 0)
+      self.layers.append(rest[:size])
+      rest = rest[size:]
+    self.layers = [layer for layer in self.layers if layer]
+    self.level = {}
+    for l, layer in enumerate(self.layers):
+      for f in layer:
+        self.level[f] = l
+
+    # calls[f] is a list of (callee, loop depth)
+    self.calls = dict((f, []) for f in range(n))
+    def loop_depth():
+      d = 0
+      while d < args.loop_depth and rng.random() < args.loop_probability:
+        d += 1
+      return d
+    for l in range(len(self.layers) - 1):
+      callers, callees = self.layers[l], self.layers[l + 1]
+      # Every function of the next layer has at least one caller
+      for i, callee in enumerate(callees):
+        self.calls[callers[i % len(callers)]].append((callee, loop_depth()))
+      for caller in callers:
+        while len(self.calls[caller]) < args.fanout:
+          self.calls[caller].append((rng.choice(callees), loop_depth()))
+    # Back edges to the same or an upper layer form recursive SCCs
+    for f in range(n):
+      if rng.random() < args.recursion:
+        upper = self.layers[rng.randint(0, self.level[f])]
+        self.calls[f].append((rng.choice(upper), loop_depth()))
+
+def emit_c(cg):
+  for f in sorted(cg.calls):
+    print('int f%d(int n);' % f)
+  print()
+  for f in sorted(cg.calls):
+    print('int f%d(int n) {' % f)
+    print('  int s = n;')
+    print('  if (n <= 0)')
+    print('    return 0;')
+    for k, (callee, depth) in enumerate(cg.calls[f]):
+      indent = '  '
+      for d in range(depth):
+        print('%sfor (int i%d_%d = 0; i%d_%d < %d; i%d_%d++)' %
+              (indent, k, d, k, d, TRIP_COUNT, k, d))
+        indent += '  '
+      print('%ss += f%d(n - 1);' % (indent, callee))
+    print('  return s;')
+    print('}')
+    print()
+  print('int main(void) {')
+  print('  return f0(%d) == 0;' % (len(cg.layers) + 1))
+  print('}')
+
+def emit_ir(cg):
+  for f in sorted(cg.calls):
+    print('define i32 @f%d(i32 %%n) {' % f)
+    print('entry:')
+    print('  %s = alloca i32')
+    for k, (callee, depth) in enumerate(cg.calls[f]):
+      for d in range(depth):
+        print('  %%i%d.%d = alloca i32' % (k, d))
+    print('  store i32 %n, i32* %s')
+    print('  %m = sub i32 %n, 1')
+    print('  %done = icmp sle i32 %n, 0')
+    print('  br i1 %done, label %exit, label %call0')
+    for k, (callee, depth) in enumerate(cg.calls[f]):
+      print()
+      print('call%d:' % k)
+      for d in range(depth):
+        print('  store i32 0, i32* %%i%d.%d' % (k, d))
+        print('  br label %%loop%d.%d' % (k, d))
+        print()
+        print('loop%d.%d:' % (k, d))
+        print('  %%iv%d.%d = load i32, i32* %%i%d.%d' % (k, d, k, d))
+        print('  %%cmp%d.%d = icmp slt i32 %%iv%d.%d, %d' % (k, d, k, d, TRIP_COUNT))
+        # Leaving a loop continues the enclosing loop or the next call
+        loop_exit = 'latch%d.%d' % (k, d - 1) if d > 0 else 'call%d' % (k + 1)
+        print('  br i1 %%cmp%d.%d, label %%body%d.%d, label %%%s' %
+              (k, d, k, d, loop_exit))
+        print()
+        print('body%d.%d:' % (k, d))
+      print('  %%r%d = call i32 @f%d(i32 %%m)' % (k, callee))
+      print('  %%s%d = load i32, i32* %%s' % k)
+      print('  %%t%d = add i32 %%s%d, %%r%d' % (k, k, k))
+      print('  store i32 %%t%d, i32* %%s' % k)
+      if depth == 0:
+        print('  br label %%call%d' % (k + 1))
+      else:
+        print('  br label %%latch%d.%d' % (k, depth - 1))
+      # Latches from the innermost loop outwards
+      for d in reversed(range(depth)):
+        print()
+        print('latch%d.%d:' % (k, d))
+        print('  %%iv%d.%d.next = add i32 %%iv%d.%d, 1' % (k, d, k, d))
+        print('  store i32 %%iv%d.%d.next, i32* %%i%d.%d' % (k, d, k, d))
+        print('  br label %%loop%d.%d' % (k, d))
+    print()
+    print('call%d:' % len(cg.calls[f]))
+    print('  br label %exit')
+    print()
+    print('exit:')
+    print('  %ret = load i32, i32* %s')
+    print('  ret i32 %ret')
+    print('}')
+    print()
+  print('define i32 @main() {')
+  print('entry:')
+  print('  %%r = call i32 @f0(i32 %d)' % (len(cg.layers) + 1))
+  print('  ret i32 %r')
+  print('}')
+
+def main():
+  parser = argparse.ArgumentParser(description=__doc__,
+      formatter_class=argparse.RawDescriptionHelpFormatter)
+  parser.add_argument('functions', type=int,
+                      help='Number of functions, not counting main')
+  parser.add_argument('--depth', type=int, default=8,
+                      help='Number of layers of the call graph')
+  parser.add_argument('--fanout', type=int, default=2,
+                      help='Number of calls from each function to the next layer')
+  parser.add_argument('--loop-depth', type=int, default=2,
+                      help='Maximum number of loops around a call')
+  parser.add_argument('--loop-probability', type=float, default=0.3,
+                      help='Probability of each further loop around a call')
+  parser.add_argument('--recursion', type=float, default=0,
+                      help='Probability of a function to call back to its own or an upper layer')
+  parser.add_argument('--seed', type=int, default=0,
+                      help='Seed of the random number generator')
+  parser.add_argument('--emit-llvm', action='store_true',
+                      help='Print LLVM IR instead of C')
+  args = parser.parse_args()
+  cg = CallGraph(args)
+  if args.emit_llvm:
+    emit_ir(cg)
+  else:
+    emit_c(cg)
+
+if __name__ == '__main__':
+  main()
@@ -0,0 +1,61 @@
+/* Iterative radix-2 fast Fourier transform. */
+
+#include <math.h>
+
+#define N 256
+
+static double re[N], im[N];
+
+unsigned reverse_bits(unsigned x, unsigned bits) {
+  unsigned r = 0, i;
+  for (i = 0; i < bits; i++) {
+    r = (r << 1) | (x & 1);
+    x >>= 1;
+  }
+  return r;
+}
+
+void bit_reverse(void) {
+  unsigned i, j;
+  for (i = 0; i < N; i++) {
+    j = reverse_bits(i, 8);
+    if (i < j) {
+      double t = re[i];
+      re[i] = re[j];
+      re[j] = t;
+      t = im[i];
+      im[i] = im[j];
+      im[j] = t;
+    }
+  }
+}
+
+void butterfly(unsigned i, unsigned j, double wr, double wi) {
+  double tr = wr * re[j] - wi * im[j];
+  double ti = wr * im[j] + wi * re[j];
+  re[j] = re[i] - tr;
+  im[j] = im[i] - ti;
+  re[i] += tr;
+  im[i] += ti;
+}
+
+void fft(void) {
+  unsigned len, i, k;
+  bit_reverse();
+  for (len = 2; len <= N; len <<= 1) {
+    double angle = -2 * M_PI / len;
+    for (i = 0; i < N; i += len)
+      for (k = 0; k < len / 2; k++)
+        butterfly(i + k, i + k + len / 2, cos(angle * k), sin(angle * k));
+  }
+}
+
+int main(void) {
+  unsigned i;
+  for (i = 0; i < N; i++) {
+    re[i] = i % 8;
+    im[i] = 0;
+  }
+  fft();
+  return re[0] > 0 ? 0 : 1;
+}
@@ -0,0 +1,48 @@
+/* Blocked matrix multiplication. */
+
+#define N 64
+#define B 16
+
+static double a[N][N], b[N][N], c[N][N];
+
+void init(double m[N][N], double seed) {
+  int i, j;
+  for (i = 0; i < N; i++)
+    for (j = 0; j < N; j++)
+      m[i][j] = seed * (i + 1) + j;
+}
+
+void mul_block(int ii, int jj, int kk) {
+  int i, j, k;
+  for (i = ii; i < ii + B; i++)
+    for (j = jj; j < jj + B; j++) {
+      double sum = c[i][j];
+      for (k = kk; k < kk + B; k++)
+        sum += a[i][k] * b[k][j];
+      c[i][j] = sum;
+    }
+}
+
+void matmul(void) {
+  int ii, jj, kk;
+  for (ii = 0; ii < N; ii += B)
+    for (jj = 0; jj < N; jj += B)
+      for (kk = 0; kk < N; kk += B)
+        mul_block(ii, jj, kk);
+}
+
+double checksum(double m[N][N]) {
+  double sum = 0;
+  int i, j;
+  for (i = 0; i < N; i++)
+    for (j = 0; j < N; j++)
+      sum += m[i][j];
+  return sum;
+}
+
+int main(void) {
+  init(a, 1.0);
+  init(b, 2.0);
+  matmul();
+  return checksum(c) > 0 ? 0 : 1;
+}
@@ -0,0 +1,77 @@
+/* Recursive descent parser and evaluator of arithmetic expressions. */
+
+static const char *input = "(1+2)*(3+4*(5-6))/7+((8*9)-(10/(11-12)))*13";
+static const char *pos;
+
+int parse_expr(void);
+
+void skip_spaces(void) {
+  while (*pos == ' ')
+    pos++;
+}
+
+int parse_number(void) {
+  int value = 0;
+  skip_spaces();
+  while (*pos >= '0' && *pos <= '9')
+    value = value * 10 + (*pos++ - '0');
+  return value;
+}
+
+int parse_factor(void) {
+  int value;
+  skip_spaces();
+  if (*pos == '(') {
+    pos++;
+    value = parse_expr();
+    skip_spaces();
+    pos++;
+    return value;
+  }
+  if (*pos == '-') {
+    pos++;
+    return -parse_factor();
+  }
+  return parse_number();
+}
+
+int parse_term(void) {
+  int value = parse_factor();
+  for (;;) {
+    skip_spaces();
+    if (*pos == '*') {
+      pos++;
+      value *= parse_factor();
+    } else if (*pos == '/') {
+      int d;
+      pos++;
+      d = parse_factor();
+      value = d ? value / d : 0;
+    } else
+      return value;
+  }
+}
+
+int parse_expr(void) {
+  int value = parse_term();
+  for (;;) {
+    skip_spaces();
+    if (*pos == '+') {
+      pos++;
+      value += parse_term();
+    } else if (*pos == '-') {
+      pos++;
+      value -= parse_term();
+    } else
+      return value;
+  }
+}
+
+int main(void) {
+  int i, sum = 0;
+  for (i = 0; i < 100; i++) {
+    pos = input;
+    sum += parse_expr();
+  }
+  return sum == 0;
+}
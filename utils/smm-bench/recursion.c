@@ -0,0 +1,55 @@
+/* Self and mutual recursion of various depths. */
+
+struct node {
+  int value;
+  struct node *left, *right;
+};
+
+#define NODES 127
+
+static struct node nodes[NODES];
+
+int fib(int n) {
+  return n < 2 ? n : fib(n - 1) + fib(n - 2);
+}
+
+int ackermann(int m, int n) {
+  if (m == 0)
+    return n + 1;
+  if (n == 0)
+    return ackermann(m - 1, 1);
+  return ackermann(m - 1, ackermann(m, n - 1));
+}
+
+int is_odd(int n);
+
+int is_even(int n) {
+  return n == 0 ? 1 : is_odd(n - 1);
+}
+
+int is_odd(int n) {
+  return n == 0 ? 0 : is_even(n - 1);
+}
+
+struct node *build(int lo, int hi) {
+  int mid;
+  if (lo > hi)
+    return 0;
+  mid = (lo + hi) / 2;
+  nodes[mid].value = mid;
+  nodes[mid].left = build(lo, mid - 1);
+  nodes[mid].right = build(mid + 1, hi);
+  return &nodes[mid];
+}
+
+int sum_tree(struct node *n) {
+  if (!n)
+    return 0;
+  return n->value + sum_tree(n->left) + sum_tree(n->right);
+}
+
+int main(void) {
+  int r = fib(20) + ackermann(2, 3) + is_even(31);
+  r += sum_tree(build(0, NODES - 1));
+  return r == 0;
+}
@@ -0,0 +1,170 @@
+#!/usr/bin/env python
+"""SPM management benchmark.
+
+This is a python program that compiles the kernels in this directory through
+the SPM management passes and reports, for each kernel, the compile time of
+every pass together with the DMA traffic of the code overlays and stack frame
+management chosen for it. The traffic is simulated by smmcmh-sim on the
+execution trace of smmcmh-exec, so no SPM target is needed.
+
+Save the results of a known good build with --output and compare later builds
+against them with --baseline to catch mappings that got worse, not only passes
+that crash.
+"""
+
+from __future__ import print_function
+
+import argparse
+import glob
+import json
+import os
+import re
+import subprocess
+import sys
+import tempfile
+
+BENCH_DIR = os.path.dirname(os.path.abspath(__file__))
+
+# A row of -time-passes: one or more "time (percent%)" columns, then the name
+TIME_RE = re.compile(r'^\s*((?:[\d.]+\s+\(\s*[\d.]+%\)\s+)+)(.*\S)\s*$')
+# A line of -stats: value, DEBUG_TYPE, description
+STAT_RE = re.compile(r'^\s*(\d+)\s+(\S+)\s+-\s+(.*\S)\s*$')
+SIM_RE = re.compile(r'Simulated code traffic: (\d+) transfers, (\d+) bytes, (\d+) DMA cycles')
+
+def run(cmd, verbose):
+  if verbose:
+    print(' '.join(cmd), file=sys.stderr)
+  proc = subprocess.Popen(cmd, stdout=subprocess.PIPE, stderr=subprocess.PIPE,
+                          universal_newlines=True)
+  out, err = proc.communicate()
+  if proc.returncode != 0:
+    sys.stderr.write(err)
+    raise RuntimeError('%s failed with exit code %d' % (cmd[0], proc.returncode))
+  return err
+
+def parse_times(err):
+  times = {}
+  for line in err.splitlines():
+    m = TIME_RE.match(line)
+    if not m or m.group(2) == 'Total':
+      continue
+    # The last column is the wall time
+    times[m.group(2)] = float(re.findall(r'([\d.]+)\s+\(', m.group(1))[-1])
+  return times
+
+def parse_stats(err):
+  stats = {}
+  for line in err.splitlines():
+    m = STAT_RE.match(line)
+    if m:
+      stats['%s: %s' % (m.group(2), m.group(3))] = int(m.group(1))
+  return stats
+
+def bench(kernel, args, tmpdir):
+  name = os.path.splitext(os.path.basename(kernel))[0]
+  ir = os.path.join(tmpdir, name + '.ll')
+  linked = os.path.join(tmpdir, name + '.linked.bc')
+  run([args.clang, '-O1', '-S', '-emit-llvm', '-fno-inline', '-o', ir, kernel],
+      args.verbose)
+  run([os.path.join(args.bindir, 'llvm-link'), '-o', linked, ir,
+       os.path.join(BENCH_DIR, 'runtime.ll')], args.verbose)
+
+  load = ['-load', os.path.join(args.libdir, 'SMMCommon' + args.shlibext)]
+  common = ['-time-passes', '-stats', '-disable-output', linked] + args.opt_args
+
+  # Code management: overlay mapping and its simulated traffic
+  err = run([os.path.join(args.bindir, 'opt')] + load +
+            ['-load', os.path.join(args.libdir, 'LLVMSMMCMH' + args.shlibext),
+             '-smmcmh-funcinfo', '-smmcmh-exec', '-smmcmh-overlay',
+             '-smmcmh-sim', '-spm-size=%d' % args.spm_size] + common,
+            args.verbose)
+  result = {'times': parse_times(err), 'stats': parse_stats(err)}
+  m = SIM_RE.search(err)
+  if m:
+    result['code'] = {'transfers': int(m.group(1)), 'bytes': int(m.group(2)),
+                      'cycles': int(m.group(3))}
+
+  # Stack management: frame management points and their estimated cost
+  err = run([os.path.join(args.bindir, 'opt')] + load +
+            ['-load', os.path.join(args.libdir, 'SMMSSM' + args.shlibext),
+             '-smm-prolog', '-smmssm',
+             '-size-constraint=%d' % args.stack_size] + common,
+            args.verbose)
+  result['times'].update(parse_times(err))
+  result['stats'].update(parse_stats(err))
+  return name, result
+
+def compare(results, baseline, tolerance):
+  regressions = []
+  for name, result in sorted(results.items()):
+    if name not in baseline or 'code' not in result:
+      continue
+    for key in ('bytes', 'cycles'):
+      old = baseline[name].get('code', {}).get(key)
+      new = result['code'][key]
+      if old is not None and new > old * (1 + tolerance / 100.0):
+        regressions.append('%s: code DMA %s %d -> %d' % (name, key, old, new))
+    for key, new in sorted(result['stats'].items()):
+      old = baseline[name].get('stats', {}).get(key)
+      if 'cycles' in key and old is not None and new > old * (1 + tolerance / 100.0):
+        regressions.append('%s: %s %d -> %d' % (name, key, old, new))
+  return regressions
+
+def main():
+  parser = argparse.ArgumentParser(description=__doc__,
+      formatter_class=argparse.RawDescriptionHelpFormatter)
+  parser.add_argument('kernels', nargs='*',
+                      help='C kernels to run, all in this directory by default')
+  parser.add_argument('--bindir', required=True,
+                      help='Directory of opt and llvm-link')
+  parser.add_argument('--libdir',
+                      help='Directory of the pass plugins, <bindir>/../lib by default')
+  parser.add_argument('--shlibext', default='.so',
+                      help='Extension of the pass plugins')
+  parser.add_argument('--clang', default='clang',
+                      help='C compiler that emits LLVM IR for this LLVM version')
+  parser.add_argument('--spm-size', type=int, default=4096,
+                      help='SPM space for code overlays in bytes')
+  parser.add_argument('--stack-size', type=int, default=1024,
+                      help='SPM space for the stack in bytes')
+  parser.add_argument('--output', help='Write the results as JSON')
+  parser.add_argument('--baseline', help='Compare with results saved by --output')
+  parser.add_argument('--tolerance', type=float, default=0,
+                      help='Allowed increase of DMA traffic in percent')
+  parser.add_argument('-v', '--verbose', action='store_true',
+                      help='Print the commands that are run')
+  parser.add_argument('--opt-arg', dest='opt_args', action='append', default=[],
+                      help='Extra opt option, e.g. --opt-arg=-smm-dma-model=<file>')
+  args = parser.parse_args()
+  if not args.libdir:
+    args.libdir = os.path.join(args.bindir, os.pardir, 'lib')
+  kernels = args.kernels or sorted(glob.glob(os.path.join(BENCH_DIR, '*.c')))
+
+  results = {}
+  tmpdir = tempfile.mkdtemp(prefix='smm-bench-')
+  for kernel in kernels:
+    name, result = bench(kernel, args, tmpdir)
+    results[name] = result
+    print('%s:' % name)
+    if 'code' in result:
+      print('  code DMA: %(transfers)d transfers, %(bytes)d bytes, '
+            '%(cycles)d cycles' % result['code'])
+    for key, value in sorted(result['stats'].items()):
+      print('  %-60s %d' % (key, value))
+    for key, value in sorted(result['times'].items(), key=lambda t: -t[1]):
+      print('  %-60s %.4fs' % (key, value))
+
+  if args.output:
+    with open(args.output, 'w') as f:
+      json.dump(results, f, indent=2, sort_keys=True)
+  if args.baseline:
+    with open(args.baseline) as f:
+      regressions = compare(results, json.load(f), args.tolerance)
+    for r in regressions:
+      print('regression: ' + r)
+    if regressions:
+      return 1
+  return 0
+
+if __name__ == '__main__':
+  sys.exit(main())
@@ -0,0 +1,19 @@
+; Interface of the SPM management runtime that the passes expect to find in the
+; module. The benchmark only compiles the kernels, so the functions are only
+; declared, and the passes declare those the program does not call yet.
+; llvm-link drops unused declarations, so the variables are defined here.
+
+@_mem_stack_base = global i8* null
+@_spm_stack_base = global i8* null
+@_stack_pointer = global i8* null
+@_mem_stack_depth = global i64 0
+@_mem_stack = global [1024 x { i8*, i8* }] zeroinitializer
+@_region_table = global i8* null
+
+declare void @_sstore()
+declare void @_sload()
+declare i8* @_g2l(i8*, i64)
+declare i8* @_l2g(i8*)
+declare i8* @c_get(i8*)
+declare void @c_init_reg(i32)
+declare void @c_init_map(i32, ...)
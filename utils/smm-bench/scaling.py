@@ -0,0 +1,175 @@
+#!/usr/bin/env python
+"""SPM management scaling benchmark.
+
+This is a python program that times each SPM management analysis on synthetic
+call graphs (see utils/create_call_graph.py) of growing size, and reports the
+scaling curve of every analysis: the time per size and the exponent k of the
+growth n^k between neighbouring sizes. A run that takes longer than the
+timeout is reported as such, and the larger sizes of that analysis are
+skipped.
+
+The overlay analyses (smmcmh-overlay, smmmo) grow with n^4 and take minutes
+at about 100 functions. They are run at every size like the others, so the
+timeout ends their curve; --max-quartic-size skips them above a number of
+functions instead, and the report lists them as skipped.
+
+The graphs only depend on the generator options and the seed, so the curves
+of two builds can be compared directly.
+"""
+
+from __future__ import print_function
+
+import argparse
+import csv
+import math
+import os
+import re
+import subprocess
+import sys
+import tempfile
+import time
+
+from run import BENCH_DIR, parse_times
+
+GENERATOR = os.path.join(BENCH_DIR, os.pardir, 'create_call_graph.py')
+
+# Name of each analysis in -time-passes, plugin, opt options, and whether it
+# grows with n^4
+ANALYSES = [
+  ('smmcmh-exec', 'Emulation of Execution)', 'LLVMSMMCMH',
+   ['-smmcmh-exec'], False),
+  ('smmcmh-overlay', 'Get code overlay scheme)', 'LLVMSMMCMH',
+   ['-smmcmh-overlay', '-spm-size=%(spm_size)d'], True),
+  ('smmssm', 'Smart Stack Management Pass', 'SMMSSM',
+   ['-smm-prolog', '-smmssm', '-size-constraint=%(stack_size)d'], False),
+  ('smmmo', 'Mapping Opt Pass', 'LLVMSMMMO',
+   ['-smmmo'], True),
+]
+
+# Entries of the time table for runs that did not produce a time
+TIMEOUT = 'timeout'
+SKIPPED = 'skipped'
+
+def format_time(t):
+  return t if t in (TIMEOUT, SKIPPED) else '%.4f' % t
+
+def time_analysis(cmd, pass_name, timeout, verbose):
+  if verbose:
+    print(' '.join(cmd), file=sys.stderr)
+  proc = subprocess.Popen(cmd, stdout=subprocess.PIPE, stderr=subprocess.PIPE,
+                          universal_newlines=True)
+  try:
+    out, err = proc.communicate(timeout=timeout)
+  except subprocess.TimeoutExpired:
+    proc.kill()
+    proc.communicate()
+    return None
+  if proc.returncode != 0:
+    sys.stderr.write(err)
+    raise RuntimeError('%s failed with exit code %d' % (cmd[0], proc.returncode))
+  return parse_times(err).get(pass_name, 0.0)
+
+def estimate_code_size(ir):
+  # Instructions are the indented lines, 4 bytes each as the passes estimate
+  return 4 * sum(1 for line in open(ir) if line.startswith('  '))
+
+def main():
+  parser = argparse.ArgumentParser(description=__doc__,
+      formatter_class=argparse.RawDescriptionHelpFormatter)
+  parser.add_argument('--bindir', required=True,
+                      help='Directory of opt and llvm-link')
+  parser.add_argument('--libdir',
+                      help='Directory of the pass plugins, <bindir>/../lib by default')
+  parser.add_argument('--shlibext', default='.so',
+                      help='Extension of the pass plugins')
+  parser.add_argument('--sizes', default='10,30,100,300,1000,3000,10000',
+                      help='Comma separated numbers of functions')
+  parser.add_argument('--analyses', default=','.join(a[0] for a in ANALYSES),
+                      help='Comma separated analyses to time')
+  parser.add_argument('--timeout', type=float, default=600,
+                      help='Seconds after which an analysis is given up')
+  parser.add_argument('--max-quartic-size', type=int, default=0,
+                      help='Largest number of functions the n^4 analyses are run on, '
+                           '0 (the default) for no limit')
+  parser.add_argument('--spm-fraction', type=float, default=0.5,
+                      help='SPM space for code overlays relative to the code size')
+  parser.add_argument('--stack-size', type=int, default=1024,
+                      help='SPM space for the stack in bytes')
+  parser.add_argument('--csv', help='Write the times as CSV')
+  parser.add_argument('-v', '--verbose', action='store_true',
+                      help='Print the commands that are run')
+  parser.add_argument('--gen-arg', dest='gen_args', action='append', default=[],
+                      help='Extra generator option, e.g. --gen-arg=--recursion=0.1')
+  args = parser.parse_args()
+  if not args.libdir:
+    args.libdir = os.path.join(args.bindir, os.pardir, 'lib')
+  sizes = [int(s) for s in args.sizes.split(',')]
+  analyses = [a for a in ANALYSES if a[0] in args.analyses.split(',')]
+
+  tmpdir = tempfile.mkdtemp(prefix='smm-scaling-')
+  times = dict((a[0], {}) for a in analyses)
+  for n in sizes:
+    ir = os.path.join(tmpdir, 'cg%d.ll' % n)
+    linked = os.path.join(tmpdir, 'cg%d.bc' % n)
+    with open(ir, 'w') as f:
+      subprocess.check_call([sys.executable, GENERATOR, str(n), '--emit-llvm'] +
+                            args.gen_args, stdout=f)
+    subprocess.check_call([os.path.join(args.bindir, 'llvm-link'), '-o', linked,
+                           ir, os.path.join(BENCH_DIR, 'runtime.ll')])
+    params = {'spm_size': max(int(estimate_code_size(ir) * args.spm_fraction), 1),
+              'stack_size': args.stack_size}
+
+    for name, pass_name, plugin, options, quartic in analyses:
+      # Larger graphs will not be any faster
+      if times[name] and times[name][sizes[sizes.index(n) - 1]] in (TIMEOUT, SKIPPED):
+        times[name][n] = times[name][sizes[sizes.index(n) - 1]]
+        continue
+      if quartic and args.max_quartic_size and n > args.max_quartic_size:
+        times[name][n] = SKIPPED
+        print('%-16s %6d functions: skipped, n^4 analysis above --max-quartic-size=%d' %
+              (name, n, args.max_quartic_size), file=sys.stderr)
+        continue
+      cmd = [os.path.join(args.bindir, 'opt'),
+             '-load', os.path.join(args.libdir, 'SMMCommon' + args.shlibext),
+             '-load', os.path.join(args.libdir, plugin + args.shlibext)]
+      cmd += [o % params for o in options]
+      cmd += ['-time-passes', '-disable-output', linked]
+      start = time.time()
+      t = time_analysis(cmd, pass_name, args.timeout, args.verbose)
+      times[name][n] = TIMEOUT if t is None else t
+      print('%-16s %6d functions: %s (%.1fs total)' %
+            (name, n, 'timeout' if t is None else '%.4fs' % t,
+             time.time() - start), file=sys.stderr)
+
+  # Scaling curves
+  print('%-16s' % 'functions' + ''.join('%12d' % n for n in sizes))
+  for name, _, _, _, _ in analyses:
+    print('%-16s' % name + ''.join('%12s' % format_time(times[name][n])
+                                   for n in sizes))
+  skipped = [a[0] for a in analyses if SKIPPED in times[a[0]].values()]
+  if skipped:
+    print('%s: skipped above %d functions (--max-quartic-size), they grow with n^4' %
+          (', '.join(skipped), args.max_quartic_size))
+  print()
+  print('growth exponent k of n^k between neighbouring sizes:')
+  for name, _, _, _, _ in analyses:
+    exponents = []
+    for n1, n2 in zip(sizes, sizes[1:]):
+      t1, t2 = times[name][n1], times[name][n2]
+      # Times near the timer resolution say nothing about the growth
+      if t1 in (TIMEOUT, SKIPPED) or t2 in (TIMEOUT, SKIPPED) or t1 < 0.001 or t2 < 0.001:
+        exponents.append('-')
+      else:
+        exponents.append('%.2f' % (math.log(t2 / t1) / math.log(float(n2) / n1)))
+    print('%-16s' % name + ''.join('%12s' % e for e in exponents))
+
+  if args.csv:
+    with open(args.csv, 'w') as f:
+      writer = csv.writer(f)
+      writer.writerow(['analysis'] + sizes)
+      for name, _, _, _, _ in analyses:
+        writer.writerow([name] + [times[name][n] for n in sizes])
+  return 0
+
+if __name__ == '__main__':
+  sys.exit(main())